@@ -17,6 +17,9 @@
 #ifndef SRC_TRACE_PROCESSOR_BASIC_TYPES_H_
 #define SRC_TRACE_PROCESSOR_BASIC_TYPES_H_
 
+#include <stdint.h>
+
+#include <limits>
 #include <memory>
 
 namespace perfetto {
@@ -24,6 +27,27 @@ namespace trace_processor {
 
 enum class OptimizationMode { kMaxBandwidth = 0, kMinLatency };
 
+// The range of timestamps, [start_ts, end_ts], of the events to load from a
+// trace (see TraceProcessor::Config::load_window).
+struct LoadWindow {
+  bool Contains(uint64_t ts) const { return ts >= start_ts && ts <= end_ts; }
+
+  // Whether |ts| is within |margin_ns| of the window. Doesn't overflow.
+  bool ContainsWithMargin(uint64_t ts) const {
+    if (ts < start_ts)
+      return start_ts - ts <= margin_ns;
+    return ts <= end_ts || ts - end_ts <= margin_ns;
+  }
+
+  bool IsUnbounded() const {
+    return start_ts == 0 && end_ts == std::numeric_limits<uint64_t>::max();
+  }
+
+  uint64_t start_ts = 0;
+  uint64_t end_ts = std::numeric_limits<uint64_t>::max();
+  uint64_t margin_ns = 1000 * 1000 * 1000ULL;  // 1 second.
+};
+
 }  // namespace trace_processor
 }  // namespace perfetto
 
@@ -0,0 +1,228 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/batch_queries.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/base/utils.h"
+
+#include "perfetto/trace_processor/raw_query.pb.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+namespace {
+
+constexpr size_t kFlushThreshold = 1024 * 1024;
+
+bool IsBlank(const std::string& str) {
+  return str.find_first_not_of(" \t\r\n") == std::string::npos;
+}
+
+}  // namespace
+
+std::vector<std::string> SplitStatements(const std::string& sql) {
+  std::vector<std::string> statements;
+  std::string current;
+  char quote = 0;
+  for (size_t i = 0; i < sql.size(); i++) {
+    char c = sql[i];
+    bool has_next = i + 1 < sql.size();
+    if (quote) {
+      if (c == quote)
+        quote = 0;
+    } else if (c == '\'' || c == '"' || c == '`') {
+      quote = c;
+    } else if (c == '-' && has_next && sql[i + 1] == '-') {
+      // Up to the end of the line, which is kept.
+      i = std::min(sql.find('\n', i), sql.size()) - 1;
+      continue;
+    } else if (c == '/' && has_next && sql[i + 1] == '*') {
+      // Up to the closing */ or the end of |sql|. As in SQLite, the comment
+      // separates the tokens around it.
+      size_t end = sql.find("*/", i + 2);
+      i = end == std::string::npos ? sql.size() : end + 1;
+      current.push_back(' ');
+      continue;
+    } else if (c == ';') {
+      if (!IsBlank(current))
+        statements.emplace_back(std::move(current));
+      current.clear();
+      continue;
+    }
+    current.push_back(c);
+  }
+  if (!IsBlank(current))
+    statements.emplace_back(std::move(current));
+  return statements;
+}
+
+BatchOutput::BatchOutput(OutputFormat format, int fd)
+    : format_(format), fd_(fd) {
+  buf_.reserve(kFlushThreshold + 4096);
+}
+
+BatchOutput::~BatchOutput() {
+  Flush();
+}
+
+void BatchOutput::BeginQuery(bool first_query) {
+  header_written_ = false;
+  if (format_ == OutputFormat::kCsv && !first_query)
+    buf_.push_back('\n');
+}
+
+void BatchOutput::WriteBatch(const protos::RawQueryResult& res) {
+  PERFETTO_CHECK(res.columns_size() == res.column_descriptors_size());
+  WriteHeaderIfNeeded(res);
+  if (res.num_records() == 0)
+    return;
+  if (format_ == OutputFormat::kCsv) {
+    WriteCsvRows(res);
+  } else {
+    WriteBinaryRows(res);
+  }
+  if (buf_.size() >= kFlushThreshold)
+    Flush();
+}
+
+bool BatchOutput::EndQuery(const std::string& error) {
+  if (format_ == OutputFormat::kBinary) {
+    if (!header_written_)
+      AppendPod(static_cast<uint32_t>(0));  // No columns.
+    AppendPod(static_cast<uint32_t>(0));
+    AppendPod(static_cast<uint32_t>(error.size()));
+    buf_.append(error);
+  }
+  return Flush();
+}
+
+bool BatchOutput::Flush() {
+  size_t written = 0;
+  while (ok_ && written < buf_.size()) {
+    ssize_t res = PERFETTO_EINTR(
+        write(fd_, buf_.data() + written, buf_.size() - written));
+    ok_ = res > 0;
+    written += ok_ ? static_cast<size_t>(res) : 0;
+  }
+  buf_.clear();
+  return ok_;
+}
+
+void BatchOutput::AppendCsvString(const std::string& str) {
+  if (str.find_first_of(",\"\r\n") == std::string::npos) {
+    buf_.append(str);
+    return;
+  }
+  buf_.push_back('"');
+  for (char c : str) {
+    if (c == '"')
+      buf_.push_back('"');
+    buf_.push_back(c);
+  }
+  buf_.push_back('"');
+}
+
+void BatchOutput::WriteHeaderIfNeeded(const protos::RawQueryResult& res) {
+  if (header_written_)
+    return;
+  header_written_ = true;
+  if (format_ == OutputFormat::kCsv) {
+    for (int c = 0; c < res.column_descriptors_size(); c++) {
+      if (c > 0)
+        buf_.push_back(',');
+      AppendCsvString(res.column_descriptors(c).name());
+    }
+    buf_.push_back('\n');
+    return;
+  }
+  AppendPod(static_cast<uint32_t>(res.column_descriptors_size()));
+  for (const auto& col : res.column_descriptors()) {
+    AppendPod(static_cast<uint8_t>(col.type()));
+    AppendPod(static_cast<uint32_t>(col.name().size()));
+    buf_.append(col.name());
+  }
+}
+
+void BatchOutput::WriteCsvRows(const protos::RawQueryResult& res) {
+  char num[32];
+  for (int r = 0; r < static_cast<int>(res.num_records()); r++) {
+    for (int c = 0; c < res.columns_size(); c++) {
+      if (c > 0)
+        buf_.push_back(',');
+      const auto& column = res.columns(c);
+      if (column.is_nulls_size() > 0 && column.is_nulls(r))
+        continue;  // NULLs are empty cells.
+      switch (res.column_descriptors(c).type()) {
+        case protos::RawQueryResult_ColumnDesc_Type_STRING:
+          AppendCsvString(column.string_values(r));
+          break;
+        case protos::RawQueryResult_ColumnDesc_Type_DOUBLE: {
+          // The shortest of the two representations that reads back as the
+          // same double.
+          double value = column.double_values(r);
+          int len = snprintf(num, sizeof(num), "%.15g", value);
+          if (strtod(num, nullptr) != value)
+            len = snprintf(num, sizeof(num), "%.17g", value);
+          buf_.append(num, static_cast<size_t>(len));
+          break;
+        }
+        case protos::RawQueryResult_ColumnDesc_Type_LONG: {
+          int len =
+              snprintf(num, sizeof(num), "%" PRId64, column.long_values(r));
+          buf_.append(num, static_cast<size_t>(len));
+          break;
+        }
+      }
+    }
+    buf_.push_back('\n');
+  }
+}
+
+void BatchOutput::WriteBinaryRows(const protos::RawQueryResult& res) {
+  AppendPod(static_cast<uint32_t>(res.num_records()));
+  for (int c = 0; c < res.columns_size(); c++) {
+    const auto& column = res.columns(c);
+    switch (res.column_descriptors(c).type()) {
+      case protos::RawQueryResult_ColumnDesc_Type_STRING:
+        for (const std::string& str : column.string_values()) {
+          AppendPod(static_cast<uint32_t>(str.size()));
+          buf_.append(str);
+        }
+        break;
+      case protos::RawQueryResult_ColumnDesc_Type_DOUBLE:
+        buf_.append(
+            reinterpret_cast<const char*>(column.double_values().data()),
+            sizeof(double) * static_cast<size_t>(column.double_values_size()));
+        break;
+      case protos::RawQueryResult_ColumnDesc_Type_LONG:
+        buf_.append(
+            reinterpret_cast<const char*>(column.long_values().data()),
+            sizeof(int64_t) * static_cast<size_t>(column.long_values_size()));
+        break;
+    }
+  }
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_BATCH_QUERIES_H_
+#define SRC_TRACE_PROCESSOR_BATCH_QUERIES_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+namespace perfetto {
+
+namespace protos {
+class RawQueryResult;
+}  // namespace protos
+
+namespace trace_processor {
+
+// The pieces of the batch mode of trace_processor_shell (-q), which runs all
+// the queries of a file and writes their results to stdout.
+
+// Splits |sql| into statements on the semicolons which are not in a string
+// literal, a quoted identifier or a comment (-- or /* */). Comments are
+// dropped and blank statements too.
+std::vector<std::string> SplitStatements(const std::string& sql);
+
+// Output formats of the batch mode.
+enum class OutputFormat { kCsv, kBinary };
+
+// Writes the results of the queries to |fd|, batch by batch as they are
+// produced, so that the memory used doesn't depend on the size of the
+// results.
+//
+// CSV: a header line with the column names followed by one line per row, as
+// in RFC 4180, NULLs being empty cells. The results of consecutive queries
+// are separated by an empty line.
+//
+// Binary (integers and doubles are in host byte order, i.e. little endian on
+// all the supported platforms). For each query:
+//   [uint32 num_columns]
+//   For each column: [uint8 type][uint32 name length][name]
+//   For each batch of rows: [uint32 num_rows (> 0)] followed, column by
+//     column, by the values of all the rows of the batch: int64 for LONG,
+//     double for DOUBLE, [uint32 length][bytes] for STRING. NULLs are
+//     written as 0, or as the string "[NULL]".
+//   [uint32 0][uint32 error length][error], the error being empty if the
+//     query succeeded.
+// The types are those of RawQueryResult::ColumnDesc. The columns are written
+// also for queries returning no rows: only failed queries can have none.
+class BatchOutput {
+ public:
+  BatchOutput(OutputFormat, int fd);
+  ~BatchOutput();
+
+  void BeginQuery(bool first_query);
+
+  // Writes a batch of ExecuteStreamingQuery(), which has the column
+  // descriptors even if it has no rows.
+  void WriteBatch(const protos::RawQueryResult&);
+
+  // Ends the query, which failed if |error| isn't empty, and flushes the
+  // output. Returns false if writing any of the output failed.
+  bool EndQuery(const std::string& error);
+
+ private:
+  BatchOutput(const BatchOutput&) = delete;
+  BatchOutput& operator=(const BatchOutput&) = delete;
+
+  template <typename T>
+  void AppendPod(T value) {
+    buf_.append(reinterpret_cast<const char*>(&value), sizeof(value));
+  }
+
+  void AppendCsvString(const std::string&);
+  void WriteHeaderIfNeeded(const protos::RawQueryResult&);
+  void WriteCsvRows(const protos::RawQueryResult&);
+  void WriteBinaryRows(const protos::RawQueryResult&);
+  bool Flush();
+
+  const OutputFormat format_;
+  const int fd_;
+  bool header_written_ = false;
+  bool ok_ = true;
+  std::string buf_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_BATCH_QUERIES_H_
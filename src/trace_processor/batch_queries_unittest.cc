@@ -0,0 +1,245 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/batch_queries.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "perfetto/base/file_utils.h"
+#include "perfetto/base/scoped_file.h"
+#include "perfetto/base/temp_file.h"
+
+#include "perfetto/trace_processor/raw_query.pb.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+using Type = protos::RawQueryResult_ColumnDesc_Type;
+
+constexpr Type kLong = protos::RawQueryResult_ColumnDesc_Type_LONG;
+constexpr Type kDouble = protos::RawQueryResult_ColumnDesc_Type_DOUBLE;
+constexpr Type kString = protos::RawQueryResult_ColumnDesc_Type_STRING;
+
+// A batch with a LONG, a DOUBLE and a STRING column, and no rows.
+protos::RawQueryResult MakeBatch(const char* string_column_name = "s") {
+  protos::RawQueryResult res;
+  const std::pair<const char*, Type> kColumns[] = {
+      {"id", kLong}, {"d", kDouble}, {string_column_name, kString}};
+  for (const auto& column : kColumns) {
+    auto* descriptor = res.add_column_descriptors();
+    descriptor->set_name(column.first);
+    descriptor->set_type(column.second);
+    res.add_columns();
+  }
+  return res;
+}
+
+void AddRow(protos::RawQueryResult* res,
+            int64_t id,
+            double d,
+            const std::string& s) {
+  res->mutable_columns(0)->add_long_values(id);
+  res->mutable_columns(1)->add_double_values(d);
+  res->mutable_columns(2)->add_string_values(s);
+  res->set_num_records(res->num_records() + 1);
+}
+
+class BatchOutputTest : public ::testing::Test {
+ protected:
+  BatchOutputTest() : file_(base::TempFile::CreateUnlinked()) {}
+
+  // Returns all the output written to the file.
+  std::string Output() {
+    std::string data;
+    EXPECT_EQ(lseek(file_.fd(), 0, SEEK_SET), 0);
+    EXPECT_TRUE(base::ReadFileDescriptor(file_.fd(), &data));
+    return data;
+  }
+
+  base::TempFile file_;
+};
+
+// Reads the values of a binary output, in order.
+class BinaryReader {
+ public:
+  explicit BinaryReader(const std::string& data) : data_(data) {}
+
+  template <typename T>
+  T Read() {
+    T value{};
+    EXPECT_LE(offset_ + sizeof(T), data_.size());
+    if (offset_ + sizeof(T) <= data_.size())
+      memcpy(&value, data_.data() + offset_, sizeof(T));
+    offset_ += sizeof(T);
+    return value;
+  }
+
+  std::string ReadString() {
+    auto size = Read<uint32_t>();
+    std::string str = data_.substr(std::min(offset_, data_.size()), size);
+    offset_ += size;
+    return str;
+  }
+
+  bool at_end() const { return offset_ == data_.size(); }
+
+ private:
+  const std::string& data_;
+  size_t offset_ = 0;
+};
+
+TEST(SplitStatementsTest, Semicolons) {
+  ASSERT_THAT(SplitStatements("SELECT 1; SELECT 2;\n;  ;SELECT 3"),
+              ElementsAre("SELECT 1", " SELECT 2", "SELECT 3"));
+  ASSERT_THAT(SplitStatements(" ; \n"), IsEmpty());
+}
+
+TEST(SplitStatementsTest, Quotes) {
+  ASSERT_THAT(
+      SplitStatements("SELECT ';', \"a;b\", `c;d`; SELECT 'it''s;'"),
+      ElementsAre("SELECT ';', \"a;b\", `c;d`", " SELECT 'it''s;'"));
+  // Comment markers in quotes are not comments.
+  ASSERT_THAT(SplitStatements("SELECT '--;', '/*;*/'; SELECT 2"),
+              ElementsAre("SELECT '--;', '/*;*/'", " SELECT 2"));
+}
+
+TEST(SplitStatementsTest, Comments) {
+  ASSERT_THAT(SplitStatements("SELECT 1 -- one; two\n; SELECT 2 --;"),
+              ElementsAre("SELECT 1 \n", " SELECT 2 "));
+  ASSERT_THAT(SplitStatements("SELECT/*;*/1; /* ';' */ SELECT 2/*"),
+              ElementsAre("SELECT 1", "   SELECT 2 "));
+  ASSERT_THAT(SplitStatements("/* only; a comment */ -- and another;"),
+              IsEmpty());
+  ASSERT_THAT(SplitStatements("SELECT 1 /* -- */; SELECT 2 -- /*\n;"),
+              ElementsAre("SELECT 1  ", " SELECT 2 \n"));
+}
+
+TEST_F(BatchOutputTest, Csv) {
+  {
+    BatchOutput output(OutputFormat::kCsv, file_.fd());
+    output.BeginQuery(true);
+    protos::RawQueryResult batch = MakeBatch("s,\"quoted\"");
+    AddRow(&batch, -1, 0.1, "plain");
+    AddRow(&batch, 2, 1.0 / 3, "a,b \"c\"\nd");
+    output.WriteBatch(batch);
+    batch = MakeBatch("ignored");
+    AddRow(&batch, 3, 1e300, "");
+    // NULLs are empty cells.
+    AddRow(&batch, 0, 4.5, "[NULL]");
+    batch.mutable_columns(0)->add_is_nulls(false);
+    batch.mutable_columns(0)->add_is_nulls(true);
+    output.WriteBatch(batch);
+    ASSERT_TRUE(output.EndQuery(""));
+
+    // Queries without rows still have a header.
+    output.BeginQuery(false);
+    output.WriteBatch(MakeBatch());
+    ASSERT_TRUE(output.EndQuery(""));
+
+    // Failed queries have none.
+    output.BeginQuery(false);
+    ASSERT_TRUE(output.EndQuery("error"));
+  }
+  ASSERT_EQ(Output(),
+            "id,d,\"s,\"\"quoted\"\"\"\n"
+            "-1,0.1,plain\n"
+            "2,0.33333333333333331,\"a,b \"\"c\"\"\nd\"\n"
+            "3,1e+300,\n"
+            ",4.5,[NULL]\n"
+            "\n"
+            "id,d,s\n"
+            "\n");
+}
+
+TEST_F(BatchOutputTest, Binary) {
+  {
+    BatchOutput output(OutputFormat::kBinary, file_.fd());
+    output.BeginQuery(true);
+    protos::RawQueryResult batch = MakeBatch();
+    AddRow(&batch, -1, 0.5, "ab");
+    AddRow(&batch, 2, 1.5, "");
+    output.WriteBatch(batch);
+    batch = MakeBatch();
+    AddRow(&batch, 3, 2.5, "c");
+    output.WriteBatch(batch);
+    ASSERT_TRUE(output.EndQuery(""));
+
+    output.BeginQuery(false);
+    output.WriteBatch(MakeBatch());
+    ASSERT_TRUE(output.EndQuery(""));
+
+    output.BeginQuery(false);
+    ASSERT_TRUE(output.EndQuery("error"));
+  }
+  std::string data = Output();
+  BinaryReader reader(data);
+  auto read_columns = [&reader] {
+    ASSERT_EQ(reader.Read<uint32_t>(), 3u);
+    ASSERT_EQ(reader.Read<uint8_t>(), kLong);
+    ASSERT_EQ(reader.ReadString(), "id");
+    ASSERT_EQ(reader.Read<uint8_t>(), kDouble);
+    ASSERT_EQ(reader.ReadString(), "d");
+    ASSERT_EQ(reader.Read<uint8_t>(), kString);
+    ASSERT_EQ(reader.ReadString(), "s");
+  };
+
+  // The first query: one block of values per column and batch.
+  read_columns();
+  ASSERT_EQ(reader.Read<uint32_t>(), 2u);
+  ASSERT_EQ(reader.Read<int64_t>(), -1);
+  ASSERT_EQ(reader.Read<int64_t>(), 2);
+  ASSERT_EQ(reader.Read<double>(), 0.5);
+  ASSERT_EQ(reader.Read<double>(), 1.5);
+  ASSERT_EQ(reader.ReadString(), "ab");
+  ASSERT_EQ(reader.ReadString(), "");
+  ASSERT_EQ(reader.Read<uint32_t>(), 1u);
+  ASSERT_EQ(reader.Read<int64_t>(), 3);
+  ASSERT_EQ(reader.Read<double>(), 2.5);
+  ASSERT_EQ(reader.ReadString(), "c");
+  ASSERT_EQ(reader.Read<uint32_t>(), 0u);
+  ASSERT_EQ(reader.ReadString(), "");
+
+  // The query without rows.
+  read_columns();
+  ASSERT_EQ(reader.Read<uint32_t>(), 0u);
+  ASSERT_EQ(reader.ReadString(), "");
+
+  // The failed query.
+  ASSERT_EQ(reader.Read<uint32_t>(), 0u);
+  ASSERT_EQ(reader.Read<uint32_t>(), 0u);
+  ASSERT_EQ(reader.ReadString(), "error");
+  ASSERT_TRUE(reader.at_end());
+}
+
+TEST(BatchOutputWriteTest, WriteErrors) {
+  base::ScopedFile fd(open("/dev/null", O_RDONLY));
+  ASSERT_TRUE(fd);
+  BatchOutput output(OutputFormat::kCsv, *fd);
+  output.BeginQuery(true);
+  output.WriteBatch(MakeBatch());
+  ASSERT_FALSE(output.EndQuery(""));
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/chunk_pool.h"
+
+#include <algorithm>
+
+#include "perfetto/base/logging.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// static
+constexpr size_t ChunkPool::kMaxFreeChunks;
+
+ChunkPool::ChunkPool() = default;
+ChunkPool::~ChunkPool() = default;
+
+uint8_t* ChunkPool::Acquire(size_t size) {
+  // Embedders typically write chunks of the same size, so the most recently
+  // released chunk (which is also the most likely to be in cache) is tried
+  // first.
+  Chunk chunk{nullptr, 0};
+  for (size_t i = free_.size(); i > 0; i--) {
+    if (free_[i - 1].capacity < size)
+      continue;
+    chunk = std::move(free_[i - 1]);
+    free_.erase(free_.begin() + static_cast<ptrdiff_t>(i - 1));
+    break;
+  }
+  if (!chunk.mem) {
+    chunk.mem.reset(new uint8_t[size]);
+    chunk.capacity = size;
+  }
+  uint8_t* mem = chunk.mem.get();
+  pending_.emplace_back(std::move(chunk));
+  return mem;
+}
+
+TraceBlobView ChunkPool::Commit(uint8_t* mem, size_t size) {
+  auto it = std::find_if(pending_.begin(), pending_.end(),
+                         [mem](const Chunk& c) { return c.mem.get() == mem; });
+  PERFETTO_CHECK(it != pending_.end());
+  PERFETTO_CHECK(size <= it->capacity);
+  size_t capacity = it->capacity;
+  it->mem.release();
+  pending_.erase(it);
+
+  // The view takes ownership of the chunk, in its raw form as the release
+  // callback must be copyable.
+  return TraceBlobView(mem, size, [this, mem, capacity] {
+    Release(Chunk{std::unique_ptr<uint8_t[]>(mem), capacity});
+  });
+}
+
+void ChunkPool::Release(Chunk chunk) {
+  if (free_.size() >= kMaxFreeChunks)
+    return;
+  free_.emplace_back(std::move(chunk));
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
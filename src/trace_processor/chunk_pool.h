@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_CHUNK_POOL_H_
+#define SRC_TRACE_PROCESSOR_CHUNK_POOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+#include "src/trace_processor/trace_blob_view.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// Recycles the buffers into which embedders write the trace before passing it
+// to the trace processor (see TraceProcessor::GetWritableChunk()). The caller
+// writes directly into a chunk, which is then handed to the tokenizer without
+// copies; once the last TraceBlobView referring to it has been parsed, the
+// chunk goes back to the pool and is reused for the next write.
+// Not thread safe: chunks must be acquired, committed and released (i.e. the
+// views on them destroyed) on the same thread.
+class ChunkPool {
+ public:
+  // Released chunks in excess of this are freed.
+  static constexpr size_t kMaxFreeChunks = 8;
+
+  ChunkPool();
+
+  // All the views returned by Commit() must be destroyed before the pool.
+  ~ChunkPool();
+
+  // Returns a chunk of at least |size| bytes. It must be passed to Commit()
+  // exactly once. Several chunks can be acquired before committing them.
+  uint8_t* Acquire(size_t size);
+
+  // Wraps the first |size| bytes of |chunk| into a TraceBlobView, which owns
+  // the chunk from now on: it is released as soon as the view and all its
+  // slices are destroyed.
+  TraceBlobView Commit(uint8_t* chunk, size_t size);
+
+  size_t free_chunks() const { return free_.size(); }
+  size_t pending_chunks() const { return pending_.size(); }
+
+ private:
+  struct Chunk {
+    std::unique_ptr<uint8_t[]> mem;
+    size_t capacity;
+  };
+
+  ChunkPool(const ChunkPool&) = delete;
+  ChunkPool& operator=(const ChunkPool&) = delete;
+
+  void Release(Chunk);
+
+  std::vector<Chunk> free_;
+  std::vector<Chunk> pending_;  // Acquired but not committed yet.
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_CHUNK_POOL_H_
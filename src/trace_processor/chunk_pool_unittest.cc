@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/chunk_pool.h"
+
+#include <string.h>
+
+#include "gtest/gtest.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+TEST(ChunkPoolTest, ChunksAreRecycled) {
+  ChunkPool pool;
+  uint8_t* chunk = pool.Acquire(1024);
+  memset(chunk, 'x', 1024);
+  ASSERT_EQ(pool.pending_chunks(), 1u);
+  {
+    TraceBlobView blob = pool.Commit(chunk, 100);
+    ASSERT_EQ(blob.data(), chunk);
+    ASSERT_EQ(blob.length(), 100u);
+    ASSERT_EQ(pool.pending_chunks(), 0u);
+
+    // Slices keep the chunk alive.
+    TraceBlobView slice = blob.slice(10, 20);
+    { TraceBlobView destroyed = std::move(blob); }
+    ASSERT_EQ(pool.free_chunks(), 0u);
+  }
+  ASSERT_EQ(pool.free_chunks(), 1u);
+
+  // A smaller chunk is carved out of the released one, a bigger one isn't.
+  ASSERT_EQ(pool.Acquire(512), chunk);
+  ASSERT_EQ(pool.free_chunks(), 0u);
+  uint8_t* big = pool.Acquire(2048);
+  ASSERT_NE(big, chunk);
+  pool.Commit(big, 0);
+  pool.Commit(chunk, 0);
+  ASSERT_EQ(pool.free_chunks(), 2u);
+}
+
+TEST(ChunkPoolTest, CommitOutOfOrder) {
+  ChunkPool pool;
+  uint8_t* a = pool.Acquire(16);
+  uint8_t* b = pool.Acquire(16);
+  ASSERT_NE(a, b);
+  memcpy(a, "a", 1);
+  memcpy(b, "b", 1);
+  TraceBlobView blob_b = pool.Commit(b, 1);
+  TraceBlobView blob_a = pool.Commit(a, 1);
+  ASSERT_EQ(*blob_a.data(), 'a');
+  ASSERT_EQ(*blob_b.data(), 'b');
+}
+
+TEST(ChunkPoolTest, FreeListIsBounded) {
+  ChunkPool pool;
+  std::vector<uint8_t*> chunks;
+  for (size_t i = 0; i < ChunkPool::kMaxFreeChunks * 2; i++)
+    chunks.push_back(pool.Acquire(64));
+  for (uint8_t* chunk : chunks)
+    pool.Commit(chunk, 0);
+  ASSERT_EQ(pool.free_chunks(), ChunkPool::kMaxFreeChunks);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,289 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_CHUNKED_COLUMN_H_
+#define SRC_TRACE_PROCESSOR_CHUNKED_COLUMN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include "perfetto/base/logging.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// Append-only storage for a single column of a table. Values are stored in
+// fixed-size chunks of |kChunkSize| elements, each of which is a plain
+// contiguous array. Compared to a std::deque this has the following benefits:
+// - Random access is a shift + mask + one indirection, with no per-chunk
+//   bookkeeping.
+// - Appending never moves existing elements, so pointers into a chunk stay
+//   valid until the column is destroyed.
+// - Whole chunks can be handed out as raw arrays (see chunk_data()), which
+//   allows tight, vectorizable loops when scanning a column.
+// - One thread can append while others read, without locks: the table of
+//   chunks read by readers is replaced, never reallocated in place, when it
+//   grows. Readers must only access rows appended before they loaded size()
+//   (or any other count published with release semantics after appending).
+// T must be trivially copyable, as chunks are allocated uninitialized.
+// |ChunkSizeLog2| can be lowered for columns which are expected to be small.
+template <typename T, size_t ChunkSizeLog2 = 13>
+class ChunkedColumn {
+ public:
+  static_assert(std::is_trivially_copyable<T>::value,
+                "ChunkedColumn supports only trivially copyable types");
+
+  static constexpr size_t kChunkSizeLog2 = ChunkSizeLog2;
+  static constexpr size_t kChunkSize = 1 << kChunkSizeLog2;  // Elements.
+  static constexpr size_t kChunkMask = kChunkSize - 1;
+
+  class const_iterator {
+   public:
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = T;
+    using difference_type = ptrdiff_t;
+    using pointer = const T*;
+    using reference = const T&;
+
+    const_iterator() = default;
+    const_iterator(const ChunkedColumn* column, size_t index)
+        : column_(column), index_(index) {}
+
+    reference operator*() const { return (*column_)[index_]; }
+    pointer operator->() const { return &(*column_)[index_]; }
+    reference operator[](difference_type n) const { return *(*this + n); }
+
+    const_iterator& operator++() {
+      index_++;
+      return *this;
+    }
+    const_iterator operator++(int) {
+      const_iterator it = *this;
+      index_++;
+      return it;
+    }
+    const_iterator& operator--() {
+      index_--;
+      return *this;
+    }
+    const_iterator operator--(int) {
+      const_iterator it = *this;
+      index_--;
+      return it;
+    }
+    const_iterator& operator+=(difference_type n) {
+      index_ = static_cast<size_t>(static_cast<difference_type>(index_) + n);
+      return *this;
+    }
+    const_iterator& operator-=(difference_type n) { return *this += -n; }
+    const_iterator operator+(difference_type n) const {
+      const_iterator it = *this;
+      return it += n;
+    }
+    const_iterator operator-(difference_type n) const {
+      const_iterator it = *this;
+      return it -= n;
+    }
+    difference_type operator-(const const_iterator& other) const {
+      return static_cast<difference_type>(index_) -
+             static_cast<difference_type>(other.index_);
+    }
+
+    bool operator==(const const_iterator& o) const {
+      return index_ == o.index_;
+    }
+    bool operator!=(const const_iterator& o) const {
+      return index_ != o.index_;
+    }
+    bool operator<(const const_iterator& o) const { return index_ < o.index_; }
+    bool operator>(const const_iterator& o) const { return index_ > o.index_; }
+    bool operator<=(const const_iterator& o) const {
+      return index_ <= o.index_;
+    }
+    bool operator>=(const const_iterator& o) const {
+      return index_ >= o.index_;
+    }
+
+    // The row index this iterator points to.
+    size_t index() const { return index_; }
+
+   private:
+    const ChunkedColumn* column_ = nullptr;
+    size_t index_ = 0;
+  };
+
+  ChunkedColumn() = default;
+
+  // Moving is not thread safe, i.e. there must be no concurrent readers.
+  ChunkedColumn(ChunkedColumn&& other) noexcept { *this = std::move(other); }
+  ChunkedColumn& operator=(ChunkedColumn&& other) {
+    chunks_ = std::move(other.chunks_);
+    chunk_tables_ = std::move(other.chunk_tables_);
+    chunk_table_capacity_ = other.chunk_table_capacity_;
+    chunk_table_.store(other.chunk_table_.load(std::memory_order_relaxed),
+                       std::memory_order_relaxed);
+    size_.store(other.size_.load(std::memory_order_relaxed),
+                std::memory_order_relaxed);
+    other.chunk_table_capacity_ = 0;
+    other.chunk_table_.store(nullptr, std::memory_order_relaxed);
+    other.size_.store(0, std::memory_order_relaxed);
+    return *this;
+  }
+
+  inline void emplace_back(T value) {
+    size_t size = size_.load(std::memory_order_relaxed);
+    if (PERFETTO_UNLIKELY((size & kChunkMask) == 0))
+      AddChunk();
+    chunks_.back()[size & kChunkMask] = value;
+    size_.store(size + 1, std::memory_order_release);
+  }
+
+  // Appends |count| values of type SrcT read from |src|, which needs not be
+  // aligned (e.g. a column of a snapshot file). The values are copied a chunk
+  // at a time, with a single memcpy per chunk when SrcT is T.
+  template <typename SrcT = T>
+  void AppendUnaligned(const void* src, size_t count) {
+    const uint8_t* src_bytes = static_cast<const uint8_t*>(src);
+    size_t size = size_.load(std::memory_order_relaxed);
+    while (count > 0) {
+      if ((size & kChunkMask) == 0)
+        AddChunk();
+      const size_t offset = size & kChunkMask;
+      const size_t len = std::min(kChunkSize - offset, count);
+      T* dst = &chunks_.back()[offset];
+      if (std::is_same<SrcT, T>::value) {
+        memcpy(dst, src_bytes, len * sizeof(T));
+      } else {
+        for (size_t i = 0; i < len; i++) {
+          SrcT value;
+          memcpy(&value, src_bytes + i * sizeof(SrcT), sizeof(SrcT));
+          dst[i] = static_cast<T>(value);
+        }
+      }
+      src_bytes += len * sizeof(SrcT);
+      size += len;
+      count -= len;
+      size_.store(size, std::memory_order_release);
+    }
+  }
+
+  inline const T& operator[](size_t index) const {
+    PERFETTO_DCHECK(index < size());
+    // Acquire pairs with the release store in AddChunk(), so that the slots
+    // of a newly allocated table are visible along with the pointer to it.
+    const T* const* table = chunk_table_.load(std::memory_order_acquire);
+    return table[index >> kChunkSizeLog2][index & kChunkMask];
+  }
+
+  const T& at(size_t index) const {
+    PERFETTO_CHECK(index < size());
+    return (*this)[index];
+  }
+
+  // Only for the writer, for the few columns whose rows can be updated after
+  // being appended. Synchronizing with readers is up to the caller.
+  T* mutable_at(size_t index) {
+    PERFETTO_DCHECK(index < size());
+    return &chunks_[index >> kChunkSizeLog2][index & kChunkMask];
+  }
+
+  const T& front() const { return (*this)[0]; }
+  const T& back() const { return (*this)[size() - 1]; }
+
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const { return const_iterator(this, size()); }
+
+  size_t size() const { return size_.load(std::memory_order_acquire); }
+  bool empty() const { return size() == 0; }
+
+  // Direct access to the chunks, for scans that want to operate on contiguous
+  // arrays. All chunks but the last contain exactly kChunkSize elements.
+  // Readers should rather compute the chunk count from the number of rows
+  // they can access.
+  size_t chunk_count() const {
+    return (size() + kChunkSize - 1) >> kChunkSizeLog2;
+  }
+  const T* chunk_data(size_t chunk) const {
+    return chunk_table_.load(std::memory_order_acquire)[chunk];
+  }
+  size_t chunk_size(size_t chunk) const {
+    PERFETTO_DCHECK(chunk < chunk_count());
+    return std::min(kChunkSize, size() - (chunk << kChunkSizeLog2));
+  }
+
+  // Returns the number of bytes allocated by this column, including the
+  // unused tail of the last chunk.
+  size_t memory_usage_bytes() const {
+    return chunks_.size() * kChunkSize * sizeof(T) +
+           chunk_table_capacity_ * 2 * sizeof(T*);
+  }
+
+ private:
+  ChunkedColumn(const ChunkedColumn&) = delete;
+  ChunkedColumn& operator=(const ChunkedColumn&) = delete;
+
+  void AddChunk() {
+    chunks_.emplace_back(new T[kChunkSize]);
+    const size_t last = chunks_.size() - 1;
+    if (chunks_.size() > chunk_table_capacity_) {
+      // Readers might be using the current table: copy it into a new one and
+      // keep the old one alive. All the tables together take less than twice
+      // the size of the last one.
+      chunk_table_capacity_ = std::max(chunk_table_capacity_ * 2, size_t(4));
+      chunk_tables_.emplace_back(new T*[chunk_table_capacity_]);
+      T** table = chunk_tables_.back().get();
+      for (size_t i = 0; i < last; i++)
+        table[i] = chunks_[i].get();
+    }
+    // Readers only access the slots of the chunks whose rows they have seen,
+    // so filling the unused slot of the current table is safe.
+    T** table = chunk_tables_.back().get();
+    table[last] = chunks_[last].get();
+    chunk_table_.store(table, std::memory_order_release);
+  }
+
+  // Owns the chunks. Only accessed by the writer.
+  std::vector<std::unique_ptr<T[]>> chunks_;
+
+  // All the tables of chunks ever used. The last one is the current one.
+  std::vector<std::unique_ptr<T*[]>> chunk_tables_;
+  size_t chunk_table_capacity_ = 0;
+
+  // The current table of chunks, read by readers.
+  std::atomic<T* const*> chunk_table_{nullptr};
+
+  std::atomic<size_t> size_{0};
+};
+
+template <typename T, size_t ChunkSizeLog2>
+constexpr size_t ChunkedColumn<T, ChunkSizeLog2>::kChunkSizeLog2;
+template <typename T, size_t ChunkSizeLog2>
+constexpr size_t ChunkedColumn<T, ChunkSizeLog2>::kChunkSize;
+template <typename T, size_t ChunkSizeLog2>
+constexpr size_t ChunkedColumn<T, ChunkSizeLog2>::kChunkMask;
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_CHUNKED_COLUMN_H_
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/chunked_column.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+using Column = ChunkedColumn<uint64_t>;
+
+TEST(ChunkedColumnTest, Empty) {
+  Column column;
+  ASSERT_EQ(column.size(), 0u);
+  ASSERT_TRUE(column.empty());
+  ASSERT_EQ(column.chunk_count(), 0u);
+  ASSERT_EQ(column.begin(), column.end());
+}
+
+TEST(ChunkedColumnTest, AppendAcrossChunks) {
+  Column column;
+  const size_t kSize = Column::kChunkSize * 2 + 3;
+  for (size_t i = 0; i < kSize; i++)
+    column.emplace_back(i * 10);
+
+  ASSERT_EQ(column.size(), kSize);
+  ASSERT_EQ(column.chunk_count(), 3u);
+  ASSERT_EQ(column.chunk_size(0), Column::kChunkSize);
+  ASSERT_EQ(column.chunk_size(1), Column::kChunkSize);
+  ASSERT_EQ(column.chunk_size(2), 3u);
+  ASSERT_EQ(column.front(), 0u);
+  ASSERT_EQ(column.back(), (kSize - 1) * 10);
+
+  for (size_t i = 0; i < kSize; i++)
+    ASSERT_EQ(column[i], i * 10);
+
+  // Walking the chunks must yield the same sequence as indexing.
+  size_t row = 0;
+  for (size_t c = 0; c < column.chunk_count(); c++) {
+    const uint64_t* data = column.chunk_data(c);
+    for (size_t i = 0; i < column.chunk_size(c); i++)
+      ASSERT_EQ(data[i], column[row++]);
+  }
+  ASSERT_EQ(row, kSize);
+}
+
+TEST(ChunkedColumnTest, AppendUnaligned) {
+  Column column;
+  column.emplace_back(1);
+
+  // Unaligned source, crossing two chunk boundaries.
+  const size_t kCount = Column::kChunkSize * 2;
+  std::vector<uint8_t> raw(kCount * sizeof(uint64_t) + 1);
+  for (size_t i = 0; i < kCount; i++) {
+    uint64_t value = i * 3;
+    memcpy(&raw[1 + i * sizeof(value)], &value, sizeof(value));
+  }
+  column.AppendUnaligned(&raw[1], kCount);
+
+  // Narrower source type, converted on the way.
+  const uint32_t narrow[] = {7, 8, 9};
+  column.AppendUnaligned<uint32_t>(narrow, 3);
+
+  ASSERT_EQ(column.size(), 1 + kCount + 3);
+  ASSERT_EQ(column.chunk_count(), 3u);
+  ASSERT_EQ(column[0], 1u);
+  for (size_t i = 0; i < kCount; i++)
+    ASSERT_EQ(column[1 + i], i * 3);
+  ASSERT_EQ(column[1 + kCount], 7u);
+  ASSERT_EQ(column.back(), 9u);
+}
+
+TEST(ChunkedColumnTest, PointersAreStable) {
+  Column column;
+  column.emplace_back(42);
+  const uint64_t* first = &column[0];
+  for (size_t i = 0; i < Column::kChunkSize * 4; i++)
+    column.emplace_back(i);
+  ASSERT_EQ(first, &column[0]);
+  ASSERT_EQ(*first, 42u);
+}
+
+TEST(ChunkedColumnTest, BinarySearch) {
+  Column column;
+  const size_t kSize = Column::kChunkSize * 3;
+  for (size_t i = 0; i < kSize; i++)
+    column.emplace_back(i * 2);
+
+  auto it = std::lower_bound(column.begin(), column.end(), 2 * 12345u + 1);
+  ASSERT_EQ(it.index(), 12346u);
+  ASSERT_EQ(*it, 2 * 12346u);
+
+  auto ub = std::upper_bound(column.begin(), column.end(), 10u);
+  ASSERT_EQ(std::distance(column.begin(), ub), 6);
+}
+
+TEST(ChunkedColumnTest, MemoryUsage) {
+  Column column;
+  column.emplace_back(1);
+  ASSERT_GE(column.memory_usage_bytes(), Column::kChunkSize * sizeof(uint64_t));
+}
+
+TEST(ChunkedColumnTest, ReadWhileAppending) {
+  Column column;
+  const size_t kSize = Column::kChunkSize * 64;
+  std::thread writer([&column] {
+    for (size_t i = 0; i < kSize; i++)
+      column.emplace_back(i * 3);
+  });
+
+  // All the elements below size() are readable while the column grows.
+  size_t size = 0;
+  while (size < kSize) {
+    size_t new_size = column.size();
+    ASSERT_GE(new_size, size);
+    for (size_t i = size; i < new_size; i++)
+      ASSERT_EQ(column[i], i * 3);
+    if (new_size > 0) {
+      ASSERT_EQ(*(column.begin() + (new_size - 1)), (new_size - 1) * 3);
+      size_t last = new_size - 1;
+      ASSERT_EQ(column.chunk_data(last >> Column::kChunkSizeLog2)
+                    [last & Column::kChunkMask],
+                last * 3);
+    }
+    size = new_size;
+  }
+  writer.join();
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -22,6 +22,8 @@
 
 #include <memory>
 
+#include "src/trace_processor/trace_blob_view.h"
+
 namespace perfetto {
 namespace trace_processor {
 
@@ -34,10 +36,16 @@ class ChunkedTraceReader {
   // Pushes more data into the trace parser. There is no requirement for the
   // caller to match line/protos boundaries. The parser class has to deal with
   // intermediate buffering lines/protos that span across different chunks.
-  // The buffer size is guaranteed to be > 0.
+  // The buffer size is guaranteed to be > 0. Readers can retain slices of the
+  // buffer (rather than copying them) for as long as they need.
   // Returns true if the data has been succesfully parsed, false if some
   // unrecoverable parsing error happened and no more chunks should be pushed.
-  virtual bool Parse(std::unique_ptr<uint8_t[]>, size_t) = 0;
+  virtual bool Parse(TraceBlobView) = 0;
+
+  // Called after the last chunk has been passed to Parse(). Readers that
+  // process chunks asynchronously must push all the pending data to the next
+  // stages before returning.
+  virtual void NotifyEndOfFile() {}
 };
 
 }  // namespace trace_processor
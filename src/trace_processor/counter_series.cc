@@ -0,0 +1,231 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/counter_series.h"
+
+#include <algorithm>
+
+#include "perfetto/base/logging.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+namespace {
+
+inline uint64_t ZigZagEncode(int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^
+         static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t ZigZagDecode(uint64_t value) {
+  return static_cast<int64_t>((value >> 1) ^ (~(value & 1) + 1));
+}
+
+// Wrapping arithmetic, so that any pair of values can be delta encoded.
+inline int64_t WrappingSub(int64_t a, int64_t b) {
+  return static_cast<int64_t>(static_cast<uint64_t>(a) -
+                              static_cast<uint64_t>(b));
+}
+
+inline int64_t WrappingAdd(int64_t a, int64_t b) {
+  return static_cast<int64_t>(static_cast<uint64_t>(a) +
+                              static_cast<uint64_t>(b));
+}
+
+}  // namespace
+
+// static
+constexpr uint32_t CounterSeries::kMaxBlockSize;
+
+CounterSeries::CounterSeries() = default;
+CounterSeries::~CounterSeries() = default;
+
+void CounterSeries::Append(uint64_t ts, int64_t value, uint32_t seq) {
+  const uint32_t size = size_.load(std::memory_order_relaxed);
+  PERFETTO_DCHECK(size == 0 || ts >= last_ts_);
+
+  // The timestamp delta is shifted to make room for the publish flag: a
+  // delta which doesn't fit starts a new block instead.
+  const uint64_t ts_delta = ts - last_ts_;
+  if (size == 0 || size - blocks_.back().first_index == kMaxBlockSize ||
+      (ts_delta >> 63) != 0) {
+    blocks_.emplace_back(
+        Block{ts, value, seq, size, static_cast<uint32_t>(data_.size())});
+  } else {
+    AppendVarInt((ts_delta << 1) | (published_ ? 1 : 0));
+    AppendVarInt(ZigZagEncode(WrappingSub(value, last_value_)));
+    if (published_)
+      AppendVarInt(seq - blocks_.back().first_seq);
+  }
+  published_ = false;
+  last_ts_ = ts;
+  last_value_ = value;
+  size_.store(size + 1, std::memory_order_release);
+}
+
+uint32_t CounterSeries::CountSamples(uint32_t end_seq) const {
+  // The blocks are sorted by sequence number: find the last one whose first
+  // sample is visible.
+  const uint32_t count = size();
+  size_t lo = 0;
+  size_t hi = BlockCount(count);
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (blocks_[mid].first_seq < end_seq) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo == 0)
+    return 0;
+
+  // A sample of the block is visible if the last one appended after a
+  // publish, up to it, is: no publish separates them.
+  const auto block = static_cast<uint32_t>(lo - 1);
+  const uint32_t end = BlockEnd(block, count);
+  Iterator it = BlockBegin(block, count);
+  while (it.index() < end && it.publish_seq_ < end_seq)
+    it.Next();
+  return it.index();
+}
+
+uint32_t CounterSeries::BlockCount(uint32_t count) const {
+  size_t lo = 0;
+  size_t hi = blocks_.size();
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (blocks_[mid].first_index < count) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return static_cast<uint32_t>(lo);
+}
+
+CounterSeries::Iterator CounterSeries::BlockBegin(uint32_t block,
+                                                  uint32_t count) const {
+  Iterator it;
+  it.series_ = this;
+  it.end_ = count;
+  if (block >= BlockCount(count)) {
+    it.index_ = count;
+    return it;
+  }
+  const Block& b = blocks_[block];
+  it.index_ = b.first_index;
+  it.block_ = block;
+  it.left_in_block_ = BlockEnd(block, count) - b.first_index - 1;
+  it.data_offset_ = b.data_offset;
+  it.ts_ = b.first_ts;
+  it.value_ = b.first_value;
+  it.publish_seq_ = b.first_seq;
+  return it;
+}
+
+uint32_t CounterSeries::BlockEnd(uint32_t block, uint32_t count) const {
+  // Readers may see blocks appended after they loaded |count|.
+  if (block + 1 < blocks_.size())
+    return std::min(blocks_[block + 1].first_index, count);
+  return count;
+}
+
+CounterSeries::Iterator CounterSeries::Begin(uint32_t count) const {
+  return BlockBegin(0, count);
+}
+
+CounterSeries::Iterator CounterSeries::LowerBound(uint64_t ts,
+                                                  uint32_t count) const {
+  // Start from the last block which begins before |ts|: the first sample >=
+  // |ts| is either in it or is the first one of the next block.
+  uint32_t block_count = BlockCount(count);
+  auto first_ge = std::partition_point(
+      blocks_.begin(), blocks_.begin() + block_count,
+      [ts](const Block& b) { return b.first_ts < ts; });
+  size_t block = first_ge.index();
+  Iterator it = BlockBegin(static_cast<uint32_t>(block > 0 ? block - 1 : 0),
+                           count);
+  while (it.valid() && it.ts() < ts)
+    it.Next();
+  return it;
+}
+
+CounterSeries::Iterator CounterSeries::Floor(uint64_t ts,
+                                             uint32_t count) const {
+  uint32_t block_count = BlockCount(count);
+  auto first_gt = std::partition_point(
+      blocks_.begin(), blocks_.begin() + block_count,
+      [ts](const Block& b) { return b.first_ts <= ts; });
+  size_t block = first_gt.index();
+  Iterator it = BlockBegin(static_cast<uint32_t>(block > 0 ? block - 1 : 0),
+                           count);
+  while (it.has_next() && it.next_ts() <= ts)
+    it.Next();
+  return it;
+}
+
+void CounterSeries::AppendVarInt(uint64_t value) {
+  while (value >= 0x80) {
+    data_.emplace_back(static_cast<uint8_t>(value | 0x80));
+    value >>= 7;
+  }
+  data_.emplace_back(static_cast<uint8_t>(value));
+}
+
+uint64_t CounterSeries::ReadVarInt(size_t* offset) const {
+  uint64_t value = 0;
+  for (uint32_t shift = 0;; shift += 7) {
+    uint8_t byte = data_[(*offset)++];
+    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+      return value;
+  }
+}
+
+uint64_t CounterSeries::Iterator::next_ts() const {
+  PERFETTO_DCHECK(has_next());
+  if (left_in_block_ == 0)
+    return series_->blocks_[block_ + 1].first_ts;
+  size_t offset = data_offset_;
+  return ts_ + (series_->ReadVarInt(&offset) >> 1);
+}
+
+void CounterSeries::Iterator::Next() {
+  if (++index_ >= end_)
+    return;
+  if (left_in_block_ == 0) {
+    const Block& b = series_->blocks_[++block_];
+    left_in_block_ = series_->BlockEnd(block_, end_) - b.first_index - 1;
+    data_offset_ = b.data_offset;
+    ts_ = b.first_ts;
+    value_ = b.first_value;
+    publish_seq_ = b.first_seq;
+    return;
+  }
+  left_in_block_--;
+  uint64_t ts_delta = series_->ReadVarInt(&data_offset_);
+  ts_ += ts_delta >> 1;
+  int64_t delta = ZigZagDecode(series_->ReadVarInt(&data_offset_));
+  value_ = WrappingAdd(value_, delta);
+  if (ts_delta & 1) {
+    publish_seq_ = series_->blocks_[block_].first_seq +
+                   static_cast<uint32_t>(series_->ReadVarInt(&data_offset_));
+  }
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,175 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_COUNTER_SERIES_H_
+#define SRC_TRACE_PROCESSOR_COUNTER_SERIES_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+
+#include "src/trace_processor/chunked_column.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// Append-only storage for the samples of one counter, in timestamp order.
+// Samples are delta encoded in blocks of up to kMaxBlockSize: each block
+// stores its first sample in full, and the following ones as the varint
+// deltas of their timestamp and (zigzag encoded) value from the previous
+// sample. Counters tend to change slowly and are sampled at a regular
+// interval, so most samples take 3-6 bytes instead of 16. Iterating is a
+// sequential decode, and seeking to a timestamp is a binary search on the
+// blocks followed by a decode of at most one block.
+//
+// Like ChunkedColumn, one thread can append while others read. Each sample
+// has a sequence number shared by all the series of the storage, and a reader
+// sees the samples appended before the storage published the row counts it
+// reads (see CountSamples()). The number is stored in full for the first
+// sample of each block only: the following samples have a flag, in the low
+// bit of their timestamp delta, telling whether the counts were published
+// since the previous sample (see MarkPublished()), and only then are followed
+// by their sequence number. Publishing often thus costs a few bytes per
+// series with new samples rather than a new block.
+class CounterSeries {
+ public:
+  static constexpr uint32_t kMaxBlockSize = 64;
+
+  // Iterates over the first |end| samples of a series, decoding them one by
+  // one. The iterator stays valid while the series grows.
+  class Iterator {
+   public:
+    bool valid() const { return index_ < end_; }
+    uint32_t index() const { return index_; }
+    uint64_t ts() const { return ts_; }
+    int64_t value() const { return value_; }
+
+    // Returns whether there is a sample after the current one, and its
+    // timestamp (which requires decoding it).
+    bool has_next() const { return index_ + 1 < end_; }
+    uint64_t next_ts() const;
+
+    void Next();
+
+   private:
+    friend class CounterSeries;
+
+    const CounterSeries* series_ = nullptr;
+    uint32_t end_ = 0;
+    uint32_t index_ = 0;
+
+    // The block of the current sample, and the number of samples of the
+    // block after it.
+    uint32_t block_ = 0;
+    uint32_t left_in_block_ = 0;
+
+    // The sequence number of the last sample, up to the current one, which
+    // was appended after a publish (or is the first of its block).
+    uint32_t publish_seq_ = 0;
+
+    // Offset of the delta of the next sample of the block.
+    size_t data_offset_ = 0;
+
+    uint64_t ts_ = 0;
+    int64_t value_ = 0;
+  };
+
+  CounterSeries();
+  ~CounterSeries();
+
+  // Appends a sample, with timestamp >= the one of the last sample. |seq| is
+  // the sequence number of the sample in the storage (see above), which must
+  // grow with each sample.
+  void Append(uint64_t ts, int64_t value, uint32_t seq);
+
+  // Records that the storage published its row counts after the last
+  // sample. Only for the writer.
+  void MarkPublished() { published_ = true; }
+  bool published() const { return published_; }
+
+  // Returns the number of samples whose sequence number is < |end_seq|,
+  // |end_seq| being the number of samples of the storage when it published
+  // the row counts read by the caller.
+  uint32_t CountSamples(uint32_t end_seq) const;
+
+  // Returns an iterator on the first sample, out of the first |count|.
+  Iterator Begin(uint32_t count) const;
+
+  // Returns an iterator on the first of the first |count| samples with a
+  // timestamp >= |ts|, invalid if there is none.
+  Iterator LowerBound(uint64_t ts, uint32_t count) const;
+
+  // Returns an iterator on the last of the first |count| samples with a
+  // timestamp <= |ts|, or on the first sample if there is none.
+  Iterator Floor(uint64_t ts, uint32_t count) const;
+
+  // The number of samples, all of which can be read. The last sample is only
+  // for the writer.
+  uint32_t size() const { return size_.load(std::memory_order_acquire); }
+  uint64_t last_ts() const { return last_ts_; }
+  int64_t last_value() const { return last_value_; }
+
+  size_t memory_usage_bytes() const {
+    return blocks_.memory_usage_bytes() + data_.memory_usage_bytes();
+  }
+
+ private:
+  CounterSeries(const CounterSeries&) = delete;
+  CounterSeries& operator=(const CounterSeries&) = delete;
+
+  struct Block {
+    uint64_t first_ts;
+    int64_t first_value;
+
+    // The sequence number of the first sample, and its index in the series.
+    uint32_t first_seq;
+    uint32_t first_index;
+
+    // Offset in |data_| of the delta of the second sample.
+    uint32_t data_offset;
+  };
+
+  // Returns an iterator on the first sample of |block|.
+  Iterator BlockBegin(uint32_t block, uint32_t count) const;
+
+  // Returns the index after the last sample of |block|, out of the first
+  // |count|.
+  uint32_t BlockEnd(uint32_t block, uint32_t count) const;
+
+  // Returns the number of blocks which contain the first |count| samples.
+  uint32_t BlockCount(uint32_t count) const;
+
+  void AppendVarInt(uint64_t value);
+  uint64_t ReadVarInt(size_t* offset) const;
+
+  // Small chunks, as traces can have thousands of counters with few samples.
+  ChunkedColumn<Block, 4> blocks_;
+  ChunkedColumn<uint8_t, 9> data_;
+
+  // Stored after the data of each sample, for readers.
+  std::atomic<uint32_t> size_{0};
+
+  // Only accessed by the writer.
+  uint64_t last_ts_ = 0;
+  int64_t last_value_ = 0;
+  bool published_ = true;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_COUNTER_SERIES_H_
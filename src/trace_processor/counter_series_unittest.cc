@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/counter_series.h"
+
+#include <limits>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+struct Sample {
+  uint64_t ts;
+  int64_t value;
+};
+
+// Samples with small and large deltas in both directions, some with the
+// same timestamp.
+std::vector<Sample> MakeSamples(size_t count) {
+  std::vector<Sample> samples;
+  uint64_t ts = 1000;
+  for (size_t i = 0; i < count; i++) {
+    ts += (i % 7 == 0) ? 0 : (i % 5 == 0 ? 1ull << 40 : i * 3);
+    int64_t value = (i % 3 == 0) ? -static_cast<int64_t>(i * 1000)
+                                 : static_cast<int64_t>(i);
+    if (i == count / 2)
+      value = std::numeric_limits<int64_t>::min();
+    if (i == count / 2 + 1)
+      value = std::numeric_limits<int64_t>::max();
+    samples.push_back(Sample{ts, value});
+  }
+  return samples;
+}
+
+TEST(CounterSeriesTest, Empty) {
+  CounterSeries series;
+  ASSERT_EQ(series.size(), 0u);
+  ASSERT_EQ(series.CountSamples(100), 0u);
+  ASSERT_FALSE(series.Begin(0).valid());
+  ASSERT_FALSE(series.LowerBound(0, 0).valid());
+  ASSERT_FALSE(series.Floor(0, 0).valid());
+}
+
+TEST(CounterSeriesTest, IterateAcrossBlocks) {
+  const auto samples = MakeSamples(CounterSeries::kMaxBlockSize * 3 + 5);
+  CounterSeries series;
+  for (uint32_t i = 0; i < samples.size(); i++)
+    series.Append(samples[i].ts, samples[i].value, i);
+  ASSERT_EQ(series.size(), samples.size());
+  ASSERT_EQ(series.last_ts(), samples.back().ts);
+  ASSERT_EQ(series.last_value(), samples.back().value);
+
+  auto it = series.Begin(series.size());
+  for (uint32_t i = 0; i < samples.size(); i++, it.Next()) {
+    ASSERT_TRUE(it.valid());
+    ASSERT_EQ(it.index(), i);
+    ASSERT_EQ(it.ts(), samples[i].ts);
+    ASSERT_EQ(it.value(), samples[i].value);
+    ASSERT_EQ(it.has_next(), i + 1 < samples.size());
+    if (it.has_next()) {
+      ASSERT_EQ(it.next_ts(), samples[i + 1].ts);
+    }
+  }
+  ASSERT_FALSE(it.valid());
+
+  // Only the first |count| samples are iterated.
+  it = series.Begin(10);
+  for (uint32_t i = 0; i < 10; i++)
+    it.Next();
+  ASSERT_FALSE(it.valid());
+}
+
+TEST(CounterSeriesTest, Seek) {
+  const auto samples = MakeSamples(CounterSeries::kMaxBlockSize * 4);
+  CounterSeries series;
+  for (uint32_t i = 0; i < samples.size(); i++)
+    series.Append(samples[i].ts, samples[i].value, i);
+
+  const uint32_t count = series.size();
+  for (const auto& sample : samples) {
+    for (uint64_t ts : {sample.ts - 1, sample.ts, sample.ts + 1}) {
+      uint32_t lower = 0;
+      while (lower < count && samples[lower].ts < ts)
+        lower++;
+      auto it = series.LowerBound(ts, count);
+      ASSERT_EQ(it.valid(), lower < count);
+      if (it.valid()) {
+        ASSERT_EQ(it.index(), lower);
+      }
+
+      uint32_t floor = 0;
+      while (floor + 1 < count && samples[floor + 1].ts <= ts)
+        floor++;
+      ASSERT_EQ(series.Floor(ts, count).index(), floor);
+    }
+  }
+
+  // Samples past |count| are ignored.
+  ASSERT_FALSE(series.LowerBound(samples[20].ts + 1, 20).valid());
+  ASSERT_EQ(series.Floor(samples.back().ts, 20).index(), 19u);
+}
+
+TEST(CounterSeriesTest, VisibilityBySequenceNumber) {
+  // Published when the storage had 3 and then 8 samples.
+  CounterSeries series;
+  series.Append(10, 1, 0);
+  series.Append(20, 2, 2);
+  series.MarkPublished();
+  series.Append(30, 3, 5);
+  series.Append(40, 4, 6);
+  series.MarkPublished();
+  series.Append(50, 5, 9);
+
+  // The samples appended after a publish go in the same block, but are
+  // visible only to readers of a later publish.
+  ASSERT_EQ(series.CountSamples(0), 0u);
+  ASSERT_EQ(series.CountSamples(3), 2u);
+  ASSERT_EQ(series.CountSamples(8), 4u);
+  ASSERT_EQ(series.CountSamples(10), 5u);
+
+  auto it = series.Begin(series.CountSamples(8));
+  ASSERT_EQ(it.ts(), 10u);
+  it.Next();
+  it.Next();
+  ASSERT_EQ(it.ts(), 30u);
+  ASSERT_EQ(it.value(), 3);
+  it.Next();
+  ASSERT_EQ(it.value(), 4);
+  ASSERT_FALSE(it.has_next());
+  it.Next();
+  ASSERT_FALSE(it.valid());
+}
+
+TEST(CounterSeriesTest, PublishedAfterEachSample) {
+  const auto samples = MakeSamples(CounterSeries::kMaxBlockSize * 3 + 5);
+  CounterSeries series;
+  for (uint32_t i = 0; i < samples.size(); i++) {
+    // Other series get the odd sequence numbers.
+    series.Append(samples[i].ts, samples[i].value, i * 2);
+    series.MarkPublished();
+  }
+  for (uint32_t i = 0; i < samples.size(); i++) {
+    ASSERT_EQ(series.CountSamples(i * 2 + 1), i + 1);
+    ASSERT_EQ(series.CountSamples(i * 2 + 2), i + 1);
+  }
+
+  auto it = series.Begin(series.size());
+  for (uint32_t i = 0; i < samples.size(); i++, it.Next()) {
+    ASSERT_EQ(it.ts(), samples[i].ts);
+    ASSERT_EQ(it.value(), samples[i].value);
+    if (it.has_next()) {
+      ASSERT_EQ(it.next_ts(), samples[i + 1].ts);
+    }
+  }
+  ASSERT_FALSE(it.valid());
+}
+
+TEST(CounterSeriesTest, LargeTimestampDeltas) {
+  CounterSeries series;
+  series.Append(0, 1, 0);
+  series.Append(std::numeric_limits<uint64_t>::max(), 2, 1);
+  series.Append(std::numeric_limits<uint64_t>::max(), 3, 2);
+  auto it = series.Begin(series.size());
+  ASSERT_EQ(it.ts(), 0u);
+  ASSERT_EQ(it.next_ts(), std::numeric_limits<uint64_t>::max());
+  it.Next();
+  it.Next();
+  ASSERT_EQ(it.ts(), std::numeric_limits<uint64_t>::max());
+  ASSERT_EQ(it.value(), 3);
+}
+
+TEST(CounterSeriesTest, DeltasAreCompact) {
+  CounterSeries series;
+  const uint32_t kSamples = 100000;
+  for (uint32_t i = 0; i < kSamples; i++)
+    series.Append(i * 1000000ull, 1000000 + (i % 10) * 1000, i);
+  // A 20 bits timestamp delta and a 14 bits value delta take 3 + 2 bytes.
+  ASSERT_LT(series.memory_usage_bytes(), kSamples * 6);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
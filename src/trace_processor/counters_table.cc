@@ -16,6 +16,8 @@
 
 #include "src/trace_processor/counters_table.h"
 
+#include <algorithm>
+
 #include "perfetto/base/logging.h"
 #include "src/trace_processor/query_constraints.h"
 #include "src/trace_processor/sqlite_utils.h"
@@ -27,6 +29,32 @@ namespace {
 
 using namespace sqlite_utils;
 
+// Returns the value of the reftype column for |ref_type|, nullptr for NULL.
+const char* RefTypeName(RefType ref_type) {
+  switch (ref_type) {
+    case RefType::kNone:
+      return nullptr;
+    case RefType::kCpu:
+      return "cpu";
+    case RefType::kUtid:
+      return "utid";
+    case RefType::kUpid:
+      return "upid";
+  }
+  return nullptr;
+}
+
+// Sets |ref_type| to the RefType whose reftype column value is |name|.
+bool FindRefType(base::StringView name, RefType* ref_type) {
+  for (RefType type : {RefType::kCpu, RefType::kUtid, RefType::kUpid}) {
+    if (name == base::StringView(RefTypeName(type))) {
+      *ref_type = type;
+      return true;
+    }
+  }
+  return false;
+}
+
 }  // namespace
 
 CountersTable::CountersTable(const TraceStorage* storage) : storage_(storage) {}
@@ -49,52 +77,64 @@ std::unique_ptr<Table::Cursor> CountersTable::CreateCursor() {
 }
 
 int CountersTable::BestIndex(const QueryConstraints& qc, BestIndexInfo* info) {
-  info->estimated_cost = 10;
-
-  // If the query has a constraint on the |kRef| field, return a reduced cost
-  // because we can do that filter efficiently.
-  const auto& constraints = qc.constraints();
-  if (constraints.size() == 1 && constraints.front().iColumn == Column::kRef) {
-    info->estimated_cost = IsOpEq(constraints.front().op) ? 1 : 10;
+  bool is_time_constrained = false;
+  bool is_counter_constrained = false;
+  for (const auto& cs : qc.constraints()) {
+    if (cs.iColumn == Column::kTimestamp)
+      is_time_constrained = true;
+    if ((cs.iColumn == Column::kName || cs.iColumn == Column::kRef) &&
+        IsOpEq(cs.op)) {
+      is_counter_constrained = true;
+    }
   }
 
+  // Constraints on the counter skip the samples of the others, and the ones
+  // on the timestamp are binary searches.
+  if (is_counter_constrained) {
+    info->estimated_cost = is_time_constrained ? 1 : 10;
+  } else {
+    info->estimated_cost = is_time_constrained ? 100 : 1000;
+  }
   return SQLITE_OK;
 }
 
 CountersTable::Cursor::Cursor(const TraceStorage* storage)
-    : storage_(storage) {}
+    : storage_(storage),
+      sample_count_(storage->GetVisibleRowCounts().counter_samples) {}
 
 int CountersTable::Cursor::Column(sqlite3_context* context, int N) {
   switch (N) {
     case Column::kTimestamp: {
-      const auto& freq = storage_->GetFreqForCpu(current_cpu_);
-      sqlite3_result_int64(context,
-                           static_cast<int64_t>(freq[index_in_cpu_].first));
+      sqlite3_result_int64(context, static_cast<int64_t>(it_.ts()));
       break;
     }
     case Column::kValue: {
-      const auto& freq = storage_->GetFreqForCpu(current_cpu_);
-      sqlite3_result_int64(context, freq[index_in_cpu_].second);
+      sqlite3_result_int64(context, it_.value());
       break;
     }
     case Column::kName: {
-      sqlite3_result_text(context, "cpufreq", -1, nullptr);
+      // Strings stay valid for the lifetime of the storage.
+      base::StringView name = storage_->GetString(counter().name_id);
+      sqlite3_result_text(context, name.data(), static_cast<int>(name.size()),
+                          SQLITE_STATIC);
       break;
     }
     case Column::kRef: {
-      sqlite3_result_int64(context, current_cpu_);
+      sqlite3_result_int64(context, counter().ref);
       break;
     }
     case Column::kRefType: {
-      sqlite3_result_text(context, "cpu", -1, nullptr);
+      const char* ref_type = RefTypeName(counter().ref_type);
+      if (ref_type) {
+        sqlite3_result_text(context, ref_type, -1, SQLITE_STATIC);
+      } else {
+        sqlite3_result_null(context);
+      }
       break;
     }
     case Column::kDuration: {
-      const auto& freq = storage_->GetFreqForCpu(current_cpu_);
-      uint64_t duration = 0;
-      if (index_in_cpu_ + 1 < freq.size()) {
-        duration = freq[index_in_cpu_ + 1].first - freq[index_in_cpu_].first;
-      }
+      // The last sample lasts until the end of the trace, which is unknown.
+      uint64_t duration = it_.has_next() ? it_.next_ts() - it_.ts() : 0;
       sqlite3_result_int64(context, static_cast<int64_t>(duration));
       break;
     }
@@ -107,45 +147,119 @@ int CountersTable::Cursor::Column(sqlite3_context* context, int N) {
 
 int CountersTable::Cursor::Filter(const QueryConstraints& qc,
                                   sqlite3_value** argv) {
+  // These only narrow down the samples to read: SQLite checks the
+  // constraints again on each row.
+  bool has_name = false;
+  base::StringView name;
+  bool has_ref = false;
+  int64_t ref = 0;
+  bool has_ref_type = false;
+  base::StringView ref_type;
+  min_ts_ = 0;
+  max_ts_ = std::numeric_limits<uint64_t>::max();
+  bool is_empty = false;
   for (size_t j = 0; j < qc.constraints().size(); j++) {
     const auto& cs = qc.constraints()[j];
-    if (cs.iColumn == Column::kRef) {
-      auto constraint_cpu = static_cast<uint32_t>(sqlite3_value_int(argv[j]));
-      if (IsOpEq(cs.op)) {
-        filter_by_cpu_ = true;
-        filter_cpu_ = constraint_cpu;
+    if (IsOpLimit(cs.op) || IsOpOffset(cs.op))
+      continue;
+    int type = sqlite3_value_type(argv[j]);
+    switch (cs.iColumn) {
+      case Column::kName:
+        if (IsOpEq(cs.op) && type == SQLITE_TEXT) {
+          has_name = true;
+          name = reinterpret_cast<const char*>(sqlite3_value_text(argv[j]));
+        }
+        break;
+      case Column::kRef:
+        if (IsOpEq(cs.op) && type == SQLITE_INTEGER) {
+          has_ref = true;
+          ref = sqlite3_value_int64(argv[j]);
+        }
+        break;
+      case Column::kRefType:
+        if (IsOpEq(cs.op) && type == SQLITE_TEXT) {
+          has_ref_type = true;
+          ref_type =
+              reinterpret_cast<const char*>(sqlite3_value_text(argv[j]));
+        }
+        break;
+      case Column::kTimestamp: {
+        if (type != SQLITE_INTEGER)
+          break;
+        // Timestamps are unsigned: a negative lower bound is no bound, and
+        // no sample is below a negative upper bound.
+        int64_t value = sqlite3_value_int64(argv[j]);
+        auto ts = static_cast<uint64_t>(std::max<int64_t>(value, 0));
+        if (IsOpGe(cs.op) || IsOpGt(cs.op)) {
+          min_ts_ = std::max(min_ts_, ts);
+        } else if (IsOpLe(cs.op) || IsOpLt(cs.op)) {
+          max_ts_ = std::min(max_ts_, ts);
+          is_empty |= value < 0;
+        } else if (IsOpEq(cs.op)) {
+          min_ts_ = std::max(min_ts_, ts);
+          max_ts_ = std::min(max_ts_, ts);
+          is_empty |= value < 0;
+        }
+        break;
       }
     }
   }
 
+  counter_ids_.clear();
+  counter_idx_ = 0;
+  if (is_empty)
+    return SQLITE_OK;
+
+  RefType counter_ref_type = RefType::kNone;
+  if (has_ref_type && !FindRefType(ref_type, &counter_ref_type))
+    return SQLITE_OK;
+
+  // With a name, the counters come from the index of TraceStorage, which can
+  // include counters not visible yet.
+  const uint32_t counter_count = storage_->GetVisibleRowCounts().counters;
+  if (has_name) {
+    StringId name_id;
+    if (!storage_->FindString(name, &name_id))
+      return SQLITE_OK;
+    counter_ids_ = storage_->FindCounters(name_id, has_ref, ref);
+  } else {
+    for (CounterId id = 0; id < counter_count; id++) {
+      if (!has_ref || storage_->counters().counter(id).ref == ref)
+        counter_ids_.emplace_back(id);
+    }
+  }
+  const auto& counters = storage_->counters();
+  auto is_filtered_out = [&](CounterId id) {
+    return id >= counter_count ||
+           (has_ref_type && counters.counter(id).ref_type != counter_ref_type);
+  };
+  counter_ids_.erase(std::remove_if(counter_ids_.begin(), counter_ids_.end(),
+                                    is_filtered_out),
+                     counter_ids_.end());
+  SeekToCounterWithSamples();
   return SQLITE_OK;
 }
 
+void CountersTable::Cursor::SeekToCounterWithSamples() {
+  for (; counter_idx_ < counter_ids_.size(); counter_idx_++) {
+    const CounterSeries* series = counter().series;
+    it_ = series->LowerBound(min_ts_, series->CountSamples(sample_count_));
+    if (it_.valid() && it_.ts() <= max_ts_)
+      return;
+  }
+}
+
 int CountersTable::Cursor::Next() {
-  if (filter_by_cpu_) {
-    current_cpu_ = filter_cpu_;
-    ++index_in_cpu_;
-  } else {
-    if (index_in_cpu_ < storage_->GetFreqForCpu(current_cpu_).size() - 1) {
-      index_in_cpu_++;
-    } else if (current_cpu_ < storage_->GetMaxCpu()) {
-      ++current_cpu_;
-      index_in_cpu_ = 0;
-    }
-    // If the cpu is has no freq events, move to the next one.
-    while (current_cpu_ != storage_->GetMaxCpu() &&
-           storage_->GetFreqForCpu(current_cpu_).size() == 0) {
-      ++current_cpu_;
-    }
+  it_.Next();
+  if (!it_.valid() || it_.ts() > max_ts_) {
+    counter_idx_++;
+    SeekToCounterWithSamples();
   }
   return SQLITE_OK;
 }
 
 int CountersTable::Cursor::Eof() {
-  if (filter_by_cpu_) {
-    return index_in_cpu_ == storage_->GetFreqForCpu(current_cpu_).size();
-  }
-  return current_cpu_ == storage_->GetMaxCpu();
+  return counter_idx_ >= counter_ids_.size();
 }
 
 }  // namespace trace_processor
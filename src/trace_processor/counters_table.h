@@ -19,6 +19,7 @@
 
 #include <limits>
 #include <memory>
+#include <vector>
 
 #include "src/trace_processor/table.h"
 #include "src/trace_processor/trace_storage.h"
@@ -26,6 +27,12 @@
 namespace perfetto {
 namespace trace_processor {
 
+// The samples of all the counters of the trace (see TraceStorage::Counters).
+// Rows are sorted by counter, then by timestamp. Constraints on name, ref and
+// reftype select the counters to read, and constraints on ts are answered by
+// a binary search in the samples of each of them, e.g.:
+//   SELECT ts, value FROM counters WHERE name = 'cpufreq' AND ref = 2
+//   AND ts BETWEEN 1000000000 AND 2000000000
 class CountersTable : public Table {
  public:
   enum Column {
@@ -57,12 +64,28 @@ class CountersTable : public Table {
     int Column(sqlite3_context*, int N) override;
 
    private:
-    bool filter_by_cpu_ = false;
-    uint32_t current_cpu_ = 0;
-    size_t index_in_cpu_ = 0;
-    uint32_t filter_cpu_ = 0;
+    // Moves to the first sample >= |min_ts_| of the first counter from
+    // |counter_idx_| on which has samples in [min_ts_, max_ts_].
+    void SeekToCounterWithSamples();
+
+    const TraceStorage::Counters::Counter& counter() const {
+      return storage_->counters().counter(counter_ids_[counter_idx_]);
+    }
 
     const TraceStorage* const storage_;
+
+    // The number of counter samples visible to the query.
+    const uint32_t sample_count_;
+
+    // The counters matching the constraints, and the one being read.
+    std::vector<CounterId> counter_ids_;
+    size_t counter_idx_ = 0;
+
+    // The current sample of the current counter.
+    CounterSeries::Iterator it_;
+
+    uint64_t min_ts_ = 0;
+    uint64_t max_ts_ = std::numeric_limits<uint64_t>::max();
   };
 
   const TraceStorage* const storage_;
@@ -79,6 +79,40 @@ TEST_F(CountersTableUnittest, SelectWhereCpu) {
   ASSERT_EQ(sqlite3_step(*stmt_), SQLITE_DONE);
 }
 
+TEST_F(CountersTableUnittest, SelectWhereNameRefAndRefType) {
+  TraceStorage* storage = context_.storage.get();
+  StringId mem = storage->InternString("mem.rss");
+  storage->PushCpuFreq(1000, 1 /* cpu */, 3000);
+  storage->PushCounter(mem, 1 /* ref */, RefType::kUpid, 1001, 10);
+  storage->PushCounter(mem, 2 /* ref */, RefType::kUpid, 1002, 20);
+  storage->PushCounter(mem, 1 /* ref */, RefType::kUtid, 1003, 30);
+
+  struct {
+    const char* where;
+    int count;
+    int sum;
+  } queries[] = {
+      {"name = 'mem.rss'", 3, 60},
+      {"name = 'mem.rss' AND ref = 1", 2, 40},
+      {"name = 'mem.rss' AND ref = 1 AND reftype = 'upid'", 1, 10},
+      {"name = 'mem.rss' AND reftype = 'utid'", 1, 30},
+      {"name = 'cpufreq' AND ref = 1", 1, 3000},
+      {"ref = 1 AND reftype = 'cpu'", 1, 3000},
+      {"ref = 1", 3, 3040},
+      {"name = 'mem.rss' AND ref = 3", 0, 0},
+      {"name = 'unknown'", 0, 0},
+      {"reftype = 'unknown'", 0, 0},
+  };
+  for (const auto& query : queries) {
+    PrepareValidStatement(
+        std::string("SELECT COUNT(*), TOTAL(value) FROM counters WHERE ") +
+        query.where);
+    ASSERT_EQ(sqlite3_step(*stmt_), SQLITE_ROW);
+    ASSERT_EQ(sqlite3_column_int(*stmt_, 0), query.count) << query.where;
+    ASSERT_EQ(sqlite3_column_int(*stmt_, 1), query.sum) << query.where;
+  }
+}
+
 TEST_F(CountersTableUnittest, GroupByFreq) {
   uint64_t timestamp = 1000;
   uint32_t freq = 3000;
@@ -101,6 +135,47 @@ TEST_F(CountersTableUnittest, GroupByFreq) {
   ASSERT_EQ(sqlite3_step(*stmt_), SQLITE_DONE);
 }
 
+TEST_F(CountersTableUnittest, NegativeTimestampBounds) {
+  context_.storage->PushCpuFreq(1000, 1 /* cpu */, 3000);
+  context_.storage->PushCpuFreq(2000, 1 /* cpu */, 4000);
+
+  PrepareValidStatement("SELECT COUNT(*) FROM counters WHERE ts >= -1");
+  ASSERT_EQ(sqlite3_step(*stmt_), SQLITE_ROW);
+  ASSERT_EQ(sqlite3_column_int(*stmt_, 0), 2);
+
+  for (const char* where : {"ts <= -1", "ts < -1", "ts = -1"}) {
+    PrepareValidStatement(std::string("SELECT COUNT(*) FROM counters WHERE ") +
+                          where);
+    ASSERT_EQ(sqlite3_step(*stmt_), SQLITE_ROW);
+    ASSERT_EQ(sqlite3_column_int(*stmt_, 0), 0) << where;
+  }
+}
+
+TEST_F(CountersTableUnittest, CompactWhenPublishedOften) {
+  // As if each Parse() call got a tiny chunk with a few samples per cpu.
+  auto* storage = context_.storage.get();
+  const uint32_t kCpus = 4;
+  const uint32_t kSamplesPerCpu = 10000;
+  for (uint32_t i = 0; i < kSamplesPerCpu; i++) {
+    for (uint32_t cpu = 0; cpu < kCpus; cpu++)
+      storage->PushCpuFreq(i * 1000000ull, cpu, 1000000 + (i % 10) * 1000);
+    if (i % 2 == 1)
+      storage->PublishRowCounts();
+  }
+  storage->PublishRowCounts();
+
+  // Besides the deltas (3 + 2 bytes), a sample appended after a publish only
+  // takes its sequence number.
+  ASSERT_LT(storage->GetMemoryUsage().counters, kCpus * kSamplesPerCpu * 7);
+
+  PrepareValidStatement(
+      "SELECT COUNT(*), SUM(value) FROM counters WHERE ref = 2");
+  ASSERT_EQ(sqlite3_step(*stmt_), SQLITE_ROW);
+  ASSERT_EQ(sqlite3_column_int(*stmt_, 0), kSamplesPerCpu);
+  ASSERT_EQ(sqlite3_column_int64(*stmt_, 1),
+            (1000000 + 4500) * static_cast<int64_t>(kSamplesPerCpu));
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -0,0 +1,310 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/cpu_summary_cache.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "perfetto/base/logging.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+namespace {
+
+// Splits [start, end) at the boundaries of the buckets of |quantum| ns and
+// invokes |fn| with the index of each bucket (relative to |first_bucket|)
+// and the time the range spends in it.
+template <typename Fn>
+inline void ForEachBucket(uint64_t start,
+                          uint64_t end,
+                          uint64_t quantum,
+                          uint64_t first_bucket,
+                          Fn fn) {
+  while (start < end) {
+    uint64_t bucket = start / quantum;
+    uint64_t bucket_end = std::min(end, (bucket + 1) * quantum);
+    fn(static_cast<size_t>(bucket - first_bucket), bucket_end - start);
+    start = bucket_end;
+  }
+}
+
+void ResizeLevel(CpuSummaryCache::Level* level, size_t bucket_count) {
+  level->busy_ns.resize(bucket_count);
+  level->top_utid.resize(bucket_count);
+  level->top_utid_ns.resize(bucket_count);
+  level->min_freq.resize(bucket_count, std::numeric_limits<uint32_t>::max());
+  level->max_freq.resize(bucket_count);
+  level->freq_ns.resize(bucket_count);
+  level->freq_ns_sum.resize(bucket_count);
+}
+
+// Resets the min frequency of the buckets without any frequency data, which
+// is initialized to UINT32_MAX while the level is being built.
+void FinalizeMinFreq(CpuSummaryCache::Level* level) {
+  for (size_t i = 0; i < level->bucket_count(); i++) {
+    if (level->freq_ns[i] == 0)
+      level->min_freq[i] = 0;
+  }
+}
+
+}  // namespace
+
+constexpr size_t CpuSummaryCache::kMinBucketLimit;
+constexpr size_t CpuSummaryCache::kMaxLevelsPerCpu;
+
+CpuSummaryCache::CpuSummaryCache(const TraceStorage* storage)
+    : storage_(storage) {}
+
+CpuSummaryCache::~CpuSummaryCache() = default;
+
+std::shared_ptr<const CpuSummaryCache::Level> CpuSummaryCache::GetLevel(
+    uint32_t cpu,
+    uint64_t quantum) {
+  PERFETTO_CHECK(cpu < base::kMaxCpus && quantum > 0);
+  PerCpu* state = UpdateCpu(cpu);
+  auto it = state->levels.find(quantum);
+  if (it != state->levels.end())
+    return it->second;
+
+  // Levels are sorted by quantum, so the last match is the coarsest.
+  const Level* finer = nullptr;
+  for (const auto& entry : state->levels) {
+    if (entry.first < quantum && quantum % entry.first == 0)
+      finer = entry.second.get();
+  }
+  std::unique_ptr<Level> level =
+      finer ? BuildFromLevel(*finer, quantum)
+            : BuildFromStorage(cpu, quantum, 0,
+                               std::numeric_limits<uint64_t>::max(), true);
+  if (!level)
+    return nullptr;
+
+  if (state->levels.size() >= kMaxLevelsPerCpu)
+    state->levels.erase(state->levels.begin());
+  std::shared_ptr<const Level> shared(level.release());
+  state->levels.emplace(quantum, shared);
+  return shared;
+}
+
+std::shared_ptr<const CpuSummaryCache::Level> CpuSummaryCache::BuildUncached(
+    uint32_t cpu,
+    uint64_t quantum,
+    uint64_t min_ts,
+    uint64_t max_ts) {
+  PERFETTO_CHECK(cpu < base::kMaxCpus && quantum > 0);
+  UpdateCpu(cpu);
+  return std::shared_ptr<const Level>(
+      BuildFromStorage(cpu, quantum, min_ts, max_ts, false).release());
+}
+
+CpuSummaryCache::PerCpu* CpuSummaryCache::UpdateCpu(uint32_t cpu) {
+  PerCpu* state = &cpus_[cpu];
+  TraceStorage::RowCounts counts = storage_->GetVisibleRowCounts();
+  UpdateCpuFreqSeries(counts.counters);
+  size_t slice_count = counts.sched_slices[cpu];
+  const CounterSeries* freqs = cpu_freq_series_[cpu];
+  size_t freq_count = freqs ? freqs->CountSamples(counts.counter_samples) : 0;
+  if (slice_count != state->slice_count || freq_count != state->freq_count) {
+    state->levels.clear();
+    state->slice_count = slice_count;
+    state->freq_count = freq_count;
+  }
+  return state;
+}
+
+void CpuSummaryCache::UpdateCpuFreqSeries(uint32_t counter_count) {
+  // Counters are only appended, unless the storage is reset.
+  if (counter_count < scanned_counters_) {
+    cpu_freq_series_.fill(nullptr);
+    scanned_counters_ = 0;
+  }
+  const TraceStorage::Counters& counters = storage_->counters();
+  for (CounterId id = scanned_counters_; id < counter_count; id++) {
+    const auto& counter = counters.counter(id);
+    if (counter.ref_type == RefType::kCpu && counter.ref >= 0 &&
+        counter.ref < static_cast<int64_t>(base::kMaxCpus) &&
+        storage_->GetString(counter.name_id) == "cpufreq") {
+      cpu_freq_series_[static_cast<size_t>(counter.ref)] = counter.series;
+    }
+  }
+  scanned_counters_ = counter_count;
+}
+
+std::unique_ptr<CpuSummaryCache::Level> CpuSummaryCache::BuildFromStorage(
+    uint32_t cpu,
+    uint64_t quantum,
+    uint64_t min_ts,
+    uint64_t max_ts,
+    bool limit_buckets) {
+  const auto& slices = storage_->SlicesForCpu(cpu);
+  const CounterSeries* freqs = cpu_freq_series_[cpu];
+
+  // Only the rows visible to the current query (see UpdateCpu()) are used.
+  const size_t slice_count = cpus_[cpu].slice_count;
+  const auto freq_count = static_cast<uint32_t>(cpus_[cpu].freq_count);
+
+  // Each cpufreq sample holds until the next one, and the last has no
+  // duration.
+  uint64_t data_start = std::numeric_limits<uint64_t>::max();
+  uint64_t data_end = 0;
+  for (size_t i = 0; i < slice_count; i++) {
+    data_start = std::min(data_start, slices.start_ns()[i]);
+    data_end = std::max(data_end, slices.start_ns()[i] + slices.durations()[i]);
+  }
+  if (freq_count >= 2) {
+    data_start = std::min(data_start, freqs->Begin(freq_count).ts());
+    data_end = std::max(
+        data_end,
+        freqs->Floor(std::numeric_limits<uint64_t>::max(), freq_count).ts());
+  }
+
+  std::unique_ptr<Level> level(new Level());
+  level->quantum = quantum;
+  if (data_start >= data_end)
+    return level;
+
+  // The buckets with data which start in [min_ts, max_ts].
+  uint64_t first_bucket = std::max(
+      data_start / quantum, min_ts / quantum + (min_ts % quantum ? 1 : 0));
+  uint64_t last_bucket = std::min((data_end - 1) / quantum, max_ts / quantum);
+  if (first_bucket > last_bucket)
+    return level;
+  level->first_bucket = first_bucket;
+  uint64_t bucket_count = last_bucket - first_bucket + 1;
+  if (limit_buckets &&
+      bucket_count > std::max(kMinBucketLimit, slice_count + freq_count)) {
+    return nullptr;
+  }
+  ResizeLevel(level.get(), static_cast<size_t>(bucket_count));
+
+  // Events are clipped to the buckets of the level.
+  const uint64_t range_start = first_bucket * quantum;
+  const uint64_t range_end = (last_bucket + 1) * quantum;
+  Level* l = level.get();
+  TopThreadTracker top_threads(l);
+  for (size_t i = 0; i < slice_count; i++) {
+    uint64_t start = slices.start_ns()[i];
+    if (start >= range_end)
+      break;
+    UniqueTid utid = slices.utids()[i];
+    auto add_busy_time = [l, &top_threads, utid](size_t b, uint64_t ns) {
+      l->busy_ns[b] += ns;
+      top_threads.AddThreadTime(b, utid, ns);
+    };
+    ForEachBucket(std::max(start, range_start),
+                  std::min(start + slices.durations()[i], range_end), quantum,
+                  l->first_bucket, add_busy_time);
+  }
+  top_threads.Flush();
+
+  for (auto it = freqs ? freqs->Begin(freq_count) : CounterSeries::Iterator();
+       it.has_next() && it.ts() < range_end; it.Next()) {
+    auto freq = static_cast<uint32_t>(it.value());
+    auto add_freq_time = [l, freq](size_t b, uint64_t ns) {
+      l->freq_ns[b] += ns;
+      l->freq_ns_sum[b] += static_cast<double>(freq) * ns;
+      l->min_freq[b] = std::min(l->min_freq[b], freq);
+      l->max_freq[b] = std::max(l->max_freq[b], freq);
+    };
+    ForEachBucket(std::max(it.ts(), range_start),
+                  std::min(it.next_ts(), range_end), quantum, l->first_bucket,
+                  add_freq_time);
+  }
+  FinalizeMinFreq(l);
+  return level;
+}
+
+std::unique_ptr<CpuSummaryCache::Level> CpuSummaryCache::BuildFromLevel(
+    const Level& finer,
+    uint64_t quantum) {
+  PERFETTO_DCHECK(quantum % finer.quantum == 0);
+  const uint64_t ratio = quantum / finer.quantum;
+
+  std::unique_ptr<Level> level(new Level());
+  level->quantum = quantum;
+  if (finer.bucket_count() == 0)
+    return level;
+
+  level->first_bucket = finer.first_bucket / ratio;
+  uint64_t last_bucket =
+      (finer.first_bucket + finer.bucket_count() - 1) / ratio;
+  ResizeLevel(level.get(),
+              static_cast<size_t>(last_bucket - level->first_bucket + 1));
+
+  TopThreadTracker top_threads(level.get());
+  for (size_t i = 0; i < finer.bucket_count(); i++) {
+    size_t b = static_cast<size_t>((finer.first_bucket + i) / ratio -
+                                   level->first_bucket);
+    level->busy_ns[b] += finer.busy_ns[i];
+    if (finer.top_utid_ns[i])
+      top_threads.AddThreadTime(b, finer.top_utid[i], finer.top_utid_ns[i]);
+    if (finer.freq_ns[i]) {
+      level->freq_ns[b] += finer.freq_ns[i];
+      level->freq_ns_sum[b] += finer.freq_ns_sum[i];
+      level->min_freq[b] = std::min(level->min_freq[b], finer.min_freq[i]);
+      level->max_freq[b] = std::max(level->max_freq[b], finer.max_freq[i]);
+    }
+  }
+  top_threads.Flush();
+  FinalizeMinFreq(level.get());
+  return level;
+}
+
+CpuSummaryCache::TopThreadTracker::TopThreadTracker(Level* level)
+    : level_(level) {}
+
+void CpuSummaryCache::TopThreadTracker::AddThreadTime(size_t bucket,
+                                                      UniqueTid utid,
+                                                      uint64_t ns) {
+  if (!has_bucket_ || bucket != bucket_) {
+    Flush();
+    bucket_ = bucket;
+    has_bucket_ = true;
+  }
+  if (utid >= utid_ns_.size())
+    utid_ns_.resize(utid + 1);
+  if (utid_ns_[utid] == 0)
+    touched_utids_.push_back(utid);
+  utid_ns_[utid] += ns;
+}
+
+void CpuSummaryCache::TopThreadTracker::Flush() {
+  if (!has_bucket_)
+    return;
+  UniqueTid top_utid = 0;
+  uint64_t top_ns = 0;
+  for (UniqueTid utid : touched_utids_) {
+    if (utid_ns_[utid] > top_ns) {
+      top_utid = utid;
+      top_ns = utid_ns_[utid];
+    }
+    utid_ns_[utid] = 0;
+  }
+  touched_utids_.clear();
+  has_bucket_ = false;
+
+  // Slices are sorted by start time, so a bucket is visited again only if a
+  // slice overlaps the previous ones. Keep the best of the partial results.
+  if (top_ns > level_->top_utid_ns[bucket_]) {
+    level_->top_utid[bucket_] = top_utid;
+    level_->top_utid_ns[bucket_] = top_ns;
+  }
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
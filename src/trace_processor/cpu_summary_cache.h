@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_CPU_SUMMARY_CACHE_H_
+#define SRC_TRACE_PROCESSOR_CPU_SUMMARY_CACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "perfetto/base/utils.h"
+#include "src/trace_processor/trace_storage.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// Caches per-CPU summaries of the sched slices and cpufreq values of a trace,
+// at the resolutions (quanta) that are queried. A summary splits time into
+// buckets of |quantum| ns, aligned to multiples of the quantum, so reading a
+// time range costs O(buckets) rather than O(slices).
+//
+// Summaries are built lazily. The first one for a CPU is computed from the
+// raw slices; later ones are aggregated from the coarsest cached summary whose
+// quantum divides theirs (e.g. 100ms from 10ms), like the levels of a mipmap.
+// All the values are exact, except for the dominant thread of summaries
+// aggregated from another summary: it's the thread which was dominant for
+// the longest in the finer buckets.
+//
+// Summaries are dropped as soon as new data for their CPU is added to the
+// storage.
+class CpuSummaryCache {
+ public:
+  // The summary of a CPU at a given quantum. Bucket i covers the time range
+  // [(first_bucket + i) * quantum, (first_bucket + i + 1) * quantum).
+  struct Level {
+    size_t bucket_count() const { return busy_ns.size(); }
+    uint64_t bucket_start(size_t i) const {
+      return (first_bucket + i) * quantum;
+    }
+
+    // Time-weighted average frequency over the part of the bucket with a
+    // known frequency, or 0 if there is none.
+    double avg_freq(size_t i) const {
+      return freq_ns[i] ? freq_ns_sum[i] / freq_ns[i] : 0;
+    }
+
+    uint64_t quantum = 0;
+    uint64_t first_bucket = 0;
+
+    // Time the CPU spent running sched slices in the bucket.
+    std::vector<uint64_t> busy_ns;
+
+    // The thread which ran the most in the bucket (0 if the CPU was idle),
+    // and for how long.
+    std::vector<UniqueTid> top_utid;
+    std::vector<uint64_t> top_utid_ns;
+
+    // Min and max frequency in the bucket, 0 if unknown.
+    std::vector<uint32_t> min_freq;
+    std::vector<uint32_t> max_freq;
+
+    // Time with a known frequency in the bucket, and the sum of frequency *
+    // time over it.
+    std::vector<uint64_t> freq_ns;
+    std::vector<double> freq_ns_sum;
+  };
+
+  // Summaries are not built when they would have more buckets than this or
+  // than the number of events of the CPU, whichever is larger: reading the
+  // raw events would be cheaper.
+  static constexpr size_t kMinBucketLimit = 4096;
+
+  explicit CpuSummaryCache(const TraceStorage*);
+  ~CpuSummaryCache();
+
+  // Returns the summary for |cpu| at |quantum| ns, building it if necessary.
+  // Returns nullptr if |quantum| is too small for this CPU (see
+  // kMinBucketLimit). The returned summary stays valid even if it is later
+  // dropped from the cache.
+  std::shared_ptr<const Level> GetLevel(uint32_t cpu, uint64_t quantum);
+
+  // Builds the summary for |cpu| at |quantum| ns straight from the raw
+  // events, restricted to the buckets starting in [min_ts, max_ts], without
+  // caching it. Unlike GetLevel(), this works for any quantum: it's the
+  // fallback for the ones too small to be cached.
+  std::shared_ptr<const Level> BuildUncached(uint32_t cpu,
+                                             uint64_t quantum,
+                                             uint64_t min_ts,
+                                             uint64_t max_ts);
+
+ private:
+  struct PerCpu {
+    // Rows of the CPU visible to the queries which built the cached levels.
+    size_t slice_count = 0;
+    size_t freq_count = 0;
+
+    // Cached levels, by quantum.
+    std::map<uint64_t, std::shared_ptr<const Level>> levels;
+  };
+
+  // Maximum number of levels cached for each CPU. When exceeded, the finest
+  // level is evicted.
+  static constexpr size_t kMaxLevelsPerCpu = 16;
+
+  // Looks up the cpufreq series among the counters added since the last
+  // call.
+  void UpdateCpuFreqSeries(uint32_t counter_count);
+
+  // Drops the levels of |cpu| if rows were added to it since they were
+  // built, and returns its state.
+  PerCpu* UpdateCpu(uint32_t cpu);
+
+  // Builds the level from the raw events, restricted to the buckets starting
+  // in [min_ts, max_ts]. Returns nullptr if |limit_buckets| is set and the
+  // level would be larger than allowed by kMinBucketLimit.
+  std::unique_ptr<Level> BuildFromStorage(uint32_t cpu,
+                                          uint64_t quantum,
+                                          uint64_t min_ts,
+                                          uint64_t max_ts,
+                                          bool limit_buckets);
+  std::unique_ptr<Level> BuildFromLevel(const Level& finer, uint64_t quantum);
+
+  // Computes the dominant thread of each bucket from the (utid, ns) pairs
+  // passed to AddThreadTime().
+  class TopThreadTracker {
+   public:
+    explicit TopThreadTracker(Level*);
+    void AddThreadTime(size_t bucket, UniqueTid utid, uint64_t ns);
+    void Flush();
+
+   private:
+    Level* const level_;
+    size_t bucket_ = 0;
+    bool has_bucket_ = false;
+    std::vector<uint64_t> utid_ns_;
+    std::vector<UniqueTid> touched_utids_;
+  };
+
+  const TraceStorage* const storage_;
+  std::array<PerCpu, base::kMaxCpus> cpus_;
+
+  // The cpufreq counter of each CPU, among the first |scanned_counters_|.
+  std::array<const CounterSeries*, base::kMaxCpus> cpu_freq_series_{};
+  uint32_t scanned_counters_ = 0;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_CPU_SUMMARY_CACHE_H_
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/cpu_summary_cache.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+using ::testing::ElementsAre;
+using Level = CpuSummaryCache::Level;
+
+class CpuSummaryCacheTest : public ::testing::Test {
+ public:
+  CpuSummaryCacheTest() {
+    // Slices on cpu 0: utid 1 in [5, 25), utid 2 in [25, 28) and [30, 34).
+    storage_.AddSliceToCpu(0, 5, 20, 1, 0, 0);
+    storage_.AddSliceToCpu(0, 25, 3, 2, 0, 0);
+    storage_.AddSliceToCpu(0, 30, 4, 2, 0, 0);
+
+    // Frequency 100 in [0, 15), 200 in [15, 40).
+    storage_.PushCpuFreq(0, 0, 100);
+    storage_.PushCpuFreq(15, 0, 200);
+    storage_.PushCpuFreq(40, 0, 300);
+  }
+
+ protected:
+  TraceStorage storage_;
+};
+
+TEST_F(CpuSummaryCacheTest, BuildFromStorage) {
+  CpuSummaryCache cache(&storage_);
+  auto level = cache.GetLevel(0, 10);
+  ASSERT_TRUE(level);
+  ASSERT_EQ(level->first_bucket, 0u);
+  ASSERT_THAT(level->busy_ns, ElementsAre(5, 10, 8, 4));
+  ASSERT_THAT(level->top_utid, ElementsAre(1, 1, 1, 2));
+  ASSERT_THAT(level->min_freq, ElementsAre(100, 100, 200, 200));
+  ASSERT_THAT(level->max_freq, ElementsAre(100, 200, 200, 200));
+  ASSERT_DOUBLE_EQ(level->avg_freq(1), 150);
+  ASSERT_DOUBLE_EQ(level->avg_freq(3), 200);
+
+  // Empty CPUs have no buckets.
+  level = cache.GetLevel(1, 10);
+  ASSERT_TRUE(level);
+  ASSERT_EQ(level->bucket_count(), 0u);
+}
+
+TEST_F(CpuSummaryCacheTest, CoarserLevelsMatchStorage) {
+  CpuSummaryCache cache(&storage_);
+  ASSERT_TRUE(cache.GetLevel(0, 5));
+  for (uint64_t quantum : {10u, 15u, 20u, 30u}) {
+    auto derived = cache.GetLevel(0, quantum);
+    auto expected = CpuSummaryCache(&storage_).GetLevel(0, quantum);
+    ASSERT_EQ(derived->first_bucket, expected->first_bucket);
+    ASSERT_EQ(derived->busy_ns, expected->busy_ns) << quantum;
+    ASSERT_EQ(derived->min_freq, expected->min_freq) << quantum;
+    ASSERT_EQ(derived->max_freq, expected->max_freq) << quantum;
+    ASSERT_EQ(derived->freq_ns, expected->freq_ns) << quantum;
+    ASSERT_EQ(derived->freq_ns_sum, expected->freq_ns_sum) << quantum;
+  }
+}
+
+TEST_F(CpuSummaryCacheTest, InvalidatedByNewData) {
+  CpuSummaryCache cache(&storage_);
+  auto before = cache.GetLevel(0, 10);
+  storage_.AddSliceToCpu(0, 40, 10, 3, 0, 0);
+  auto after = cache.GetLevel(0, 10);
+  ASSERT_THAT(before->busy_ns, ElementsAre(5, 10, 8, 4));
+  ASSERT_THAT(after->busy_ns, ElementsAre(5, 10, 8, 4, 10));
+  ASSERT_EQ(after->top_utid[4], 3u);
+}
+
+TEST_F(CpuSummaryCacheTest, QuantumTooSmall) {
+  storage_.AddSliceToCpu(0, 1000000000, 1, 3, 0, 0);
+  CpuSummaryCache cache(&storage_);
+  ASSERT_FALSE(cache.GetLevel(0, 1));
+  ASSERT_TRUE(cache.GetLevel(0, 1000000));
+
+  // Uncached levels are built for any quantum, over the requested range.
+  auto level = cache.BuildUncached(0, 1, 22, 27);
+  ASSERT_TRUE(level);
+  ASSERT_EQ(level->first_bucket, 22u);
+  ASSERT_THAT(level->busy_ns, ElementsAre(1, 1, 1, 1, 1, 1));
+  ASSERT_THAT(level->top_utid, ElementsAre(1, 1, 1, 2, 2, 2));
+  ASSERT_THAT(level->min_freq, ElementsAre(200, 200, 200, 200, 200, 200));
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,222 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/cpu_summary_table.h"
+
+#include <bitset>
+#include <limits>
+
+#include "perfetto/base/logging.h"
+#include "src/trace_processor/sqlite_utils.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+namespace {
+
+using namespace sqlite_utils;
+
+}  // namespace
+
+CpuSummaryTable::CpuSummaryTable(const TraceStorage* storage)
+    : cache_(new CpuSummaryCache(storage)) {}
+
+void CpuSummaryTable::RegisterTable(sqlite3* db, const TraceStorage* storage) {
+  Table::Register<CpuSummaryTable>(db, storage,
+                                   "CREATE TABLE cpu_summary("
+                                   "ts UNSIGNED BIG INT, "
+                                   "cpu UNSIGNED INT, "
+                                   "busy_dur UNSIGNED BIG INT, "
+                                   "utid UNSIGNED INT, "
+                                   "min_freq UNSIGNED INT, "
+                                   "max_freq UNSIGNED INT, "
+                                   "avg_freq DOUBLE, "
+                                   "quantum HIDDEN BIG INT, "
+                                   "PRIMARY KEY(cpu, ts)"
+                                   ") WITHOUT ROWID;");
+}
+
+std::unique_ptr<Table::Cursor> CpuSummaryTable::CreateCursor() {
+  return std::unique_ptr<Table::Cursor>(new Cursor(cache_.get()));
+}
+
+int CpuSummaryTable::BestIndex(const QueryConstraints& qc,
+                               BestIndexInfo* info) {
+  bool has_quantum = false;
+  bool has_cpu_eq = false;
+  for (size_t i = 0; i < qc.constraints().size(); i++) {
+    const auto& cs = qc.constraints()[i];
+    if (cs.iColumn == Column::kQuantum) {
+      if (!IsOpEq(cs.op))
+        return SQLITE_CONSTRAINT_FUNCTION;
+      has_quantum = true;
+      info->omit[i] = true;
+    }
+    if (cs.iColumn == Column::kCpu && IsOpEq(cs.op))
+      has_cpu_eq = true;
+  }
+
+  // Without a quantum, Filter() fails: make sure SQLite prefers any plan
+  // which passes one.
+  info->estimated_cost = has_quantum ? 10 : 1000000;
+
+  // Rows are sorted by (cpu, ts).
+  const auto& order_by = qc.order_by();
+  bool cpu_ts_order =
+      order_by.size() <= 2 &&
+      (order_by.size() < 1 ||
+       (order_by[0].iColumn == Column::kCpu && !order_by[0].desc)) &&
+      (order_by.size() < 2 ||
+       (order_by[1].iColumn == Column::kTimestamp && !order_by[1].desc));
+  bool ts_order = order_by.size() == 1 &&
+                  order_by[0].iColumn == Column::kTimestamp &&
+                  !order_by[0].desc && has_cpu_eq;
+  info->order_by_consumed = cpu_ts_order || ts_order;
+  return SQLITE_OK;
+}
+
+CpuSummaryTable::Cursor::Cursor(CpuSummaryCache* cache) : cache_(cache) {}
+
+int CpuSummaryTable::Cursor::Filter(const QueryConstraints& qc,
+                                    sqlite3_value** argv) {
+  std::bitset<base::kMaxCpus> cpu_filter;
+  cpu_filter.set();
+  uint64_t quantum = 0;
+  uint64_t min_ts = 0;
+  uint64_t max_ts = std::numeric_limits<uint64_t>::max();
+  for (size_t i = 0; i < qc.constraints().size(); i++) {
+    const auto& cs = qc.constraints()[i];
+    switch (cs.iColumn) {
+      case Column::kCpu:
+        PopulateFilterBitmap(cs.op, argv[i], &cpu_filter);
+        break;
+      case Column::kQuantum:
+        quantum = static_cast<uint64_t>(sqlite3_value_int64(argv[i]));
+        break;
+      case Column::kTimestamp: {
+        // These only narrow down the buckets to scan: SQLite checks the
+        // constraints again on each row.
+        auto ts = static_cast<uint64_t>(sqlite3_value_int64(argv[i]));
+        if (IsOpGe(cs.op) || IsOpGt(cs.op)) {
+          min_ts = std::max(min_ts, ts);
+        } else if (IsOpLe(cs.op) || IsOpLt(cs.op)) {
+          max_ts = std::min(max_ts, ts);
+        }
+        break;
+      }
+    }
+  }
+
+  if (quantum == 0) {
+    sqlite3_free(pVtab->zErrMsg);
+    pVtab->zErrMsg = sqlite3_mprintf("cpu_summary requires quantum > 0");
+    return SQLITE_ERROR;
+  }
+
+  ranges_.clear();
+  for (uint32_t cpu = 0; cpu < base::kMaxCpus; cpu++) {
+    if (!cpu_filter.test(cpu))
+      continue;
+    // Quanta too small to be cached are summarized from the raw events, for
+    // the requested time range only.
+    auto level = cache_->GetLevel(cpu, quantum);
+    if (!level)
+      level = cache_->BuildUncached(cpu, quantum, min_ts, max_ts);
+
+    // Restrict the range to the buckets starting in [min_ts, max_ts].
+    uint64_t first = level->first_bucket;
+    uint64_t min_bucket = min_ts / quantum + (min_ts % quantum ? 1 : 0);
+    uint64_t max_bucket = max_ts / quantum;
+    size_t count = level->bucket_count();
+    size_t begin = min_bucket > first
+                       ? static_cast<size_t>(std::min<uint64_t>(
+                             min_bucket - first, count))
+                       : 0;
+    size_t end = max_bucket >= first
+                     ? static_cast<size_t>(std::min<uint64_t>(
+                           max_bucket - first + 1, count))
+                     : 0;
+    if (begin < end)
+      ranges_.emplace_back(CpuRange{cpu, std::move(level), begin, end});
+  }
+
+  range_idx_ = 0;
+  bucket_ = ranges_.empty() ? 0 : ranges_[0].begin;
+  SkipEmptyBuckets();
+  return SQLITE_OK;
+}
+
+int CpuSummaryTable::Cursor::Next() {
+  bucket_++;
+  SkipEmptyBuckets();
+  return SQLITE_OK;
+}
+
+void CpuSummaryTable::Cursor::SkipEmptyBuckets() {
+  while (range_idx_ < ranges_.size()) {
+    const CpuRange& range = ranges_[range_idx_];
+    for (; bucket_ < range.end; bucket_++) {
+      if (range.level->busy_ns[bucket_] || range.level->freq_ns[bucket_])
+        return;
+    }
+    if (++range_idx_ < ranges_.size())
+      bucket_ = ranges_[range_idx_].begin;
+  }
+}
+
+int CpuSummaryTable::Cursor::Eof() {
+  return range_idx_ >= ranges_.size();
+}
+
+int CpuSummaryTable::Cursor::Column(sqlite3_context* context, int N) {
+  const CpuRange& range = ranges_[range_idx_];
+  const CpuSummaryCache::Level& level = *range.level;
+  switch (N) {
+    case Column::kTimestamp:
+      sqlite3_result_int64(
+          context, static_cast<sqlite3_int64>(level.bucket_start(bucket_)));
+      break;
+    case Column::kCpu:
+      sqlite3_result_int(context, static_cast<int>(range.cpu));
+      break;
+    case Column::kBusyDuration:
+      sqlite3_result_int64(context,
+                           static_cast<sqlite3_int64>(level.busy_ns[bucket_]));
+      break;
+    case Column::kUtid:
+      sqlite3_result_int64(context, level.top_utid[bucket_]);
+      break;
+    case Column::kMinFreq:
+      sqlite3_result_int64(context, level.min_freq[bucket_]);
+      break;
+    case Column::kMaxFreq:
+      sqlite3_result_int64(context, level.max_freq[bucket_]);
+      break;
+    case Column::kAvgFreq:
+      sqlite3_result_double(context, level.avg_freq(bucket_));
+      break;
+    case Column::kQuantum:
+      sqlite3_result_int64(context, static_cast<sqlite3_int64>(level.quantum));
+      break;
+    default:
+      PERFETTO_FATAL("Unknown column %d", N);
+      break;
+  }
+  return SQLITE_OK;
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_CPU_SUMMARY_TABLE_H_
+#define SRC_TRACE_PROCESSOR_CPU_SUMMARY_TABLE_H_
+
+#include <sqlite3.h>
+
+#include <memory>
+#include <vector>
+
+#include "src/trace_processor/cpu_summary_cache.h"
+#include "src/trace_processor/table.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// A summary of the activity of each CPU, bucketed by time. Queries must
+// specify the size of the buckets with the hidden |quantum| column:
+//   SELECT ts, busy_dur, utid FROM cpu_summary WHERE quantum = 1000000
+// Each row is a bucket of |quantum| ns starting at |ts| (a multiple of the
+// quantum) in which the CPU was busy or had a known frequency. Unlike the
+// quantized sched table, which returns one row for each slice in each bucket,
+// this table returns one row per bucket, from summaries cached by
+// CpuSummaryCache.
+class CpuSummaryTable : public Table {
+ public:
+  enum Column {
+    kTimestamp = 0,
+    kCpu = 1,
+    kBusyDuration = 2,
+    kUtid = 3,
+    kMinFreq = 4,
+    kMaxFreq = 5,
+    kAvgFreq = 6,
+
+    // Hidden columns.
+    kQuantum = 7,
+  };
+
+  static void RegisterTable(sqlite3* db, const TraceStorage* storage);
+
+  CpuSummaryTable(const TraceStorage*);
+
+  // Table implementation.
+  std::unique_ptr<Table::Cursor> CreateCursor() override;
+  int BestIndex(const QueryConstraints&, BestIndexInfo*) override;
+
+ private:
+  class Cursor : public Table::Cursor {
+   public:
+    Cursor(CpuSummaryCache*);
+
+    // Implementation of Table::Cursor.
+    int Filter(const QueryConstraints&, sqlite3_value**) override;
+    int Next() override;
+    int Eof() override;
+    int Column(sqlite3_context*, int N) override;
+
+   private:
+    // The range of buckets returned for a CPU.
+    struct CpuRange {
+      uint32_t cpu;
+      std::shared_ptr<const CpuSummaryCache::Level> level;
+      size_t begin;
+      size_t end;
+    };
+
+    // Moves to the first non-empty bucket at or after the current one.
+    void SkipEmptyBuckets();
+
+    std::vector<CpuRange> ranges_;
+    size_t range_idx_ = 0;
+    size_t bucket_ = 0;
+
+    CpuSummaryCache* const cache_;
+  };
+
+  std::unique_ptr<CpuSummaryCache> cache_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_CPU_SUMMARY_TABLE_H_
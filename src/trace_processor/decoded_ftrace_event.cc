@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/decoded_ftrace_event.h"
+
+#include "perfetto/base/logging.h"
+#include "perfetto/protozero/proto_decoder.h"
+
+#include "perfetto/trace/trace_packet.pb.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+using protozero::ProtoDecoder;
+
+namespace {
+
+DecodedFtraceEvent::SchedSwitch DecodeSchedSwitch(const uint8_t* data,
+                                                  size_t size) {
+  ProtoDecoder decoder(data, size);
+  DecodedFtraceEvent::SchedSwitch sswitch{};
+  base::StringView prev_comm;
+  for (auto fld = decoder.ReadField(); fld.id != 0; fld = decoder.ReadField()) {
+    switch (fld.id) {
+      case protos::SchedSwitchFtraceEvent::kPrevPidFieldNumber:
+        sswitch.prev_pid = fld.as_uint32();
+        break;
+      case protos::SchedSwitchFtraceEvent::kPrevStateFieldNumber:
+        sswitch.prev_state = fld.as_uint32();
+        break;
+      case protos::SchedSwitchFtraceEvent::kPrevCommFieldNumber:
+        prev_comm = fld.as_string();
+        break;
+      case protos::SchedSwitchFtraceEvent::kNextPidFieldNumber:
+        sswitch.next_pid = fld.as_uint32();
+        break;
+      default:
+        break;
+    }
+  }
+  PERFETTO_DCHECK(decoder.IsEndOfBuffer());
+  sswitch.prev_comm_data = prev_comm.data();
+  sswitch.prev_comm_size = static_cast<uint32_t>(prev_comm.size());
+  return sswitch;
+}
+
+DecodedFtraceEvent::CpuFrequency DecodeCpuFrequency(const uint8_t* data,
+                                                    size_t size) {
+  ProtoDecoder decoder(data, size);
+  DecodedFtraceEvent::CpuFrequency freq{};
+  for (auto fld = decoder.ReadField(); fld.id != 0; fld = decoder.ReadField()) {
+    switch (fld.id) {
+      case protos::CpuFrequencyFtraceEvent::kCpuIdFieldNumber:
+        freq.cpu_id = fld.as_uint32();
+        break;
+      case protos::CpuFrequencyFtraceEvent::kStateFieldNumber:
+        freq.state = fld.as_uint32();
+        break;
+    }
+  }
+  PERFETTO_DCHECK(decoder.IsEndOfBuffer());
+  return freq;
+}
+
+DecodedFtraceEvent::SchedProcessFree DecodeSchedProcessFree(
+    const uint8_t* data,
+    size_t size) {
+  ProtoDecoder decoder(data, size);
+  DecodedFtraceEvent::SchedProcessFree free{};
+  for (auto fld = decoder.ReadField(); fld.id != 0; fld = decoder.ReadField()) {
+    if (fld.id == protos::SchedProcessFreeFtraceEvent::kPidFieldNumber)
+      free.pid = fld.as_uint32();
+  }
+  PERFETTO_DCHECK(decoder.IsEndOfBuffer());
+  return free;
+}
+
+}  // namespace
+
+// static
+DecodedFtraceEvent DecodedFtraceEvent::Decode(uint32_t field_id,
+                                              const uint8_t* data,
+                                              size_t size) {
+  DecodedFtraceEvent event;
+  switch (field_id) {
+    case protos::FtraceEvent::kSchedSwitchFieldNumber:
+      event.type = Type::kSchedSwitch;
+      event.sched_switch = DecodeSchedSwitch(data, size);
+      break;
+    case protos::FtraceEvent::kCpuFrequencyFieldNumber:
+      event.type = Type::kCpuFrequency;
+      event.cpu_frequency = DecodeCpuFrequency(data, size);
+      break;
+    case protos::FtraceEvent::kSchedProcessFreeFieldNumber:
+      event.type = Type::kSchedProcessFree;
+      event.sched_process_free = DecodeSchedProcessFree(data, size);
+      break;
+    default:
+      break;
+  }
+  return event;
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_DECODED_FTRACE_EVENT_H_
+#define SRC_TRACE_PROCESSOR_DECODED_FTRACE_EVENT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "perfetto/base/string_view.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// The payload of an FtraceEvent which the parser stores, decoded by the
+// tokenizer (on a worker thread when there is a WorkerPool) so that the
+// parser only has to apply it to the trackers and the storage.
+//
+// This is a plain struct which travels through the TraceSorter with the
+// TraceBlobView of the event. The strings point into the bytes of the
+// event, which that TraceBlobView keeps alive.
+struct DecodedFtraceEvent {
+  enum class Type : uint8_t {
+    // An event the parser ignores, or none was decoded.
+    kOther = 0,
+    kSchedSwitch,
+    kCpuFrequency,
+    kSchedProcessFree,
+  };
+
+  struct SchedSwitch {
+    base::StringView prev_comm() const {
+      return base::StringView(prev_comm_data, prev_comm_size);
+    }
+
+    uint32_t prev_pid;
+    uint32_t prev_state;
+    uint32_t next_pid;
+    uint32_t prev_comm_size;
+    const char* prev_comm_data;
+  };
+
+  struct CpuFrequency {
+    uint32_t cpu_id;
+    uint32_t state;
+  };
+
+  struct SchedProcessFree {
+    uint32_t pid;
+  };
+
+  // Decodes the payload of an FtraceEvent, i.e. its field with the given id.
+  // Returns an event of type kOther if the parser doesn't store events of
+  // that type.
+  static DecodedFtraceEvent Decode(uint32_t field_id,
+                                   const uint8_t* data,
+                                   size_t size);
+
+  DecodedFtraceEvent() : type(Type::kOther) {}
+
+  Type type;
+  // Only the member matching |type| is valid.
+  union {
+    SchedSwitch sched_switch;
+    CpuFrequency cpu_frequency;
+    SchedProcessFree sched_process_free;
+  };
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_DECODED_FTRACE_EVENT_H_
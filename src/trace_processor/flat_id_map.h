@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_FLAT_ID_MAP_H_
+#define SRC_TRACE_PROCESSOR_FLAT_ID_MAP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "perfetto/base/logging.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// Maps 32 bit ids (e.g. tids and pids) to 32 bit values (e.g. utids and
+// upids), with 0 standing for "no value". Entries are stored inline in a
+// single open addressing table with linear probing, so a lookup touches one
+// or two cache lines and never allocates. Entries are never removed: setting
+// the value of an id to 0 just marks it as unused.
+// The id 0xffffffff marks empty slots in the table: as real traces contain
+// pid and tid -1, its value is kept aside, out of the table.
+class FlatIdMap {
+ public:
+  static constexpr uint32_t kEmptyId = 0xffffffff;
+
+  FlatIdMap() : entries_(kInitialCapacity) {}
+
+  // Returns the value of |id|, or 0 if not set.
+  inline uint32_t Get(uint32_t id) const {
+    if (PERFETTO_UNLIKELY(id == kEmptyId))
+      return empty_id_value_;
+    for (size_t i = Hash(id);; i = (i + 1) & mask()) {
+      const Entry& entry = entries_[i];
+      if (entry.id == id)
+        return entry.value;
+      if (entry.id == kEmptyId)
+        return 0;
+    }
+  }
+
+  inline void Set(uint32_t id, uint32_t value) {
+    if (PERFETTO_UNLIKELY(id == kEmptyId)) {
+      has_empty_id_ = true;
+      empty_id_value_ = value;
+      return;
+    }
+    for (size_t i = Hash(id);; i = (i + 1) & mask()) {
+      Entry& entry = entries_[i];
+      if (entry.id == id) {
+        entry.value = value;
+        return;
+      }
+      if (entry.id == kEmptyId) {
+        entry.id = id;
+        entry.value = value;
+        // Keep the load factor below 1/2, so that probe sequences stay short.
+        if (++size_ * 2 > entries_.size())
+          Grow();
+        return;
+      }
+    }
+  }
+
+  // Number of ids ever set, including the ones whose value is now 0.
+  size_t size() const { return size_ + (has_empty_id_ ? 1 : 0); }
+
+  size_t memory_usage_bytes() const { return entries_.size() * sizeof(Entry); }
+
+ private:
+  static constexpr uint32_t kInitialShift = 64 - 10;
+  static constexpr size_t kInitialCapacity = 1 << (64 - kInitialShift);
+
+  struct Entry {
+    uint32_t id = kEmptyId;
+    uint32_t value = 0;
+  };
+
+  size_t mask() const { return entries_.size() - 1; }
+
+  // Fibonacci hashing: ids are often sequential, the multiplication spreads
+  // them across the table, whose index is taken from the top bits.
+  inline size_t Hash(uint32_t id) const {
+    return static_cast<size_t>((id * 0x9E3779B97F4A7C15ULL) >> shift_);
+  }
+
+  void Grow() {
+    std::vector<Entry> old(entries_.size() * 2);
+    old.swap(entries_);
+    shift_--;
+    size_ = 0;
+    for (const Entry& entry : old) {
+      if (entry.id != kEmptyId)
+        Set(entry.id, entry.value);
+    }
+  }
+
+  std::vector<Entry> entries_;
+  uint32_t shift_ = kInitialShift;
+  size_t size_ = 0;  // Entries in |entries_|.
+
+  // The value of kEmptyId, which can't be stored in |entries_|.
+  bool has_empty_id_ = false;
+  uint32_t empty_id_value_ = 0;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_FLAT_ID_MAP_H_
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/flat_id_map.h"
+
+#include <random>
+#include <unordered_map>
+
+#include "gtest/gtest.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+TEST(FlatIdMapTest, GetAndSet) {
+  FlatIdMap map;
+  ASSERT_EQ(map.Get(0), 0u);
+  map.Set(0, 10);
+  map.Set(42, 20);
+  ASSERT_EQ(map.Get(0), 10u);
+  ASSERT_EQ(map.Get(42), 20u);
+  ASSERT_EQ(map.Get(1), 0u);
+  ASSERT_EQ(map.size(), 2u);
+
+  // Ids are never removed, just cleared.
+  map.Set(42, 0);
+  ASSERT_EQ(map.Get(42), 0u);
+  ASSERT_EQ(map.size(), 2u);
+  map.Set(42, 30);
+  ASSERT_EQ(map.Get(42), 30u);
+  ASSERT_EQ(map.size(), 2u);
+}
+
+TEST(FlatIdMapTest, ReservedId) {
+  // pid/tid -1, which is also the marker of the empty slots.
+  const uint32_t kMinusOne = static_cast<uint32_t>(-1);
+  FlatIdMap map;
+  ASSERT_EQ(map.Get(kMinusOne), 0u);
+  map.Set(kMinusOne, 5);
+  ASSERT_EQ(map.Get(kMinusOne), 5u);
+  ASSERT_EQ(map.size(), 1u);
+
+  // Other ids, enough to grow the table, don't see or overwrite it.
+  for (uint32_t id = 0; id < 10000; id++) {
+    ASSERT_EQ(map.Get(id), 0u);
+    map.Set(id, id + 1);
+  }
+  ASSERT_EQ(map.Get(kMinusOne), 5u);
+  ASSERT_EQ(map.Get(10000), 0u);
+  ASSERT_EQ(map.size(), 10001u);
+}
+
+TEST(FlatIdMapTest, MatchesUnorderedMap) {
+  FlatIdMap map;
+  std::unordered_map<uint32_t, uint32_t> expected;
+  std::minstd_rand0 rnd(0);
+  for (uint32_t i = 0; i < 100000; i++) {
+    // Mix sequential ids, as pids usually are, and sparse ones.
+    uint32_t id = i % 2 ? i : static_cast<uint32_t>(rnd() % 4000000);
+    map.Set(id, i + 1);
+    expected[id] = i + 1;
+  }
+  ASSERT_EQ(map.size(), expected.size());
+  for (const auto& kv : expected)
+    ASSERT_EQ(map.Get(kv.first), kv.second);
+  ASSERT_EQ(map.Get(4000001), 0u);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,485 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/json_tokenizer.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "perfetto/base/logging.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace json {
+
+namespace {
+
+constexpr uint64_t kOnes = 0x0101010101010101ULL;
+constexpr uint64_t kHighBits = 0x8080808080808080ULL;
+
+// Returns non-zero if any of the bytes of |word| is |c|.
+inline uint64_t HasByte(uint64_t word, char c) {
+  uint64_t x = word ^ (kOnes * static_cast<uint8_t>(c));
+  return (x - kOnes) & ~x & kHighBits;
+}
+
+inline bool IsBracketOrQuote(char c) {
+  return c == '"' || c == '{' || c == '}' || c == '[' || c == ']';
+}
+
+inline bool IsWhitespace(char c) {
+  return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+// Returns the first bracket or quote in [p, end), or |end|. Words of eight
+// bytes without any are skipped with a handful of ALU operations.
+inline const char* FindBracketOrQuote(const char* p, const char* end) {
+  while (end - p >= 8) {
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    if (HasByte(word, '"') | HasByte(word, '{') | HasByte(word, '}') |
+        HasByte(word, '[') | HasByte(word, ']')) {
+      break;
+    }
+    p += 8;
+  }
+  while (p < end && !IsBracketOrQuote(*p))
+    p++;
+  return p;
+}
+
+void AppendUtf8(uint32_t code_point, std::string* out) {
+  if (code_point < 0x80) {
+    out->push_back(static_cast<char>(code_point));
+  } else if (code_point < 0x800) {
+    out->push_back(static_cast<char>(0xC0 | (code_point >> 6)));
+    out->push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+  } else if (code_point < 0x10000) {
+    out->push_back(static_cast<char>(0xE0 | (code_point >> 12)));
+    out->push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+    out->push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+  } else {
+    out->push_back(static_cast<char>(0xF0 | (code_point >> 18)));
+    out->push_back(static_cast<char>(0x80 | ((code_point >> 12) & 0x3F)));
+    out->push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+    out->push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+  }
+}
+
+bool ParseHex4(const char* p, uint32_t* value) {
+  *value = 0;
+  for (int i = 0; i < 4; i++) {
+    char c = p[i];
+    uint32_t digit;
+    if (c >= '0' && c <= '9') {
+      digit = static_cast<uint32_t>(c - '0');
+    } else if (c >= 'a' && c <= 'f') {
+      digit = static_cast<uint32_t>(c - 'a' + 10);
+    } else if (c >= 'A' && c <= 'F') {
+      digit = static_cast<uint32_t>(c - 'A' + 10);
+    } else {
+      return false;
+    }
+    *value = (*value << 4) | digit;
+  }
+  return true;
+}
+
+// Decodes the escape sequences of the body of a JSON string.
+bool Unescape(base::StringView raw, std::string* out) {
+  out->clear();
+  const char* p = raw.data();
+  const char* end = p + raw.size();
+  while (p < end) {
+    const char* backslash =
+        static_cast<const char*>(memchr(p, '\\', static_cast<size_t>(end - p)));
+    if (!backslash) {
+      out->append(p, static_cast<size_t>(end - p));
+      break;
+    }
+    out->append(p, static_cast<size_t>(backslash - p));
+    p = backslash + 1;
+    if (p == end)
+      return false;
+    switch (*p++) {
+      case '"':
+        out->push_back('"');
+        break;
+      case '\\':
+        out->push_back('\\');
+        break;
+      case '/':
+        out->push_back('/');
+        break;
+      case 'b':
+        out->push_back('\b');
+        break;
+      case 'f':
+        out->push_back('\f');
+        break;
+      case 'n':
+        out->push_back('\n');
+        break;
+      case 'r':
+        out->push_back('\r');
+        break;
+      case 't':
+        out->push_back('\t');
+        break;
+      case 'u': {
+        uint32_t code_point;
+        if (end - p < 4 || !ParseHex4(p, &code_point))
+          return false;
+        p += 4;
+        // Combine UTF-16 surrogate pairs.
+        uint32_t low;
+        if (code_point >= 0xD800 && code_point < 0xDC00 && end - p >= 6 &&
+            p[0] == '\\' && p[1] == 'u' && ParseHex4(p + 2, &low) &&
+            low >= 0xDC00 && low < 0xE000) {
+          code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+          p += 6;
+        }
+        AppendUtf8(code_point, out);
+        break;
+      }
+      default:
+        return false;
+    }
+  }
+  return true;
+}
+
+bool ParseInt(base::StringView str, int64_t* value) {
+  const char* p = str.data();
+  const char* end = p + str.size();
+  bool negative = p < end && *p == '-';
+  if (negative)
+    p++;
+  if (p == end)
+    return false;
+  int64_t result = 0;
+  for (; p < end && *p >= '0' && *p <= '9'; p++)
+    result = result * 10 + (*p - '0');
+  // Tolerate a fractional part (e.g. "tid": 12.0) by truncating it.
+  if (p < end && *p != '.' && *p != 'e' && *p != 'E')
+    return false;
+  *value = negative ? -result : result;
+  return true;
+}
+
+// Reads JSON values from a buffer. All the methods return kNeedsMoreData if
+// the value is truncated by the end of the buffer.
+class Scanner {
+ public:
+  Scanner(const char* p, const char* end) : p_(p), end_(end) {}
+
+  const char* pos() const { return p_; }
+
+  // Skips whitespace and returns the next character, or '\0' at the end.
+  char Peek() {
+    while (p_ < end_ && IsWhitespace(*p_))
+      p_++;
+    return p_ < end_ ? *p_ : '\0';
+  }
+
+  void Advance() { p_++; }
+
+  // Reads the string starting at the current (quote) character. |raw| is set
+  // to the body of the string, which needs unescaping if |escaped| is set.
+  ReadDictRes ReadString(base::StringView* raw, bool* escaped) {
+    PERFETTO_DCHECK(*p_ == '"');
+    const char* body = p_ + 1;
+    const char* s = body;
+    for (;;) {
+      const char* quote = static_cast<const char*>(
+          memchr(s, '"', static_cast<size_t>(end_ - s)));
+      if (!quote)
+        return kNeedsMoreData;
+      // The quote is escaped if preceded by an odd number of backslashes.
+      const char* b = quote;
+      while (b > body && b[-1] == '\\')
+        b--;
+      if ((quote - b) % 2 == 0) {
+        size_t size = static_cast<size_t>(quote - body);
+        *raw = base::StringView(body, size);
+        *escaped = memchr(body, '\\', size) != nullptr;
+        p_ = quote + 1;
+        return kFoundDict;
+      }
+      s = quote + 1;
+    }
+  }
+
+  // Reads the string at the current character into |value|, unescaping it
+  // into |storage| if necessary. Other types of values are skipped.
+  ReadDictRes ReadStringValue(base::StringView* value, std::string* storage) {
+    if (Peek() != '"')
+      return SkipValue();
+    bool escaped;
+    base::StringView raw;
+    ReadDictRes res = ReadString(&raw, &escaped);
+    if (res != kFoundDict)
+      return res;
+    // Keys whose values are expected to be plain identifiers (e.g. "ph")
+    // have no |storage|.
+    if (!escaped || !storage) {
+      *value = raw;
+      return kFoundDict;
+    }
+    if (!Unescape(raw, storage))
+      return kFatalError;
+    *value = base::StringView(*storage);
+    return kFoundDict;
+  }
+
+  // Reads a number (or any other scalar token: true, false, null).
+  ReadDictRes ReadScalar(base::StringView* token) {
+    const char* start = p_;
+    while (p_ < end_ && *p_ != ',' && *p_ != '}' && *p_ != ']' &&
+           !IsWhitespace(*p_)) {
+      p_++;
+    }
+    if (p_ == end_)
+      return kNeedsMoreData;
+    *token = base::StringView(start, static_cast<size_t>(p_ - start));
+    return kFoundDict;
+  }
+
+  // Skips the value at the current character, of any type.
+  ReadDictRes SkipValue() {
+    char c = Peek();
+    if (c == '\0')
+      return kNeedsMoreData;
+    if (c == '"') {
+      base::StringView raw;
+      bool escaped;
+      return ReadString(&raw, &escaped);
+    }
+    if (c != '{' && c != '[') {
+      base::StringView token;
+      return ReadScalar(&token);
+    }
+
+    // Only brackets and strings (which can contain brackets) matter when
+    // skipping a nested value.
+    int depth = 0;
+    for (;;) {
+      p_ = FindBracketOrQuote(p_, end_);
+      if (p_ == end_)
+        return kNeedsMoreData;
+      switch (*p_) {
+        case '"': {
+          base::StringView raw;
+          bool escaped;
+          ReadDictRes res = ReadString(&raw, &escaped);
+          if (res != kFoundDict)
+            return res;
+          continue;
+        }
+        case '{':
+        case '[':
+          depth++;
+          break;
+        default:
+          if (--depth == 0) {
+            p_++;
+            return kFoundDict;
+          }
+      }
+      p_++;
+    }
+  }
+
+ private:
+  const char* p_;
+  const char* const end_;
+};
+
+// Calls |fn|(key, scanner) for each key of the dictionary at the current
+// character of |scanner|. |fn| must consume the value.
+template <typename Fn>
+ReadDictRes ForEachKey(Scanner* scanner, Fn fn) {
+  if (scanner->Peek() != '{')
+    return kFatalError;
+  scanner->Advance();
+  for (;;) {
+    char c = scanner->Peek();
+    if (c == '\0')
+      return kNeedsMoreData;
+    if (c == '}') {
+      scanner->Advance();
+      return kFoundDict;
+    }
+    if (c == ',') {
+      scanner->Advance();
+      continue;
+    }
+    if (c != '"')
+      return kFatalError;
+    base::StringView key;
+    bool escaped;
+    ReadDictRes res = scanner->ReadString(&key, &escaped);
+    if (res != kFoundDict)
+      return res;
+    c = scanner->Peek();
+    if (c == '\0')
+      return kNeedsMoreData;
+    if (c != ':')
+      return kFatalError;
+    scanner->Advance();
+    if (scanner->Peek() == '\0')
+      return kNeedsMoreData;
+    res = fn(key, scanner);
+    if (res != kFoundDict)
+      return res;
+  }
+}
+
+ReadDictRes ReadUint32(Scanner* scanner, uint32_t* value) {
+  base::StringView token;
+  ReadDictRes res = scanner->ReadScalar(&token);
+  int64_t int_value;
+  if (res == kFoundDict && ParseInt(token, &int_value))
+    *value = static_cast<uint32_t>(int_value);
+  return res;
+}
+
+ReadDictRes ReadMicros(Scanner* scanner, uint64_t* ns, bool* present) {
+  base::StringView token;
+  ReadDictRes res = scanner->ReadScalar(&token);
+  if (res == kFoundDict && ParseMicrosToNanos(token, ns) && present)
+    *present = true;
+  return res;
+}
+
+}  // namespace
+
+void TraceEvent::Clear() {
+  ph = cat = name = args_name = base::StringView();
+  has_ts = false;
+  ts_ns = dur_ns = 0;
+  pid = tid = 0;
+}
+
+ReadDictRes ReadOneJsonDict(const char* start,
+                            const char* end,
+                            TraceEvent* event,
+                            const char** next) {
+  const char* p = start;
+  while (p < end && (IsWhitespace(*p) || *p == ','))
+    p++;
+  if (p == end)
+    return kNeedsMoreData;
+  if (*p == ']' || *p == '}')
+    return kEndOfTrace;
+
+  event->Clear();
+  const char* args_start = nullptr;
+  const char* args_end = nullptr;
+  Scanner scanner(p, end);
+  auto read_key = [event, &args_start, &args_end](
+                      base::StringView key, Scanner* s) -> ReadDictRes {
+    // Keys are dispatched on their length first, to avoid a string
+    // comparison for each known key.
+    if (key.size() == 2) {
+      if (key == "ph")
+        return s->ReadStringValue(&event->ph, nullptr);
+      if (key == "ts")
+        return ReadMicros(s, &event->ts_ns, &event->has_ts);
+    }
+    if (key.size() == 3) {
+      if (key == "cat")
+        return s->ReadStringValue(&event->cat, &event->cat_storage);
+      if (key == "dur")
+        return ReadMicros(s, &event->dur_ns, nullptr);
+      if (key == "pid")
+        return ReadUint32(s, &event->pid);
+      if (key == "tid")
+        return ReadUint32(s, &event->tid);
+    }
+    if (key.size() == 4) {
+      if (key == "name")
+        return s->ReadStringValue(&event->name, &event->name_storage);
+      if (key == "args") {
+        args_start = s->pos();
+        ReadDictRes skip_res = s->SkipValue();
+        args_end = s->pos();
+        return skip_res;
+      }
+    }
+    return s->SkipValue();
+  };
+  ReadDictRes res = ForEachKey(&scanner, read_key);
+  if (res != kFoundDict) {
+    if (res == kFatalError)
+      PERFETTO_ELOG("JSON error at offset %zu", static_cast<size_t>(
+                                                     scanner.pos() - start));
+    return res;
+  }
+  *next = scanner.pos();
+
+  // The args are decoded only for metadata events, which use args.name for
+  // the name of processes and threads.
+  if (args_start && event->ph.size() == 1 && event->ph.data()[0] == 'M') {
+    Scanner args(args_start, args_end);
+    if (args.Peek() == '{') {
+      auto read_args_key = [event](base::StringView key,
+                                   Scanner* s) -> ReadDictRes {
+        if (key == "name")
+          return s->ReadStringValue(&event->args_name,
+                                    &event->args_name_storage);
+        return s->SkipValue();
+      };
+      if (ForEachKey(&args, read_args_key) != kFoundDict)
+        return kFatalError;
+    }
+  }
+  return kFoundDict;
+}
+
+bool ParseMicrosToNanos(base::StringView str, uint64_t* ns) {
+  const char* p = str.data();
+  const char* end = p + str.size();
+  if (p == end || *p < '0' || *p > '9')
+    return false;
+  uint64_t micros = 0;
+  for (; p < end && *p >= '0' && *p <= '9'; p++)
+    micros = micros * 10 + static_cast<uint64_t>(*p - '0');
+  uint64_t frac_ns = 0;
+  if (p < end && *p == '.') {
+    p++;
+    uint64_t scale = 100;
+    for (; p < end && *p >= '0' && *p <= '9'; p++) {
+      frac_ns += static_cast<uint64_t>(*p - '0') * scale;
+      scale /= 10;
+    }
+  }
+  if (p < end) {
+    // Exponents are rare enough that it's fine to take the slow path.
+    if (*p != 'e' && *p != 'E')
+      return false;
+    double value = strtod(str.ToStdString().c_str(), nullptr);
+    *ns = static_cast<uint64_t>(llround(value * 1000));
+    return true;
+  }
+  *ns = micros * 1000 + frac_ns;
+  return true;
+}
+
+}  // namespace json
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_JSON_TOKENIZER_H_
+#define SRC_TRACE_PROCESSOR_JSON_TOKENIZER_H_
+
+#include <stdint.h>
+
+#include <string>
+
+#include "perfetto/base/string_view.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace json {
+
+// The fields of a legacy JSON trace event which are used by JsonTraceParser.
+// All the other keys are skipped without being decoded.
+// String values point either into the buffer being tokenized or, if they
+// contain escape sequences, into the unescaped copies owned by this struct.
+// Either way they are valid only until the next event is read.
+struct TraceEvent {
+  void Clear();
+
+  base::StringView ph;
+  base::StringView cat;
+  base::StringView name;
+
+  // The "name" key of the "args" dictionary (used by metadata events).
+  base::StringView args_name;
+
+  // Timestamps are converted from microseconds (possibly fractional) to ns.
+  bool has_ts = false;
+  uint64_t ts_ns = 0;
+  uint64_t dur_ns = 0;
+  uint32_t pid = 0;
+  uint32_t tid = 0;
+
+  // Storage for the strings which need to be unescaped. Kept across events to
+  // recycle their capacity.
+  std::string cat_storage;
+  std::string name_storage;
+  std::string args_name_storage;
+};
+
+enum ReadDictRes { kFoundDict, kNeedsMoreData, kEndOfTrace, kFatalError };
+
+// Reads the JSON dictionary at the beginning of [start, end), skipping any
+// leading whitespace and commas, into |event|. On success, |next| is set to
+// the first byte after the dictionary.
+// Returns kNeedsMoreData if the dictionary is truncated, and kEndOfTrace if
+// the closing bracket of the event array (or of the outer dict) is found.
+//
+// The input is scanned in place: nothing is allocated unless an interesting
+// string contains escape sequences, and the values of the keys that are not
+// needed (e.g. "args" of non-metadata events) are skipped by looking only at
+// the brackets and quotes, eight bytes at a time.
+ReadDictRes ReadOneJsonDict(const char* start,
+                            const char* end,
+                            TraceEvent* event,
+                            const char** next);
+
+// Parses a JSON number of microseconds, e.g. "12.3456", into nanoseconds.
+// Returns false if |str| is not a non-negative number.
+bool ParseMicrosToNanos(base::StringView str, uint64_t* ns);
+
+}  // namespace json
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_JSON_TOKENIZER_H_
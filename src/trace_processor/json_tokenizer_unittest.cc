@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/json_tokenizer.h"
+
+#include <string>
+
+#include "gtest/gtest.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace json {
+namespace {
+
+ReadDictRes Read(const std::string& str, TraceEvent* event, size_t* len) {
+  const char* next = nullptr;
+  ReadDictRes res =
+      ReadOneJsonDict(str.data(), str.data() + str.size(), event, &next);
+  if (res == kFoundDict)
+    *len = static_cast<size_t>(next - str.data());
+  return res;
+}
+
+TEST(JsonTokenizerTest, BasicKeys) {
+  const std::string str =
+      R"(, {"pid": 12, "tid": 34, "ts": 5.5, "dur": 2, "ph": "X",
+          "cat": "c", "name": "n", "unknown": [1, {"a": null}]} ,{)";
+  TraceEvent event;
+  size_t len = 0;
+  ASSERT_EQ(Read(str, &event, &len), kFoundDict);
+  ASSERT_EQ(str[len - 1], '}');
+  ASSERT_EQ(event.pid, 12u);
+  ASSERT_EQ(event.tid, 34u);
+  ASSERT_TRUE(event.has_ts);
+  ASSERT_EQ(event.ts_ns, 5500u);
+  ASSERT_EQ(event.dur_ns, 2000u);
+  ASSERT_EQ(event.ph.ToStdString(), "X");
+  ASSERT_EQ(event.cat.ToStdString(), "c");
+  ASSERT_EQ(event.name.ToStdString(), "n");
+  ASSERT_TRUE(event.args_name.empty());
+}
+
+TEST(JsonTokenizerTest, BracketsAndEscapesInStrings) {
+  const std::string str =
+      R"({"name": "a{b}\"c[", "cat": "\\", "ph": "B", "x": "}\\"})";
+  TraceEvent event;
+  size_t len = 0;
+  ASSERT_EQ(Read(str, &event, &len), kFoundDict);
+  ASSERT_EQ(len, str.size());
+  ASSERT_EQ(event.name.ToStdString(), "a{b}\"c[");
+  ASSERT_EQ(event.cat.ToStdString(), "\\");
+  ASSERT_FALSE(event.has_ts);
+}
+
+TEST(JsonTokenizerTest, UnicodeEscapes) {
+  const std::string str = R"({"name": "\u00e9\ud83d\ude00\n"})";
+  TraceEvent event;
+  size_t len = 0;
+  ASSERT_EQ(Read(str, &event, &len), kFoundDict);
+  ASSERT_EQ(event.name.ToStdString(), "\xc3\xa9\xf0\x9f\x98\x80\n");
+}
+
+TEST(JsonTokenizerTest, MetadataArgs) {
+  const std::string str =
+      R"({"ph": "M", "name": "thread_name", "pid": 1, "tid": 2,
+          "args": {"x": {"name": "no"}, "name": "worker"}})";
+  TraceEvent event;
+  size_t len = 0;
+  ASSERT_EQ(Read(str, &event, &len), kFoundDict);
+  ASSERT_EQ(event.args_name.ToStdString(), "worker");
+
+  // The args of the other events are not decoded.
+  std::string other = str;
+  other[8] = 'X';
+  ASSERT_EQ(Read(other, &event, &len), kFoundDict);
+  ASSERT_TRUE(event.args_name.empty());
+}
+
+TEST(JsonTokenizerTest, TruncatedDict) {
+  const std::string str =
+      R"({"ph": "M", "name": "a\"b", "ts": 12.25, "args": {"name": "x"}})";
+  TraceEvent event;
+  size_t len = 0;
+  for (size_t i = 0; i < str.size(); i++)
+    ASSERT_EQ(Read(str.substr(0, i), &event, &len), kNeedsMoreData) << i;
+  ASSERT_EQ(Read(str, &event, &len), kFoundDict);
+  ASSERT_EQ(event.ts_ns, 12250u);
+}
+
+TEST(JsonTokenizerTest, EndOfTrace) {
+  TraceEvent event;
+  size_t len = 0;
+  ASSERT_EQ(Read(" ,\n ]}", &event, &len), kEndOfTrace);
+  ASSERT_EQ(Read("}", &event, &len), kEndOfTrace);
+  ASSERT_EQ(Read(" \n", &event, &len), kNeedsMoreData);
+}
+
+TEST(JsonTokenizerTest, MalformedDict) {
+  TraceEvent event;
+  size_t len = 0;
+  ASSERT_EQ(Read(R"({"ph" "X"})", &event, &len), kFatalError);
+  ASSERT_EQ(Read(R"({ph: "X"})", &event, &len), kFatalError);
+  ASSERT_EQ(Read(R"({"name": "\q"})", &event, &len), kFatalError);
+}
+
+TEST(JsonTokenizerTest, ParseMicrosToNanos) {
+  uint64_t ns = 0;
+  ASSERT_TRUE(ParseMicrosToNanos(base::StringView("12"), &ns));
+  ASSERT_EQ(ns, 12000u);
+  ASSERT_TRUE(ParseMicrosToNanos(base::StringView("12.3456"), &ns));
+  ASSERT_EQ(ns, 12345u);
+  ASSERT_TRUE(ParseMicrosToNanos(base::StringView("0.001"), &ns));
+  ASSERT_EQ(ns, 1u);
+  ASSERT_TRUE(ParseMicrosToNanos(base::StringView("1.5e3"), &ns));
+  ASSERT_EQ(ns, 1500000u);
+  ASSERT_FALSE(ParseMicrosToNanos(base::StringView("-1"), &ns));
+  ASSERT_FALSE(ParseMicrosToNanos(base::StringView("12x"), &ns));
+  ASSERT_FALSE(ParseMicrosToNanos(base::StringView(""), &ns));
+}
+
+}  // namespace
+}  // namespace json
+}  // namespace trace_processor
+}  // namespace perfetto
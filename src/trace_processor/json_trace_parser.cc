@@ -16,70 +16,18 @@
 
 #include "src/trace_processor/json_trace_parser.h"
 
-#include <json/reader.h>
-#include <json/value.h>
-
 #include <limits>
 #include <string>
 
-#include "perfetto/base/build_config.h"
 #include "perfetto/base/logging.h"
 #include "perfetto/base/utils.h"
 #include "src/trace_processor/process_tracker.h"
 #include "src/trace_processor/trace_processor_context.h"
 
-#if PERFETTO_BUILDFLAG(PERFETTO_ANDROID_BUILD) || \
-    PERFETTO_BUILDFLAG(PERFETTO_CHROMIUM_BUILD)
-#error The JSON trace parser is supported only in the standalone build for now.
-#endif
-
 namespace perfetto {
 namespace trace_processor {
 
-namespace {
-
-enum ReadDictRes { kFoundDict, kNeedsMoreData, kEndOfTrace, kFatalError };
-
-// Parses at most one JSON dictionary and returns a pointer to the end of it,
-// or nullptr if no dict could be detected.
-// This is to avoid decoding the full trace in memory and reduce heap traffic.
-// E.g.  input:  { a:1 b:{ c:2, d:{ e:3 } } } , { a:4, ... },
-//       output: [   only this is parsed    ] ^return value points here.
-ReadDictRes ReadOneJsonDict(const char* start,
-                            const char* end,
-                            Json::Value* value,
-                            const char** next) {
-  int braces = 0;
-  const char* dict_begin = nullptr;
-  for (const char* s = start; s < end; s++) {
-    if (isspace(*s) || *s == ',')
-      continue;
-    if (*s == '{') {
-      if (braces == 0)
-        dict_begin = s;
-      braces++;
-      continue;
-    }
-    if (*s == '}') {
-      if (braces <= 0)
-        return kEndOfTrace;
-      if (--braces > 0)
-        continue;
-      Json::Reader reader;
-      if (!reader.parse(dict_begin, s + 1, *value, /*collectComments=*/false)) {
-        PERFETTO_ELOG("JSON error: %s",
-                      reader.getFormattedErrorMessages().c_str());
-        return kFatalError;
-      }
-      *next = s + 1;
-      return kFoundDict;
-    }
-    // TODO(primiano): skip braces in quoted strings, e.g.: {"foo": "ba{z" }
-  }
-  return kNeedsMoreData;
-}
-
-}  // namespace
+using json::ReadDictRes;
 
 // static
 constexpr char JsonTraceParser::kPreamble[];
@@ -89,100 +37,142 @@ JsonTraceParser::JsonTraceParser(TraceProcessorContext* context)
 
 JsonTraceParser::~JsonTraceParser() = default;
 
-bool JsonTraceParser::Parse(std::unique_ptr<uint8_t[]> data, size_t size) {
-  buffer_.insert(buffer_.end(), data.get(), data.get() + size);
-  char* buf = &buffer_[0];
-  const char* next = buf;
-  const char* end = &buffer_[buffer_.size()];
+bool JsonTraceParser::Parse(TraceBlobView blob) {
+  const char* data = reinterpret_cast<const char*>(blob.data());
+  const char* data_end = data + blob.length();
+  const char* next = data;
 
   if (offset_ == 0) {
-    if (strncmp(buf, kPreamble, strlen(kPreamble))) {
-      buf[strlen(kPreamble)] = '\0';
+    const size_t kPreambleLen = strlen(kPreamble);
+    if (blob.length() < kPreambleLen ||
+        strncmp(data, kPreamble, kPreambleLen)) {
+      std::string got(data, std::min(blob.length(), kPreambleLen));
       PERFETTO_FATAL("Invalid trace preamble, expecting '%s' got '%s'",
-                     kPreamble, buf);
+                     kPreamble, got.c_str());
+    }
+    next += kPreambleLen;
+    offset_ += kPreambleLen;
+  }
+
+  // Complete the event left truncated by the previous chunk, if any. Only
+  // the bytes needed to do so are copied, the rest of the chunk is tokenized
+  // in place.
+  if (!buffer_.empty()) {
+    for (;;) {
+      size_t len = std::min(static_cast<size_t>(data_end - next),
+                            std::max(buffer_.size(), size_t(4096)));
+      size_t old_size = buffer_.size();
+      buffer_.insert(buffer_.end(), next, next + len);
+      const char* buf_next = nullptr;
+      ReadDictRes res = json::ReadOneJsonDict(
+          buffer_.data(), buffer_.data() + buffer_.size(), &event_, &buf_next);
+      if (res == json::kNeedsMoreData) {
+        next += len;
+        if (next == data_end)
+          return true;
+        continue;
+      }
+      if (res == json::kFatalError)
+        return false;
+      if (res == json::kEndOfTrace) {
+        buffer_.clear();
+        return true;
+      }
+      ProcessEvent();
+      size_t consumed = static_cast<size_t>(buf_next - buffer_.data());
+      PERFETTO_DCHECK(consumed > old_size);
+      next += consumed - old_size;
+      offset_ += consumed;
+      buffer_.clear();
+      break;
+    }
+  }
+
+  while (next < data_end) {
+    const char* dict_end = nullptr;
+    ReadDictRes res =
+        json::ReadOneJsonDict(next, data_end, &event_, &dict_end);
+    if (res == json::kFatalError)
+      return false;
+    if (res == json::kEndOfTrace)
+      return true;
+    if (res == json::kNeedsMoreData) {
+      buffer_.assign(next, data_end);
+      break;
     }
-    next += strlen(kPreamble);
+    ProcessEvent();
+    offset_ += static_cast<uint64_t>(dict_end - next);
+    next = dict_end;
   }
+  return true;
+}
+
+void JsonTraceParser::ProcessEvent() {
+  const json::TraceEvent& event = event_;
+  if (event.ph.empty())
+    return;
 
   ProcessTracker* procs = context_->process_tracker.get();
   TraceStorage* storage = context_->storage.get();
   TraceStorage::NestableSlices* slices = storage->mutable_nestable_slices();
 
-  while (next < end) {
-    Json::Value value;
-    const auto res = ReadOneJsonDict(next, end, &value, &next);
-    if (res == kFatalError)
-      return false;
-    if (res == kEndOfTrace || res == kNeedsMoreData)
+  char phase = event.ph.data()[0];
+  uint32_t tid = event.tid;
+  uint32_t pid = event.pid;
+  uint64_t ts = event.ts_ns;
+  StringId cat_id = storage->InternString(event.cat);
+  StringId name_id = storage->InternString(event.name);
+  UniqueTid utid = procs->UpdateThread(tid, pid);
+  SlicesStack& stack = threads_[utid];
+
+  auto add_slice = [slices, &stack, utid, cat_id,
+                    name_id](const Slice& slice) {
+    if (stack.size() >= std::numeric_limits<uint8_t>::max())
+      return;
+    const uint8_t depth = static_cast<uint8_t>(stack.size()) - 1;
+    uint64_t parent_stack_id, stack_id;
+    std::tie(parent_stack_id, stack_id) = GetStackHashes(stack);
+    slices->AddSlice(slice.start_ts, slice.end_ts - slice.start_ts, utid,
+                     cat_id, name_id, depth, stack_id, parent_stack_id);
+  };
+
+  switch (phase) {
+    case 'B': {  // TRACE_EVENT_BEGIN.
+      MaybeCloseStack(ts, stack);
+      stack.emplace_back(Slice{cat_id, name_id, ts, 0});
       break;
-    auto& ph = value["ph"];
-    if (!ph.isString())
-      continue;
-    char phase = *ph.asCString();
-    uint32_t tid = value["tid"].asUInt();
-    uint32_t pid = value["pid"].asUInt();
-    uint64_t ts = value["ts"].asLargestUInt() * 1000;
-    const char* cat = value["cat"].asCString();
-    const char* name = value["name"].asCString();
-    StringId cat_id = storage->InternString(cat);
-    StringId name_id = storage->InternString(name);
-    UniqueTid utid = procs->UpdateThread(tid, pid);
-    SlicesStack& stack = threads_[utid];
-
-    auto add_slice = [slices, &stack, utid, cat_id,
-                      name_id](const Slice& slice) {
-      if (stack.size() >= std::numeric_limits<uint8_t>::max())
-        return;
-      const uint8_t depth = static_cast<uint8_t>(stack.size()) - 1;
-      uint64_t parent_stack_id, stack_id;
-      std::tie(parent_stack_id, stack_id) = GetStackHashes(stack);
-      slices->AddSlice(slice.start_ts, slice.end_ts - slice.start_ts, utid,
-                       cat_id, name_id, depth, stack_id, parent_stack_id);
-    };
-
-    switch (phase) {
-      case 'B': {  // TRACE_EVENT_BEGIN.
-        MaybeCloseStack(ts, stack);
-        stack.emplace_back(Slice{cat_id, name_id, ts, 0});
-        break;
-      }
-      case 'E': {  // TRACE_EVENT_END.
-        PERFETTO_CHECK(!stack.empty());
-        MaybeCloseStack(ts, stack);
-        PERFETTO_CHECK(stack.back().cat_id == cat_id);
-        PERFETTO_CHECK(stack.back().name_id == name_id);
-        Slice& slice = stack.back();
-        slice.end_ts = slice.start_ts;
-        add_slice(slice);
-        stack.pop_back();
+    }
+    case 'E': {  // TRACE_EVENT_END.
+      PERFETTO_CHECK(!stack.empty());
+      MaybeCloseStack(ts, stack);
+      PERFETTO_CHECK(stack.back().cat_id == cat_id);
+      PERFETTO_CHECK(stack.back().name_id == name_id);
+      Slice& slice = stack.back();
+      slice.end_ts = slice.start_ts;
+      add_slice(slice);
+      stack.pop_back();
+      break;
+    }
+    case 'X': {  // TRACE_EVENT (scoped event).
+      MaybeCloseStack(ts, stack);
+      uint64_t end_ts = ts + event.dur_ns;
+      stack.emplace_back(Slice{cat_id, name_id, ts, end_ts});
+      Slice& slice = stack.back();
+      add_slice(slice);
+      break;
+    }
+    case 'M': {  // Metadata events (process and thread names).
+      if (event.name == "thread_name") {
+        procs->UpdateThreadName(tid, pid, event.args_name);
         break;
       }
-      case 'X': {  // TRACE_EVENT (scoped event).
-        MaybeCloseStack(ts, stack);
-        uint64_t end_ts = ts + value["dur"].asUInt() * 1000;
-        stack.emplace_back(Slice{cat_id, name_id, ts, end_ts});
-        Slice& slice = stack.back();
-        add_slice(slice);
+      if (event.name == "process_name") {
+        procs->UpdateProcess(pid, event.args_name);
         break;
       }
-      case 'M': {  // Metadata events (process and thread names).
-        if (strcmp(value["name"].asCString(), "thread_name") == 0) {
-          const char* thread_name = value["args"]["name"].asCString();
-          procs->UpdateThreadName(tid, pid, thread_name);
-          break;
-        }
-        if (strcmp(value["name"].asCString(), "process_name") == 0) {
-          const char* proc_name = value["args"]["name"].asCString();
-          procs->UpdateProcess(pid, proc_name);
-          break;
-        }
-      }
     }
-    // TODO(primiano): auto-close B slices left open at the end.
   }
-  offset_ += static_cast<uint64_t>(next - buf);
-  buffer_.erase(buffer_.begin(), buffer_.begin() + (next - buf));
-  return true;
+  // TODO(primiano): auto-close B slices left open at the end.
 }
 
 void JsonTraceParser::MaybeCloseStack(uint64_t ts, SlicesStack& stack) {
@@ -24,6 +24,7 @@
 #include <unordered_map>
 
 #include "src/trace_processor/chunked_trace_reader.h"
+#include "src/trace_processor/json_tokenizer.h"
 #include "src/trace_processor/trace_storage.h"
 
 namespace perfetto {
@@ -33,6 +34,9 @@ class TraceProcessorContext;
 
 // Parses legacy chrome JSON traces. The support for now is extremely rough
 // and supports only explicit TRACE_EVENT_BEGIN/END events.
+// Chunks are tokenized in place (see json_tokenizer.h): only an event
+// straddling two chunks is copied, so memory usage doesn't depend on the
+// size of the trace.
 class JsonTraceParser : public ChunkedTraceReader {
  public:
   static constexpr char kPreamble[] = "{\"traceEvents\":[";
@@ -41,7 +45,7 @@ class JsonTraceParser : public ChunkedTraceReader {
   ~JsonTraceParser() override;
 
   // TraceParser implementation.
-  bool Parse(std::unique_ptr<uint8_t[]>, size_t) override;
+  bool Parse(TraceBlobView) override;
 
  private:
   struct Slice {
@@ -52,13 +56,20 @@ class JsonTraceParser : public ChunkedTraceReader {
   };
   using SlicesStack = std::vector<Slice>;
 
+  void ProcessEvent();
+
   static inline void MaybeCloseStack(uint64_t end_ts, SlicesStack&);
   static inline std::tuple<uint64_t, uint64_t> GetStackHashes(
       const SlicesStack&);
 
   TraceProcessorContext* const context_;
   uint64_t offset_ = 0;
+
+  // The tail of the previous chunk, holding a truncated event.
   std::vector<char> buffer_;
+
+  // The event being processed. Kept across events to recycle its buffers.
+  json::TraceEvent event_;
   std::unordered_map<UniqueTid, SlicesStack> threads_;
 };
 
@@ -16,6 +16,8 @@
 
 #include "src/trace_processor/process_table.h"
 
+#include <algorithm>
+
 #include "perfetto/base/logging.h"
 #include "src/trace_processor/query_constraints.h"
 #include "src/trace_processor/sqlite_utils.h"
@@ -46,7 +48,7 @@ std::unique_ptr<Table::Cursor> ProcessTable::CreateCursor() {
 }
 
 int ProcessTable::BestIndex(const QueryConstraints& qc, BestIndexInfo* info) {
-  info->estimated_cost = static_cast<uint32_t>(storage_->process_count());
+  info->estimated_cost = storage_->GetVisibleRowCounts().processes - 1;
 
   // If the query has a constraint on the |upid| field, return a reduced cost
   // because we can do that filter efficiently.
@@ -69,8 +71,8 @@ int ProcessTable::Cursor::Column(sqlite3_context* context, int N) {
     case Column::kName: {
       const auto& process = storage_->GetProcess(upid_filter_.current);
       const auto& name = storage_->GetString(process.name_id);
-      sqlite3_result_text(context, name.c_str(),
-                          static_cast<int>(name.length()), nullptr);
+      sqlite3_result_text(context, name.data(), static_cast<int>(name.size()),
+                          nullptr);
       break;
     }
     case Column::kPid: {
@@ -88,7 +90,9 @@ int ProcessTable::Cursor::Column(sqlite3_context* context, int N) {
 int ProcessTable::Cursor::Filter(const QueryConstraints& qc,
                                  sqlite3_value** argv) {
   upid_filter_.min = 1;
-  upid_filter_.max = static_cast<uint32_t>(storage_->process_count());
+  // The 0th row is the invalid-process sentinel.
+  const uint32_t max_upid = storage_->GetVisibleRowCounts().processes - 1;
+  upid_filter_.max = max_upid;
   upid_filter_.desc = false;
   upid_filter_.current = upid_filter_.min;
 
@@ -111,6 +115,8 @@ int ProcessTable::Cursor::Filter(const QueryConstraints& qc,
       }
     }
   }
+  // Never return rows which were not visible when the query started.
+  upid_filter_.max = std::min(upid_filter_.max, max_upid);
   for (const auto& ob : qc.order_by()) {
     if (ob.iColumn == Column::kUpid) {
       upid_filter_.desc = ob.desc;
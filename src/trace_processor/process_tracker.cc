@@ -31,24 +31,27 @@ ProcessTracker::~ProcessTracker() = default;
 UniqueTid ProcessTracker::UpdateThread(uint64_t timestamp,
                                        uint32_t tid,
                                        StringId thread_name_id) {
-  auto pair_it = tids_.equal_range(tid);
-
-  // If a utid exists for the tid, find it and update the name.
-  if (pair_it.first != pair_it.second) {
-    auto prev_utid = std::prev(pair_it.second)->second;
-    TraceStorage::Thread* thread =
-        context_->storage->GetMutableThread(prev_utid);
-    thread->name_id = thread_name_id;
-    return prev_utid;
+  // If a thread is using the tid, update its name. The name rarely changes,
+  // so the lock is almost never taken on this path.
+  UniqueTid utid = tids_.Get(tid);
+  if (PERFETTO_LIKELY(utid != 0)) {
+    TraceStorage::Thread* thread = context_->storage->GetMutableThread(utid);
+    if (PERFETTO_UNLIKELY(thread->name_id != thread_name_id)) {
+      auto lock = context_->storage->LockMetadata();
+      thread->name_id = thread_name_id;
+    }
+    return utid;
   }
 
-  // If none exist, assign a new utid and store it.
+  // If none is, assign a new utid and store it. The new row is not visible to
+  // readers until the next TraceStorage::PublishRowCounts(), so it can be
+  // initialized without locking.
   UniqueTid new_utid = context_->storage->AddEmptyThread(tid);
   TraceStorage::Thread* thread = context_->storage->GetMutableThread(new_utid);
   thread->name_id = thread_name_id;
   if (timestamp)
     thread->start_ns = timestamp;
-  tids_.emplace(tid, new_utid);
+  tids_.Set(tid, new_utid);
   return new_utid;
 };
 
@@ -58,45 +61,38 @@ void ProcessTracker::UpdateThreadName(uint32_t tid,
   UniqueTid utid = UpdateThread(tid, pid);
   auto* thread = context_->storage->GetMutableThread(utid);
   auto name_id = context_->storage->InternString(name);
+  auto lock = context_->storage->LockMetadata();
   thread->name_id = name_id;
 }
 
 UniqueTid ProcessTracker::UpdateThread(uint32_t tid, uint32_t pid) {
-  auto tids_pair = tids_.equal_range(tid);
-
-  // Try looking for a thread that matches both tid and thread group id (pid).
+  // Use the thread currently using the tid, unless it belongs to another
+  // thread group (pid), which means that the tid has been recycled.
+  UniqueTid utid = tids_.Get(tid);
   TraceStorage::Thread* thread = nullptr;
-  UniqueTid utid = 0;
-  for (auto it = tids_pair.first; it != tids_pair.second; it++) {
-    UniqueTid iter_utid = it->second;
-    auto* iter_thread = context_->storage->GetMutableThread(iter_utid);
-    if (iter_thread->upid == 0) {
-      // We haven't discovered the parent process for the thread. Assign it
-      // now and use this thread.
-      thread = iter_thread;
-      utid = iter_utid;
-      break;
-    }
-    const auto& iter_process = context_->storage->GetProcess(iter_thread->upid);
-    if (iter_process.pid == pid) {
-      // We found a thread that matches both the tid and its parent pid.
-      thread = iter_thread;
-      utid = iter_utid;
-      break;
+  if (utid != 0) {
+    thread = context_->storage->GetMutableThread(utid);
+    // If we haven't discovered the parent process for the thread yet, it is
+    // assigned below.
+    if (thread->upid != 0 &&
+        context_->storage->GetProcess(thread->upid).pid != pid) {
+      thread = nullptr;
     }
-  }  // for(tids).
+  }
 
   // If no matching thread was found, create a new one.
   if (thread == nullptr) {
     utid = context_->storage->AddEmptyThread(tid);
-    tids_.emplace(tid, utid);
+    tids_.Set(tid, utid);
     thread = context_->storage->GetMutableThread(utid);
   }
 
   // Find matching process or create new one.
   if (thread->upid == 0) {  // Not set, upid == 0 is invalid.
-    std::tie(thread->upid, std::ignore) =
-        GetOrCreateProcess(pid, thread->start_ns);
+    UniquePid upid;
+    std::tie(upid, std::ignore) = GetOrCreateProcess(pid, thread->start_ns);
+    auto lock = context_->storage->LockMetadata();
+    thread->upid = upid;
   }
 
   return utid;
@@ -107,31 +103,27 @@ UniquePid ProcessTracker::UpdateProcess(uint32_t pid, base::StringView name) {
   UniquePid upid;
   TraceStorage::Process* process;
   std::tie(upid, process) = GetOrCreateProcess(pid, 0 /* start_ns */);
-  process->name_id = proc_name_id;
+  {
+    auto lock = context_->storage->LockMetadata();
+    process->name_id = proc_name_id;
+  }
   UpdateThread(/*tid=*/pid, pid);  // Create an entry for the main thread.
   return upid;
 }
 
 std::tuple<UniquePid, TraceStorage::Process*>
 ProcessTracker::GetOrCreateProcess(uint32_t pid, uint64_t start_ns) {
-  auto pids_pair = pids_.equal_range(pid);
-
-  UniquePid upid = 0;
-  for (auto it = pids_pair.first; it != pids_pair.second; it++) {
-    if (it->first == pid) {
-      upid = it->second;
-      break;
-    }
-  }
-
+  UniquePid upid = pids_.Get(pid);
   if (upid == 0) {
     upid = context_->storage->AddEmptyProcess(pid);
-    pids_.emplace(pid, upid);
+    pids_.Set(pid, upid);
   }
 
   auto* process = context_->storage->GetMutableProcess(upid);
-  if (process->start_ns == 0)
+  if (process->start_ns == 0 && start_ns != 0) {
+    auto lock = context_->storage->LockMetadata();
     process->start_ns = start_ns;
+  }
 
   // Give a default name to the process based on its PID just in case we never
   // get to see the real comm (e.g., we miss the trace packet that containts it
@@ -140,12 +132,35 @@ ProcessTracker::GetOrCreateProcess(uint32_t pid, uint64_t start_ns) {
     char process_name[64];
     size_t len =
         static_cast<size_t>(sprintf(process_name, "[pid:%" PRIu32 "]", pid));
-    process->name_id =
+    StringId name_id =
         context_->storage->InternString(base::StringView(process_name, len));
+    auto lock = context_->storage->LockMetadata();
+    process->name_id = name_id;
   }
 
   return std::make_tuple(upid, process);
 }
 
+void ProcessTracker::EndThread(uint64_t timestamp, uint32_t tid) {
+  UniqueTid utid = tids_.Get(tid);
+  if (utid == 0)
+    return;
+  auto lock = context_->storage->LockMetadata();
+  TraceStorage::Thread* thread = context_->storage->GetMutableThread(utid);
+  thread->end_ns = timestamp;
+  tids_.Set(tid, 0);
+
+  // The main thread of a process is freed only after all the other threads,
+  // so this is the end of the process too.
+  if (thread->upid == 0)
+    return;
+  TraceStorage::Process* process =
+      context_->storage->GetMutableProcess(thread->upid);
+  if (process->pid != tid || pids_.Get(tid) != thread->upid)
+    return;
+  process->end_ns = timestamp;
+  pids_.Set(tid, 0);
+}
+
 }  // namespace trace_processor
 }  // namespace perfetto
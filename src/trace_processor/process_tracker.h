@@ -20,6 +20,7 @@
 #include <tuple>
 
 #include "perfetto/base/string_view.h"
+#include "src/trace_processor/flat_id_map.h"
 #include "src/trace_processor/trace_processor_context.h"
 #include "src/trace_processor/trace_storage.h"
 
@@ -33,29 +34,18 @@ class ProcessTracker {
   ProcessTracker& operator=(const ProcessTracker&) = delete;
   virtual ~ProcessTracker();
 
-  using UniqueProcessIterator =
-      std::multimap<uint32_t, UniquePid>::const_iterator;
-  using UniqueProcessBounds =
-      std::pair<UniqueProcessIterator, UniqueProcessIterator>;
-
-  using UniqueThreadIterator =
-      std::multimap<uint32_t, UniqueTid>::const_iterator;
-  using UniqueThreadBounds =
-      std::pair<UniqueThreadIterator, UniqueThreadIterator>;
-
-  // TODO(b/110409911): Invalidation of process and threads is yet to be
-  // implemented. This will include passing timestamps into the below methods
-  // to ensure the correct upid/utid is found.
-
   // Called when a sched switch event is seen in the trace. Retrieves the
-  // UniqueTid that matches the tid or assigns a new UniqueTid and stores
-  // the thread_name_id.
+  // UniqueTid of the thread currently using the tid, or assigns a new
+  // UniqueTid if the tid is not in use (e.g. because it was seen last before
+  // its thread ended), and stores the thread_name_id.
   UniqueTid UpdateThread(uint64_t timestamp,
                          uint32_t tid,
                          StringId thread_name_id);
 
   // Called when a thread is seen the process tree. Retrieves the matching utid
-  // for the tid and the matching upid for the tgid and stores both.
+  // for the tid and the matching upid for the tgid and stores both. If the
+  // thread currently using the tid belongs to another process, the tid has
+  // been recycled and a new utid is assigned.
   // Virtual for testing.
   virtual UniqueTid UpdateThread(uint32_t tid, uint32_t tgid);
 
@@ -67,17 +57,16 @@ class ProcessTracker {
   // Virtual for testing.
   virtual UniquePid UpdateProcess(uint32_t pid, base::StringView name);
 
-  // Returns the bounds of a range that includes all UniquePids that have the
-  // requested pid.
-  UniqueProcessBounds UpidsForPid(uint32_t pid) {
-    return pids_.equal_range(pid);
-  }
+  // Called when a thread ends (i.e. on sched_process_free). From now on its
+  // tid can be reused by a new thread, which will get a new utid. When the
+  // main thread of a process ends, the process ends too.
+  void EndThread(uint64_t timestamp, uint32_t tid);
+
+  // Returns the UniquePid of the process currently using |pid|, or 0 if none.
+  UniquePid UpidForPid(uint32_t pid) const { return pids_.Get(pid); }
 
-  // Returns the bounds of a range that includes all UniqueTids that have the
-  // requested tid.
-  UniqueThreadBounds UtidsForTid(uint32_t tid) {
-    return tids_.equal_range(tid);
-  }
+  // Returns the UniqueTid of the thread currently using |tid|, or 0 if none.
+  UniqueTid UtidForTid(uint32_t tid) const { return tids_.Get(tid); }
 
   std::tuple<UniquePid, TraceStorage::Process*> GetOrCreateProcess(
       uint32_t pid,
@@ -86,13 +75,13 @@ class ProcessTracker {
  private:
   TraceProcessorContext* const context_;
 
-  // Each tid can have multiple UniqueTid entries, a new UniqueTid is assigned
-  // each time a thread is seen in the trace.
-  std::multimap<uint32_t /* tid */, UniqueTid> tids_;
+  // Over the trace, each tid can be used by multiple threads (and so have
+  // multiple UniqueTid entries). This maps it to the thread currently using
+  // it. Looked up on each sched_switch.
+  FlatIdMap tids_;
 
-  // Each pid can have multiple UniquePid entries, a new UniquePid is assigned
-  // each time a process is seen in the trace.
-  std::multimap<uint32_t /* pid (aka tgid) */, UniquePid> pids_;
+  // Same for pids (aka tgids), which map to the current UniquePid.
+  FlatIdMap pids_;
 };
 
 }  // namespace trace_processor
@@ -43,25 +43,21 @@ class ProcessTrackerTest : public ::testing::Test {
 TEST_F(ProcessTrackerTest, PushProcess) {
   TraceStorage storage;
   context.process_tracker->UpdateProcess(1, "test");
-  auto pair_it = context.process_tracker->UpidsForPid(1);
-  ASSERT_EQ(pair_it.first->second, 1);
+  ASSERT_EQ(context.process_tracker->UpidForPid(1), 1u);
 }
 
 TEST_F(ProcessTrackerTest, PushTwoProcessEntries_SamePidAndName) {
   context.process_tracker->UpdateProcess(1, "test");
   context.process_tracker->UpdateProcess(1, "test");
-  auto pair_it = context.process_tracker->UpidsForPid(1);
-  ASSERT_EQ(pair_it.first->second, 1);
-  ASSERT_EQ(++pair_it.first, pair_it.second);
+  ASSERT_EQ(context.process_tracker->UpidForPid(1), 1u);
+  ASSERT_EQ(context.storage->process_count(), 1u);
 }
 
 TEST_F(ProcessTrackerTest, PushTwoProcessEntries_DifferentPid) {
   context.process_tracker->UpdateProcess(1, "test");
   context.process_tracker->UpdateProcess(3, "test");
-  auto pair_it = context.process_tracker->UpidsForPid(1);
-  ASSERT_EQ(pair_it.first->second, 1);
-  auto second_pair_it = context.process_tracker->UpidsForPid(3);
-  ASSERT_EQ(second_pair_it.first->second, 2);
+  ASSERT_EQ(context.process_tracker->UpidForPid(1), 1u);
+  ASSERT_EQ(context.process_tracker->UpidForPid(3), 2u);
 }
 
 TEST_F(ProcessTrackerTest, AddProcessEntry_CorrectName) {
@@ -103,14 +99,50 @@ TEST_F(ProcessTrackerTest, UpdateThreadCreate) {
   TraceStorage::Thread thread = context.storage->GetThread(1);
 
   ASSERT_EQ(context.storage->thread_count(), 1);
-  auto tid_it = context.process_tracker->UtidsForTid(12);
-  ASSERT_NE(tid_it.first, tid_it.second);
+  ASSERT_EQ(context.process_tracker->UtidForTid(12), 1u);
   ASSERT_EQ(thread.upid, 1);
-  auto pid_it = context.process_tracker->UpidsForPid(2);
-  ASSERT_NE(pid_it.first, pid_it.second);
+  ASSERT_EQ(context.process_tracker->UpidForPid(2), 1u);
   ASSERT_EQ(context.storage->process_count(), 1);
 }
 
+TEST_F(ProcessTrackerTest, RecycledTidInOtherProcess) {
+  UniqueTid first = context.process_tracker->UpdateThread(12, 2);
+  ASSERT_EQ(context.process_tracker->UpdateThread(12, 2), first);
+
+  // The same tid in a different thread group is a different thread.
+  UniqueTid second = context.process_tracker->UpdateThread(12, 3);
+  ASSERT_NE(second, first);
+  ASSERT_EQ(context.process_tracker->UtidForTid(12), second);
+  ASSERT_EQ(context.storage->GetThread(second).tid, 12u);
+}
+
+TEST_F(ProcessTrackerTest, EndThread) {
+  ProcessTracker* procs = context.process_tracker.get();
+  StringId name_id = context.storage->InternString("name");
+  procs->UpdateProcess(2, "proc");
+  UniqueTid main_utid = procs->UtidForTid(2);
+  UniqueTid utid = procs->UpdateThread(/*tid=*/4, /*pid=*/2);
+  ASSERT_EQ(procs->UpdateThread(100, /*tid=*/4, name_id), utid);
+
+  // Once ended, the tid is reused by a new thread.
+  procs->EndThread(200, /*tid=*/4);
+  ASSERT_EQ(context.storage->GetThread(utid).end_ns, 200u);
+  ASSERT_EQ(procs->UtidForTid(4), 0u);
+  UniqueTid new_utid = procs->UpdateThread(300, /*tid=*/4, name_id);
+  ASSERT_NE(new_utid, utid);
+  ASSERT_EQ(context.storage->GetThread(new_utid).start_ns, 300u);
+  ASSERT_EQ(procs->UpidForPid(2), 1u);
+
+  // The end of the main thread is the end of the process.
+  procs->EndThread(400, /*tid=*/2);
+  ASSERT_EQ(context.storage->GetThread(main_utid).end_ns, 400u);
+  ASSERT_EQ(context.storage->GetProcess(1).end_ns, 400u);
+  ASSERT_EQ(procs->UpidForPid(2), 0u);
+  procs->UpdateProcess(2, "new_proc");
+  ASSERT_EQ(procs->UpidForPid(2), 2u);
+  ASSERT_NE(procs->UtidForTid(2), main_utid);
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
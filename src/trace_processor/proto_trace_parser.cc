@@ -124,80 +124,47 @@ void ProtoTraceParser::ParseProcess(TraceBlobView process) {
 
 void ProtoTraceParser::ParseFtracePacket(uint32_t cpu,
                                          uint64_t timestamp,
-                                         TraceBlobView ftrace) {
-  ProtoDecoder decoder(ftrace.data(), ftrace.length());
-  for (auto fld = decoder.ReadField(); fld.id != 0; fld = decoder.ReadField()) {
-    switch (fld.id) {
-      case protos::FtraceEvent::kSchedSwitchFieldNumber: {
-        PERFETTO_DCHECK(timestamp > 0);
-        const size_t fld_off = ftrace.offset_of(fld.data());
-        ParseSchedSwitch(cpu, timestamp, ftrace.slice(fld_off, fld.size()));
-        break;
-      }
-      case protos::FtraceEvent::kCpuFrequency: {
-        PERFETTO_DCHECK(timestamp > 0);
-        const size_t fld_off = ftrace.offset_of(fld.data());
-        ParseCpuFreq(timestamp, ftrace.slice(fld_off, fld.size()));
-        break;
-      }
-      default:
-        break;
-    }
+                                         TraceBlobView,
+                                         const DecodedFtraceEvent& event) {
+  switch (event.type) {
+    case DecodedFtraceEvent::Type::kSchedSwitch:
+      PERFETTO_DCHECK(timestamp > 0);
+      ParseSchedSwitch(cpu, timestamp, event.sched_switch);
+      break;
+    case DecodedFtraceEvent::Type::kCpuFrequency:
+      PERFETTO_DCHECK(timestamp > 0);
+      ParseCpuFreq(timestamp, event.cpu_frequency);
+      break;
+    case DecodedFtraceEvent::Type::kSchedProcessFree:
+      PERFETTO_DCHECK(timestamp > 0);
+      ParseSchedProcessFree(timestamp, event.sched_process_free);
+      break;
+    case DecodedFtraceEvent::Type::kOther:
+      break;
   }
-  PERFETTO_DCHECK(decoder.IsEndOfBuffer());
 }
 
-void ProtoTraceParser::ParseCpuFreq(uint64_t timestamp, TraceBlobView view) {
-  ProtoDecoder decoder(view.data(), view.length());
-
-  uint32_t cpu = 0;
-  uint32_t new_freq = 0;
-  for (auto fld = decoder.ReadField(); fld.id != 0; fld = decoder.ReadField()) {
-    switch (fld.id) {
-      case protos::CpuFrequencyFtraceEvent::kCpuIdFieldNumber:
-        cpu = fld.as_uint32();
-        break;
-      case protos::CpuFrequencyFtraceEvent::kStateFieldNumber:
-        new_freq = fld.as_uint32();
-        break;
-    }
-  }
-
-  context_->storage->PushCpuFreq(timestamp, cpu, new_freq);
-
-  PERFETTO_DCHECK(decoder.IsEndOfBuffer());
+void ProtoTraceParser::ParseCpuFreq(
+    uint64_t timestamp,
+    const DecodedFtraceEvent::CpuFrequency& freq) {
+  context_->storage->PushCpuFreq(timestamp, freq.cpu_id, freq.state);
 }
 
-void ProtoTraceParser::ParseSchedSwitch(uint32_t cpu,
-                                        uint64_t timestamp,
-                                        TraceBlobView sswitch) {
-  ProtoDecoder decoder(sswitch.data(), sswitch.length());
+void ProtoTraceParser::ParseSchedProcessFree(
+    uint64_t timestamp,
+    const DecodedFtraceEvent::SchedProcessFree& free) {
+  // Despite the name, the event is emitted for each thread (and |pid| is
+  // actually a tid).
+  context_->process_tracker->EndThread(timestamp, free.pid);
+}
 
-  uint32_t prev_pid = 0;
-  uint32_t prev_state = 0;
-  base::StringView prev_comm;
-  uint32_t next_pid = 0;
-  for (auto fld = decoder.ReadField(); fld.id != 0; fld = decoder.ReadField()) {
-    switch (fld.id) {
-      case protos::SchedSwitchFtraceEvent::kPrevPidFieldNumber:
-        prev_pid = fld.as_uint32();
-        break;
-      case protos::SchedSwitchFtraceEvent::kPrevStateFieldNumber:
-        prev_state = fld.as_uint32();
-        break;
-      case protos::SchedSwitchFtraceEvent::kPrevCommFieldNumber:
-        prev_comm = fld.as_string();
-        break;
-      case protos::SchedSwitchFtraceEvent::kNextPidFieldNumber:
-        next_pid = fld.as_uint32();
-        break;
-      default:
-        break;
-    }
-  }
-  context_->sched_tracker->PushSchedSwitch(cpu, timestamp, prev_pid, prev_state,
-                                           prev_comm, next_pid);
-  PERFETTO_DCHECK(decoder.IsEndOfBuffer());
+void ProtoTraceParser::ParseSchedSwitch(
+    uint32_t cpu,
+    uint64_t timestamp,
+    const DecodedFtraceEvent::SchedSwitch& sswitch) {
+  context_->sched_tracker->PushSchedSwitch(
+      cpu, timestamp, sswitch.prev_pid, sswitch.prev_state,
+      sswitch.prev_comm(), sswitch.next_pid);
 }
 
 }  // namespace trace_processor
@@ -20,6 +20,7 @@
 #include <stdint.h>
 #include <memory>
 
+#include "src/trace_processor/decoded_ftrace_event.h"
 #include "src/trace_processor/trace_blob_view.h"
 
 namespace perfetto {
@@ -34,12 +35,20 @@ class ProtoTraceParser {
 
   // virtual for testing.
   virtual void ParseTracePacket(TraceBlobView);
+  // Ftrace events are decoded by the tokenizer: |event| is their payload,
+  // whose strings point into |ftrace|.
   virtual void ParseFtracePacket(uint32_t cpu,
                                  uint64_t timestamp,
-                                 TraceBlobView);
+                                 TraceBlobView ftrace,
+                                 const DecodedFtraceEvent& event);
   void ParseProcessTree(TraceBlobView);
-  void ParseSchedSwitch(uint32_t cpu, uint64_t timestamp, TraceBlobView);
-  void ParseCpuFreq(uint64_t timestamp, TraceBlobView);
+  void ParseSchedSwitch(uint32_t cpu,
+                        uint64_t timestamp,
+                        const DecodedFtraceEvent::SchedSwitch&);
+  void ParseCpuFreq(uint64_t timestamp,
+                    const DecodedFtraceEvent::CpuFrequency&);
+  void ParseSchedProcessFree(uint64_t timestamp,
+                             const DecodedFtraceEvent::SchedProcessFree&);
   void ParseThread(TraceBlobView);
   void ParseProcess(TraceBlobView);
 
@@ -22,6 +22,7 @@
 #include "src/trace_processor/proto_trace_parser.h"
 #include "src/trace_processor/sched_tracker.h"
 #include "src/trace_processor/trace_sorter.h"
+#include "src/trace_processor/worker_pool.h"
 
 #include "perfetto/trace/trace.pb.h"
 #include "perfetto/trace/trace_packet.pb.h"
@@ -34,6 +35,7 @@ using ::testing::_;
 using ::testing::Args;
 using ::testing::ElementsAreArray;
 using ::testing::Eq;
+using ::testing::InSequence;
 using ::testing::Pointwise;
 
 class MockSchedTracker : public SchedTracker {
@@ -87,8 +89,8 @@ class ProtoTraceParserTest : public ::testing::Test {
     std::unique_ptr<uint8_t[]> raw_trace(new uint8_t[trace.ByteSize()]);
     trace.SerializeToArray(raw_trace.get(), trace.ByteSize());
     ProtoTraceTokenizer tokenizer(&context_);
-    tokenizer.Parse(std::move(raw_trace),
-                    static_cast<size_t>(trace.ByteSize()));
+    tokenizer.Parse(TraceBlobView(std::move(raw_trace), 0,
+                                  static_cast<size_t>(trace.ByteSize())));
   }
 
  protected:
@@ -225,6 +227,239 @@ TEST_F(ProtoTraceParserTest, RepeatedLoadSinglePacket) {
   Tokenize(trace_2);
 }
 
+TEST_F(ProtoTraceParserTest, DropBundlesWithInvalidCpu) {
+  protos::Trace trace;
+  // The first two bundles have a cpu too large for the fast paths of the
+  // tokenizer and out of range; the last one is valid.
+  const uint32_t kCpus[] = {1000, 0xffffffff, 10};
+  for (uint32_t i = 0; i < 3; i++) {
+    auto* bundle = trace.add_packet()->mutable_ftrace_events();
+    bundle->set_cpu(kCpus[i]);
+    auto* event = bundle->add_event();
+    event->set_timestamp(1000 + i);
+    auto* sched_switch = event->mutable_sched_switch();
+    sched_switch->set_prev_pid(10);
+    sched_switch->set_prev_state(32);
+    sched_switch->set_prev_comm("proc");
+    sched_switch->set_next_pid(100);
+  }
+
+  EXPECT_CALL(*sched_, PushSchedSwitch(10, 1002, 10, 32,
+                                       base::StringView("proc"), 100));
+  Tokenize(trace);
+  ASSERT_EQ(storage_->stats().ftrace_bundles_invalid_cpu_, 2u);
+}
+
+TEST_F(ProtoTraceParserTest, LoadWindowKeepsThreadLifetimeEvents) {
+  protos::Trace trace;
+  auto* bundle = trace.add_packet()->mutable_ftrace_events();
+  bundle->set_cpu(1);
+  // Far before the window: only the end of the thread is kept.
+  auto* event = bundle->add_event();
+  event->set_timestamp(100);
+  event->mutable_sched_process_free()->set_pid(42);
+  event = bundle->add_event();
+  event->set_timestamp(101);
+  event->mutable_sched_switch()->set_next_pid(42);
+  event = bundle->add_event();
+  event->set_timestamp(102);
+  event->mutable_print()->set_buf("foo");
+  // In the margin before the window.
+  event = bundle->add_event();
+  event->set_timestamp(9500);
+  event->mutable_sched_switch()->set_next_pid(43);
+  // In the window.
+  event = bundle->add_event();
+  event->set_timestamp(10500);
+  event->mutable_print()->set_buf("bar");
+  // Far after the window.
+  event = bundle->add_event();
+  event->set_timestamp(50000);
+  event->mutable_task_rename()->set_pid(43);
+  event = bundle->add_event();
+  event->set_timestamp(50001);
+  event->mutable_sched_switch()->set_next_pid(44);
+
+  LoadWindow window;
+  window.start_ts = 10000;
+  window.end_ts = 11000;
+  window.margin_ns = 1000;
+  std::string raw_trace = trace.SerializeAsString();
+  std::vector<ProtoTraceTokenizer::TokenizedPiece> pieces;
+  uint32_t invalid_bundles = 0;
+  ASSERT_TRUE(ProtoTraceTokenizer::TokenizeAndSortTrace(
+      reinterpret_cast<const uint8_t*>(raw_trace.data()), raw_trace.size(),
+      window, &pieces, &invalid_bundles));
+  std::vector<uint64_t> timestamps;
+  for (const auto& piece : pieces)
+    timestamps.push_back(piece.timestamp);
+  std::vector<uint64_t> expected{100, 9500, 10500, 50000};
+  ASSERT_EQ(timestamps, expected);
+}
+
+TEST_F(ProtoTraceParserTest, LoadWindowSkipsBundlesOutsideOfIt) {
+  protos::Trace trace;
+  // One bundle far before the window, one in its margin and one far after.
+  const uint64_t kBundleStarts[] = {100, 9500, 50000};
+  for (uint64_t start : kBundleStarts) {
+    auto* bundle = trace.add_packet()->mutable_ftrace_events();
+    bundle->set_cpu(1);
+    auto* event = bundle->add_event();
+    event->set_timestamp(start);
+    event->mutable_sched_switch()->set_next_pid(42);
+    event = bundle->add_event();
+    event->set_timestamp(start + 1);
+    event->mutable_sched_process_free()->set_pid(42);
+    event = bundle->add_event();
+    event->set_timestamp(start + 2);
+    event->mutable_task_rename()->set_pid(43);
+    event = bundle->add_event();
+    event->set_timestamp(start + 3);
+    event->mutable_cpu_frequency()->set_state(1000);
+  }
+
+  LoadWindow window;
+  window.start_ts = 10000;
+  window.end_ts = 11000;
+  window.margin_ns = 1000;
+  std::string raw_trace = trace.SerializeAsString();
+  std::vector<ProtoTraceTokenizer::TokenizedPiece> pieces;
+  uint32_t invalid_bundles = 0;
+  ASSERT_TRUE(ProtoTraceTokenizer::TokenizeAndSortTrace(
+      reinterpret_cast<const uint8_t*>(raw_trace.data()), raw_trace.size(),
+      window, &pieces, &invalid_bundles));
+  std::vector<uint64_t> timestamps;
+  for (const auto& piece : pieces)
+    timestamps.push_back(piece.timestamp);
+  std::vector<uint64_t> expected{101,  102,  9500,  9501,
+                                 9502, 9503, 50001, 50002};
+  ASSERT_EQ(timestamps, expected);
+}
+
+TEST_F(ProtoTraceParserTest, TokenizerDecodesFtraceEvents) {
+  protos::Trace trace;
+  auto* bundle = trace.add_packet()->mutable_ftrace_events();
+  bundle->set_cpu(1);
+  auto* event = bundle->add_event();
+  event->set_timestamp(100);
+  event->set_pid(12);
+  auto* sched_switch = event->mutable_sched_switch();
+  sched_switch->set_prev_pid(12);
+  sched_switch->set_prev_state(32);
+  sched_switch->set_prev_comm("proc");
+  sched_switch->set_next_pid(13);
+  event = bundle->add_event();
+  event->set_timestamp(101);
+  event->mutable_cpu_frequency()->set_cpu_id(2);
+  event->mutable_cpu_frequency()->set_state(1000);
+  event = bundle->add_event();
+  event->set_timestamp(102);
+  event->mutable_sched_process_free()->set_pid(12);
+  event = bundle->add_event();
+  event->set_timestamp(103);
+  event->mutable_print()->set_buf("foo");
+
+  std::string raw_trace = trace.SerializeAsString();
+  std::vector<ProtoTraceTokenizer::TokenizedPiece> pieces;
+  uint32_t invalid_bundles = 0;
+  ASSERT_TRUE(ProtoTraceTokenizer::TokenizeAndSortTrace(
+      reinterpret_cast<const uint8_t*>(raw_trace.data()), raw_trace.size(),
+      LoadWindow(), &pieces, &invalid_bundles));
+  ASSERT_EQ(pieces.size(), 4u);
+  using Type = DecodedFtraceEvent::Type;
+
+  ASSERT_EQ(pieces[0].event.type, Type::kSchedSwitch);
+  const auto& sswitch = pieces[0].event.sched_switch;
+  ASSERT_EQ(sswitch.prev_pid, 12u);
+  ASSERT_EQ(sswitch.prev_state, 32u);
+  ASSERT_EQ(sswitch.next_pid, 13u);
+  ASSERT_EQ(sswitch.prev_comm().ToStdString(), "proc");
+  // The string points into the trace.
+  ASSERT_GE(sswitch.prev_comm().data(), &raw_trace[pieces[0].offset]);
+  ASSERT_LT(sswitch.prev_comm().data(),
+            &raw_trace[pieces[0].offset + pieces[0].length]);
+
+  ASSERT_EQ(pieces[1].event.type, Type::kCpuFrequency);
+  ASSERT_EQ(pieces[1].event.cpu_frequency.cpu_id, 2u);
+  ASSERT_EQ(pieces[1].event.cpu_frequency.state, 1000u);
+
+  ASSERT_EQ(pieces[2].event.type, Type::kSchedProcessFree);
+  ASSERT_EQ(pieces[2].event.sched_process_free.pid, 12u);
+
+  ASSERT_EQ(pieces[3].event.type, Type::kOther);
+}
+
+TEST_F(ProtoTraceParserTest, LoadWithWorkerPool) {
+  context_.worker_pool.reset(new WorkerPool(2));
+
+  protos::Trace trace;
+  const uint32_t kNumPackets = 50;
+  for (uint32_t i = 0; i < kNumPackets; i++) {
+    auto* bundle = trace.add_packet()->mutable_ftrace_events();
+    bundle->set_cpu(i % 4);
+    auto* event = bundle->add_event();
+    event->set_timestamp(1000 + i);
+    auto* sched_switch = event->mutable_sched_switch();
+    sched_switch->set_prev_pid(i);
+    sched_switch->set_prev_state(32);
+    sched_switch->set_prev_comm("proc");
+    sched_switch->set_next_pid(i + 1);
+  }
+
+  InSequence seq;
+  for (uint32_t i = 0; i < kNumPackets; i++) {
+    EXPECT_CALL(*sched_, PushSchedSwitch(i % 4, 1000 + i, i, 32,
+                                         base::StringView("proc"), i + 1));
+  }
+
+  // Push the trace in small chunks, so that packets span across chunks and
+  // several chunks are in flight on the pool at the same time.
+  std::string raw_trace = trace.SerializeAsString();
+  ProtoTraceTokenizer tokenizer(&context_);
+  const size_t kChunkSize = 7;
+  for (size_t off = 0; off < raw_trace.size(); off += kChunkSize) {
+    size_t size = std::min(kChunkSize, raw_trace.size() - off);
+    std::unique_ptr<uint8_t[]> chunk(new uint8_t[size]);
+    memcpy(chunk.get(), &raw_trace[off], size);
+    tokenizer.Parse(TraceBlobView(std::move(chunk), 0, size));
+  }
+  tokenizer.NotifyEndOfFile();
+}
+
+TEST_F(ProtoTraceParserTest, LoadLargePacketsInTinyChunks) {
+  // Two process trees of a few KB each, i.e. packets much larger than the
+  // chunks and with a multi-byte size in their header.
+  protos::Trace trace;
+  const uint32_t kNumProcesses = 500;
+  std::vector<std::string> names;
+  for (uint32_t i = 0; i < kNumProcesses; i++)
+    names.push_back("proc" + std::to_string(i));
+  for (int32_t pid = 0; pid < 2 * static_cast<int32_t>(kNumProcesses);) {
+    auto* tree = trace.add_packet()->mutable_process_tree();
+    for (const std::string& name : names) {
+      auto* process = tree->add_processes();
+      process->add_cmdline(name);
+      process->set_pid(pid++);
+      process->set_ppid(1);
+    }
+  }
+
+  InSequence seq;
+  for (uint32_t pid = 0; pid < 2 * kNumProcesses; pid++) {
+    EXPECT_CALL(*process_, UpdateProcess(pid, base::StringView(
+                                                  names[pid % kNumProcesses])));
+  }
+
+  std::string raw_trace = trace.SerializeAsString();
+  ProtoTraceTokenizer tokenizer(&context_);
+  for (size_t off = 0; off < raw_trace.size(); off++) {
+    std::unique_ptr<uint8_t[]> chunk(new uint8_t[1]);
+    chunk[0] = static_cast<uint8_t>(raw_trace[off]);
+    ASSERT_TRUE(tokenizer.Parse(TraceBlobView(std::move(chunk), 0, 1)));
+  }
+  tokenizer.NotifyEndOfFile();
+}
+
 TEST_F(ProtoTraceParserTest, LoadCpuFreq) {
   protos::Trace trace_1;
   auto* bundle = trace_1.add_packet()->mutable_ftrace_events();
@@ -16,6 +16,11 @@
 
 #include "src/trace_processor/proto_trace_tokenizer.h"
 
+#include <inttypes.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
 #include <string>
 
 #include "perfetto/base/logging.h"
@@ -26,6 +31,8 @@
 #include "src/trace_processor/sched_tracker.h"
 #include "src/trace_processor/trace_blob_view.h"
 #include "src/trace_processor/trace_sorter.h"
+#include "src/trace_processor/trace_storage.h"
+#include "src/trace_processor/worker_pool.h"
 
 #include "perfetto/trace/trace.pb.h"
 #include "perfetto/trace/trace_packet.pb.h"
@@ -39,101 +46,370 @@ using protozero::proto_utils::MakeTagLengthDelimited;
 using protozero::proto_utils::MakeTagVarInt;
 using protozero::proto_utils::ParseVarInt;
 
-ProtoTraceTokenizer::ProtoTraceTokenizer(TraceProcessorContext* ctx)
-    : trace_sorter_(ctx->sorter.get()) {}
-ProtoTraceTokenizer::~ProtoTraceTokenizer() = default;
-
-bool ProtoTraceTokenizer::Parse(std::unique_ptr<uint8_t[]> owned_buf,
-                                size_t size) {
-  uint8_t* data = &owned_buf[0];
-  if (!partial_buf_.empty()) {
-    // It takes ~5 bytes for a proto preamble + the varint size.
-    const size_t kHeaderBytes = 5;
-    if (PERFETTO_UNLIKELY(partial_buf_.size() < kHeaderBytes)) {
-      size_t missing_len = std::min(kHeaderBytes - partial_buf_.size(), size);
-      partial_buf_.insert(partial_buf_.end(), &data[0], &data[missing_len]);
-      if (partial_buf_.size() < kHeaderBytes)
-        return true;
-      data += missing_len;
-      size -= missing_len;
+namespace {
+
+// What happens to an FtraceEvent outside of the LoadWindow.
+enum class OutOfWindowPolicy {
+  kDrop,
+  // The events which determine the state of a cpu after them (i.e. the
+  // thread running or the frequency) are kept within the margin.
+  kKeepInMargin,
+  // The events which end or rename a thread are always kept: otherwise a tid
+  // which exits before the window would never be freed, and its reuse would
+  // be attributed to the old thread. They are rare.
+  kKeep,
+};
+
+// |field_id| is the id of the payload of the FtraceEvent.
+OutOfWindowPolicy GetOutOfWindowPolicy(uint32_t field_id) {
+  switch (field_id) {
+    case protos::FtraceEvent::kSchedSwitchFieldNumber:
+    case protos::FtraceEvent::kCpuFrequencyFieldNumber:
+      return OutOfWindowPolicy::kKeepInMargin;
+    case protos::FtraceEvent::kSchedProcessFreeFieldNumber:
+    case protos::FtraceEvent::kTaskRenameFieldNumber:
+      return OutOfWindowPolicy::kKeep;
+    default:
+      return OutOfWindowPolicy::kDrop;
+  }
+}
+
+// Reads the timestamp of the FtraceEvent in [data, data + length), which
+// |decoder| is decoding. On the fast path, |decoder| is moved past it.
+PERFETTO_ALWAYS_INLINE
+bool ReadFtraceEventTimestamp(ProtoDecoder* decoder,
+                              const uint8_t* data,
+                              size_t length,
+                              uint64_t* timestamp) {
+  constexpr auto kTimestampFieldNumber =
+      protos::FtraceEvent::kTimestampFieldNumber;
+
+  // Speculate on the fact that the timestamp is often the 1st field of the
+  // event.
+  constexpr auto timestampFieldTag = MakeTagVarInt(kTimestampFieldNumber);
+  if (PERFETTO_LIKELY(length > 10 && data[0] == timestampFieldTag)) {
+    // Fastpath.
+    const uint8_t* next = ParseVarInt(data + 1, data + 11, timestamp);
+    if (next == data + 1)
+      return false;
+    decoder->Reset(next);
+    return true;
+  }
+  // Slowpath.
+  return decoder->FindIntField<kTimestampFieldNumber>(timestamp);
+}
+
+// Returns the payload of the FtraceEvent, i.e. its field which is neither
+// its timestamp nor its pid, reading from the current position of
+// |decoder|. Returns a field with id 0 if there is none.
+PERFETTO_ALWAYS_INLINE
+ProtoDecoder::Field FindFtraceEventPayload(ProtoDecoder* decoder) {
+  for (auto fld = decoder->ReadField(); fld.id != 0;
+       fld = decoder->ReadField()) {
+    if (fld.id != protos::FtraceEvent::kTimestampFieldNumber &&
+        fld.id != protos::FtraceEvent::kPidFieldNumber) {
+      return fld;
+    }
+  }
+  return ProtoDecoder::Field{};
+}
+
+// Whether all the events of the FtraceEventBundle are outside of the window
+// and of its margin, judging by its first and last events: the events of a
+// bundle are those of one cpu, in timestamp order.
+bool IsFtraceBundleOutsideWindow(const uint8_t* data,
+                                 size_t length,
+                                 const LoadWindow& window) {
+  ProtoDecoder decoder(data, length);
+  ProtoDecoder::Field first{};
+  ProtoDecoder::Field last{};
+  for (auto fld = decoder.ReadField(); fld.id != 0; fld = decoder.ReadField()) {
+    if (fld.id == protos::FtraceEventBundle::kEventFieldNumber) {
+      if (first.id == 0)
+        first = fld;
+      last = fld;
     }
+  }
+  if (first.id == 0)
+    return false;
+
+  uint64_t first_ts;
+  uint64_t last_ts;
+  ProtoDecoder first_decoder(first.data(), first.size());
+  ProtoDecoder last_decoder(last.data(), last.size());
+  if (!ReadFtraceEventTimestamp(&first_decoder, first.data(), first.size(),
+                                &first_ts) ||
+      !ReadFtraceEventTimestamp(&last_decoder, last.data(), last.size(),
+                                &last_ts) ||
+      first_ts > last_ts) {
+    return false;
+  }
+  bool before =
+      last_ts < window.start_ts && !window.ContainsWithMargin(last_ts);
+  bool after =
+      first_ts > window.end_ts && !window.ContainsWithMargin(first_ts);
+  return before || after;
+}
+
+}  // namespace
+
+// static
+constexpr uint32_t ProtoTraceTokenizer::TokenizedPiece::kNoCpu;
+constexpr size_t ProtoTraceTokenizer::kMaxPacketHeaderSize;
+
+ProtoTraceTokenizer::ProtoTraceTokenizer(TraceProcessorContext* ctx,
+                                         const LoadWindow& window)
+    : storage_(ctx->storage.get()),
+      trace_sorter_(ctx->sorter.get()),
+      worker_pool_(ctx->worker_pool.get()),
+      window_(window) {}
+
+ProtoTraceTokenizer::~ProtoTraceTokenizer() {
+  // Tasks that are still running on the pool reference the in-flight chunks.
+  for (auto& chunk : in_flight_chunks_)
+    chunk->tokenized_future.wait();
+}
+
+bool ProtoTraceTokenizer::Parse(TraceBlobView blob) {
+  const uint8_t* data = blob.data();
+  size_t size = blob.length();
+  if (partial_header_size_ > 0) {
+    // Complete the TracePacket started in the previous chunks. This consumes
+    // either the whole chunk or the rest of the packet.
+    size_t consumed = 0;
+    if (!AppendToPartialPacket(data, size, &consumed))
+      return false;  // Unrecoverable error, stop parsing.
+    data += consumed;
+    size -= consumed;
+  }
+
+  // Find the end of the last whole TracePacket in this chunk. This is a cheap
+  // walk over the packet headers.
+  ProtoDecoder decoder(data, size);
+  for (auto fld = decoder.ReadField(); fld.id != 0; fld = decoder.ReadField()) {
+  }
+  const size_t whole_size = static_cast<size_t>(decoder.offset());
+  if (whole_size > 0)
+    ParseInternal(blob.slice(blob.offset_of(data), whole_size));
+
+  // The leftover bytes are the beginning of a TracePacket which continues in
+  // the next chunks. Note that |blob| keeps them alive until here.
+  const size_t leftover = size - whole_size;
+  if (leftover > 0) {
+    size_t consumed = 0;
+    if (!AppendToPartialPacket(&data[whole_size], leftover, &consumed))
+      return false;
+    if (consumed < leftover) {
+      // A whole packet that the decoder above didn't accept.
+      PERFETTO_ELOG("Failed parsing a TracePacket from the partial buffer");
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ProtoTraceTokenizer::AppendToPartialPacket(const uint8_t* data,
+                                                size_t size,
+                                                size_t* consumed) {
+  size_t off = 0;
+  if (!partial_packet_) {
+    // Gather the field header (the tag and the varint size) byte by byte,
+    // until the size is known.
+    auto header_complete = [this] {
+      return partial_header_size_ > 1 &&
+             (partial_header_[partial_header_size_ - 1] & 0x80) == 0;
+    };
+    while (off < size && !header_complete() &&
+           partial_header_size_ < kMaxPacketHeaderSize) {
+      partial_header_[partial_header_size_++] = data[off++];
+    }
+    *consumed = off;
+    if (!header_complete() && partial_header_size_ < kMaxPacketHeaderSize)
+      return true;
 
-    // At this point we have enough data in partial_buf_ to read at least the
-    // field header and know the size of the next TracePacket.
     constexpr uint8_t kTracePacketTag =
         MakeTagLengthDelimited(protos::Trace::kPacketFieldNumber);
-    const uint8_t* pos = &partial_buf_[0];
-    uint8_t proto_field_tag = *pos;
+    const uint8_t* header_end = &partial_header_[partial_header_size_];
     uint64_t field_size = 0;
-    const uint8_t* next = ParseVarInt(++pos, &*partial_buf_.end(), &field_size);
-    bool parse_failed = next == pos;
-    pos = next;
-    if (proto_field_tag != kTracePacketTag || field_size == 0 || parse_failed) {
+    const uint8_t* next =
+        ParseVarInt(&partial_header_[1], header_end, &field_size);
+    const uint64_t kMaxFieldSize =
+        std::numeric_limits<uint32_t>::max() - kMaxPacketHeaderSize;
+    if (partial_header_[0] != kTracePacketTag || next != header_end ||
+        field_size == 0 || field_size > kMaxFieldSize) {
       PERFETTO_ELOG("Failed parsing a TracePacket from the partial buffer");
-      return false;  // Unrecoverable error, stop parsing.
+      return false;
     }
 
-    // At this point we know how big the TracePacket is.
-    size_t hdr_size = static_cast<size_t>(pos - &partial_buf_[0]);
-    size_t size_incl_header = static_cast<size_t>(field_size + hdr_size);
-    PERFETTO_DCHECK(size_incl_header > partial_buf_.size());
-
-    // There is a good chance that between the |partial_buf_| and the new |data|
-    // of the current call we have enough bytes to parse a TracePacket.
-    if (partial_buf_.size() + size >= size_incl_header) {
-      // Create a new buffer for the whole TracePacket and copy into that:
-      // 1) The beginning of the TracePacket (including the proto header) from
-      //    the partial buffer.
-      // 2) The rest of the TracePacket from the current |data| buffer (note
-      //    that we might have consumed already a few bytes form |data| earlier
-      //    in this function, hence we need to keep |off| into account).
-      std::unique_ptr<uint8_t[]> buf(new uint8_t[size_incl_header]);
-      memcpy(&buf[0], partial_buf_.data(), partial_buf_.size());
-      // |size_missing| is the number of bytes for the rest of the TracePacket
-      // in |data|.
-      size_t size_missing = size_incl_header - partial_buf_.size();
-      memcpy(&buf[partial_buf_.size()], &data[0], size_missing);
-      data += size_missing;
-      size -= size_missing;
-      partial_buf_.clear();
-      uint8_t* buf_start = &buf[0];  // Note that buf is std::moved below.
-      ParseInternal(std::move(buf), buf_start, size_incl_header);
+    // Now that the size of the TracePacket is known, gather it into a buffer
+    // of the exact size, so that every byte is copied only once however many
+    // chunks the packet spans.
+    partial_packet_size_ =
+        partial_header_size_ + static_cast<size_t>(field_size);
+    partial_packet_.reset(new uint8_t[partial_packet_size_]);
+    memcpy(partial_packet_.get(), partial_header_, partial_header_size_);
+    partial_packet_filled_ = partial_header_size_;
+  }
+
+  size_t len =
+      std::min(partial_packet_size_ - partial_packet_filled_, size - off);
+  memcpy(&partial_packet_[partial_packet_filled_], &data[off], len);
+  partial_packet_filled_ += len;
+  off += len;
+  *consumed = off;
+  if (partial_packet_filled_ < partial_packet_size_)
+    return true;
+
+  TraceBlobView packet(std::move(partial_packet_), 0, partial_packet_size_);
+  partial_header_size_ = 0;
+  partial_packet_size_ = 0;
+  partial_packet_filled_ = 0;
+  ParseInternal(std::move(packet));
+  return true;
+}
+
+void ProtoTraceTokenizer::NotifyEndOfFile() {
+  while (!in_flight_chunks_.empty())
+    ApplyOldestInFlightChunk();
+}
+
+void ProtoTraceTokenizer::ParseInternal(TraceBlobView whole_buf) {
+  const uint8_t* data = whole_buf.data();
+  const size_t whole_size = whole_buf.length();
+  const uint8_t* start = data - whole_buf.offset_of(data);
+
+  if (!worker_pool_) {
+    pieces_.clear();
+    uint32_t invalid_bundles =
+        TokenizeChunk(start, data, whole_size, window_, &pieces_);
+    storage_->AddFtraceBundlesInvalidCpu(invalid_bundles);
+    ApplyPieces(&whole_buf, pieces_);
+    return;
+  }
+
+  // Bound the number of chunks (and hence memory) held in the pipeline. Keep
+  // a couple of chunks per worker queued, so that workers never starve while
+  // this thread is busy applying.
+  const size_t max_in_flight = 2 * worker_pool_->num_threads();
+  while (in_flight_chunks_.size() >= max_in_flight)
+    ApplyOldestInFlightChunk();
+
+  // Note that the TraceBlobView itself is never touched by the worker (its
+  // refcount is not thread safe): the worker reads only the raw bytes, which
+  // are kept alive by |chunk->buffer| until the chunk is applied.
+  std::unique_ptr<InFlightChunk> chunk(new InFlightChunk(std::move(whole_buf)));
+  chunk->tokenized_future = chunk->tokenized.get_future();
+  InFlightChunk* raw_chunk = chunk.get();
+  in_flight_chunks_.emplace_back(std::move(chunk));
+  const LoadWindow window = window_;
+  worker_pool_->PostTask([raw_chunk, start, data, whole_size, window] {
+    raw_chunk->invalid_bundles =
+        TokenizeChunk(start, data, whole_size, window, &raw_chunk->pieces);
+    raw_chunk->tokenized.set_value();
+  });
+
+  // Opportunistically apply the chunks that are ready without blocking.
+  while (!in_flight_chunks_.empty() &&
+         in_flight_chunks_.front()->tokenized_future.wait_for(
+             std::chrono::seconds(0)) == std::future_status::ready) {
+    ApplyOldestInFlightChunk();
+  }
+}
+
+void ProtoTraceTokenizer::ApplyOldestInFlightChunk() {
+  PERFETTO_DCHECK(!in_flight_chunks_.empty());
+  std::unique_ptr<InFlightChunk> chunk = std::move(in_flight_chunks_.front());
+  in_flight_chunks_.pop_front();
+  chunk->tokenized_future.wait();
+  storage_->AddFtraceBundlesInvalidCpu(chunk->invalid_bundles);
+  ApplyPieces(&chunk->buffer, chunk->pieces);
+}
+
+void ProtoTraceTokenizer::ApplyPieces(
+    TraceBlobView* buffer,
+    const std::vector<TokenizedPiece>& pieces) {
+  for (const TokenizedPiece& piece : pieces) {
+    TraceBlobView view = buffer->slice(piece.offset, piece.length);
+    if (piece.cpu == TokenizedPiece::kNoCpu) {
+      // Use parent data and length because we want to parse this again
+      // later to get the exact type of the packet.
+      trace_sorter_->PushTracePacket(last_timestamp_, std::move(view));
+      continue;
+    }
+    last_timestamp_ = piece.timestamp;
+
+    // We don't need to parse this packet, just push it to be sorted with
+    // the timestamp.
+    trace_sorter_->PushFtracePacket(piece.cpu, piece.timestamp,
+                                    std::move(view), piece.event);
+  }
+}
+
+// static
+bool ProtoTraceTokenizer::TokenizeAndSortTrace(
+    const uint8_t* data,
+    size_t size,
+    const LoadWindow& window,
+    std::vector<TokenizedPiece>* pieces,
+    uint32_t* invalid_bundles) {
+  ProtoDecoder decoder(data, size);
+  for (auto fld = decoder.ReadField(); fld.id != 0; fld = decoder.ReadField()) {
+  }
+  const size_t whole_size = static_cast<size_t>(decoder.offset());
+  *invalid_bundles = TokenizeChunk(data, data, whole_size, window, pieces);
+
+  uint64_t last_timestamp = 0;
+  for (TokenizedPiece& piece : *pieces) {
+    if (piece.cpu == TokenizedPiece::kNoCpu) {
+      piece.timestamp = last_timestamp;
     } else {
-      partial_buf_.insert(partial_buf_.end(), data, &data[size]);
-      return true;
+      last_timestamp = piece.timestamp;
     }
   }
-  ParseInternal(std::move(owned_buf), data, size);
-  return true;
+
+  // As in the TraceSorter, the events are mostly sorted already and the
+  // order of those with the same timestamp and source is preserved.
+  std::stable_sort(pieces->begin(), pieces->end(),
+                   [](const TokenizedPiece& a, const TokenizedPiece& b) {
+                     return a.SortsBefore(b);
+                   });
+  return whole_size == size;
 }
 
-void ProtoTraceTokenizer::ParseInternal(std::unique_ptr<uint8_t[]> owned_buf,
-                                        uint8_t* data,
-                                        size_t size) {
-  PERFETTO_DCHECK(data >= &owned_buf[0]);
-  const uint8_t* start = &owned_buf[0];
-  const size_t data_off = static_cast<size_t>(data - start);
-  TraceBlobView whole_buf(std::move(owned_buf), data_off, size);
+// static
+uint32_t ProtoTraceTokenizer::TokenizeChunk(
+    const uint8_t* buf_start,
+    const uint8_t* data,
+    size_t size,
+    const LoadWindow& window,
+    std::vector<TokenizedPiece>* pieces) {
+  uint32_t invalid_bundles = 0;
   ProtoDecoder decoder(data, size);
   for (auto fld = decoder.ReadField(); fld.id != 0; fld = decoder.ReadField()) {
     if (fld.id != protos::Trace::kPacketFieldNumber) {
       PERFETTO_ELOG("Non-trace packet field found in root Trace proto");
       continue;
     }
-    size_t field_offset = static_cast<size_t>(fld.data() - start);
-    ParsePacket(whole_buf.slice(field_offset, fld.size()));
-  }
-
-  const size_t leftover = static_cast<size_t>(size - decoder.offset());
-  if (leftover > 0) {
-    PERFETTO_DCHECK(partial_buf_.empty());
-    partial_buf_.insert(partial_buf_.end(), &data[decoder.offset()],
-                        &data[decoder.offset() + leftover]);
+    // The length of the pieces is 32 bit, their offset is not.
+    if (PERFETTO_UNLIKELY(static_cast<uint64_t>(fld.size()) >
+                          std::numeric_limits<uint32_t>::max())) {
+      PERFETTO_ELOG("Skipping TracePacket larger than 4 GB");
+      continue;
+    }
+    if (!TokenizePacket(buf_start, fld.data(), fld.size(), window, pieces))
+      invalid_bundles++;
   }
+  PERFETTO_DCHECK(decoder.IsEndOfBuffer());
+  return invalid_bundles;
 }
 
-void ProtoTraceTokenizer::ParsePacket(TraceBlobView packet) {
-  ProtoDecoder decoder(packet.data(), packet.length());
+// static
+bool ProtoTraceTokenizer::TokenizePacket(const uint8_t* buf_start,
+                                         const uint8_t* packet,
+                                         size_t size,
+                                         const LoadWindow& window,
+                                         std::vector<TokenizedPiece>* pieces) {
+  ProtoDecoder decoder(packet, size);
 
   // TODO(taylori): Add a timestamp to TracePacket and read it here.
 
@@ -143,24 +419,28 @@ void ProtoTraceTokenizer::ParsePacket(TraceBlobView packet) {
       continue;
 
     if (fld.id == protos::TracePacket::kFtraceEventsFieldNumber) {
-      const size_t fld_off = packet.offset_of(fld.data());
-      ParseFtraceBundle(packet.slice(fld_off, fld.size()));
-      return;
+      return TokenizeFtraceBundle(buf_start, fld.data(), fld.size(), window,
+                                  pieces);
     }
   }
 
-  // Use parent data and length because we want to parse this again
-  // later to get the exact type of the packet.
-  trace_sorter_->PushTracePacket(last_timestamp_, std::move(packet));
+  auto offset = static_cast<size_t>(packet - buf_start);
+  pieces->emplace_back(offset, static_cast<uint32_t>(size),
+                       TokenizedPiece::kNoCpu, 0 /* timestamp */);
   PERFETTO_DCHECK(decoder.IsEndOfBuffer());
+  return true;
 }
 
+// static
 PERFETTO_ALWAYS_INLINE
-void ProtoTraceTokenizer::ParseFtraceBundle(TraceBlobView bundle) {
+bool ProtoTraceTokenizer::TokenizeFtraceBundle(
+    const uint8_t* buf_start,
+    const uint8_t* data,
+    size_t length,
+    const LoadWindow& window,
+    std::vector<TokenizedPiece>* pieces) {
   constexpr auto kCpuFieldNumber = protos::FtraceEventBundle::kCpuFieldNumber;
   constexpr auto kCpuFieldTag = MakeTagVarInt(kCpuFieldNumber);
-  const uint8_t* data = bundle.data();
-  const size_t length = bundle.length();
   ProtoDecoder decoder(data, length);
 
   // For speed we speculate on the location and size (<128) of the cpu field.
@@ -175,16 +455,35 @@ void ProtoTraceTokenizer::ParseFtraceBundle(TraceBlobView bundle) {
   } else {
     if (!PERFETTO_LIKELY((decoder.FindIntField<kCpuFieldNumber>(&cpu)))) {
       PERFETTO_ELOG("CPU field not found in FtraceEventBundle");
-      return;
+      return false;
     }
   }
 
+  // The cpu indexes the queues of the TraceSorter and the per-cpu tables.
+  if (PERFETTO_UNLIKELY(cpu >= base::kMaxCpus)) {
+    PERFETTO_ELOG("FtraceEventBundle with invalid cpu %" PRIu64, cpu);
+    return false;
+  }
+
+  // When the whole bundle is beyond the margin of the window, only the events
+  // which are kept anywhere (see OutOfWindowPolicy) are tokenized: the others
+  // are skipped without reading their timestamp.
+  const bool outside_window = !window.IsUnbounded() &&
+                              IsFtraceBundleOutsideWindow(data, length, window);
+
   for (auto fld = decoder.ReadField(); fld.id != 0; fld = decoder.ReadField()) {
     switch (fld.id) {
       case protos::FtraceEventBundle::kEventFieldNumber: {
-        const size_t fld_off = bundle.offset_of(fld.data());
+        if (PERFETTO_UNLIKELY(outside_window)) {
+          ProtoDecoder event_decoder(fld.data(), fld.size());
+          auto policy =
+              GetOutOfWindowPolicy(FindFtraceEventPayload(&event_decoder).id);
+          if (policy != OutOfWindowPolicy::kKeep)
+            break;
+        }
         auto cpu_32 = static_cast<uint32_t>(cpu);
-        ParseFtraceEvent(cpu_32, bundle.slice(fld_off, fld.size()));
+        TokenizeFtraceEvent(buf_start, cpu_32, fld.data(), fld.size(), window,
+                            pieces);
         break;
       }
       default:
@@ -192,41 +491,47 @@ void ProtoTraceTokenizer::ParseFtraceBundle(TraceBlobView bundle) {
     }
   }
   PERFETTO_DCHECK(decoder.IsEndOfBuffer());
+  return true;
 }
 
+// static
 PERFETTO_ALWAYS_INLINE
-void ProtoTraceTokenizer::ParseFtraceEvent(uint32_t cpu, TraceBlobView event) {
-  constexpr auto kTimestampFieldNumber =
-      protos::FtraceEvent::kTimestampFieldNumber;
-  const uint8_t* data = event.data();
-  const size_t length = event.length();
+void ProtoTraceTokenizer::TokenizeFtraceEvent(
+    const uint8_t* buf_start,
+    uint32_t cpu,
+    const uint8_t* data,
+    size_t length,
+    const LoadWindow& window,
+    std::vector<TokenizedPiece>* pieces) {
   ProtoDecoder decoder(data, length);
   uint64_t timestamp;
-  bool timestamp_found = false;
-
-  // Speculate on the fact that the timestamp is often the 1st field of the
-  // event.
-  constexpr auto timestampFieldTag = MakeTagVarInt(kTimestampFieldNumber);
-  if (PERFETTO_LIKELY(length > 10 && data[0] == timestampFieldTag)) {
-    // Fastpath.
-    const uint8_t* next = ParseVarInt(data + 1, data + 11, &timestamp);
-    timestamp_found = next != data + 1;
-    decoder.Reset(next);
-  } else {
-    // Slowpath.
-    timestamp_found = decoder.FindIntField<kTimestampFieldNumber>(&timestamp);
-  }
-
-  if (PERFETTO_UNLIKELY(!timestamp_found)) {
+  if (PERFETTO_UNLIKELY(
+          !ReadFtraceEventTimestamp(&decoder, data, length, &timestamp))) {
     PERFETTO_ELOG("Timestamp field not found in FtraceEvent");
     return;
   }
 
-  last_timestamp_ = timestamp;
+  ProtoDecoder::Field payload = FindFtraceEventPayload(&decoder);
 
-  // We don't need to parse this packet, just push it to be sorted with
-  // the timestamp.
-  trace_sorter_->PushFtracePacket(cpu, timestamp, std::move(event));
+  // Outside of the window, only the events which the state at the edges of
+  // the window depends on are kept (see OutOfWindowPolicy).
+  if (PERFETTO_UNLIKELY(!window.Contains(timestamp))) {
+    OutOfWindowPolicy policy = GetOutOfWindowPolicy(payload.id);
+    if (policy == OutOfWindowPolicy::kDrop ||
+        (policy == OutOfWindowPolicy::kKeepInMargin &&
+         !window.ContainsWithMargin(timestamp))) {
+      return;
+    }
+  }
+
+  DecodedFtraceEvent event;
+  if (payload.id != 0 && payload.type == kFieldTypeLengthDelimited) {
+    event = DecodedFtraceEvent::Decode(payload.id, payload.data(),
+                                       payload.size());
+  }
+  auto offset = static_cast<size_t>(data - buf_start);
+  pieces->emplace_back(offset, static_cast<uint32_t>(length), cpu, timestamp,
+                       event);
 }
 
 }  // namespace trace_processor
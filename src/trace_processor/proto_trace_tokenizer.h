@@ -19,47 +19,184 @@
 
 #include <stdint.h>
 
+#include <deque>
+#include <future>
+#include <limits>
 #include <memory>
 #include <vector>
 
+#include "src/trace_processor/basic_types.h"
 #include "src/trace_processor/chunked_trace_reader.h"
+#include "src/trace_processor/decoded_ftrace_event.h"
+#include "src/trace_processor/trace_blob_view.h"
 
 namespace perfetto {
 namespace trace_processor {
 
 class TraceProcessorContext;
-class TraceBlobView;
 class TraceSorter;
+class TraceStorage;
+class WorkerPool;
 
 // Reads a protobuf trace in chunks and extracts boundaries of trace packets
 // (or subfields, for the case of ftrace) with their timestamps.
+//
+// Tokenization happens in two steps:
+// 1) TokenizeChunk() walks a chunk of whole TracePackets and decodes the
+//    FtraceEventBundles, producing a list of TokenizedPiece (offset, length,
+//    cpu and timestamp of each ftrace event or non-ftrace packet). The
+//    payload of the ftrace events which the parser stores is decoded too,
+//    into a DecodedFtraceEvent, so that the parser only applies it. This
+//    step only reads the chunk and can run on any thread.
+// 2) ApplyPieces() slices the chunk according to the pieces and pushes them
+//    into the TraceSorter, in the same order as they appear in the trace.
+// If the context has a WorkerPool, step 1) of each chunk is posted to the
+// pool and step 2) happens when the chunk gets to the head of the queue of
+// in-flight chunks, either in a later Parse() call or in NotifyEndOfFile().
+//
+// Ftrace events outside of the LoadWindow are dropped in step 1), so that
+// they are never copied, sorted or decoded, except for those the state in the
+// window depends on. Bundles entirely beyond the margin of the window are
+// only scanned for the events which are always kept.
 class ProtoTraceTokenizer : public ChunkedTraceReader {
  public:
   // |reader| is the abstract method of getting chunks of size |chunk_size_b|
   // from a trace file with these chunks parsed into |trace|.
-  explicit ProtoTraceTokenizer(TraceProcessorContext*);
+  explicit ProtoTraceTokenizer(TraceProcessorContext*,
+                               const LoadWindow& = LoadWindow());
   ~ProtoTraceTokenizer() override;
 
   // ChunkedTraceReader implementation.
-  bool Parse(std::unique_ptr<uint8_t[]>, size_t size) override;
+  bool Parse(TraceBlobView) override;
+  void NotifyEndOfFile() override;
+
+  struct TokenizedPiece {
+    static constexpr uint32_t kNoCpu = std::numeric_limits<uint32_t>::max();
+
+    TokenizedPiece(size_t o,
+                   uint32_t l,
+                   uint32_t c,
+                   uint64_t ts,
+                   const DecodedFtraceEvent& e = DecodedFtraceEvent())
+        : offset(o), timestamp(ts), length(l), cpu(c), event(e) {}
+
+    // The order of the TraceSorter: by timestamp, then non-ftrace packets
+    // before ftrace events and by cpu (kNoCpu + 1 wraps around to 0).
+    bool SortsBefore(const TokenizedPiece& o) const {
+      return timestamp < o.timestamp ||
+             (timestamp == o.timestamp && cpu + 1 < o.cpu + 1);
+    }
+
+    // Relative to the start of the chunk buffer, which can be a whole trace
+    // file of more than 4 GB (see TokenizeAndSortTrace()).
+    size_t offset;
+    // Only valid for ftrace events, unless set by TokenizeAndSortTrace().
+    uint64_t timestamp;
+    uint32_t length;
+    uint32_t cpu;  // kNoCpu for non-ftrace packets.
+    // The payload of ftrace events, decoded along with the timestamp.
+    DecodedFtraceEvent event;
+  };
+
+  // Tokenizes a whole trace held in [data, data + size) and sorts the pieces
+  // in the order in which the TraceSorter would pass them to the parser.
+  // Non-ftrace packets get the timestamp of the last ftrace event before
+  // them. Doesn't touch any state, so that several traces can be tokenized
+  // at once on different threads. Returns false if the trace is truncated,
+  // in which case the pieces of the whole packets are still returned.
+  // |invalid_bundles| is set to the number of FtraceEventBundles dropped
+  // because of an invalid cpu.
+  static bool TokenizeAndSortTrace(const uint8_t* data,
+                                   size_t size,
+                                   const LoadWindow&,
+                                   std::vector<TokenizedPiece>*,
+                                   uint32_t* invalid_bundles);
 
  private:
-  void ParseInternal(std::unique_ptr<uint8_t[]> owned_buf,
-                     uint8_t* data,
-                     size_t size);
-  void ParsePacket(TraceBlobView);
-  void ParseFtraceBundle(TraceBlobView);
-  void ParseFtraceEvent(uint32_t cpu, TraceBlobView);
+  // A chunk whose tokenization has been posted on the WorkerPool.
+  struct InFlightChunk {
+    explicit InFlightChunk(TraceBlobView b) : buffer(std::move(b)) {}
+
+    TraceBlobView buffer;
+    std::vector<TokenizedPiece> pieces;
+    uint32_t invalid_bundles = 0;
+    std::promise<void> tokenized;
+    std::future<void> tokenized_future;
+  };
+
+  // Tokenizes the sequence of whole TracePackets in [data, data + size).
+  // |buf_start| is the beginning of the chunk buffer, used to compute the
+  // offsets of the pieces. Doesn't touch any member, so that it can be
+  // invoked on a worker thread. Returns the number of FtraceEventBundles
+  // dropped because their cpu is missing or out of range, which the caller
+  // adds to the stats of the storage.
+  static uint32_t TokenizeChunk(const uint8_t* buf_start,
+                                const uint8_t* data,
+                                size_t size,
+                                const LoadWindow&,
+                                std::vector<TokenizedPiece>*);
+  // These two return false if the packet is an FtraceEventBundle with an
+  // invalid cpu, in which case no piece is emitted for it.
+  static bool TokenizePacket(const uint8_t* buf_start,
+                             const uint8_t* packet,
+                             size_t size,
+                             const LoadWindow&,
+                             std::vector<TokenizedPiece>*);
+  static bool TokenizeFtraceBundle(const uint8_t* buf_start,
+                                   const uint8_t* bundle,
+                                   size_t size,
+                                   const LoadWindow&,
+                                   std::vector<TokenizedPiece>*);
+  static void TokenizeFtraceEvent(const uint8_t* buf_start,
+                                  uint32_t cpu,
+                                  const uint8_t* event,
+                                  size_t size,
+                                  const LoadWindow&,
+                                  std::vector<TokenizedPiece>*);
 
+  // Appends the bytes of a TracePacket that spans several chunks. Reads the
+  // packet size from its header and then copies the fragments into a buffer
+  // of the exact size, which is parsed as soon as it is full. Sets
+  // |consumed| to the bytes used, which are fewer than |size| only if the
+  // packet got completed. Returns false if the packet header is invalid.
+  bool AppendToPartialPacket(const uint8_t* data,
+                             size_t size,
+                             size_t* consumed);
+
+  // Tokenizes a buffer of whole TracePackets and pushes them to the sorter.
+  void ParseInternal(TraceBlobView whole_packets);
+  void ApplyPieces(TraceBlobView* buffer, const std::vector<TokenizedPiece>&);
+
+  // Waits for the tokenization of the oldest in-flight chunk and applies it.
+  void ApplyOldestInFlightChunk();
+
+  TraceStorage* const storage_;
   TraceSorter* const trace_sorter_;
+  WorkerPool* const worker_pool_;
+  const LoadWindow window_;
+
+  // Tag and varint size of a TracePacket field.
+  static constexpr size_t kMaxPacketHeaderSize = 1 + 10;
 
   // Used to glue together trace packets that span across two (or more)
-  // Parse() boundaries.
-  std::vector<uint8_t> partial_buf_;
+  // Parse() boundaries. The header is gathered first in |partial_header_|;
+  // once it is complete, |partial_packet_| is allocated with the size of the
+  // whole packet and filled as the next chunks arrive.
+  uint8_t partial_header_[kMaxPacketHeaderSize];
+  size_t partial_header_size_ = 0;  // 0 if no packet is partially read.
+  std::unique_ptr<uint8_t[]> partial_packet_;
+  size_t partial_packet_size_ = 0;
+  size_t partial_packet_filled_ = 0;
 
   // Temporary. Currently trace packets do not have a timestamp, so the
   // timestamp given is last_timestamp.
   uint64_t last_timestamp_ = 0;
+
+  // Scratch buffer used when tokenizing on the calling thread.
+  std::vector<TokenizedPiece> pieces_;
+
+  // Chunks posted on the |worker_pool_|, in trace order.
+  std::deque<std::unique_ptr<InFlightChunk>> in_flight_chunks_;
 };
 
 }  // namespace trace_processor
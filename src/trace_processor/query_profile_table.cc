@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/query_profile_table.h"
+
+#include <sqlite3.h>
+
+namespace perfetto {
+namespace trace_processor {
+
+namespace {
+
+void ResultString(sqlite3_context* context, const std::string& str) {
+  sqlite3_result_text(context, str.data(), static_cast<int>(str.size()),
+                      nullptr);
+}
+
+void ResultUint64(sqlite3_context* context, uint64_t value) {
+  sqlite3_result_int64(context, static_cast<sqlite3_int64>(value));
+}
+
+}  // namespace
+
+QueryProfileTable::QueryProfileTable(const TraceStorage*) {}
+
+void QueryProfileTable::RegisterTable(sqlite3* db,
+                                      const TraceStorage* storage) {
+  Table::Register<QueryProfileTable>(db, storage,
+                                     "CREATE TABLE query_profile("
+                                     "query_id UNSIGNED BIG INT, "
+                                     "sql STRING, "
+                                     "table_name STRING, "
+                                     "constraints STRING, "
+                                     "sqlite_constraints STRING, "
+                                     "order_by STRING, "
+                                     "filter_calls UNSIGNED BIG INT, "
+                                     "next_calls UNSIGNED BIG INT, "
+                                     "column_calls UNSIGNED BIG INT, "
+                                     "rows_produced UNSIGNED BIG INT, "
+                                     "rows_rejected UNSIGNED BIG INT, "
+                                     "filter_ns UNSIGNED BIG INT, "
+                                     "time_ns UNSIGNED BIG INT, "
+                                     "PRIMARY KEY(query_id, table_name, "
+                                     "constraints, sqlite_constraints, "
+                                     "order_by)"
+                                     ") WITHOUT ROWID;");
+}
+
+std::unique_ptr<Table::Cursor> QueryProfileTable::CreateCursor() {
+  return std::unique_ptr<Table::Cursor>(new Cursor());
+}
+
+int QueryProfileTable::BestIndex(const QueryConstraints&,
+                                 BestIndexInfo* info) {
+  info->order_by_consumed = false;  // Delegate sorting to SQLite.
+  info->estimated_cost = static_cast<uint32_t>(QueryProfiler::kMaxQueries);
+  return SQLITE_OK;
+}
+
+QueryProfileTable::Cursor::Cursor() = default;
+QueryProfileTable::Cursor::~Cursor() = default;
+
+int QueryProfileTable::Cursor::Filter(const QueryConstraints&,
+                                      sqlite3_value** /*argv*/) {
+  rows_.clear();
+  row_ = 0;
+
+  // The profiler of the query reading this table holds the profiles of the
+  // queries which preceded it.
+  const QueryProfiler* profiler = QueryProfiler::current();
+  if (!profiler)
+    return SQLITE_OK;
+  for (const QueryProfile& query : profiler->completed()) {
+    for (const TableStats& table : query.tables)
+      rows_.emplace_back(Row{&query, &table});
+  }
+  return SQLITE_OK;
+}
+
+int QueryProfileTable::Cursor::Next() {
+  row_++;
+  return SQLITE_OK;
+}
+
+int QueryProfileTable::Cursor::Eof() {
+  return row_ >= rows_.size();
+}
+
+int QueryProfileTable::Cursor::Column(sqlite3_context* context, int N) {
+  const QueryProfile& query = *rows_[row_].query;
+  const TableStats& table = *rows_[row_].table;
+  switch (N) {
+    case Column::kQueryId:
+      ResultUint64(context, query.query_id);
+      break;
+    case Column::kSql:
+      ResultString(context, query.sql);
+      break;
+    case Column::kTableName:
+      ResultString(context, table.table_name);
+      break;
+    case Column::kConstraints:
+      ResultString(context, table.constraints);
+      break;
+    case Column::kSqliteConstraints:
+      ResultString(context, table.sqlite_constraints);
+      break;
+    case Column::kOrderBy:
+      ResultString(context, table.order_by);
+      break;
+    case Column::kFilterCalls:
+      ResultUint64(context, table.filter.calls);
+      break;
+    case Column::kNextCalls:
+      ResultUint64(context, table.next.calls);
+      break;
+    case Column::kColumnCalls:
+      ResultUint64(context, table.column.calls);
+      break;
+    case Column::kRows:
+      ResultUint64(context, table.rows);
+      break;
+    case Column::kRowsRejected:
+      ResultUint64(context, table.rows_rejected);
+      break;
+    case Column::kFilterNs:
+      ResultUint64(context, table.filter.sampled_ns);
+      break;
+    case Column::kTimeNs:
+      ResultUint64(context, table.filter.sampled_ns +
+                                table.next.EstimatedNs() +
+                                table.column.EstimatedNs());
+      break;
+  }
+  return SQLITE_OK;
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
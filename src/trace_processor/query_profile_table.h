@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_QUERY_PROFILE_TABLE_H_
+#define SRC_TRACE_PROCESSOR_QUERY_PROFILE_TABLE_H_
+
+#include <memory>
+#include <vector>
+
+#include "src/trace_processor/query_profiler.h"
+#include "src/trace_processor/table.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+class QueryConstraints;
+class TraceStorage;
+
+// A virtual table listing, for each of the last queries run, the virtual
+// tables it accessed with the constraints pushed down to them and the work
+// they did (see QueryProfiler). For instance, the rows of the last query which
+// SQLite filtered itself are:
+//   SELECT table_name, sqlite_constraints, rows_rejected FROM query_profile
+//   WHERE query_id = (SELECT MAX(query_id) FROM query_profile)
+class QueryProfileTable : public Table {
+ public:
+  enum Column {
+    kQueryId = 0,
+    kSql = 1,
+    kTableName = 2,
+    kConstraints = 3,
+    kSqliteConstraints = 4,
+    kOrderBy = 5,
+    kFilterCalls = 6,
+    kNextCalls = 7,
+    kColumnCalls = 8,
+    kRows = 9,
+    kRowsRejected = 10,
+    kFilterNs = 11,
+    kTimeNs = 12,
+  };
+
+  QueryProfileTable(const TraceStorage*);
+
+  static void RegisterTable(sqlite3* db, const TraceStorage* storage);
+
+  // Table implementation.
+  std::unique_ptr<Table::Cursor> CreateCursor() override;
+  int BestIndex(const QueryConstraints&, BestIndexInfo*) override;
+
+ private:
+  using QueryProfile = QueryProfiler::QueryProfile;
+  using TableStats = QueryProfiler::TableStats;
+
+  // Implementation of the SQLite cursor interface.
+  class Cursor : public Table::Cursor {
+   public:
+    Cursor();
+    ~Cursor() override;
+
+    // Implementation of Table::Cursor.
+    int Filter(const QueryConstraints&, sqlite3_value**) override;
+    int Next() override;
+    int Eof() override;
+    int Column(sqlite3_context*, int N) override;
+
+   private:
+    struct Row {
+      const QueryProfile* query;
+      const TableStats* table;
+    };
+
+    // The profiles of the completed queries are not modified while the
+    // query reading them runs.
+    std::vector<Row> rows_;
+    size_t row_ = 0;
+  };
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_QUERY_PROFILE_TABLE_H_
@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/query_profile_table.h"
+#include "src/trace_processor/process_table.h"
+#include "src/trace_processor/process_tracker.h"
+#include "src/trace_processor/scoped_db.h"
+#include "src/trace_processor/trace_processor_context.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+class QueryProfileTableUnittest : public ::testing::Test {
+ public:
+  QueryProfileTableUnittest() {
+    sqlite3* db = nullptr;
+    PERFETTO_CHECK(sqlite3_open(":memory:", &db) == SQLITE_OK);
+    db_.reset(db);
+
+    context_.storage.reset(new TraceStorage());
+    context_.process_tracker.reset(new ProcessTracker(&context_));
+
+    ProcessTable::RegisterTable(db_.get(), context_.storage.get());
+    QueryProfileTable::RegisterTable(db_.get(), context_.storage.get());
+  }
+
+  // Runs |sql| to completion as TraceProcessor does, and returns the number
+  // of rows.
+  int RunProfiledQuery(const std::string& sql) {
+    QueryProfiler::Scope scope(&profiler_, sql);
+    PrepareValidStatement(sql);
+    int rows = 0;
+    while (sqlite3_step(*stmt_) == SQLITE_ROW)
+      rows++;
+    stmt_.reset();
+    return rows;
+  }
+
+  void PrepareValidStatement(const std::string& sql) {
+    int size = static_cast<int>(sql.size());
+    sqlite3_stmt* stmt;
+    ASSERT_EQ(sqlite3_prepare_v2(*db_, sql.c_str(), size, &stmt, nullptr),
+              SQLITE_OK);
+    stmt_.reset(stmt);
+  }
+
+  const char* GetColumnAsText(int colId) {
+    return reinterpret_cast<const char*>(sqlite3_column_text(*stmt_, colId));
+  }
+
+  ~QueryProfileTableUnittest() override { context_.storage->ResetStorage(); }
+
+ protected:
+  TraceProcessorContext context_;
+  QueryProfiler profiler_;
+  ScopedDb db_;
+  ScopedStmt stmt_;
+};
+
+TEST_F(QueryProfileTableUnittest, RowsRejectedBySqlite) {
+  context_.process_tracker->UpdateProcess(1, "p1");
+  context_.process_tracker->UpdateProcess(2, "p2");
+  context_.process_tracker->UpdateProcess(3, "p3");
+  context_.process_tracker->UpdateProcess(4, "p4");
+
+  ASSERT_EQ(RunProfiledQuery("SELECT name FROM process WHERE pid > 2"), 2);
+
+  QueryProfiler::Scope scope(&profiler_, "");
+  PrepareValidStatement(
+      "SELECT query_id, table_name, constraints, sqlite_constraints, "
+      "filter_calls, rows_produced, rows_rejected FROM query_profile");
+  ASSERT_EQ(sqlite3_step(*stmt_), SQLITE_ROW);
+  ASSERT_EQ(sqlite3_column_int(*stmt_, 0), 1);
+  ASSERT_STREQ(GetColumnAsText(1), "process");
+  ASSERT_STREQ(GetColumnAsText(2), "pid > ?");
+  ASSERT_STREQ(GetColumnAsText(3), "pid > ?");
+  ASSERT_EQ(sqlite3_column_int(*stmt_, 4), 1);
+  ASSERT_EQ(sqlite3_column_int(*stmt_, 5), 4);
+  ASSERT_EQ(sqlite3_column_int(*stmt_, 6), 2);
+  ASSERT_EQ(sqlite3_step(*stmt_), SQLITE_DONE);
+}
+
+TEST_F(QueryProfileTableUnittest, KeepsLastQueries) {
+  context_.process_tracker->UpdateProcess(1, "p1");
+
+  const size_t kQueries = QueryProfiler::kMaxQueries + 2;
+  for (size_t i = 0; i < kQueries; i++)
+    RunProfiledQuery("SELECT * FROM process WHERE upid = 1");
+
+  QueryProfiler::Scope scope(&profiler_, "");
+  PrepareValidStatement(
+      "SELECT MIN(query_id), MAX(query_id), COUNT(*), sql, rows_rejected "
+      "FROM query_profile");
+  ASSERT_EQ(sqlite3_step(*stmt_), SQLITE_ROW);
+  ASSERT_EQ(sqlite3_column_int64(*stmt_, 0), 3);
+  ASSERT_EQ(sqlite3_column_int64(*stmt_, 1), static_cast<int64_t>(kQueries));
+  ASSERT_EQ(sqlite3_column_int64(*stmt_, 2),
+            static_cast<int64_t>(QueryProfiler::kMaxQueries));
+  ASSERT_STREQ(GetColumnAsText(3), "SELECT * FROM process WHERE upid = 1");
+  ASSERT_EQ(sqlite3_column_int(*stmt_, 4), 0);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
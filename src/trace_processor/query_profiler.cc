@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/query_profiler.h"
+
+#include "perfetto/base/logging.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+namespace {
+
+thread_local QueryProfiler* g_current_profiler = nullptr;
+
+}  // namespace
+
+constexpr size_t QueryProfiler::kMaxQueries;
+constexpr uint64_t QueryProfiler::kSamplingPeriod;
+
+QueryProfiler::Scope::Scope(QueryProfiler* profiler, const std::string& sql)
+    : profiler_(profiler), prev_(g_current_profiler) {
+  PERFETTO_DCHECK(profiler_ != prev_);
+  profiler_->running_ = QueryProfile();
+  profiler_->running_.query_id = ++profiler_->last_query_id_;
+  profiler_->running_.sql = sql;
+  g_current_profiler = profiler_;
+}
+
+QueryProfiler::Scope::~Scope() {
+  PERFETTO_DCHECK(g_current_profiler == profiler_);
+  g_current_profiler = prev_;
+  auto* completed = &profiler_->completed_;
+  if (completed->size() == kMaxQueries)
+    completed->pop_front();
+  completed->emplace_back(std::move(profiler_->running_));
+  profiler_->running_ = QueryProfile();
+}
+
+QueryProfiler::QueryProfiler() = default;
+QueryProfiler::~QueryProfiler() = default;
+
+// static
+QueryProfiler* QueryProfiler::current() {
+  return g_current_profiler;
+}
+
+QueryProfiler::TableStats* QueryProfiler::GetTableStats(
+    const std::string& table_name,
+    const std::string& constraints,
+    const std::string& order_by,
+    const std::string& sqlite_constraints) {
+  for (TableStats& stats : running_.tables) {
+    if (stats.table_name == table_name && stats.constraints == constraints &&
+        stats.order_by == order_by &&
+        stats.sqlite_constraints == sqlite_constraints) {
+      return &stats;
+    }
+  }
+  running_.tables.emplace_back();
+  TableStats* stats = &running_.tables.back();
+  stats->table_name = table_name;
+  stats->constraints = constraints;
+  stats->order_by = order_by;
+  stats->sqlite_constraints = sqlite_constraints;
+  return stats;
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_QUERY_PROFILER_H_
+#define SRC_TRACE_PROCESSOR_QUERY_PROFILER_H_
+
+#include <stdint.h>
+
+#include <deque>
+#include <string>
+
+namespace perfetto {
+namespace trace_processor {
+
+// Collects, for each query, how SQLite used the virtual tables: the
+// constraints pushed down to each table, the number of calls to the cursor
+// methods, the rows produced and the time spent in the table. The profiles of
+// the last kMaxQueries queries are kept and exposed by the query_profile
+// table (see QueryProfileTable).
+//
+// The counters are always collected, as they cost about as much as the
+// virtual call they wrap. Timing is only sampled for Next() and Column(),
+// which are called for each row, and extrapolated.
+class QueryProfiler {
+ public:
+  static constexpr size_t kMaxQueries = 16;
+
+  // Next() and Column() calls are timed once every kSamplingPeriod calls.
+  static constexpr uint64_t kSamplingPeriod = 64;
+
+  struct CallStats {
+    // Estimated time spent in all the calls.
+    uint64_t EstimatedNs() const {
+      return sampled_calls ? sampled_ns * calls / sampled_calls : 0;
+    }
+
+    uint64_t calls = 0;
+    uint64_t sampled_calls = 0;
+    uint64_t sampled_ns = 0;
+  };
+
+  // The accesses of a query to a table with the same set of constraints.
+  struct TableStats {
+    std::string table_name;
+
+    // Constraints and ORDER BY handled by the table, e.g. "ts >= ?, cpu = ?".
+    std::string constraints;
+    std::string order_by;
+
+    // Constraints which SQLite checks itself on each row produced.
+    std::string sqlite_constraints;
+
+    CallStats filter;
+    CallStats next;
+    CallStats column;
+
+    // Rows produced by the table.
+    uint64_t rows = 0;
+
+    // Rows on which SQLite read only the columns of |sqlite_constraints|
+    // before moving on: an upper bound of the rows it rejected, exact unless
+    // the query reads no other column of the table (e.g. COUNT(*)).
+    uint64_t rows_rejected = 0;
+  };
+
+  struct QueryProfile {
+    uint64_t query_id = 0;
+    std::string sql;
+
+    // Never reallocated, as cursors point to the stats they update.
+    std::deque<TableStats> tables;
+  };
+
+  // Profiles the query run on the current thread while in scope.
+  class Scope {
+   public:
+    Scope(QueryProfiler*, const std::string& sql);
+    ~Scope();
+
+   private:
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+    QueryProfiler* const profiler_;
+    QueryProfiler* const prev_;
+  };
+
+  QueryProfiler();
+  ~QueryProfiler();
+
+  // Returns the profiler of the query running on the current thread, if any.
+  static QueryProfiler* current();
+
+  // Returns the stats for the running query which match the arguments,
+  // creating them on first use.
+  TableStats* GetTableStats(const std::string& table_name,
+                            const std::string& constraints,
+                            const std::string& order_by,
+                            const std::string& sqlite_constraints);
+
+  uint64_t running_query_id() const { return running_.query_id; }
+
+  // Oldest first. Doesn't include the running query.
+  const std::deque<QueryProfile>& completed() const { return completed_; }
+
+ private:
+  QueryProfiler(const QueryProfiler&) = delete;
+  QueryProfiler& operator=(const QueryProfiler&) = delete;
+
+  uint64_t last_query_id_ = 0;
+  QueryProfile running_;
+  std::deque<QueryProfile> completed_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_QUERY_PROFILER_H_
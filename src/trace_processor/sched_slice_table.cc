@@ -34,49 +34,6 @@ using namespace sqlite_utils;
 
 constexpr uint64_t kUint64Max = std::numeric_limits<uint64_t>::max();
 
-template <size_t N = base::kMaxCpus>
-bool PopulateFilterBitmap(int op,
-                          sqlite3_value* value,
-                          std::bitset<N>* filter) {
-  bool constraint_implemented = true;
-  int64_t int_value = sqlite3_value_int64(value);
-  if (IsOpGe(op) || IsOpGt(op)) {
-    // If the operator is gt, then add one to the upper bound.
-    int_value = IsOpGt(op) ? int_value + 1 : int_value;
-
-    // Set to false all values less than |int_value|.
-    size_t ub = static_cast<size_t>(std::max<int64_t>(0, int_value));
-    ub = std::min(ub, filter->size());
-    for (size_t i = 0; i < ub; i++) {
-      filter->set(i, false);
-    }
-  } else if (IsOpLe(op) || IsOpLt(op)) {
-    // If the operator is lt, then minus one to the lower bound.
-    int_value = IsOpLt(op) ? int_value - 1 : int_value;
-
-    // Set to false all values greater than |int_value|.
-    size_t lb = static_cast<size_t>(std::max<int64_t>(0, int_value));
-    lb = std::min(lb, filter->size());
-    for (size_t i = lb; i < filter->size(); i++) {
-      filter->set(i, false);
-    }
-  } else if (IsOpEq(op)) {
-    if (int_value >= 0 && static_cast<size_t>(int_value) < filter->size()) {
-      // If the value is in bounds, set all bits to false and restore the value
-      // of the bit at the specified index.
-      bool existing = filter->test(static_cast<size_t>(int_value));
-      filter->reset();
-      filter->set(static_cast<size_t>(int_value), existing);
-    } else {
-      // If the index is out of bounds, nothing should match.
-      filter->reset();
-    }
-  } else {
-    constraint_implemented = false;
-  }
-  return constraint_implemented;
-}
-
 template <class T>
 inline int Compare(T first, T second, bool desc) {
   if (first < second) {
@@ -87,6 +44,31 @@ inline int Compare(T first, T second, bool desc) {
   return 0;
 }
 
+// Returns whether |order_by| sorts the slices of each CPU by timestamp, in
+// which case they can be merged rather than sorted. Sets |desc| if the
+// timestamps are in descending order.
+bool IsTimestampOrder(const std::vector<QueryConstraints::OrderBy>& order_by,
+                      bool* desc) {
+  bool has_timestamp = false;
+  *desc = false;
+  for (const auto& ob : order_by) {
+    switch (ob.iColumn) {
+      case SchedSliceTable::Column::kCpu:
+        break;
+      case SchedSliceTable::Column::kTimestamp:
+      case SchedSliceTable::Column::kQuantizedGroup:
+        if (has_timestamp && ob.desc != *desc)
+          return false;
+        has_timestamp = true;
+        *desc = ob.desc;
+        break;
+      default:
+        return false;
+    }
+  }
+  return true;
+}
+
 }  // namespace
 
 SchedSliceTable::SchedSliceTable(const TraceStorage* storage)
@@ -109,12 +91,13 @@ void SchedSliceTable::RegisterTable(sqlite3* db, const TraceStorage* storage) {
 }
 
 std::unique_ptr<Table::Cursor> SchedSliceTable::CreateCursor() {
-  return std::unique_ptr<Table::Cursor>(new Cursor(storage_));
+  return std::unique_ptr<Table::Cursor>(new Cursor(storage_, &utid_index_));
 }
 
 int SchedSliceTable::BestIndex(const QueryConstraints& qc,
                                BestIndexInfo* info) {
   bool is_time_constrained = false;
+  bool is_utid_constrained = false;
   for (size_t i = 0; i < qc.constraints().size(); i++) {
     const auto& cs = qc.constraints()[i];
 
@@ -133,21 +116,25 @@ int SchedSliceTable::BestIndex(const QueryConstraints& qc,
         cs.iColumn == Column::kTimestamp) {
       is_time_constrained = true;
     }
+
+    if (cs.iColumn == Column::kUtid && IsOpEq(cs.op))
+      is_utid_constrained = true;
   }
 
-  info->estimated_cost = is_time_constrained ? 10 : 10000;
+  // The slices of a thread are looked up through |utid_index_|.
+  if (is_utid_constrained) {
+    info->estimated_cost = is_time_constrained ? 1 : 5;
+  } else {
+    info->estimated_cost = is_time_constrained ? 10 : 10000;
+  }
 
-  bool is_quantized_group_order_desc = false;
-  bool is_duration_timestamp_order = false;
+  bool is_time_order = false;
   for (const auto& ob : qc.order_by()) {
     switch (ob.iColumn) {
       case Column::kQuantizedGroup:
-        if (ob.desc)
-          is_quantized_group_order_desc = true;
-        break;
       case Column::kTimestamp:
       case Column::kDuration:
-        is_duration_timestamp_order = true;
+        is_time_order = true;
         break;
       case Column::kCpu:
         break;
@@ -166,11 +153,12 @@ int SchedSliceTable::BestIndex(const QueryConstraints& qc,
       has_quantum_constraint = true;
   }
 
-  // If a quantum constraint is present, we don't support native ordering by
-  // time related parameters or by quantized group in descending order.
-  bool needs_sqlite_orderby =
-      has_quantum_constraint &&
-      (is_duration_timestamp_order || is_quantized_group_order_desc);
+  // If a quantum constraint is present, slices are split in quantized groups
+  // as they are returned, so the only time related order supported natively
+  // is the timestamp order of the groups, ascending or descending.
+  bool ts_order_desc = false;
+  bool needs_sqlite_orderby = has_quantum_constraint && is_time_order &&
+                              !IsTimestampOrder(qc.order_by(), &ts_order_desc);
 
   info->order_by_consumed = !needs_sqlite_orderby;
 
@@ -193,12 +181,13 @@ int SchedSliceTable::FindFunction(const char* name,
   return 0;
 }
 
-SchedSliceTable::Cursor::Cursor(const TraceStorage* storage)
-    : storage_(storage) {}
+SchedSliceTable::Cursor::Cursor(const TraceStorage* storage,
+                                UtidIndexPerCpu* utid_index)
+    : storage_(storage), utid_index_(utid_index) {}
 
 int SchedSliceTable::Cursor::Filter(const QueryConstraints& qc,
                                     sqlite3_value** argv) {
-  filter_state_.reset(new FilterState(storage_, qc, argv));
+  filter_state_.reset(new FilterState(storage_, utid_index_, qc, argv));
   return SQLITE_OK;
 }
 
@@ -283,9 +272,13 @@ int SchedSliceTable::Cursor::Column(sqlite3_context* context, int N) {
 
 SchedSliceTable::FilterState::FilterState(
     const TraceStorage* storage,
+    UtidIndexPerCpu* utid_index,
     const QueryConstraints& query_constraints,
     sqlite3_value** argv)
-    : order_by_(query_constraints.order_by()), storage_(storage) {
+    : order_by_(query_constraints.order_by()),
+      storage_(storage),
+      utid_index_(utid_index),
+      slice_counts_(storage->GetVisibleRowCounts().sched_slices) {
   std::bitset<base::kMaxCpus> cpu_filter;
   cpu_filter.set();
 
@@ -294,11 +287,26 @@ SchedSliceTable::FilterState::FilterState(
   uint64_t ts_lower_bound = 0;
   bool ts_clip = false;
 
+  // Whether the rows returned match all the constraints, i.e. SQLite doesn't
+  // filter any out.
+  bool all_constraints_applied = true;
+  int64_t limit = -1;
+  int64_t offset = 0;
+
   for (size_t i = 0; i < query_constraints.constraints().size(); i++) {
     const auto& cs = query_constraints.constraints()[i];
+    if (IsOpLimit(cs.op)) {
+      limit = sqlite3_value_int64(argv[i]);
+      continue;
+    }
+    if (IsOpOffset(cs.op)) {
+      offset = sqlite3_value_int64(argv[i]);
+      continue;
+    }
     switch (cs.iColumn) {
       case Column::kCpu:
-        PopulateFilterBitmap(cs.op, argv[i], &cpu_filter);
+        if (!PopulateFilterBitmap(cs.op, argv[i], &cpu_filter))
+          all_constraints_applied = false;
         break;
       case Column::kQuantum:
         quantum_ = static_cast<uint64_t>(sqlite3_value_int64(argv[i]));
@@ -309,18 +317,43 @@ SchedSliceTable::FilterState::FilterState(
       case Column::kClipTimestamp:
         ts_clip = sqlite3_value_int(argv[i]) ? true : false;
         break;
+      case Column::kUtid:
+        // SQLite checks the other constraints on utid.
+        if (IsOpEq(cs.op) && !has_utid_) {
+          has_utid_ = true;
+          utid_ = static_cast<UniqueTid>(sqlite3_value_int64(argv[i]));
+        } else {
+          all_constraints_applied = false;
+        }
+        break;
       case Column::kTimestamp: {
         auto ts = static_cast<uint64_t>(sqlite3_value_int64(argv[i]));
         if (IsOpGe(cs.op) || IsOpGt(cs.op)) {
           min_ts = IsOpGe(cs.op) ? ts : ts + 1;
         } else if (IsOpLe(cs.op) || IsOpLt(cs.op)) {
           max_ts = IsOpLe(cs.op) ? ts : ts - 1;
+        } else {
+          all_constraints_applied = false;
         }
         break;
       }
+      case Column::kDuration:
+      case Column::kCycles:
+        all_constraints_applied = false;
+        break;
     }
   }
 
+  ts_order_ = IsTimestampOrder(order_by_, &ts_order_desc_);
+
+  // With a LIMIT, at most |limit| + |offset| rows are read from the table if
+  // they are returned in the order of the query and SQLite doesn't filter
+  // them further.
+  if (limit >= 0 && offset >= 0 && all_constraints_applied &&
+      !order_by_.empty()) {
+    max_rows_ = static_cast<uint64_t>(limit) + static_cast<uint64_t>(offset);
+  }
+
   if (ts_clip) {
     PERFETTO_DCHECK(ts_lower_bound == 0);
     if (ts_lower_bound)
@@ -340,13 +373,13 @@ SchedSliceTable::FilterState::FilterState(
       if (!cpu_filter.test(cpu))
         continue;
       const auto& start_ns = storage_->SlicesForCpu(cpu).start_ns();
+      auto end = start_ns.begin() + slice_counts_[cpu];
       // std::lower_bound will find the first timestamp >= |ts_lower_bound|.
       // From there we need to move one back, if possible.
-      auto it =
-          std::lower_bound(start_ns.begin(), start_ns.end(), ts_lower_bound);
+      auto it = std::lower_bound(start_ns.begin(), end, ts_lower_bound);
       if (std::distance(start_ns.begin(), it) > 0)
         it--;
-      if (it == start_ns.end())
+      if (it == end)
         continue;
       if (*it < ts_lower_bound) {
         largest_ts_before = std::max(largest_ts_before, *it);
@@ -364,9 +397,9 @@ SchedSliceTable::FilterState::FilterState(
       continue;
     uint64_t ts_clip_min = ts_clip ? min_ts : 0;
     uint64_t ts_clip_max = ts_clip ? max_ts : kUint64Max;
-    StateForCpu(cpu)->Initialize(
-        cpu, storage_, quantum_, ts_clip_min, ts_clip_max,
-        CreateSortedIndexVectorForCpu(cpu, min_ts, max_ts));
+    StateForCpu(cpu)->Initialize(cpu, storage_, quantum_, ts_clip_min,
+                                 ts_clip_max, ts_order_ && ts_order_desc_);
+    SetRowsForCpu(cpu, min_ts, max_ts);
   }
 
   // Set the cpu index to be the first item to look at.
@@ -401,31 +434,65 @@ int SchedSliceTable::FilterState::CompareCpuToNextCpu(uint32_t cpu) {
   return CompareSlices(cpu, row, next_cpu_, next_row);
 }
 
-std::vector<uint32_t>
-SchedSliceTable::FilterState::CreateSortedIndexVectorForCpu(uint32_t cpu,
-                                                            uint64_t min_ts,
-                                                            uint64_t max_ts) {
+void SchedSliceTable::FilterState::SetRowsForCpu(uint32_t cpu,
+                                                 uint64_t min_ts,
+                                                 uint64_t max_ts) {
+  // Only the slices visible when the query started are returned, even if
+  // more are added meanwhile.
   const auto& slices = storage_->SlicesForCpu(cpu);
   const auto& start_ns = slices.start_ns();
-  PERFETTO_CHECK(slices.slice_count() <= std::numeric_limits<uint32_t>::max());
-
-  auto min_it = std::lower_bound(start_ns.begin(), start_ns.end(), min_ts);
-  auto max_it = std::upper_bound(min_it, start_ns.end(), max_ts);
-  ptrdiff_t dist = std::distance(min_it, max_it);
-  PERFETTO_CHECK(dist >= 0 && static_cast<size_t>(dist) <= start_ns.size());
-
-  std::vector<uint32_t> indices(static_cast<size_t>(dist));
+  std::vector<uint32_t> indices;
+  if (has_utid_) {
+    // As the slices of a CPU are in timestamp order, so are the rows of each
+    // thread in the index.
+    UtidIndex* index = &(*utid_index_)[cpu];
+    index->Update(slices.utids(), start_ns, slice_counts_[cpu]);
+    const auto& rows = index->RowsForUtid(utid_);
+    auto min_it = std::lower_bound(
+        rows.begin(), rows.end(), min_ts,
+        [&start_ns](uint32_t row, uint64_t ts) { return start_ns[row] < ts; });
+    auto max_it = std::upper_bound(
+        min_it, rows.end(), max_ts,
+        [&start_ns](uint64_t ts, uint32_t row) { return ts < start_ns[row]; });
+    indices.assign(min_it, max_it);
+  } else {
+    auto end = start_ns.begin() + slice_counts_[cpu];
+    auto min_it = std::lower_bound(start_ns.begin(), end, min_ts);
+    auto max_it = std::upper_bound(min_it, end, max_ts);
+    ptrdiff_t dist = std::distance(min_it, max_it);
+    PERFETTO_CHECK(dist >= 0 && dist <= end - start_ns.begin());
+    auto first_row = static_cast<uint32_t>(min_it - start_ns.begin());
+
+    // Slices are stored in timestamp order, so if no ordering or just
+    // timestamp order is requested, they are returned in place (forwards or
+    // backwards): queries which read only the first rows don't look at the
+    // others.
+    if (ts_order_) {
+      StateForCpu(cpu)->SetRowRange(first_row, static_cast<uint32_t>(dist));
+      return;
+    }
 
-  // Fill |indices| with the consecutive row numbers affected by the filtering.
-  std::iota(indices.begin(), indices.end(),
-            std::distance(start_ns.begin(), min_it));
+    // Fill |indices| with the consecutive row numbers affected by the
+    // filtering.
+    indices.resize(static_cast<size_t>(dist));
+    std::iota(indices.begin(), indices.end(), first_row);
+  }
 
-  // In other cases, sort by the given criteria.
-  std::sort(indices.begin(), indices.end(),
-            [this, cpu](uint32_t f, uint32_t s) {
-              return CompareSlices(cpu, f, cpu, s) < 0;
-            });
-  return indices;
+  // In other cases, sort by the given criteria. Only the rows which the query
+  // can return need to be in order.
+  if (!ts_order_) {
+    auto compare = [this, cpu](uint32_t f, uint32_t s) {
+      return CompareSlices(cpu, f, cpu, s) < 0;
+    };
+    if (max_rows_ < indices.size()) {
+      auto last = indices.begin() + static_cast<ptrdiff_t>(max_rows_);
+      std::partial_sort(indices.begin(), last, indices.end(), compare);
+      indices.erase(last, indices.end());
+    } else {
+      std::sort(indices.begin(), indices.end(), compare);
+    }
+  }
+  StateForCpu(cpu)->SetRowIds(std::move(indices));
 }
 
 int SchedSliceTable::FilterState::CompareSlices(uint32_t f_cpu,
@@ -453,6 +520,12 @@ int SchedSliceTable::FilterState::CompareSlicesOnColumn(
     case SchedSliceTable::Column::kTimestampLowerBound:
       PERFETTO_CHECK(false);
     case SchedSliceTable::Column::kTimestamp:
+      // With a quantum, the timestamp is the one of the quantized group (only
+      // supported when merging CPUs, see BestIndex()).
+      if (quantum_ != 0) {
+        return Compare(StateForCpu(f_cpu)->next_timestamp(),
+                       StateForCpu(s_cpu)->next_timestamp(), ob.desc);
+      }
       return Compare(f_sl.start_ns()[f_idx], s_sl.start_ns()[s_idx], ob.desc);
     case SchedSliceTable::Column::kDuration:
       return Compare(f_sl.durations()[f_idx], s_sl.durations()[s_idx], ob.desc);
@@ -463,10 +536,6 @@ int SchedSliceTable::FilterState::CompareSlicesOnColumn(
     case SchedSliceTable::Column::kCycles:
       return Compare(f_sl.cycles()[f_idx], s_sl.cycles()[s_idx], ob.desc);
     case SchedSliceTable::Column::kQuantizedGroup: {
-      // We don't support sorting in descending order on quantized group when
-      // we have a non-zero quantum.
-      PERFETTO_CHECK(!ob.desc || quantum_ == 0);
-
       uint64_t f_timestamp = StateForCpu(f_cpu)->next_timestamp();
       uint64_t s_timestamp = StateForCpu(s_cpu)->next_timestamp();
 
@@ -478,19 +547,37 @@ int SchedSliceTable::FilterState::CompareSlicesOnColumn(
   PERFETTO_FATAL("Unexpected column %d", ob.iColumn);
 }
 
-void SchedSliceTable::PerCpuState::Initialize(
-    uint32_t cpu,
-    const TraceStorage* storage,
-    uint64_t quantum,
-    uint64_t ts_clip_min,
-    uint64_t ts_clip_max,
-    std::vector<uint32_t> sorted_row_ids) {
+void SchedSliceTable::PerCpuState::Initialize(uint32_t cpu,
+                                              const TraceStorage* storage,
+                                              uint64_t quantum,
+                                              uint64_t ts_clip_min,
+                                              uint64_t ts_clip_max,
+                                              bool reverse) {
   cpu_ = cpu;
   storage_ = storage;
   quantum_ = quantum;
   ts_clip_min_ = ts_clip_min;
   ts_clip_max_ = ts_clip_max;
+  reverse_ = reverse;
+}
+
+void SchedSliceTable::PerCpuState::SetRowIds(
+    std::vector<uint32_t> sorted_row_ids) {
   sorted_row_ids_ = std::move(sorted_row_ids);
+  use_row_ids_ = true;
+  first_row_ = 0;
+  row_count_ = static_cast<uint32_t>(sorted_row_ids_.size());
+  next_row_id_index_ = 0;
+  UpdateNextTimestampForNextRow();
+}
+
+void SchedSliceTable::PerCpuState::SetRowRange(uint32_t first_row,
+                                               uint32_t row_count) {
+  sorted_row_ids_.clear();
+  use_row_ids_ = false;
+  first_row_ = first_row;
+  row_count_ = row_count;
+  next_row_id_index_ = 0;
   UpdateNextTimestampForNextRow();
 }
 
@@ -504,9 +591,20 @@ void SchedSliceTable::PerCpuState::FindNextSlice() {
     return;
   }
 
+  uint64_t start_slice = slices.start_ns()[next_row_id()];
+  if (reverse_) {
+    // The quantized groups of the slice are returned from the last one.
+    if (next_timestamp_ <= start_slice) {
+      next_row_id_index_++;
+      UpdateNextTimestampForNextRow();
+    } else {
+      next_timestamp_ = std::max(start_slice, next_timestamp_ - quantum_);
+    }
+    return;
+  }
+
   uint64_t start_group = next_timestamp_ / quantum_;
-  uint64_t end_slice =
-      slices.start_ns()[next_row_id()] + slices.durations()[next_row_id()];
+  uint64_t end_slice = start_slice + slices.durations()[next_row_id()];
   uint64_t next_group_start = (start_group + 1) * quantum_;
 
   if (next_group_start >= end_slice) {
@@ -518,8 +616,23 @@ void SchedSliceTable::PerCpuState::FindNextSlice() {
 }
 
 void SchedSliceTable::PerCpuState::UpdateNextTimestampForNextRow() {
-  next_timestamp_ =
-      IsNextRowIdIndexValid() ? Slices().start_ns()[next_row_id()] : 0;
+  if (!IsNextRowIdIndexValid()) {
+    next_timestamp_ = 0;
+    return;
+  }
+  const auto& slices = Slices();
+  uint64_t start_slice = slices.start_ns()[next_row_id()];
+  next_timestamp_ = start_slice;
+  if (!reverse_ || quantum_ == 0)
+    return;
+
+  // Backwards, the first quantized group is the one which contains the end of
+  // the slice.
+  uint64_t end_slice = start_slice + slices.durations()[next_row_id()];
+  if (end_slice > start_slice) {
+    uint64_t last_group_start = (end_slice - 1) / quantum_ * quantum_;
+    next_timestamp_ = std::max(start_slice, last_group_start);
+  }
 }
 
 }  // namespace trace_processor
@@ -18,6 +18,7 @@
 #define SRC_TRACE_PROCESSOR_SCHED_SLICE_TABLE_H_
 
 #include <sqlite3.h>
+#include <array>
 #include <limits>
 #include <memory>
 
@@ -25,6 +26,7 @@
 #include "src/trace_processor/query_constraints.h"
 #include "src/trace_processor/table.h"
 #include "src/trace_processor/trace_storage.h"
+#include "src/trace_processor/utid_index.h"
 
 namespace perfetto {
 namespace trace_processor {
@@ -65,13 +67,25 @@ class SchedSliceTable : public Table {
                     uint64_t quantum,
                     uint64_t ts_clip_min,
                     uint64_t ts_clip_max,
-                    std::vector<uint32_t> sorted_row_ids);
+                    bool reverse);
+
+    // Sets the rows to return: either the rows in |sorted_row_ids|, or the
+    // |row_count| consecutive rows from |first_row|. In both cases the rows
+    // are returned in the given order, or in reverse order if |reverse| was
+    // set in Initialize().
+    void SetRowIds(std::vector<uint32_t> sorted_row_ids);
+    void SetRowRange(uint32_t first_row, uint32_t row_count);
+
     void FindNextSlice();
     bool IsNextRowIdIndexValid() const {
-      return next_row_id_index_ < sorted_row_ids_.size();
+      return next_row_id_index_ < row_count_;
     }
 
-    size_t next_row_id() const { return sorted_row_ids_[next_row_id_index_]; }
+    size_t next_row_id() const {
+      uint32_t index =
+          reverse_ ? row_count_ - 1 - next_row_id_index_ : next_row_id_index_;
+      return use_row_ids_ ? sorted_row_ids_[index] : first_row_ + index;
+    }
     uint64_t next_timestamp() const { return next_timestamp_; }
     uint64_t ts_clip_min() const { return ts_clip_min_; }
     uint64_t ts_clip_max() const { return ts_clip_max_; }
@@ -83,10 +97,18 @@ class SchedSliceTable : public Table {
 
     void UpdateNextTimestampForNextRow();
 
-    // Vector of row ids sorted by the the given order by constraints.
+    // Vector of row ids sorted by the the given order by constraints, used
+    // instead of the range of rows from |first_row_| if |use_row_ids_|.
     std::vector<uint32_t> sorted_row_ids_;
+    bool use_row_ids_ = false;
+    uint32_t first_row_ = 0;
+    uint32_t row_count_ = 0;
 
-    // An offset into |sorted_row_ids_| indicating the next row to return.
+    // If set, the rows are returned from the last to the first one, and
+    // slices are split in quantized groups from their end.
+    bool reverse_ = false;
+
+    // The number of rows returned so far.
     uint32_t next_row_id_index_ = 0;
 
     // The timestamp of the row to index. This is either the timestamp of
@@ -108,10 +130,13 @@ class SchedSliceTable : public Table {
     const TraceStorage* storage_ = nullptr;
   };
 
+  using UtidIndexPerCpu = std::array<UtidIndex, base::kMaxCpus>;
+
   // Transient state for a filter operation on a Cursor.
   class FilterState {
    public:
     FilterState(const TraceStorage* storage,
+                UtidIndexPerCpu* utid_index,
                 const QueryConstraints& query_constraints,
                 sqlite3_value** argv);
 
@@ -130,11 +155,9 @@ class SchedSliceTable : public Table {
     uint64_t quantum() const { return quantum_; }
 
    private:
-    // Creates a vector of indices into the slices for the given |cpu| sorted
-    // by the order by criteria.
-    std::vector<uint32_t> CreateSortedIndexVectorForCpu(uint32_t cpu,
-                                                        uint64_t min_ts,
-                                                        uint64_t max_ts);
+    // Sets the rows of |cpu| which are in the [min_ts, max_ts] range as the
+    // rows to return, in the order by criteria.
+    void SetRowsForCpu(uint32_t cpu, uint64_t min_ts, uint64_t max_ts);
 
     // Compares the next slice of the given |cpu| with the next slice of the
     // |next_cpu_|. Return <0 if |cpu| is ordered before, >0 if ordered after,
@@ -170,13 +193,32 @@ class SchedSliceTable : public Table {
     // The sorting criteria for this filter operation.
     std::vector<QueryConstraints::OrderBy> order_by_;
 
+    // Set if the rows are sorted by timestamp on each CPU, in descending
+    // order if |ts_order_desc_|. In this case the rows of each CPU are
+    // iterated in place, and merged, rather than sorted.
+    bool ts_order_ = false;
+    bool ts_order_desc_ = false;
+
+    // If the order by criteria are applied, the number of rows which the
+    // query can return. Only the first ones of each CPU need to be sorted.
+    uint64_t max_rows_ = std::numeric_limits<uint64_t>::max();
+
+    // Set if the query has an equality constraint on utid, in which case
+    // only the slices of |utid_| are looked at.
+    bool has_utid_ = false;
+    UniqueTid utid_ = 0;
+
     const TraceStorage* const storage_;
+    UtidIndexPerCpu* const utid_index_;
+
+    // Number of slices of each CPU visible to the query.
+    const std::array<uint32_t, base::kMaxCpus> slice_counts_;
   };
 
   // Implementation of the SQLite cursor interface.
   class Cursor : public Table::Cursor {
    public:
-    Cursor(const TraceStorage* storage);
+    Cursor(const TraceStorage* storage, UtidIndexPerCpu* utid_index);
 
     // Implementation of Table::Cursor.
     int Filter(const QueryConstraints&, sqlite3_value**) override;
@@ -186,10 +228,15 @@ class SchedSliceTable : public Table {
 
    private:
     const TraceStorage* const storage_;
+    UtidIndexPerCpu* const utid_index_;
     std::unique_ptr<FilterState> filter_state_;
   };
 
   const TraceStorage* const storage_;
+
+  // The slices of each thread on each CPU, built on the first query with a
+  // utid constraint.
+  UtidIndexPerCpu utid_index_;
 };
 
 }  // namespace trace_processor
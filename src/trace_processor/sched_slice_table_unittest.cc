@@ -253,6 +253,50 @@ TEST_F(SchedSliceTableTest, QuantizationSqliteDurationOrder) {
   ASSERT_EQ(sqlite3_step(*stmt_), SQLITE_DONE);
 }
 
+TEST_F(SchedSliceTableTest, DescendingOrderAndLimit) {
+  uint32_t cpu_1 = 3;
+  uint32_t cpu_2 = 8;
+  uint64_t timestamp = 100;
+  uint32_t pid_1 = 2;
+  uint32_t prev_state = 32;
+  static const char kCommProc1[] = "process1";
+  static const char kCommProc2[] = "process2";
+  uint32_t pid_2 = 4;
+  context_.sched_tracker->PushSchedSwitch(cpu_2, timestamp, pid_1, prev_state,
+                                          kCommProc1, pid_2);
+  context_.sched_tracker->PushSchedSwitch(cpu_1, timestamp + 3, pid_2,
+                                          prev_state, kCommProc2, pid_1);
+  context_.sched_tracker->PushSchedSwitch(cpu_2, timestamp + 4, pid_1,
+                                          prev_state, kCommProc1, pid_2);
+  context_.sched_tracker->PushSchedSwitch(cpu_1, timestamp + 10, pid_2,
+                                          prev_state, kCommProc2, pid_1);
+
+  auto query = [this](const std::string& clauses) {
+    PrepareValidStatement("SELECT ts, dur, cpu FROM sched " + clauses);
+    std::vector<int> res;
+    while (sqlite3_step(*stmt_) == SQLITE_ROW) {
+      for (int i = 0; i < 3; i++)
+        res.push_back(sqlite3_column_int(*stmt_, i));
+    }
+    return res;
+  };
+
+  ASSERT_THAT(query("ORDER BY ts DESC"), ElementsAre(103, 7, 3, 100, 4, 8));
+  ASSERT_THAT(query("WHERE ts < 103 ORDER BY ts DESC"),
+              ElementsAre(100, 4, 8));
+
+  // Slices are split in quantized groups from their end.
+  ASSERT_THAT(query("WHERE quantum = 5 ORDER BY ts DESC"),
+              ElementsAre(105, 5, 3, 103, 2, 3, 100, 4, 8));
+  ASSERT_THAT(query("WHERE quantum = 5 ORDER BY quantized_group DESC, cpu"),
+              ElementsAre(105, 5, 3, 103, 2, 3, 100, 4, 8));
+
+  ASSERT_THAT(query("ORDER BY dur DESC LIMIT 1"), ElementsAre(103, 7, 3));
+  ASSERT_THAT(query("ORDER BY dur LIMIT 1 OFFSET 1"), ElementsAre(103, 7, 3));
+  ASSERT_THAT(query("WHERE dur < 5 ORDER BY dur DESC LIMIT 1"),
+              ElementsAre(100, 4, 8));
+}
+
 TEST_F(SchedSliceTableTest, QuantizationGroupAndSum) {
   uint32_t cpu_1 = 3;
   uint32_t cpu_2 = 8;
@@ -318,6 +362,52 @@ TEST_F(SchedSliceTableTest, UtidTest) {
   ASSERT_EQ(sqlite3_step(*stmt_), SQLITE_DONE);
 }
 
+TEST_F(SchedSliceTableTest, UtidFiltering) {
+  uint32_t cpu_1 = 3;
+  uint32_t cpu_2 = 8;
+  uint32_t pid_1 = 2;
+  uint32_t pid_2 = 4;
+  uint32_t prev_state = 32;
+
+  // |pid_1| and |pid_2| swap CPUs at each time unit, from T=100 to T=109.
+  auto push_switches = [this, cpu_1, cpu_2, pid_1, pid_2,
+                        prev_state](uint64_t from, uint64_t to) {
+    for (uint64_t ts = from; ts < to; ts++) {
+      bool even = ts % 2 == 0;
+      context_.sched_tracker->PushSchedSwitch(cpu_1, ts, even ? pid_2 : pid_1,
+                                              prev_state, "p", even ? pid_1
+                                                                    : pid_2);
+      context_.sched_tracker->PushSchedSwitch(cpu_2, ts, even ? pid_1 : pid_2,
+                                              prev_state, "p", even ? pid_2
+                                                                    : pid_1);
+    }
+  };
+  push_switches(100, 110);
+
+  auto query = [this](const std::string& where_clauses) {
+    PrepareValidStatement("SELECT ts, cpu from sched WHERE " + where_clauses +
+                          " ORDER BY ts");
+    std::vector<int> res;
+    while (sqlite3_step(*stmt_) == SQLITE_ROW) {
+      res.push_back(sqlite3_column_int(*stmt_, 0));
+      res.push_back(sqlite3_column_int(*stmt_, 1));
+    }
+    return res;
+  };
+
+  ASSERT_THAT(query("utid = 1 and ts <= 103"),
+              ElementsAre(100, 3, 101, 8, 102, 3, 103, 8));
+  ASSERT_THAT(query("utid = 2 and ts > 106"), ElementsAre(107, 3, 108, 8));
+  ASSERT_THAT(query("utid = 2 and cpu = 8 and ts > 100 and ts < 106"),
+              ElementsAre(102, 8, 104, 8));
+  ASSERT_THAT(query("utid = 3"), IsEmpty());
+
+  // Slices added after the first query are indexed too.
+  push_switches(110, 112);
+  ASSERT_THAT(query("utid = 1 and ts >= 108"),
+              ElementsAre(108, 3, 109, 8, 110, 3));
+}
+
 TEST_F(SchedSliceTableTest, TimestampFiltering) {
   uint32_t cpu_5 = 5;
   uint32_t cpu_7 = 7;
@@ -53,7 +53,7 @@ void SchedTracker::PushSchedSwitch(uint32_t cpu,
         prev->timestamp, prev->next_pid /* == prev_pid */, prev_thread_name_id);
     uint64_t cycles = CalculateCycles(cpu, prev->timestamp, timestamp);
     context_->storage->AddSliceToCpu(cpu, prev->timestamp, duration, utid,
-                                     cycles);
+                                     cycles, prev_state);
   }
 
   // If the this events previous pid does not match the previous event's next
@@ -72,37 +72,28 @@ void SchedTracker::PushSchedSwitch(uint32_t cpu,
 uint64_t SchedTracker::CalculateCycles(uint32_t cpu,
                                        uint64_t start_ns,
                                        uint64_t end_ns) {
-  const auto& frequencies = context_->storage->GetFreqForCpu(cpu);
-  auto lower_index = lower_index_per_cpu_[cpu];
-  if (frequencies.empty())
+  const CounterSeries* frequencies = context_->storage->GetCpuFreqSeries(cpu);
+  if (!frequencies)
     return 0;
 
-  long double cycles = 0;
-
-  // Move the lower index up to the first cpu_freq event before start_ns.
-  while (lower_index + 1 < frequencies.size()) {
-    if (frequencies[lower_index + 1].first >= start_ns)
-      break;
-    ++lower_index;
-  };
+  // Most slices are shorter than the interval between two cpu_freq events.
+  if (frequencies->last_ts() <= start_ns) {
+    long double freq_khz = frequencies->last_value();
+    return static_cast<uint64_t>(round((end_ns - start_ns) / 1E6L * freq_khz));
+  }
 
   // Since events are processed in timestamp order, we don't have any cpu_freq
   // events with a timestamp larger than end_ns. Therefore we care about all
-  // freq events from lower_index (first event before start_ns) to the last
-  // cpu_freq event.
-  for (size_t i = lower_index; i < frequencies.size(); ++i) {
+  // freq events from the last one before start_ns to the last cpu_freq event.
+  long double cycles = 0;
+  for (auto it = frequencies->Floor(start_ns, frequencies->size());
+       it.valid(); it.Next()) {
     // Using max handles the special case for the first cpu_freq event.
-    uint64_t cycle_start = std::max(frequencies[i].first, start_ns);
+    uint64_t cycle_start = std::max(it.ts(), start_ns);
     // If there are no more freq_events we compute cycles until |end_ns|.
-    uint64_t cycle_end = end_ns;
-    if (i + 1 < frequencies.size())
-      cycle_end = frequencies[i + 1].first;
-
-    uint32_t freq_khz = frequencies[i].second;
-    cycles += ((cycle_end - cycle_start) / 1E6L) * freq_khz;
+    uint64_t cycle_end = it.has_next() ? it.next_ts() : end_ns;
+    cycles += ((cycle_end - cycle_start) / 1E6L) * it.value();
   }
-
-  lower_index_per_cpu_[cpu] = frequencies.size() - 1;
   return static_cast<uint64_t>(round(cycles));
 }
 
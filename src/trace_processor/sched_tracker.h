@@ -62,8 +62,6 @@ class SchedTracker {
   // Store the previous sched event to calculate the duration before storing it.
   std::array<SchedSwitchEvent, base::kMaxCpus> last_sched_per_cpu_;
 
-  std::array<size_t, base::kMaxCpus> lower_index_per_cpu_{};
-
   uint64_t prev_timestamp_ = 0;
 
   TraceProcessorContext* const context_;
@@ -23,11 +23,18 @@
 #include <bitset>
 #include <numeric>
 
+#include "src/trace_processor/sqlite_utils.h"
 #include "src/trace_processor/trace_storage.h"
 
 namespace perfetto {
 namespace trace_processor {
 
+namespace {
+
+using namespace sqlite_utils;
+
+}  // namespace
+
 SliceTable::SliceTable(const TraceStorage* storage) : storage_(storage) {}
 
 void SliceTable::RegisterTable(sqlite3* db, const TraceStorage* storage) {
@@ -48,72 +55,124 @@ void SliceTable::RegisterTable(sqlite3* db, const TraceStorage* storage) {
 }
 
 std::unique_ptr<Table::Cursor> SliceTable::CreateCursor() {
-  return std::unique_ptr<Table::Cursor>(new Cursor(storage_));
+  return std::unique_ptr<Table::Cursor>(new Cursor(storage_, &utid_index_));
 }
 
-int SliceTable::BestIndex(const QueryConstraints&, BestIndexInfo* info) {
+int SliceTable::BestIndex(const QueryConstraints& qc, BestIndexInfo* info) {
   info->order_by_consumed = false;  // Delegate sorting to SQLite.
-  info->estimated_cost =
-      static_cast<uint32_t>(storage_->nestable_slices().slice_count());
+  info->estimated_cost = storage_->GetVisibleRowCounts().nestable_slices;
+
+  // The slices of a thread are looked up through |utid_index_|.
+  for (const auto& cs : qc.constraints()) {
+    if (cs.iColumn == Column::kUtid && IsOpEq(cs.op))
+      info->estimated_cost = 10;
+  }
   return SQLITE_OK;
 }
 
-SliceTable::Cursor::Cursor(const TraceStorage* storage) : storage_(storage) {
-  num_rows_ = storage->nestable_slices().slice_count();
+SliceTable::Cursor::Cursor(const TraceStorage* storage, UtidIndex* utid_index)
+    : storage_(storage), utid_index_(utid_index) {
+  num_rows_ = storage->GetVisibleRowCounts().nestable_slices;
 }
 
 SliceTable::Cursor::~Cursor() = default;
 
-int SliceTable::Cursor::Filter(const QueryConstraints&,
-                               sqlite3_value** /*argv*/) {
+int SliceTable::Cursor::Filter(const QueryConstraints& qc,
+                               sqlite3_value** argv) {
+  index_ = 0;
+  has_utid_ = false;
+  UniqueTid utid = 0;
+  uint64_t min_ts = 0;
+  uint64_t max_ts = std::numeric_limits<uint64_t>::max();
+  for (size_t i = 0; i < qc.constraints().size(); i++) {
+    const auto& cs = qc.constraints()[i];
+    switch (cs.iColumn) {
+      case Column::kUtid:
+        // SQLite checks the other constraints on utid.
+        if (IsOpEq(cs.op) && !has_utid_) {
+          has_utid_ = true;
+          utid = static_cast<UniqueTid>(sqlite3_value_int64(argv[i]));
+        }
+        break;
+      case Column::kTimestamp: {
+        auto ts = static_cast<uint64_t>(sqlite3_value_int64(argv[i]));
+        if (IsOpGe(cs.op) || IsOpGt(cs.op)) {
+          min_ts = IsOpGe(cs.op) ? ts : ts + 1;
+        } else if (IsOpLe(cs.op) || IsOpLt(cs.op)) {
+          max_ts = IsOpLe(cs.op) ? ts : ts - 1;
+        }
+        break;
+      }
+    }
+  }
+  if (!has_utid_)
+    return SQLITE_OK;
+
+  // The ts constraints are only worth applying to the rows of the thread,
+  // which are sorted by timestamp in the index.
+  const auto& slices = storage_->nestable_slices();
+  const auto& start_ns = slices.start_ns();
+  utid_index_->Update(slices.utids(), start_ns,
+                      static_cast<uint32_t>(num_rows_));
+  const auto& rows = utid_index_->RowsForUtid(utid);
+  auto min_it = std::lower_bound(
+      rows.begin(), rows.end(), min_ts,
+      [&start_ns](uint32_t row, uint64_t ts) { return start_ns[row] < ts; });
+  auto max_it = std::upper_bound(
+      min_it, rows.end(), max_ts,
+      [&start_ns](uint64_t ts, uint32_t row) { return ts < start_ns[row]; });
+  utid_rows_.assign(min_it, max_it);
   return SQLITE_OK;
 }
 
 int SliceTable::Cursor::Next() {
-  row_++;
+  index_++;
   return SQLITE_OK;
 }
 
 int SliceTable::Cursor::Eof() {
-  return row_ >= num_rows_;
+  return index_ >= (has_utid_ ? utid_rows_.size() : num_rows_);
 }
 
 int SliceTable::Cursor::Column(sqlite3_context* context, int col) {
   const auto& slices = storage_->nestable_slices();
+  const size_t row = current_row();
   switch (col) {
     case Column::kTimestamp:
       sqlite3_result_int64(context,
-                           static_cast<sqlite3_int64>(slices.start_ns()[row_]));
+                           static_cast<sqlite3_int64>(slices.start_ns()[row]));
       break;
     case Column::kDuration:
       sqlite3_result_int64(
-          context, static_cast<sqlite3_int64>(slices.durations()[row_]));
+          context, static_cast<sqlite3_int64>(slices.durations()[row]));
       break;
     case Column::kUtid:
       sqlite3_result_int64(context,
-                           static_cast<sqlite3_int64>(slices.utids()[row_]));
+                           static_cast<sqlite3_int64>(slices.utids()[row]));
       break;
-    case Column::kCategory:
-      sqlite3_result_text(context,
-                          storage_->GetString(slices.cats()[row_]).c_str(), -1,
+    case Column::kCategory: {
+      const auto& cat = storage_->GetString(slices.cats()[row]);
+      sqlite3_result_text(context, cat.data(), static_cast<int>(cat.size()),
                           nullptr);
       break;
-    case Column::kName:
-      sqlite3_result_text(context,
-                          storage_->GetString(slices.names()[row_]).c_str(), -1,
+    }
+    case Column::kName: {
+      const auto& name = storage_->GetString(slices.names()[row]);
+      sqlite3_result_text(context, name.data(), static_cast<int>(name.size()),
                           nullptr);
       break;
+    }
     case Column::kDepth:
       sqlite3_result_int64(context,
-                           static_cast<sqlite3_int64>(slices.depths()[row_]));
+                           static_cast<sqlite3_int64>(slices.depths()[row]));
       break;
     case Column::kStackId:
       sqlite3_result_int64(
-          context, static_cast<sqlite3_int64>(slices.stack_ids()[row_]));
+          context, static_cast<sqlite3_int64>(slices.stack_ids()[row]));
       break;
     case Column::kParentStackId:
       sqlite3_result_int64(
-          context, static_cast<sqlite3_int64>(slices.parent_stack_ids()[row_]));
+          context, static_cast<sqlite3_int64>(slices.parent_stack_ids()[row]));
       break;
   }
   return SQLITE_OK;
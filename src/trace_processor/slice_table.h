@@ -19,8 +19,10 @@
 
 #include <limits>
 #include <memory>
+#include <vector>
 
 #include "src/trace_processor/table.h"
+#include "src/trace_processor/utid_index.h"
 
 namespace perfetto {
 namespace trace_processor {
@@ -31,9 +33,9 @@ class TraceStorage;
 // A virtual table that allows to query slices coming from userspace events
 // such as chromium TRACE_EVENT macros. Conversely to "shced" slices, these
 // slices can be nested and form stacks.
-// The current implementation of this table is extremely simple and not
-// particularly efficient, as it delegates all the sorting and filtering to
-// the SQLite query engine.
+// Queries on the slices of a thread (i.e. with a utid = x constraint) only
+// read the slices of that thread, optionally restricted to a ts range; all
+// the other sorting and filtering is delegated to the SQLite query engine.
 class SliceTable : public Table {
  public:
   enum Column {
@@ -59,7 +61,7 @@ class SliceTable : public Table {
   // Implementation of the SQLite cursor interface.
   class Cursor : public Table::Cursor {
    public:
-    Cursor(const TraceStorage* storage);
+    Cursor(const TraceStorage* storage, UtidIndex* utid_index);
     ~Cursor() override;
 
     // Implementation of Table::Cursor.
@@ -69,12 +71,27 @@ class SliceTable : public Table {
     int Column(sqlite3_context*, int N) override;
 
    private:
-    size_t row_ = 0;
+    // Returns the row of the slice the cursor points to.
+    size_t current_row() const {
+      return has_utid_ ? utid_rows_[index_] : index_;
+    }
+
+    // Without a utid constraint the cursor iterates through all the rows,
+    // otherwise through |utid_rows_|.
+    size_t index_ = 0;
     size_t num_rows_ = 0;
+    bool has_utid_ = false;
+    std::vector<uint32_t> utid_rows_;
+
     const TraceStorage* const storage_;
+    UtidIndex* const utid_index_;
   };
 
   const TraceStorage* const storage_;
+
+  // The slices of each thread, built on the first query with a utid
+  // constraint.
+  UtidIndex utid_index_;
 };
 
 }  // namespace trace_processor
@@ -0,0 +1,313 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/span_join_table.h"
+
+#include <ctype.h>
+
+#include <algorithm>
+#include <set>
+
+#include "perfetto/base/logging.h"
+#include "src/trace_processor/sqlite_utils.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+namespace {
+
+using namespace sqlite_utils;
+
+// Returns the SQL operator corresponding to a constraint which can be pushed
+// down to the child tables, or nullptr if the constraint is not supported.
+const char* PushdownOpToString(int op) {
+  if (IsOpEq(op))
+    return "=";
+  if (IsOpGe(op))
+    return ">=";
+  if (IsOpGt(op))
+    return ">";
+  if (IsOpLe(op))
+    return "<=";
+  if (IsOpLt(op))
+    return "<";
+  return nullptr;
+}
+
+std::string TrimWhitespace(const std::string& str) {
+  size_t start = str.find_first_not_of(" \t\n");
+  if (start == std::string::npos)
+    return "";
+  size_t end = str.find_last_not_of(" \t\n");
+  return str.substr(start, end - start + 1);
+}
+
+bool IsIdentifier(const std::string& str) {
+  return !str.empty() && std::all_of(str.begin(), str.end(), [](char c) {
+    return isalnum(static_cast<unsigned char>(c)) || c == '_';
+  });
+}
+
+}  // namespace
+
+SpanJoinTable::SpanJoinTable(sqlite3* db, const TraceStorage*) : db_(db) {}
+
+void SpanJoinTable::RegisterTable(sqlite3* db, const TraceStorage* storage) {
+  Table::RegisterWithArgs<SpanJoinTable>(db, storage, "span_join");
+}
+
+std::string SpanJoinTable::Init(const std::vector<std::string>& args,
+                                std::string* error) {
+  if (args.size() != 3) {
+    *error = "span_join expects 3 arguments: (table1, table2, partition_col)";
+    return "";
+  }
+  std::vector<std::string> names;
+  for (const std::string& arg : args) {
+    names.emplace_back(TrimWhitespace(arg));
+    if (!IsIdentifier(names.back())) {
+      *error = "span_join: invalid argument '" + arg + "'";
+      return "";
+    }
+  }
+  partition_col_ = names[2];
+
+  std::string columns;
+  if (!InitChildTable(names[0], &t1_, &columns, error) ||
+      !InitChildTable(names[1], &t2_, &columns, error)) {
+    return "";
+  }
+
+  std::set<std::string> unique_columns(t1_.columns.begin(),
+                                       t1_.columns.end());
+  for (const std::string& column : t2_.columns) {
+    if (!unique_columns.insert(column).second) {
+      *error = "span_join: column '" + column + "' is in both " + t1_.name +
+               " and " + t2_.name + ", rename it in a view";
+      return "";
+    }
+  }
+
+  return "CREATE TABLE x(ts UNSIGNED BIG INT, dur UNSIGNED BIG INT, " +
+         partition_col_ + " BIG INT" + columns + ");";
+}
+
+bool SpanJoinTable::InitChildTable(const std::string& name,
+                                   ChildTable* table,
+                                   std::string* create_columns,
+                                   std::string* error) {
+  table->name = name;
+  std::string sql = "PRAGMA table_info(" + name + ")";
+  sqlite3_stmt* raw_stmt = nullptr;
+  int err = sqlite3_prepare_v2(db_, sql.c_str(), static_cast<int>(sql.size()),
+                               &raw_stmt, nullptr);
+  ScopedStmt stmt(raw_stmt);
+  if (err != SQLITE_OK) {
+    *error = sqlite3_errmsg(db_);
+    return false;
+  }
+
+  // Each row of table_info is (cid, name, type, notnull, dflt_value, pk).
+  bool has_ts = false;
+  bool has_dur = false;
+  bool has_partition = false;
+  while ((err = sqlite3_step(*stmt)) == SQLITE_ROW) {
+    const char* col_name =
+        reinterpret_cast<const char*>(sqlite3_column_text(*stmt, 1));
+    const char* col_type =
+        reinterpret_cast<const char*>(sqlite3_column_text(*stmt, 2));
+    std::string column = col_name ? col_name : "";
+    if (column == "ts") {
+      has_ts = true;
+    } else if (column == "dur") {
+      has_dur = true;
+    } else if (column == partition_col_) {
+      has_partition = true;
+    } else {
+      table->columns.emplace_back(column);
+      *create_columns += ", " + column + " " + (col_type ? col_type : "");
+    }
+  }
+  if (err != SQLITE_DONE) {
+    *error = sqlite3_errmsg(db_);
+    return false;
+  }
+  if (!has_ts || !has_dur || !has_partition) {
+    *error = "span_join: " + name + " must have ts, dur and " +
+             partition_col_ + " columns";
+    return false;
+  }
+  return true;
+}
+
+std::unique_ptr<Table::Cursor> SpanJoinTable::CreateCursor() {
+  return std::unique_ptr<Table::Cursor>(new Cursor(this, db_));
+}
+
+int SpanJoinTable::BestIndex(const QueryConstraints& qc, BestIndexInfo* info) {
+  // Constraints on the partition are pushed down to both tables, which makes
+  // the join much cheaper.
+  info->estimated_cost = 100;
+  for (const auto& cs : qc.constraints()) {
+    if (cs.iColumn == Column::kPartition && IsOpEq(cs.op))
+      info->estimated_cost = 10;
+  }
+
+  // Rows are produced ordered by (partition, ts).
+  const auto& order_by = qc.order_by();
+  info->order_by_consumed =
+      !order_by.empty() && order_by.size() <= 2 &&
+      order_by[0].iColumn == Column::kPartition && !order_by[0].desc &&
+      (order_by.size() == 1 ||
+       (order_by[1].iColumn == Column::kTimestamp && !order_by[1].desc));
+  return SQLITE_OK;
+}
+
+SpanJoinTable::Cursor::Cursor(const SpanJoinTable* table, sqlite3* db)
+    : table_(table), db_(db) {}
+
+int SpanJoinTable::Cursor::Filter(const QueryConstraints& qc,
+                                  sqlite3_value** argv) {
+  int err = PrepareQuery(table_->t1_, qc, argv, &q1_);
+  if (err != SQLITE_OK)
+    return err;
+  err = PrepareQuery(table_->t2_, qc, argv, &q2_);
+  if (err != SQLITE_OK)
+    return err;
+
+  err = q1_.Step();
+  if (err != SQLITE_OK)
+    return err;
+  err = q2_.Step();
+  if (err != SQLITE_OK)
+    return err;
+
+  eof_ = false;
+  return FindOverlap();
+}
+
+int SpanJoinTable::Cursor::PrepareQuery(const ChildTable& table,
+                                        const QueryConstraints& qc,
+                                        sqlite3_value** argv,
+                                        ChildQuery* query) {
+  const std::string& partition = table_->partition_col_;
+  std::string sql = "SELECT ts, dur, " + partition;
+  for (const std::string& column : table.columns)
+    sql += ", " + column;
+  sql += " FROM " + table.name;
+
+  std::vector<sqlite3_value*> values;
+  for (size_t i = 0; i < qc.constraints().size(); i++) {
+    const auto& cs = qc.constraints()[i];
+    const char* op = PushdownOpToString(cs.op);
+    if (cs.iColumn != Column::kPartition || !op)
+      continue;
+    sql += values.empty() ? " WHERE " : " AND ";
+    sql += partition + " " + op + " ?";
+    values.push_back(argv[i]);
+  }
+  sql += " ORDER BY " + partition + ", ts";
+
+  sqlite3_stmt* raw_stmt = nullptr;
+  int err = sqlite3_prepare_v2(db_, sql.c_str(), static_cast<int>(sql.size()),
+                               &raw_stmt, nullptr);
+  query->stmt.reset(raw_stmt);
+  if (err != SQLITE_OK)
+    return err;
+  for (size_t i = 0; i < values.size(); i++) {
+    err = sqlite3_bind_value(*query->stmt, static_cast<int>(i + 1), values[i]);
+    if (err != SQLITE_OK)
+      return err;
+  }
+  query->eof = false;
+  return SQLITE_OK;
+}
+
+int SpanJoinTable::Cursor::ChildQuery::Step() {
+  int err = sqlite3_step(*stmt);
+  if (err == SQLITE_DONE) {
+    eof = true;
+    return SQLITE_OK;
+  }
+  if (err != SQLITE_ROW)
+    return err;
+  ts = sqlite3_column_int64(*stmt, 0);
+  end = ts + sqlite3_column_int64(*stmt, 1);
+  partition = sqlite3_column_int64(*stmt, 2);
+  return SQLITE_OK;
+}
+
+int SpanJoinTable::Cursor::FindOverlap() {
+  while (!q1_.eof && !q2_.eof) {
+    int err;
+    if (q1_.partition < q2_.partition) {
+      err = q1_.Step();
+    } else if (q2_.partition < q1_.partition) {
+      err = q2_.Step();
+    } else if (std::max(q1_.ts, q2_.ts) < std::min(q1_.end, q2_.end)) {
+      return SQLITE_OK;
+    } else {
+      // The interval which ends first can't overlap anything else in the
+      // other table, as the intervals of each partition are sorted and
+      // disjoint.
+      err = q1_.end <= q2_.end ? q1_.Step() : q2_.Step();
+    }
+    if (err != SQLITE_OK)
+      return err;
+  }
+  eof_ = true;
+  return SQLITE_OK;
+}
+
+int SpanJoinTable::Cursor::Next() {
+  int err = q1_.end <= q2_.end ? q1_.Step() : q2_.Step();
+  if (err != SQLITE_OK)
+    return err;
+  return FindOverlap();
+}
+
+int SpanJoinTable::Cursor::Eof() {
+  return eof_;
+}
+
+int SpanJoinTable::Cursor::Column(sqlite3_context* context, int N) {
+  switch (N) {
+    case Column::kTimestamp:
+      sqlite3_result_int64(context, std::max(q1_.ts, q2_.ts));
+      break;
+    case Column::kDuration:
+      sqlite3_result_int64(context, std::min(q1_.end, q2_.end) -
+                                        std::max(q1_.ts, q2_.ts));
+      break;
+    case Column::kPartition:
+      sqlite3_result_int64(context, q1_.partition);
+      break;
+    default: {
+      // The other columns are forwarded from the current row of the child
+      // queries, where they follow ts, dur and the partition.
+      size_t col = static_cast<size_t>(N - Column::kPartition - 1);
+      size_t t1_cols = table_->t1_.columns.size();
+      sqlite3_stmt* stmt = col < t1_cols ? *q1_.stmt : *q2_.stmt;
+      int stmt_col = static_cast<int>(col < t1_cols ? col : col - t1_cols) + 3;
+      sqlite3_result_value(context, sqlite3_column_value(stmt, stmt_col));
+      break;
+    }
+  }
+  return SQLITE_OK;
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
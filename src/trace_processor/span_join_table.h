@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_SPAN_JOIN_TABLE_H_
+#define SRC_TRACE_PROCESSOR_SPAN_JOIN_TABLE_H_
+
+#include <sqlite3.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "src/trace_processor/scoped_db.h"
+#include "src/trace_processor/table.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// Computes the intersection of the intervals of two tables, partitioned by a
+// column they have in common. Tables are instantiated with:
+//   CREATE VIRTUAL TABLE span USING span_join(t1, t2, partition_col)
+// where t1 and t2 are tables (or views) with "ts" and "dur" columns and an
+// integer |partition_col| column (e.g. cpu or utid). Within a partition, the
+// intervals of each table must not overlap, as is the case for sched slices
+// on a cpu or counter values.
+// Each row is the non-empty intersection of a row of t1 and a row of t2 with
+// the same partition and has the columns:
+//   ts, dur, partition_col, <other columns of t1>, <other columns of t2>
+// Both tables are read once, ordered by (partition, ts), and merged in a
+// single pass, so the cost is linear in the size of the inputs rather than
+// quadratic as with a SQL join on the interval bounds.
+class SpanJoinTable : public Table {
+ public:
+  enum Column { kTimestamp = 0, kDuration = 1, kPartition = 2 };
+
+  static void RegisterTable(sqlite3* db, const TraceStorage* storage);
+
+  SpanJoinTable(sqlite3*, const TraceStorage*);
+
+  // Table implementation.
+  std::string Init(const std::vector<std::string>& args,
+                   std::string* error) override;
+  std::unique_ptr<Table::Cursor> CreateCursor() override;
+  int BestIndex(const QueryConstraints&, BestIndexInfo*) override;
+
+ private:
+  // One of the two tables being joined.
+  struct ChildTable {
+    std::string name;
+
+    // Columns forwarded to the output, i.e. all but ts, dur and the
+    // partition column.
+    std::vector<std::string> columns;
+  };
+
+  class Cursor : public Table::Cursor {
+   public:
+    Cursor(const SpanJoinTable*, sqlite3*);
+
+    // Implementation of Table::Cursor.
+    int Filter(const QueryConstraints&, sqlite3_value**) override;
+    int Next() override;
+    int Eof() override;
+    int Column(sqlite3_context*, int N) override;
+
+   private:
+    // A query on a child table, ordered by (partition, ts), together with
+    // the interval of its current row.
+    struct ChildQuery {
+      int Step();
+
+      ScopedStmt stmt;
+      bool eof = true;
+      int64_t partition = 0;
+      int64_t ts = 0;
+      int64_t end = 0;
+    };
+
+    int PrepareQuery(const ChildTable&,
+                     const QueryConstraints&,
+                     sqlite3_value** argv,
+                     ChildQuery*);
+
+    // Advances the child queries until their current rows overlap (or one of
+    // them reaches the end).
+    int FindOverlap();
+
+    ChildQuery q1_;
+    ChildQuery q2_;
+    bool eof_ = true;
+
+    const SpanJoinTable* const table_;
+    sqlite3* const db_;
+  };
+
+  // Reads the columns of |name| into |table|. Returns false and sets |error|
+  // if the table doesn't exist or lacks the columns required for the join.
+  bool InitChildTable(const std::string& name,
+                      ChildTable* table,
+                      std::string* create_columns,
+                      std::string* error);
+
+  std::string partition_col_;
+  ChildTable t1_;
+  ChildTable t2_;
+
+  sqlite3* const db_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_SPAN_JOIN_TABLE_H_
@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/span_join_table.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "src/trace_processor/scoped_db.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+using Rows = std::vector<std::vector<int64_t>>;
+
+class SpanJoinTableTest : public ::testing::Test {
+ public:
+  SpanJoinTableTest() {
+    sqlite3* db = nullptr;
+    PERFETTO_CHECK(sqlite3_open(":memory:", &db) == SQLITE_OK);
+    db_.reset(db);
+
+    SpanJoinTable::RegisterTable(db_.get(), nullptr);
+  }
+
+  void Exec(const std::string& sql) {
+    char* err = nullptr;
+    int res = sqlite3_exec(*db_, sql.c_str(), nullptr, nullptr, &err);
+    ASSERT_EQ(res, SQLITE_OK) << (err ? err : "");
+  }
+
+  void PrepareValidStatement(const std::string& sql) {
+    int size = static_cast<int>(sql.size());
+    sqlite3_stmt* stmt;
+    ASSERT_EQ(sqlite3_prepare_v2(*db_, sql.c_str(), size, &stmt, nullptr),
+              SQLITE_OK);
+    stmt_.reset(stmt);
+  }
+
+  // Steps through |stmt_| and returns the rows, with all columns as ints.
+  Rows StepAll() {
+    Rows rows;
+    while (sqlite3_step(*stmt_) == SQLITE_ROW) {
+      rows.emplace_back();
+      for (int i = 0; i < sqlite3_column_count(*stmt_); i++)
+        rows.back().push_back(sqlite3_column_int64(*stmt_, i));
+    }
+    return rows;
+  }
+
+ protected:
+  ScopedDb db_;
+  ScopedStmt stmt_;
+};
+
+TEST_F(SpanJoinTableTest, JoinsWithinPartitions) {
+  Exec("CREATE TABLE a(ts BIG INT, dur BIG INT, cpu INT, utid INT);");
+  Exec("CREATE TABLE b(ts BIG INT, dur BIG INT, cpu INT, freq INT);");
+  // cpu 0: a = [0, 10) [10, 20) [25, 30); b = [5, 15) [15, 40).
+  Exec("INSERT INTO a VALUES (0, 10, 0, 1), (10, 10, 0, 2), (25, 5, 0, 3);");
+  Exec("INSERT INTO b VALUES (5, 10, 0, 100), (15, 25, 0, 200);");
+  // cpu 1 only in a, cpu 2 only in b, cpu 3 in both without overlaps.
+  Exec("INSERT INTO a VALUES (0, 100, 1, 4), (0, 10, 3, 5);");
+  Exec("INSERT INTO b VALUES (0, 100, 2, 300), (10, 10, 3, 400);");
+  Exec("CREATE VIRTUAL TABLE span USING span_join(a, b, cpu);");
+
+  PrepareValidStatement("SELECT ts, dur, cpu, utid, freq FROM span");
+  ASSERT_EQ(StepAll(), Rows({
+                        {5, 5, 0, 1, 100},
+                        {10, 5, 0, 2, 100},
+                        {15, 5, 0, 2, 200},
+                        {25, 5, 0, 3, 200},
+                    }));
+}
+
+TEST_F(SpanJoinTableTest, PartitionConstraintIsPushedDown) {
+  Exec("CREATE TABLE a(ts BIG INT, dur BIG INT, utid INT, x INT);");
+  Exec("CREATE TABLE b(ts BIG INT, dur BIG INT, utid INT, y INT);");
+  Exec("INSERT INTO a VALUES (0, 10, 1, 1), (0, 10, 2, 2);");
+  Exec("INSERT INTO b VALUES (5, 10, 1, 3), (5, 10, 2, 4);");
+  Exec("CREATE VIRTUAL TABLE span USING span_join(a, b, utid);");
+
+  PrepareValidStatement("SELECT * FROM span WHERE utid = 2 ORDER BY utid");
+  ASSERT_EQ(StepAll(), Rows({{5, 5, 2, 2, 4}}));
+}
+
+TEST_F(SpanJoinTableTest, InvalidArguments) {
+  Exec("CREATE TABLE a(ts BIG INT, dur BIG INT, cpu INT, v INT);");
+  Exec("CREATE TABLE b(ts BIG INT, cpu INT);");
+  Exec("CREATE TABLE c(ts BIG INT, dur BIG INT, cpu INT, v INT);");
+
+  const char* kStatements[] = {
+      "CREATE VIRTUAL TABLE s USING span_join(a, a);",
+      "CREATE VIRTUAL TABLE s USING span_join(a, b, cpu);",
+      "CREATE VIRTUAL TABLE s USING span_join(a, c, cpu);",
+      "CREATE VIRTUAL TABLE s USING span_join(a, no_such_table, cpu);",
+  };
+  for (const char* sql : kStatements) {
+    ASSERT_NE(sqlite3_exec(*db_, sql, nullptr, nullptr, nullptr), SQLITE_OK)
+        << sql;
+  }
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
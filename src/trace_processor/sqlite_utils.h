@@ -18,6 +18,14 @@
 #define SRC_TRACE_PROCESSOR_SQLITE_UTILS_H_
 
 #include <sqlite3.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <bitset>
+#include <string>
+
+#include "perfetto/base/utils.h"
 
 namespace perfetto {
 namespace trace_processor {
@@ -43,6 +51,113 @@ inline bool IsOpLt(int op) {
   return op == SQLITE_INDEX_CONSTRAINT_LT;
 }
 
+// The LIMIT and OFFSET of a query are passed to the vtables as constraints,
+// on an arbitrary column, since SQLite 3.38.
+inline bool IsOpLimit(int op) {
+#if SQLITE_VERSION_NUMBER >= 3038000
+  return op == SQLITE_INDEX_CONSTRAINT_LIMIT;
+#else
+  base::ignore_result(op);
+  return false;
+#endif
+}
+
+inline bool IsOpOffset(int op) {
+#if SQLITE_VERSION_NUMBER >= 3038000
+  return op == SQLITE_INDEX_CONSTRAINT_OFFSET;
+#else
+  base::ignore_result(op);
+  return false;
+#endif
+}
+
+// Returns the SQL operator of a vtable constraint, e.g. ">=".
+inline std::string OpToString(int op) {
+  switch (op) {
+    case SQLITE_INDEX_CONSTRAINT_EQ:
+      return "=";
+    case SQLITE_INDEX_CONSTRAINT_GT:
+      return ">";
+    case SQLITE_INDEX_CONSTRAINT_LE:
+      return "<=";
+    case SQLITE_INDEX_CONSTRAINT_LT:
+      return "<";
+    case SQLITE_INDEX_CONSTRAINT_GE:
+      return ">=";
+    case SQLITE_INDEX_CONSTRAINT_MATCH:
+      return "MATCH";
+#if SQLITE_VERSION_NUMBER >= 3021000
+    case SQLITE_INDEX_CONSTRAINT_LIKE:
+      return "LIKE";
+    case SQLITE_INDEX_CONSTRAINT_GLOB:
+      return "GLOB";
+    case SQLITE_INDEX_CONSTRAINT_NE:
+      return "!=";
+    case SQLITE_INDEX_CONSTRAINT_ISNOT:
+      return "IS NOT";
+    case SQLITE_INDEX_CONSTRAINT_ISNOTNULL:
+      return "IS NOT NULL";
+    case SQLITE_INDEX_CONSTRAINT_ISNULL:
+      return "IS NULL";
+    case SQLITE_INDEX_CONSTRAINT_IS:
+      return "IS";
+#endif
+#if SQLITE_VERSION_NUMBER >= 3038000
+    case SQLITE_INDEX_CONSTRAINT_LIMIT:
+      return "LIMIT";
+    case SQLITE_INDEX_CONSTRAINT_OFFSET:
+      return "OFFSET";
+#endif
+  }
+  return "op" + std::to_string(op);
+}
+
+// Updates |filter|, a bitmap of the rows of an integer column which can match,
+// according to a constraint on the column. Returns false if |op| is not
+// supported, in which case |filter| is left untouched.
+template <size_t N>
+bool PopulateFilterBitmap(int op,
+                          sqlite3_value* value,
+                          std::bitset<N>* filter) {
+  bool constraint_implemented = true;
+  int64_t int_value = sqlite3_value_int64(value);
+  if (IsOpGe(op) || IsOpGt(op)) {
+    // If the operator is gt, then add one to the upper bound.
+    int_value = IsOpGt(op) ? int_value + 1 : int_value;
+
+    // Set to false all values less than |int_value|.
+    size_t ub = static_cast<size_t>(std::max<int64_t>(0, int_value));
+    ub = std::min(ub, filter->size());
+    for (size_t i = 0; i < ub; i++) {
+      filter->set(i, false);
+    }
+  } else if (IsOpLe(op) || IsOpLt(op)) {
+    // If the operator is lt, then minus one to the lower bound.
+    int_value = IsOpLt(op) ? int_value - 1 : int_value;
+
+    // Set to false all values greater than |int_value|.
+    size_t lb = static_cast<size_t>(std::max<int64_t>(0, int_value));
+    lb = std::min(lb, filter->size());
+    for (size_t i = lb; i < filter->size(); i++) {
+      filter->set(i, false);
+    }
+  } else if (IsOpEq(op)) {
+    if (int_value >= 0 && static_cast<size_t>(int_value) < filter->size()) {
+      // If the value is in bounds, set all bits to false and restore the value
+      // of the bit at the specified index.
+      bool existing = filter->test(static_cast<size_t>(int_value));
+      filter->reset();
+      filter->set(static_cast<size_t>(int_value), existing);
+    } else {
+      // If the index is out of bounds, nothing should match.
+      filter->reset();
+    }
+  } else {
+    constraint_implemented = false;
+  }
+  return constraint_implemented;
+}
+
 }  // namespace sqlite_utils
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -0,0 +1,712 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/storage_snapshot.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <limits>
+#include <type_traits>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/base/utils.h"
+#include "src/trace_processor/trace_processor_context.h"
+#include "src/trace_processor/trace_storage.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+namespace {
+
+constexpr size_t kAlignment = 8;
+constexpr size_t kHeaderSize = sizeof(StorageSnapshot::kMagic) + 8;
+
+inline size_t PaddingFor(size_t offset) {
+  return (kAlignment - offset % kAlignment) % kAlignment;
+}
+
+// The section writers below are invoked twice for each section: first with a
+// CountingSink to compute the size of the payload, which goes in the section
+// header, then with the FileSink. This avoids having to buffer whole sections.
+class CountingSink {
+ public:
+  template <typename T>
+  void Write(T) {
+    size_ += sizeof(T);
+  }
+  void WriteRaw(const void*, size_t size) { size_ += size; }
+  void Pad() { size_ += PaddingFor(size_); }
+
+  size_t size() const { return size_; }
+
+ private:
+  size_t size_ = 0;
+};
+
+class FileSink {
+ public:
+  explicit FileSink(int fd) : fd_(fd) { buf_.reserve(kFlushSize); }
+
+  template <typename T>
+  void Write(T value) {
+    WriteRaw(&value, sizeof(T));
+  }
+
+  void WriteRaw(const void* data, size_t size) {
+    const uint8_t* ptr = static_cast<const uint8_t*>(data);
+    buf_.insert(buf_.end(), ptr, ptr + size);
+    offset_ += size;
+    if (buf_.size() >= kFlushSize)
+      Flush();
+  }
+
+  void Pad() {
+    static const uint8_t kZeros[kAlignment]{};
+    WriteRaw(kZeros, PaddingFor(offset_));
+  }
+
+  // Returns false if any of the writes so far failed.
+  bool Flush() {
+    size_t written = 0;
+    while (ok_ && written < buf_.size()) {
+      ssize_t res = PERFETTO_EINTR(
+          write(fd_, buf_.data() + written, buf_.size() - written));
+      ok_ = res > 0;
+      written += ok_ ? static_cast<size_t>(res) : 0;
+    }
+    buf_.clear();
+    return ok_;
+  }
+
+ private:
+  static constexpr size_t kFlushSize = 1024 * 1024;
+
+  const int fd_;
+  std::vector<uint8_t> buf_;
+  size_t offset_ = 0;
+  bool ok_ = true;
+};
+
+// static
+constexpr size_t FileSink::kFlushSize;
+
+// Writes a column of |count| values, each converted to DiskT.
+template <typename DiskT, typename Sink, typename Getter>
+void WriteColumn(Sink* sink, size_t count, Getter getter) {
+  sink->template Write<uint64_t>(count);
+  for (size_t i = 0; i < count; i++)
+    sink->template Write<DiskT>(static_cast<DiskT>(getter(i)));
+  sink->Pad();
+}
+
+// Fast path for columns stored with the same type in memory and on disk.
+template <typename DiskT, typename Sink, typename T>
+void WriteColumn(Sink* sink, const ChunkedColumn<T>& column) {
+  if (!std::is_same<DiskT, T>::value) {
+    WriteColumn<DiskT>(sink, column.size(),
+                       [&column](size_t i) { return column[i]; });
+    return;
+  }
+  sink->template Write<uint64_t>(column.size());
+  for (size_t c = 0; c < column.chunk_count(); c++)
+    sink->WriteRaw(column.chunk_data(c), column.chunk_size(c) * sizeof(T));
+  sink->Pad();
+}
+
+struct StringsWriter {
+  template <typename Sink>
+  static void Write(const TraceStorage& storage, Sink* sink) {
+    const size_t count = storage.string_count();
+    WriteColumn<uint32_t>(sink, count, [&storage](size_t i) {
+      return storage.GetString(i).size();
+    });
+    size_t total_size = 0;
+    for (size_t i = 0; i < count; i++)
+      total_size += storage.GetString(i).size();
+    sink->template Write<uint64_t>(total_size);
+    for (size_t i = 0; i < count; i++) {
+      base::StringView str = storage.GetString(i);
+      sink->WriteRaw(str.data(), str.size());
+    }
+    sink->Pad();
+  }
+};
+
+struct ProcessesWriter {
+  template <typename Sink>
+  static void Write(const TraceStorage& storage, Sink* sink) {
+    // UniquePid 0 is reserved and not serialized.
+    const size_t count = storage.process_count();
+    auto process = [&storage](size_t i) -> TraceStorage::Process {
+      return storage.GetProcess(static_cast<UniquePid>(i + 1));
+    };
+    WriteColumn<uint32_t>(sink, count,
+                          [&process](size_t i) { return process(i).pid; });
+    WriteColumn<uint64_t>(sink, count,
+                          [&process](size_t i) { return process(i).start_ns; });
+    WriteColumn<uint64_t>(sink, count,
+                          [&process](size_t i) { return process(i).end_ns; });
+    WriteColumn<uint64_t>(sink, count,
+                          [&process](size_t i) { return process(i).name_id; });
+  }
+};
+
+struct ThreadsWriter {
+  template <typename Sink>
+  static void Write(const TraceStorage& storage, Sink* sink) {
+    // UniqueTid 0 is reserved and not serialized.
+    const size_t count = storage.thread_count();
+    auto thread = [&storage](size_t i) -> TraceStorage::Thread {
+      return storage.GetThread(static_cast<UniqueTid>(i + 1));
+    };
+    WriteColumn<uint32_t>(sink, count,
+                          [&thread](size_t i) { return thread(i).tid; });
+    WriteColumn<uint64_t>(sink, count,
+                          [&thread](size_t i) { return thread(i).start_ns; });
+    WriteColumn<uint64_t>(sink, count,
+                          [&thread](size_t i) { return thread(i).end_ns; });
+    WriteColumn<uint64_t>(sink, count,
+                          [&thread](size_t i) { return thread(i).name_id; });
+    WriteColumn<uint32_t>(sink, count,
+                          [&thread](size_t i) { return thread(i).upid; });
+  }
+};
+
+struct SchedSlicesWriter {
+  template <typename Sink>
+  static void Write(const TraceStorage& storage, Sink* sink) {
+    std::vector<uint32_t> cpus;
+    for (uint32_t cpu = 0; cpu < base::kMaxCpus; cpu++) {
+      if (storage.SlicesForCpu(cpu).slice_count() > 0)
+        cpus.emplace_back(cpu);
+    }
+    WriteColumn<uint32_t>(sink, cpus.size(),
+                          [&cpus](size_t i) { return cpus[i]; });
+    for (uint32_t cpu : cpus) {
+      const auto& slices = storage.SlicesForCpu(cpu);
+      WriteColumn<uint64_t>(sink, slices.start_ns());
+      WriteColumn<uint64_t>(sink, slices.durations());
+      WriteColumn<uint32_t>(sink, slices.utids());
+      WriteColumn<uint64_t>(sink, slices.cycles());
+      WriteColumn<uint32_t>(sink, slices.end_states());
+    }
+  }
+};
+
+struct NestableSlicesWriter {
+  template <typename Sink>
+  static void Write(const TraceStorage& storage, Sink* sink) {
+    const auto& slices = storage.nestable_slices();
+    WriteColumn<uint64_t>(sink, slices.start_ns());
+    WriteColumn<uint64_t>(sink, slices.durations());
+    WriteColumn<uint32_t>(sink, slices.utids());
+    WriteColumn<uint64_t>(sink, slices.cats());
+    WriteColumn<uint64_t>(sink, slices.names());
+    WriteColumn<uint8_t>(sink, slices.depths());
+    WriteColumn<uint64_t>(sink, slices.stack_ids());
+    WriteColumn<uint64_t>(sink, slices.parent_stack_ids());
+  }
+};
+
+struct CountersWriter {
+  template <typename Sink>
+  static void Write(const TraceStorage& storage, Sink* sink) {
+    const auto& counters = storage.counters();
+    const size_t count = counters.counter_count();
+    WriteColumn<uint64_t>(sink, count, [&counters](size_t i) {
+      return counters.counter(static_cast<CounterId>(i)).name_id;
+    });
+    WriteColumn<int64_t>(sink, count, [&counters](size_t i) {
+      return counters.counter(static_cast<CounterId>(i)).ref;
+    });
+    WriteColumn<uint32_t>(sink, count, [&counters](size_t i) {
+      return counters.counter(static_cast<CounterId>(i)).ref_type;
+    });
+    for (CounterId id = 0; id < count; id++) {
+      // The samples are decoded in order, as WriteColumn() reads them.
+      const CounterSeries* series = counters.counter(id).series;
+      const uint32_t samples = series->size();
+      CounterSeries::Iterator it = series->Begin(samples);
+      WriteColumn<uint64_t>(sink, samples, [&it](size_t i) {
+        PERFETTO_DCHECK(it.index() == i);
+        uint64_t ts = it.ts();
+        it.Next();
+        return ts;
+      });
+      it = series->Begin(samples);
+      WriteColumn<int64_t>(sink, samples, [&it](size_t) {
+        int64_t value = it.value();
+        it.Next();
+        return value;
+      });
+    }
+  }
+};
+
+struct StatsWriter {
+  template <typename Sink>
+  static void Write(const TraceStorage& storage, Sink* sink) {
+    const auto& stats = storage.stats();
+    WriteColumn<uint64_t>(sink, 2, [&stats](size_t i) {
+      return i == 0 ? stats.mismatched_sched_switch_tids_
+                    : stats.ftrace_bundles_invalid_cpu_;
+    });
+  }
+};
+
+template <typename SectionWriter>
+void WriteSection(const TraceStorage& storage,
+                  StorageSnapshot::SectionId id,
+                  FileSink* sink) {
+  CountingSink counter;
+  SectionWriter::Write(storage, &counter);
+  sink->Write<uint32_t>(id);
+  sink->Write<uint32_t>(0);  // Reserved.
+  sink->Write<uint64_t>(counter.size());
+  SectionWriter::Write(storage, sink);
+  sink->Pad();
+}
+
+// Bounds-checked reader over the snapshot buffer. All methods return false
+// (and leave the cursor in an unspecified state) if the data is truncated.
+class SnapshotCursor {
+ public:
+  SnapshotCursor(const uint8_t* data, size_t size)
+      : start_(data), pos_(data), end_(data + size) {}
+
+  template <typename T>
+  bool Read(T* value) {
+    if (static_cast<size_t>(end_ - pos_) < sizeof(T))
+      return false;
+    memcpy(value, pos_, sizeof(T));
+    pos_ += sizeof(T);
+    return true;
+  }
+
+  bool Skip(size_t size) {
+    if (static_cast<size_t>(end_ - pos_) < size)
+      return false;
+    pos_ += size;
+    return true;
+  }
+
+  bool Align() { return Skip(PaddingFor(static_cast<size_t>(pos_ - start_))); }
+
+  // Reads a column header and returns a pointer to its |count| values.
+  template <typename T>
+  bool ReadColumn(uint64_t* count, const uint8_t** values) {
+    if (!Read(count))
+      return false;
+    if (*count > static_cast<size_t>(end_ - pos_) / sizeof(T))
+      return false;
+    *values = pos_;
+    pos_ += *count * sizeof(T);
+    return Align();
+  }
+
+  // Same as above for columns whose size is known in advance.
+  template <typename T>
+  bool ReadColumn(uint64_t expected_count, const uint8_t** values) {
+    uint64_t count = 0;
+    return ReadColumn<T>(&count, values) && count == expected_count;
+  }
+
+  const uint8_t* pos() const { return pos_; }
+
+ private:
+  const uint8_t* const start_;
+  const uint8_t* pos_;
+  const uint8_t* const end_;
+};
+
+template <typename T>
+inline T ValueAt(const uint8_t* values, size_t index) {
+  T value;
+  memcpy(&value, values + index * sizeof(T), sizeof(T));
+  return value;
+}
+
+// Returns whether all the |count| values of a column are below |limit|, to
+// validate the references to other tables before appending a whole column.
+template <typename T>
+bool AllBelow(const uint8_t* values, size_t count, uint64_t limit) {
+  for (size_t i = 0; i < count; i++) {
+    if (static_cast<uint64_t>(ValueAt<T>(values, i)) >= limit)
+      return false;
+  }
+  return true;
+}
+
+bool LoadStrings(SnapshotCursor* cursor, TraceStorage* storage) {
+  uint64_t count = 0;
+  uint64_t total_size = 0;
+  const uint8_t* sizes = nullptr;
+  const uint8_t* chars = nullptr;
+  if (!cursor->ReadColumn<uint32_t>(&count, &sizes) ||
+      !cursor->ReadColumn<char>(&total_size, &chars)) {
+    return false;
+  }
+  size_t offset = 0;
+  for (size_t i = 0; i < count; i++) {
+    size_t size = ValueAt<uint32_t>(sizes, i);
+    if (size > total_size - offset)
+      return false;
+    auto* str = reinterpret_cast<const char*>(chars + offset);
+    // The IDs are assigned in insertion order, so they match the ones in the
+    // original storage as long as the strings are unique.
+    if (storage->InternString(base::StringView(str, size)) != i)
+      return false;
+    offset += size;
+  }
+  return true;
+}
+
+bool LoadProcesses(SnapshotCursor* cursor, TraceStorage* storage) {
+  uint64_t count = 0;
+  const uint8_t* pids = nullptr;
+  const uint8_t* starts = nullptr;
+  const uint8_t* ends = nullptr;
+  const uint8_t* names = nullptr;
+  if (!cursor->ReadColumn<uint32_t>(&count, &pids) ||
+      !cursor->ReadColumn<uint64_t>(count, &starts) ||
+      !cursor->ReadColumn<uint64_t>(count, &ends) ||
+      !cursor->ReadColumn<uint64_t>(count, &names)) {
+    return false;
+  }
+  for (size_t i = 0; i < count; i++) {
+    StringId name_id = ValueAt<uint64_t>(names, i);
+    if (name_id >= storage->string_count())
+      return false;
+    UniquePid upid = storage->AddEmptyProcess(ValueAt<uint32_t>(pids, i));
+    auto* process = storage->GetMutableProcess(upid);
+    process->start_ns = ValueAt<uint64_t>(starts, i);
+    process->end_ns = ValueAt<uint64_t>(ends, i);
+    process->name_id = name_id;
+  }
+  return true;
+}
+
+bool LoadThreads(SnapshotCursor* cursor, TraceStorage* storage) {
+  uint64_t count = 0;
+  const uint8_t* tids = nullptr;
+  const uint8_t* starts = nullptr;
+  const uint8_t* ends = nullptr;
+  const uint8_t* names = nullptr;
+  const uint8_t* upids = nullptr;
+  if (!cursor->ReadColumn<uint32_t>(&count, &tids) ||
+      !cursor->ReadColumn<uint64_t>(count, &starts) ||
+      !cursor->ReadColumn<uint64_t>(count, &ends) ||
+      !cursor->ReadColumn<uint64_t>(count, &names) ||
+      !cursor->ReadColumn<uint32_t>(count, &upids)) {
+    return false;
+  }
+  for (size_t i = 0; i < count; i++) {
+    StringId name_id = ValueAt<uint64_t>(names, i);
+    UniquePid upid = ValueAt<uint32_t>(upids, i);
+    if (name_id >= storage->string_count() || upid > storage->process_count())
+      return false;
+    UniqueTid utid = storage->AddEmptyThread(ValueAt<uint32_t>(tids, i));
+    auto* thread = storage->GetMutableThread(utid);
+    thread->start_ns = ValueAt<uint64_t>(starts, i);
+    thread->end_ns = ValueAt<uint64_t>(ends, i);
+    thread->name_id = name_id;
+    thread->upid = upid;
+  }
+  return true;
+}
+
+bool LoadSchedSlices(SnapshotCursor* cursor, TraceStorage* storage) {
+  uint64_t cpu_count = 0;
+  const uint8_t* cpus = nullptr;
+  if (!cursor->ReadColumn<uint32_t>(&cpu_count, &cpus))
+    return false;
+  for (size_t c = 0; c < cpu_count; c++) {
+    uint32_t cpu = ValueAt<uint32_t>(cpus, c);
+    uint64_t count = 0;
+    const uint8_t* starts = nullptr;
+    const uint8_t* durs = nullptr;
+    const uint8_t* utids = nullptr;
+    const uint8_t* cycles = nullptr;
+    const uint8_t* end_states = nullptr;
+    if (cpu >= base::kMaxCpus ||
+        !cursor->ReadColumn<uint64_t>(&count, &starts) ||
+        !cursor->ReadColumn<uint64_t>(count, &durs) ||
+        !cursor->ReadColumn<uint32_t>(count, &utids) ||
+        !cursor->ReadColumn<uint64_t>(count, &cycles) ||
+        !cursor->ReadColumn<uint32_t>(count, &end_states)) {
+      return false;
+    }
+    if (!AllBelow<uint32_t>(utids, count, storage->thread_count() + 1))
+      return false;
+    storage->mutable_slices_for_cpu(cpu)->AppendSlices(
+        count, starts, durs, utids, cycles, end_states);
+  }
+  return true;
+}
+
+bool LoadNestableSlices(SnapshotCursor* cursor, TraceStorage* storage) {
+  uint64_t count = 0;
+  const uint8_t* starts = nullptr;
+  const uint8_t* durs = nullptr;
+  const uint8_t* utids = nullptr;
+  const uint8_t* cats = nullptr;
+  const uint8_t* names = nullptr;
+  const uint8_t* depths = nullptr;
+  const uint8_t* stack_ids = nullptr;
+  const uint8_t* parent_stack_ids = nullptr;
+  if (!cursor->ReadColumn<uint64_t>(&count, &starts) ||
+      !cursor->ReadColumn<uint64_t>(count, &durs) ||
+      !cursor->ReadColumn<uint32_t>(count, &utids) ||
+      !cursor->ReadColumn<uint64_t>(count, &cats) ||
+      !cursor->ReadColumn<uint64_t>(count, &names) ||
+      !cursor->ReadColumn<uint8_t>(count, &depths) ||
+      !cursor->ReadColumn<uint64_t>(count, &stack_ids) ||
+      !cursor->ReadColumn<uint64_t>(count, &parent_stack_ids)) {
+    return false;
+  }
+  if (!AllBelow<uint64_t>(cats, count, storage->string_count()) ||
+      !AllBelow<uint64_t>(names, count, storage->string_count()) ||
+      !AllBelow<uint32_t>(utids, count, storage->thread_count() + 1)) {
+    return false;
+  }
+  storage->mutable_nestable_slices()->AppendSlices(
+      count, starts, durs, utids, cats, names, depths, stack_ids,
+      parent_stack_ids);
+  return true;
+}
+
+bool LoadCounters(SnapshotCursor* cursor, TraceStorage* storage) {
+  uint64_t count = 0;
+  const uint8_t* name_ids = nullptr;
+  const uint8_t* refs = nullptr;
+  const uint8_t* ref_types = nullptr;
+  if (!cursor->ReadColumn<uint64_t>(&count, &name_ids) ||
+      !cursor->ReadColumn<int64_t>(count, &refs) ||
+      !cursor->ReadColumn<uint32_t>(count, &ref_types)) {
+    return false;
+  }
+  for (size_t i = 0; i < count; i++) {
+    StringId name_id = ValueAt<uint64_t>(name_ids, i);
+    uint32_t ref_type = ValueAt<uint32_t>(ref_types, i);
+    if (name_id >= storage->string_count() ||
+        ref_type > static_cast<uint32_t>(RefType::kUpid)) {
+      return false;
+    }
+    CounterId id = storage->GetOrAddCounter(
+        name_id, ValueAt<int64_t>(refs, i), static_cast<RefType>(ref_type));
+    if (id != i)
+      return false;
+  }
+  auto* counters = storage->mutable_counters();
+  for (CounterId id = 0; id < count; id++) {
+    uint64_t samples = 0;
+    const uint8_t* timestamps = nullptr;
+    const uint8_t* values = nullptr;
+    if (!cursor->ReadColumn<uint64_t>(&samples, &timestamps) ||
+        !cursor->ReadColumn<int64_t>(samples, &values)) {
+      return false;
+    }
+    for (size_t i = 0; i < samples; i++) {
+      if (!counters->AddSample(id, ValueAt<uint64_t>(timestamps, i),
+                               ValueAt<int64_t>(values, i))) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool LoadStats(SnapshotCursor* cursor, TraceStorage* storage) {
+  const uint8_t* values = nullptr;
+  if (!cursor->ReadColumn<uint64_t>(2, &values))
+    return false;
+  auto* stats = storage->mutable_stats();
+  stats->mismatched_sched_switch_tids_ = ValueAt<uint64_t>(values, 0);
+  stats->ftrace_bundles_invalid_cpu_ = ValueAt<uint64_t>(values, 1);
+  return true;
+}
+
+}  // namespace
+
+// static
+constexpr char StorageSnapshot::kMagic[];
+constexpr uint32_t StorageSnapshot::kVersion;
+
+// static
+bool StorageSnapshot::Write(const TraceStorage& storage, int fd) {
+  FileSink sink(fd);
+  sink.WriteRaw(kMagic, sizeof(kMagic));
+  sink.Write<uint32_t>(kVersion);
+  sink.Write<uint32_t>(0);  // Reserved.
+
+  // Strings go first, as the other sections refer to them. Same for processes
+  // and threads.
+  WriteSection<StringsWriter>(storage, kStrings, &sink);
+  WriteSection<ProcessesWriter>(storage, kProcesses, &sink);
+  WriteSection<ThreadsWriter>(storage, kThreads, &sink);
+  WriteSection<SchedSlicesWriter>(storage, kSchedSlices, &sink);
+  WriteSection<NestableSlicesWriter>(storage, kNestableSlices, &sink);
+  WriteSection<CountersWriter>(storage, kCounters, &sink);
+  WriteSection<StatsWriter>(storage, kStats, &sink);
+
+  sink.Write<uint32_t>(kEnd);
+  sink.Write<uint32_t>(0);  // Reserved.
+  sink.Write<uint64_t>(0);  // Payload size.
+  return sink.Flush();
+}
+
+StorageSnapshotReader::StorageSnapshotReader(TraceProcessorContext* context)
+    : context_(context), unit_size_(kHeaderSize) {}
+
+StorageSnapshotReader::~StorageSnapshotReader() = default;
+
+bool StorageSnapshotReader::Parse(TraceBlobView blob) {
+  const uint8_t* data = blob.data();
+  size_t size = blob.length();
+  while (size > 0) {
+    if (state_ == State::kFailed)
+      return false;
+    if (state_ == State::kEnd) {
+      PERFETTO_ELOG("Unexpected data after the end of the snapshot");
+      Fail();
+      return false;
+    }
+
+    const uint8_t* unit = nullptr;
+    if (pending_.empty() && size >= unit_size_) {
+      // Fast path: the whole unit is in this chunk, read it in place.
+      unit = data;
+      data += unit_size_;
+      size -= unit_size_;
+    } else {
+      const size_t len = std::min(unit_size_ - pending_.size(), size);
+      pending_.insert(pending_.end(), data, data + len);
+      data += len;
+      size -= len;
+      if (pending_.size() < unit_size_)
+        return true;
+      unit = pending_.data();
+    }
+
+    bool ok = ConsumeUnit(unit);
+    pending_.clear();
+    if (pending_.capacity() > kHeaderSize)
+      std::vector<uint8_t>().swap(pending_);
+    if (!ok) {
+      Fail();
+      return false;
+    }
+  }
+  return true;
+}
+
+void StorageSnapshotReader::NotifyEndOfFile() {
+  if (state_ != State::kEnd && state_ != State::kFailed) {
+    PERFETTO_ELOG("Truncated trace processor snapshot");
+    Fail();
+  }
+}
+
+void StorageSnapshotReader::Fail() {
+  PERFETTO_ELOG("Failed to load the trace processor snapshot");
+  state_ = State::kFailed;
+  std::vector<uint8_t>().swap(pending_);
+}
+
+bool StorageSnapshotReader::ConsumeUnit(const uint8_t* data) {
+  static_assert(kHeaderSize % kAlignment == 0, "Misaligned header");
+  constexpr size_t kSectionHeaderSize = 16;
+  SnapshotCursor cursor(data, unit_size_);
+  switch (state_) {
+    case State::kHeader: {
+      uint32_t version = 0;
+      if (!cursor.Skip(sizeof(StorageSnapshot::kMagic)) ||
+          !cursor.Read(&version)) {
+        return false;
+      }
+      if (version != StorageSnapshot::kVersion) {
+        PERFETTO_ELOG("Unsupported snapshot version %u (expected %u)",
+                      version, StorageSnapshot::kVersion);
+        return false;
+      }
+      state_ = State::kSectionHeader;
+      unit_size_ = kSectionHeaderSize;
+      return true;
+    }
+    case State::kSectionHeader: {
+      uint64_t size = 0;
+      if (!cursor.Read(&section_id_) || !cursor.Skip(sizeof(uint32_t)) ||
+          !cursor.Read(&size)) {
+        return false;
+      }
+      if (section_id_ == StorageSnapshot::kEnd) {
+        state_ = State::kEnd;
+        return true;
+      }
+      if (size > std::numeric_limits<size_t>::max() - kAlignment)
+        return false;
+      section_size_ = static_cast<size_t>(size);
+      state_ = State::kPayload;
+      unit_size_ = section_size_ + PaddingFor(section_size_);
+      return true;
+    }
+    case State::kPayload:
+      break;
+    case State::kEnd:
+    case State::kFailed:
+      PERFETTO_FATAL("Unexpected snapshot state");
+  }
+
+  state_ = State::kSectionHeader;
+  unit_size_ = kSectionHeaderSize;
+  SnapshotCursor section(data, section_size_);
+  TraceStorage* storage = context_->storage.get();
+  bool ok = true;
+  switch (section_id_) {
+    case StorageSnapshot::kStrings:
+      ok = LoadStrings(&section, storage);
+      break;
+    case StorageSnapshot::kProcesses:
+      ok = LoadProcesses(&section, storage);
+      break;
+    case StorageSnapshot::kThreads:
+      ok = LoadThreads(&section, storage);
+      break;
+    case StorageSnapshot::kSchedSlices:
+      ok = LoadSchedSlices(&section, storage);
+      break;
+    case StorageSnapshot::kNestableSlices:
+      ok = LoadNestableSlices(&section, storage);
+      break;
+    case StorageSnapshot::kCounters:
+      ok = LoadCounters(&section, storage);
+      break;
+    case StorageSnapshot::kStats:
+      ok = LoadStats(&section, storage);
+      break;
+    default:
+      PERFETTO_ELOG("Skipping unknown snapshot section %u", section_id_);
+      break;
+  }
+  if (!ok)
+    PERFETTO_ELOG("Malformed snapshot section %u", section_id_);
+  return ok;
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_STORAGE_SNAPSHOT_H_
+#define SRC_TRACE_PROCESSOR_STORAGE_SNAPSHOT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "src/trace_processor/chunked_trace_reader.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+class TraceProcessorContext;
+class TraceStorage;
+
+// A snapshot is a dump of a fully built TraceStorage. Loading it back is
+// much faster than re-tokenizing, re-sorting and re-parsing the original
+// trace. Snapshots are fed to TraceProcessor::Parse() like any other trace
+// and are detected by their magic header.
+//
+// File format (integers are in host byte order, i.e. little endian on all the
+// supported platforms):
+// Header:  [kMagic (16 bytes)][uint32 kVersion][uint32 reserved]
+// Section: [uint32 section id][uint32 reserved][uint64 payload size]
+//          [payload][padding to 8 bytes]
+// The last section is always kEnd. Payloads are made of columns, each one
+// being [uint64 count][count fixed-size values][padding to 8 bytes]. All
+// columns start at an 8-byte aligned file offset, so that a reader can mmap
+// the file and access them in place.
+// Bump kVersion whenever the set of sections or their layout changes; files
+// with a different version are rejected.
+class StorageSnapshot {
+ public:
+  static constexpr char kMagic[] = "PERFETTO_TPSNAP";  // 15 chars + NUL.
+  static constexpr uint32_t kVersion = 4;
+
+  enum SectionId : uint32_t {
+    kEnd = 0,
+    kStrings = 1,
+    kProcesses = 2,
+    kThreads = 3,
+    kSchedSlices = 4,
+    kNestableSlices = 5,
+    kCounters = 6,
+    kStats = 7,
+  };
+
+  // Writes a snapshot of |storage| to |fd|. Returns false on I/O errors.
+  static bool Write(const TraceStorage& storage, int fd);
+};
+
+// Loads a snapshot into the (empty) storage of the context. The snapshot is
+// decoded section by section as it arrives: a section held in a single chunk
+// is read in place, one spanning several chunks is first copied into a
+// buffer of its size. Passing the whole snapshot in one chunk (e.g. a mapping
+// of the file, as the shell does) avoids any copy besides the one into the
+// storage. Columns are appended to the storage a chunk at a time rather than
+// row by row, except where the storage needs per-row work (the index of the
+// strings, the encoding of the counter samples).
+// Only the storage is restored: parsing more trace data into a TraceProcessor
+// that loaded a snapshot is not supported.
+//
+// The rows of each section are validated before being appended, so a
+// malformed snapshot leaves the storage with the sections loaded before the
+// error, like a truncated trace. Nothing is removed from the storage, which
+// queries may be reading meanwhile.
+class StorageSnapshotReader : public ChunkedTraceReader {
+ public:
+  explicit StorageSnapshotReader(TraceProcessorContext*);
+  ~StorageSnapshotReader() override;
+
+  // ChunkedTraceReader implementation.
+  bool Parse(TraceBlobView) override;
+  void NotifyEndOfFile() override;
+
+ private:
+  // What the next |unit_size_| bytes of the snapshot are.
+  enum class State { kHeader, kSectionHeader, kPayload, kEnd, kFailed };
+
+  // Decodes the unit expected in the current state and moves to the next
+  // one. Returns false if the snapshot is malformed.
+  bool ConsumeUnit(const uint8_t* data);
+
+  // Sets |state_| to kFailed. What was loaded so far stays in the storage.
+  void Fail();
+
+  TraceProcessorContext* const context_;
+  State state_ = State::kHeader;
+  size_t unit_size_;
+  uint32_t section_id_ = 0;
+  size_t section_size_ = 0;  // Without the padding.
+
+  // The current unit, if it spans several chunks.
+  std::vector<uint8_t> pending_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_STORAGE_SNAPSHOT_H_
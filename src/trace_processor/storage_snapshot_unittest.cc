@@ -0,0 +1,215 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/storage_snapshot.h"
+
+#include <unistd.h>
+
+#include <limits>
+
+#include "gtest/gtest.h"
+#include "perfetto/base/temp_file.h"
+#include "src/trace_processor/trace_processor_context.h"
+#include "src/trace_processor/trace_storage.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+class StorageSnapshotTest : public ::testing::Test {
+ public:
+  StorageSnapshotTest() {
+    original_.storage.reset(new TraceStorage());
+    loaded_.storage.reset(new TraceStorage());
+  }
+
+  // Writes |original_| to a file and loads it back into |loaded_|, feeding
+  // the reader in chunks of |chunk_size| bytes.
+  void RoundTrip(size_t chunk_size) {
+    base::TempFile file = base::TempFile::CreateUnlinked();
+    ASSERT_TRUE(StorageSnapshot::Write(*original_.storage, file.fd()));
+    off_t size = lseek(file.fd(), 0, SEEK_END);
+    ASSERT_GT(size, 0);
+    ASSERT_EQ(lseek(file.fd(), 0, SEEK_SET), 0);
+
+    StorageSnapshotReader reader(&loaded_);
+    for (off_t off = 0; off < size;) {
+      size_t len = std::min(chunk_size, static_cast<size_t>(size - off));
+      std::unique_ptr<uint8_t[]> buf(new uint8_t[len]);
+      ASSERT_EQ(read(file.fd(), buf.get(), len), static_cast<ssize_t>(len));
+      ASSERT_TRUE(reader.Parse(TraceBlobView(std::move(buf), 0, len)));
+      off += static_cast<off_t>(len);
+    }
+    reader.NotifyEndOfFile();
+  }
+
+  void CheckRoundTrip(size_t chunk_size);
+
+ protected:
+  TraceProcessorContext original_;
+  TraceProcessorContext loaded_;
+};
+
+// Fills |original_|, loads it back and checks that |loaded_| matches it.
+void StorageSnapshotTest::CheckRoundTrip(size_t chunk_size) {
+  TraceStorage* storage = original_.storage.get();
+  StringId proc_name = storage->InternString("proc");
+  StringId thread_name = storage->InternString("thread");
+  StringId cat = storage->InternString("cat");
+
+  UniquePid upid = storage->AddEmptyProcess(10);
+  storage->GetMutableProcess(upid)->name_id = proc_name;
+  storage->GetMutableProcess(upid)->start_ns = 5;
+  UniqueTid utid = storage->AddEmptyThread(11);
+  storage->GetMutableThread(utid)->name_id = thread_name;
+  storage->GetMutableThread(utid)->upid = upid;
+  storage->GetMutableThread(utid)->end_ns = 50;
+
+  for (uint32_t i = 0; i < 10000; i++)
+    storage->AddSliceToCpu(i % 3, 100 + i, 10, utid, i * 2, i % 5);
+  storage->mutable_nestable_slices()->AddSlice(100, 10, utid, cat,
+                                               thread_name, 1, 1234, 567);
+  storage->PushCpuFreq(100, 2, 1000);
+  storage->PushCpuFreq(200, 2, 2000);
+  StringId mem_name = storage->InternString("mem.rss");
+  for (int64_t i = 0; i < 1000; i++) {
+    storage->PushCounter(mem_name, upid, RefType::kUpid,
+                         static_cast<uint64_t>(1000 + i * 10), -i * i);
+  }
+  storage->AddMismatchedSchedSwitch();
+  storage->AddFtraceBundlesInvalidCpu(3);
+
+  RoundTrip(chunk_size);
+  const TraceStorage& loaded = *loaded_.storage;
+
+  ASSERT_EQ(loaded.string_count(), storage->string_count());
+  for (StringId i = 0; i < storage->string_count(); i++)
+    ASSERT_EQ(loaded.GetString(i), storage->GetString(i));
+
+  ASSERT_EQ(loaded.process_count(), 1u);
+  ASSERT_EQ(loaded.GetProcess(upid).pid, 10u);
+  ASSERT_EQ(loaded.GetProcess(upid).name_id, proc_name);
+  ASSERT_EQ(loaded.GetProcess(upid).start_ns, 5u);
+  ASSERT_EQ(loaded.thread_count(), 1u);
+  ASSERT_EQ(loaded.GetThread(utid).tid, 11u);
+  ASSERT_EQ(loaded.GetThread(utid).name_id, thread_name);
+  ASSERT_EQ(loaded.GetThread(utid).upid, upid);
+  ASSERT_EQ(loaded.GetThread(utid).end_ns, 50u);
+
+  for (uint32_t cpu = 0; cpu < base::kMaxCpus; cpu++) {
+    const auto& expected = storage->SlicesForCpu(cpu);
+    const auto& actual = loaded.SlicesForCpu(cpu);
+    ASSERT_EQ(actual.slice_count(), expected.slice_count());
+    for (size_t i = 0; i < expected.slice_count(); i++) {
+      ASSERT_EQ(actual.start_ns()[i], expected.start_ns()[i]);
+      ASSERT_EQ(actual.durations()[i], expected.durations()[i]);
+      ASSERT_EQ(actual.utids()[i], expected.utids()[i]);
+      ASSERT_EQ(actual.cycles()[i], expected.cycles()[i]);
+      ASSERT_EQ(actual.end_states()[i], expected.end_states()[i]);
+    }
+  }
+
+  const auto& nestable = loaded.nestable_slices();
+  ASSERT_EQ(nestable.slice_count(), 1u);
+  ASSERT_EQ(nestable.cats()[0], cat);
+  ASSERT_EQ(nestable.names()[0], thread_name);
+  ASSERT_EQ(nestable.depths()[0], 1u);
+  ASSERT_EQ(nestable.stack_ids()[0], 1234u);
+  ASSERT_EQ(nestable.parent_stack_ids()[0], 567u);
+
+  const auto& counters = loaded.counters();
+  ASSERT_EQ(counters.counter_count(), 2u);
+  ASSERT_EQ(loaded.GetString(counters.counter(0).name_id), "cpufreq");
+  ASSERT_EQ(counters.counter(0).ref, 2);
+  ASSERT_EQ(counters.counter(0).ref_type, RefType::kCpu);
+  const CounterSeries* freqs = counters.counter(0).series;
+  ASSERT_EQ(freqs->size(), 2u);
+  auto it = freqs->Begin(freqs->size());
+  ASSERT_EQ(it.ts(), 100u);
+  ASSERT_EQ(it.value(), 1000);
+  it.Next();
+  ASSERT_EQ(it.ts(), 200u);
+  ASSERT_EQ(it.value(), 2000);
+  const CounterSeries* mem = counters.counter(1).series;
+  ASSERT_EQ(counters.counter(1).ref_type, RefType::kUpid);
+  ASSERT_EQ(mem->size(), 1000u);
+  it = mem->Begin(mem->size());
+  for (int64_t i = 0; i < 1000; i++, it.Next()) {
+    ASSERT_EQ(it.ts(), static_cast<uint64_t>(1000 + i * 10));
+    ASSERT_EQ(it.value(), -i * i);
+  }
+  ASSERT_EQ(loaded.stats().mismatched_sched_switch_tids_, 1u);
+  ASSERT_EQ(loaded.stats().ftrace_bundles_invalid_cpu_, 3u);
+}
+
+TEST_F(StorageSnapshotTest, RoundTripInTinyChunks) {
+  CheckRoundTrip(/*chunk_size=*/7);
+}
+
+TEST_F(StorageSnapshotTest, RoundTripInOneChunk) {
+  // Every section is read in place from the chunk.
+  CheckRoundTrip(std::numeric_limits<size_t>::max());
+}
+
+TEST_F(StorageSnapshotTest, TruncatedSnapshotIsRejected) {
+  TraceStorage* storage = original_.storage.get();
+  storage->InternString("foo");
+  for (uint32_t i = 0; i < 100; i++)
+    storage->AddSliceToCpu(0, i, 1, 0, 0, 0);
+
+  base::TempFile file = base::TempFile::CreateUnlinked();
+  ASSERT_TRUE(StorageSnapshot::Write(*storage, file.fd()));
+  off_t size = lseek(file.fd(), 0, SEEK_END);
+  ASSERT_EQ(lseek(file.fd(), 0, SEEK_SET), 0);
+
+  // Drop the last 100 bytes.
+  size_t len = static_cast<size_t>(size) - 100;
+  std::unique_ptr<uint8_t[]> buf(new uint8_t[len]);
+  ASSERT_EQ(read(file.fd(), buf.get(), len), static_cast<ssize_t>(len));
+  StorageSnapshotReader reader(&loaded_);
+  ASSERT_TRUE(reader.Parse(TraceBlobView(std::move(buf), 0, len)));
+  reader.NotifyEndOfFile();
+
+  // The sections before the truncated one (the nestable slices) stay loaded.
+  ASSERT_EQ(loaded_.storage->SlicesForCpu(0).slice_count(), 100u);
+  ASSERT_EQ(loaded_.storage->string_count(), 2u);
+  ASSERT_EQ(loaded_.storage->nestable_slices().slice_count(), 0u);
+}
+
+TEST_F(StorageSnapshotTest, TrailingDataIsRejected) {
+  TraceStorage* storage = original_.storage.get();
+  for (uint32_t i = 0; i < 100; i++)
+    storage->AddSliceToCpu(0, i, 1, 0, 0, 0);
+
+  base::TempFile file = base::TempFile::CreateUnlinked();
+  ASSERT_TRUE(StorageSnapshot::Write(*storage, file.fd()));
+  off_t size = lseek(file.fd(), 0, SEEK_END);
+  ASSERT_EQ(lseek(file.fd(), 0, SEEK_SET), 0);
+
+  size_t len = static_cast<size_t>(size) + 8;
+  std::unique_ptr<uint8_t[]> buf(new uint8_t[len]());
+  ASSERT_EQ(read(file.fd(), buf.get(), len), static_cast<ssize_t>(size));
+  StorageSnapshotReader reader(&loaded_);
+  ASSERT_FALSE(reader.Parse(TraceBlobView(std::move(buf), 0, len)));
+  reader.NotifyEndOfFile();
+
+  // The snapshot itself was loaded.
+  ASSERT_EQ(loaded_.storage->SlicesForCpu(0).slice_count(), 100u);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/string_pool.h"
+
+#include <algorithm>
+
+namespace perfetto {
+namespace trace_processor {
+
+// static
+constexpr size_t StringPool::kBlockSize;
+constexpr size_t StringPool::kMinSlots;
+constexpr StringId StringPool::kEmptySlot;
+
+StringPool::StringPool(HashFn hash_fn)
+    : hash_fn_(hash_fn), slots_(kMinSlots, Slot{0, kEmptySlot}) {
+  // Reserve string ID 0 for the empty string.
+  InternString("");
+}
+
+StringPool::~StringPool() = default;
+StringPool::StringPool(StringPool&&) noexcept = default;
+StringPool& StringPool::operator=(StringPool&&) = default;
+
+StringId StringPool::InternString(base::StringView str) {
+  const uint64_t hash = hash_fn_(str);
+  const size_t mask = slots_.size() - 1;
+  for (size_t i = static_cast<size_t>(hash) & mask;; i = (i + 1) & mask) {
+    Slot& slot = slots_[i];
+    if (slot.id == kEmptySlot) {
+      StringId id = string_starts_.size();
+      string_starts_.emplace_back(InsertInBlock(str));
+      slot.hash = hash;
+      slot.id = id;
+      if (string_starts_.size() * 2 > slots_.size())
+        GrowIndex();
+      return id;
+    }
+    if (slot.hash == hash && Get(slot.id) == str)
+      return slot.id;
+  }
+}
+
+bool StringPool::Find(base::StringView str, StringId* id) const {
+  const uint64_t hash = hash_fn_(str);
+  const size_t mask = slots_.size() - 1;
+  for (size_t i = static_cast<size_t>(hash) & mask;; i = (i + 1) & mask) {
+    const Slot& slot = slots_[i];
+    if (slot.id == kEmptySlot)
+      return false;
+    if (slot.hash == hash && Get(slot.id) == str) {
+      *id = slot.id;
+      return true;
+    }
+  }
+}
+
+const char* StringPool::InsertInBlock(base::StringView str) {
+  PERFETTO_CHECK(str.size() <= std::numeric_limits<uint32_t>::max());
+  const size_t needed = sizeof(uint32_t) + str.size() + 1;
+  if (blocks_.empty() || last_block_used_ + needed > last_block_size_) {
+    last_block_size_ = std::max(kBlockSize, needed);
+    last_block_used_ = 0;
+    blocks_.emplace_back(new char[last_block_size_]);
+    allocated_bytes_ += last_block_size_;
+  }
+  char* dst = blocks_.back().get() + last_block_used_;
+  last_block_used_ += needed;
+
+  const uint32_t size = static_cast<uint32_t>(str.size());
+  memcpy(dst, &size, sizeof(size));
+  dst += sizeof(size);
+  memcpy(dst, str.data(), str.size());
+  dst[str.size()] = '\0';
+  return dst;
+}
+
+void StringPool::GrowIndex() {
+  std::vector<Slot> old_slots(slots_.size() * 2, Slot{0, kEmptySlot});
+  old_slots.swap(slots_);
+  const size_t mask = slots_.size() - 1;
+  for (const Slot& old_slot : old_slots) {
+    if (old_slot.id == kEmptySlot)
+      continue;
+    size_t i = static_cast<size_t>(old_slot.hash) & mask;
+    while (slots_[i].id != kEmptySlot)
+      i = (i + 1) & mask;
+    slots_[i] = old_slot;
+  }
+}
+
+size_t StringPool::memory_usage_bytes() const {
+  return allocated_bytes_ + string_starts_.memory_usage_bytes() +
+         slots_.capacity() * sizeof(Slot);
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_STRING_POOL_H_
+#define SRC_TRACE_PROCESSOR_STRING_POOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/base/string_view.h"
+#include "src/trace_processor/chunked_column.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// StringId is a dense index into the StringPool, assigned in order of
+// insertion. ID 0 is always the empty string.
+using StringId = size_t;
+
+// Interns strings into a set of large, append-only arena blocks.
+// Each string is stored contiguously as:
+// [uint32_t length][length bytes of the string]['\0'].
+// The trailing NUL allows passing the strings to C APIs, the length prefix
+// allows getting the size without strlen().
+// Lookups go through an open-addressing hash table (linear probing) which
+// stores the full 64-bit hash of each string but always compares the actual
+// bytes before returning a match, so colliding strings get distinct IDs.
+// Strings are never moved once inserted, so the returned StringViews stay
+// valid for the lifetime of the pool.
+class StringPool {
+ public:
+  using HashFn = uint64_t (*)(base::StringView);
+
+  // |hash_fn| is only overridden by tests, to force collisions.
+  explicit StringPool(HashFn hash_fn = &DefaultHash);
+  ~StringPool();
+
+  StringPool(StringPool&&) noexcept;
+  StringPool& operator=(StringPool&&);
+
+  // Returns the ID of |str|, copying it into the pool if not already there.
+  StringId InternString(base::StringView str);
+
+  // Sets |id| to the ID of |str| and returns true if it was interned.
+  bool Find(base::StringView str, StringId* id) const;
+
+  // The returned view is NUL terminated.
+  inline base::StringView Get(StringId id) const {
+    PERFETTO_DCHECK(id < string_starts_.size());
+    const char* str = string_starts_[id];
+    uint32_t size;
+    memcpy(&size, str - sizeof(uint32_t), sizeof(uint32_t));
+    return base::StringView(str, size);
+  }
+
+  // Number of interned strings, including the empty string with ID 0.
+  size_t size() const { return string_starts_.size(); }
+
+  size_t memory_usage_bytes() const;
+
+ private:
+  StringPool(const StringPool&) = delete;
+  StringPool& operator=(const StringPool&) = delete;
+
+  // Blocks are allocated with this size, unless a string is larger than it.
+  static constexpr size_t kBlockSize = 1024 * 1024;
+  static constexpr size_t kMinSlots = 1024;
+  static constexpr StringId kEmptySlot = std::numeric_limits<StringId>::max();
+
+  struct Slot {
+    uint64_t hash;
+    StringId id;
+  };
+
+  static uint64_t DefaultHash(base::StringView str) { return str.Hash(); }
+
+  // Copies |str| in the current block and returns a pointer to its first
+  // character.
+  const char* InsertInBlock(base::StringView str);
+
+  // Doubles the number of slots, re-inserting all the existing IDs.
+  void GrowIndex();
+
+  HashFn hash_fn_;
+
+  std::vector<std::unique_ptr<char[]>> blocks_;
+  size_t last_block_used_ = 0;
+  size_t last_block_size_ = 0;
+  size_t allocated_bytes_ = 0;
+
+  // For each StringId, a pointer to the first character of the string. Can be
+  // read while strings are being interned on another thread (see
+  // TraceStorage).
+  ChunkedColumn<const char*> string_starts_;
+
+  // Open-addressing index. Its size is always a power of two and it's never
+  // filled more than half.
+  std::vector<Slot> slots_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_STRING_POOL_H_
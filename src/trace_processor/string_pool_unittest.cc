@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/string_pool.h"
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+TEST(StringPoolTest, EmptyStringIsZero) {
+  StringPool pool;
+  ASSERT_EQ(pool.size(), 1u);
+  ASSERT_EQ(pool.InternString(""), 0u);
+  ASSERT_EQ(pool.Get(0).size(), 0u);
+  ASSERT_EQ(pool.Get(0).data()[0], '\0');
+}
+
+TEST(StringPoolTest, InternIsIdempotent) {
+  StringPool pool;
+  StringId foo = pool.InternString("foo");
+  StringId bar = pool.InternString("bar");
+  StringId foobar = pool.InternString("foobar");
+  ASSERT_NE(foo, bar);
+  ASSERT_NE(foo, foobar);
+  ASSERT_EQ(pool.InternString("foo"), foo);
+  ASSERT_EQ(pool.InternString(base::StringView("foobar", 3)), foo);
+  ASSERT_EQ(pool.size(), 4u);
+
+  ASSERT_EQ(pool.Get(foobar), base::StringView("foobar"));
+  ASSERT_EQ(pool.Get(foobar).size(), 6u);
+  ASSERT_EQ(pool.Get(foobar).data()[6], '\0');
+}
+
+TEST(StringPoolTest, Find) {
+  StringPool pool;
+  StringId foo = pool.InternString("foo");
+  StringId id = 0;
+  ASSERT_TRUE(pool.Find("foo", &id));
+  ASSERT_EQ(id, foo);
+  ASSERT_TRUE(pool.Find("", &id));
+  ASSERT_EQ(id, 0u);
+  ASSERT_FALSE(pool.Find("bar", &id));
+  ASSERT_FALSE(pool.Find("fo", &id));
+  ASSERT_EQ(pool.size(), 2u);
+}
+
+TEST(StringPoolTest, ManyStringsAreStable) {
+  StringPool pool;
+  std::vector<StringId> ids;
+  std::vector<const char*> ptrs;
+  const size_t kNumStrings = 100000;
+  for (size_t i = 0; i < kNumStrings; i++) {
+    std::string str = "thread_" + std::to_string(i);
+    ids.push_back(pool.InternString(base::StringView(str)));
+    ptrs.push_back(pool.Get(ids.back()).data());
+  }
+  ASSERT_EQ(pool.size(), kNumStrings + 1);
+  for (size_t i = 0; i < kNumStrings; i++) {
+    std::string str = "thread_" + std::to_string(i);
+    ASSERT_EQ(ids[i], i + 1);
+    ASSERT_EQ(pool.InternString(base::StringView(str)), ids[i]);
+    ASSERT_EQ(pool.Get(ids[i]).data(), ptrs[i]);
+    ASSERT_EQ(pool.Get(ids[i]).ToStdString(), str);
+  }
+}
+
+TEST(StringPoolTest, StringLargerThanBlock) {
+  StringPool pool;
+  std::string big(3 * 1024 * 1024, 'x');
+  StringId small_id = pool.InternString("small");
+  StringId big_id = pool.InternString(base::StringView(big));
+  StringId small_id_2 = pool.InternString("small2");
+  ASSERT_EQ(pool.Get(big_id).ToStdString(), big);
+  ASSERT_EQ(pool.Get(small_id), base::StringView("small"));
+  ASSERT_EQ(pool.Get(small_id_2), base::StringView("small2"));
+}
+
+TEST(StringPoolTest, EmbeddedNul) {
+  StringPool pool;
+  StringId a = pool.InternString(base::StringView("a\0b", 3));
+  StringId b = pool.InternString(base::StringView("a\0c", 3));
+  ASSERT_NE(a, b);
+  ASSERT_EQ(pool.Get(a).size(), 3u);
+}
+
+TEST(StringPoolTest, HashCollisions) {
+  // Every string has the same 64-bit hash, so lookups can only tell them
+  // apart by comparing the bytes. Enough strings to grow the index.
+  StringPool pool([](base::StringView) -> uint64_t { return 42; });
+  const size_t kNumStrings = 3000;
+  std::vector<StringId> ids;
+  for (size_t i = 0; i < kNumStrings; i++) {
+    std::string str = "str_" + std::to_string(i);
+    ids.push_back(pool.InternString(base::StringView(str)));
+    ASSERT_EQ(ids.back(), i + 1);
+  }
+  ASSERT_EQ(pool.size(), kNumStrings + 1);
+  ASSERT_EQ(pool.InternString(""), 0u);
+  for (size_t i = 0; i < kNumStrings; i++) {
+    std::string str = "str_" + std::to_string(i);
+    ASSERT_EQ(pool.InternString(base::StringView(str)), ids[i]);
+    ASSERT_EQ(pool.Get(ids[i]).ToStdString(), str);
+  }
+  ASSERT_EQ(pool.size(), kNumStrings + 1);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -45,12 +45,12 @@ std::unique_ptr<Table::Cursor> StringTable::CreateCursor() {
 
 int StringTable::BestIndex(const QueryConstraints&, BestIndexInfo* info) {
   info->order_by_consumed = false;  // Delegate sorting to SQLite.
-  info->estimated_cost = static_cast<uint32_t>(storage_->string_count());
+  info->estimated_cost = storage_->GetVisibleRowCounts().strings;
   return SQLITE_OK;
 }
 
 StringTable::Cursor::Cursor(const TraceStorage* storage) : storage_(storage) {
-  num_rows_ = storage->string_count();
+  num_rows_ = storage->GetVisibleRowCounts().strings;
 }
 
 StringTable::Cursor::~Cursor() = default;
@@ -75,10 +75,12 @@ int StringTable::Cursor::Column(sqlite3_context* context, int col) {
     case Column::kStringId:
       sqlite3_result_int64(context, static_cast<sqlite3_int64>(row_));
       break;
-    case Column::kString:
-      sqlite3_result_text(context, storage_->GetString(string_id).c_str(), -1,
+    case Column::kString: {
+      const auto& str = storage_->GetString(string_id);
+      sqlite3_result_text(context, str.data(), static_cast<int>(str.size()),
                           nullptr);
       break;
+    }
   }
   return SQLITE_OK;
 }
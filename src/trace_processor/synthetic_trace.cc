@@ -0,0 +1,358 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/synthetic_trace.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include <deque>
+#include <random>
+#include <vector>
+
+#include "perfetto/base/logging.h"
+
+#include "perfetto/trace/trace.pb.h"
+#include "perfetto/trace/trace_packet.pb.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+constexpr uint32_t kPidMax = 32768;
+constexpr uint32_t kFirstPid = 300;
+constexpr uint64_t kStartTs = 1000 * 1000 * 1000ULL;
+constexpr uint32_t kMaxEventGapNs = 20000;
+constexpr uint32_t kPrio = 120;
+
+// Values of sched_switch's prev_state.
+constexpr int64_t kTaskRunning = 0;
+constexpr int64_t kTaskInterruptible = 1;
+constexpr int64_t kTaskUninterruptible = 2;
+constexpr int64_t kTaskDead = 0x40;
+
+// Number of bundles written between a late bundle and its due position.
+constexpr uint32_t kLateBundleDelay = 4;
+
+constexpr uint32_t kFrequenciesKhz[] = {300000,  576000,  748000,  998000,
+                                        1209000, 1401000, 1708000, 1900000};
+
+// A deterministic PRNG: the distributions of <random> are implementation
+// defined, so they are not used.
+class Random {
+ public:
+  explicit Random(uint32_t seed) : engine_(seed) {}
+
+  // Returns a value in [0, n).
+  uint32_t Next(uint32_t n) { return static_cast<uint32_t>(engine_() % n); }
+
+  // Returns true with probability |p|.
+  bool Chance(double p) {
+    return static_cast<double>(engine_() - engine_.min()) <
+           p * static_cast<double>(engine_.max() - engine_.min());
+  }
+
+ private:
+  std::minstd_rand engine_;
+};
+
+struct Thread {
+  uint32_t tid;
+  uint32_t pid;
+  std::string comm;
+};
+
+class ProtoTraceGenerator {
+ public:
+  explicit ProtoTraceGenerator(const SyntheticTraceConfig& config)
+      : config_(config),
+        rnd_(config.seed),
+        tid_in_use_(kPidMax),
+        running_(config.num_cpus, Thread{0, 0, "swapper"}),
+        pending_(config.num_cpus) {}
+
+  std::string Generate() {
+    protos::ProcessTree* tree = trace_.add_packet()->mutable_process_tree();
+    for (uint32_t i = 0; i < config_.num_processes; i++)
+      SpawnProcess(tree);
+
+    const uint32_t total_weight =
+        config_.sched_switch_weight + config_.cpu_freq_weight;
+    PERFETTO_CHECK(total_weight > 0 && config_.num_cpus > 0);
+    uint64_t ts = kStartTs;
+    for (uint32_t i = 0; i < config_.num_events; i++) {
+      ts += 1 + rnd_.Next(kMaxEventGapNs);
+      uint32_t cpu = rnd_.Next(config_.num_cpus);
+      if (rnd_.Next(total_weight) < config_.sched_switch_weight) {
+        AddSchedSwitch(cpu, ts);
+      } else {
+        AddCpuFreq(cpu, ts);
+      }
+    }
+
+    for (uint32_t cpu = 0; cpu < config_.num_cpus; cpu++) {
+      if (pending_[cpu].event_size() > 0)
+        WriteBundle(cpu);
+    }
+    while (!late_bundles_.empty()) {
+      trace_.add_packet()->mutable_ftrace_events()->Swap(
+          &late_bundles_.front().bundle);
+      late_bundles_.pop_front();
+    }
+    return trace_.SerializeAsString();
+  }
+
+ private:
+  struct LateBundle {
+    protos::FtraceEventBundle bundle;
+    uint64_t due_bundle_index;
+  };
+
+  uint32_t AllocateTid() {
+    for (;;) {
+      uint32_t tid = next_tid_++;
+      if (next_tid_ == kPidMax)
+        next_tid_ = kFirstPid;
+      if (!tid_in_use_[tid]) {
+        tid_in_use_[tid] = true;
+        return tid;
+      }
+    }
+  }
+
+  void SpawnThread(protos::ProcessTree* tree, uint32_t pid, uint32_t tid) {
+    char comm[16];
+    sprintf(comm, "thread_%" PRIu32, tid);
+    threads_.emplace_back(Thread{tid, pid, comm});
+    auto* thread = tree->add_threads();
+    thread->set_tid(static_cast<int32_t>(tid));
+    thread->set_tgid(static_cast<int32_t>(pid));
+    thread->set_name(comm);
+  }
+
+  void SpawnProcess(protos::ProcessTree* tree) {
+    uint32_t pid = AllocateTid();
+    auto* process = tree->add_processes();
+    process->set_pid(static_cast<int32_t>(pid));
+    process->set_ppid(1);
+    process->add_cmdline("/system/bin/process_" + std::to_string(pid));
+    SpawnThread(tree, pid, pid);
+    for (uint32_t i = 1; i < config_.threads_per_process; i++)
+      SpawnThread(tree, pid, AllocateTid());
+  }
+
+  // Replaces |thread|, which has exited.
+  void ExitThread(const Thread& thread) {
+    tid_in_use_[thread.tid] = false;
+    for (size_t i = 0; i < threads_.size(); i++) {
+      if (threads_[i].tid == thread.tid) {
+        threads_[i] = threads_.back();
+        threads_.pop_back();
+        break;
+      }
+    }
+    protos::ProcessTree* tree = trace_.add_packet()->mutable_process_tree();
+    if (thread.tid == thread.pid) {
+      SpawnProcess(tree);
+    } else {
+      SpawnThread(tree, thread.pid, AllocateTid());
+    }
+  }
+
+  // Returns a random thread which is not running on any CPU, or the idle
+  // thread.
+  Thread PickNextThread() {
+    if (threads_.empty() || rnd_.Next(8) == 0)
+      return Thread{0, 0, "swapper"};
+    const Thread& thread = threads_[rnd_.Next(
+        static_cast<uint32_t>(threads_.size()))];
+    for (const Thread& running : running_) {
+      if (running.tid == thread.tid)
+        return Thread{0, 0, "swapper"};
+    }
+    return thread;
+  }
+
+  protos::FtraceEvent* AddEvent(uint32_t cpu, uint64_t ts, uint32_t pid) {
+    if (static_cast<uint32_t>(pending_[cpu].event_size()) ==
+        config_.events_per_bundle) {
+      WriteBundle(cpu);
+    }
+    protos::FtraceEvent* event = pending_[cpu].add_event();
+    event->set_timestamp(ts);
+    event->set_pid(pid);
+    return event;
+  }
+
+  void AddSchedSwitch(uint32_t cpu, uint64_t ts) {
+    const Thread prev = running_[cpu];
+    const bool exits = prev.tid != 0 && rnd_.Chance(config_.process_churn);
+    Thread next = PickNextThread();
+    if (exits && next.tid == prev.tid)
+      next = Thread{0, 0, "swapper"};
+
+    int64_t prev_state = kTaskDead;
+    if (!exits) {
+      static constexpr int64_t kStates[] = {kTaskRunning, kTaskInterruptible,
+                                            kTaskInterruptible,
+                                            kTaskUninterruptible};
+      prev_state = kStates[rnd_.Next(4)];
+    }
+    auto* sched_switch = AddEvent(cpu, ts, prev.tid)->mutable_sched_switch();
+    sched_switch->set_prev_comm(prev.comm);
+    sched_switch->set_prev_pid(static_cast<int32_t>(prev.tid));
+    sched_switch->set_prev_prio(kPrio);
+    sched_switch->set_prev_state(prev_state);
+    sched_switch->set_next_comm(next.comm);
+    sched_switch->set_next_pid(static_cast<int32_t>(next.tid));
+    sched_switch->set_next_prio(kPrio);
+    running_[cpu] = next;
+
+    if (exits) {
+      auto* process_free =
+          AddEvent(cpu, ts + 1, next.tid)->mutable_sched_process_free();
+      process_free->set_comm(prev.comm);
+      process_free->set_pid(static_cast<int32_t>(prev.tid));
+      process_free->set_prio(kPrio);
+      ExitThread(prev);
+    }
+  }
+
+  void AddCpuFreq(uint32_t cpu, uint64_t ts) {
+    const size_t kNumFrequencies =
+        sizeof(kFrequenciesKhz) / sizeof(kFrequenciesKhz[0]);
+    uint32_t freq =
+        kFrequenciesKhz[rnd_.Next(static_cast<uint32_t>(kNumFrequencies))];
+    auto* cpu_freq = AddEvent(cpu, ts, 0)->mutable_cpu_frequency();
+    cpu_freq->set_state(freq);
+    cpu_freq->set_cpu_id(cpu);
+  }
+
+  // Writes the pending events of |cpu| as a bundle, possibly late.
+  void WriteBundle(uint32_t cpu) {
+    protos::FtraceEventBundle* bundle = &pending_[cpu];
+    bundle->set_cpu(cpu);
+    if (rnd_.Chance(config_.out_of_order_ratio)) {
+      late_bundles_.emplace_back(
+          LateBundle{*bundle, bundles_written_ + kLateBundleDelay});
+    } else {
+      trace_.add_packet()->mutable_ftrace_events()->Swap(bundle);
+      bundles_written_++;
+      while (!late_bundles_.empty() &&
+             late_bundles_.front().due_bundle_index <= bundles_written_) {
+        trace_.add_packet()->mutable_ftrace_events()->Swap(
+            &late_bundles_.front().bundle);
+        late_bundles_.pop_front();
+      }
+    }
+    bundle->Clear();
+  }
+
+  const SyntheticTraceConfig config_;
+  Random rnd_;
+  protos::Trace trace_;
+
+  uint32_t next_tid_ = kFirstPid;
+  std::vector<bool> tid_in_use_;
+
+  // Threads which have not exited.
+  std::vector<Thread> threads_;
+
+  // Thread running on each CPU.
+  std::vector<Thread> running_;
+
+  // Events of each CPU not yet written.
+  std::vector<protos::FtraceEventBundle> pending_;
+
+  std::deque<LateBundle> late_bundles_;
+  uint64_t bundles_written_ = 0;
+};
+
+}  // namespace
+
+std::string GenerateSyntheticProtoTrace(const SyntheticTraceConfig& config) {
+  return ProtoTraceGenerator(config).Generate();
+}
+
+std::string GenerateSyntheticJsonTrace(const SyntheticTraceConfig& config) {
+  constexpr size_t kMaxDepth = 8;
+  constexpr uint32_t kNumNames = 64;
+  constexpr uint32_t kNumCategories = 8;
+  Random rnd(config.seed);
+
+  struct Stack {
+    uint32_t pid;
+    uint32_t tid;
+    std::vector<uint32_t> names;
+  };
+  std::vector<Stack> threads;
+  std::string json = "{\"traceEvents\":[\n";
+  char buf[256];
+  for (uint32_t p = 0; p < config.num_processes; p++) {
+    uint32_t pid = kFirstPid + p * config.threads_per_process;
+    for (uint32_t t = 0; t < config.threads_per_process; t++) {
+      uint32_t tid = pid + t;
+      threads.emplace_back(Stack{pid, tid, {}});
+      sprintf(buf,
+              "{\"ph\":\"M\",\"cat\":\"__metadata\",\"name\":\"thread_name\","
+              "\"pid\":%" PRIu32 ",\"tid\":%" PRIu32
+              ",\"ts\":0,\"args\":{\"name\":\"thread_%" PRIu32 "\"}},\n",
+              pid, tid, tid);
+      json += buf;
+    }
+  }
+  PERFETTO_CHECK(!threads.empty());
+
+  // Timestamps are in microseconds.
+  uint64_t ts = kStartTs / 1000;
+  auto add_event = [&json, &buf, &ts](char ph, const Stack& thread,
+                                      uint32_t name) {
+    sprintf(buf,
+            "{\"ph\":\"%c\",\"cat\":\"cat_%" PRIu32
+            "\",\"name\":\"slice_%" PRIu32 "\",\"pid\":%" PRIu32
+            ",\"tid\":%" PRIu32 ",\"ts\":%" PRIu64 "},\n",
+            ph, name % kNumCategories, name, thread.pid, thread.tid, ts);
+    json += buf;
+  };
+  for (uint32_t i = 0; i < config.num_events; i++) {
+    ts += 1 + rnd.Next(10);
+    Stack& thread =
+        threads[rnd.Next(static_cast<uint32_t>(threads.size()))];
+    bool begin = thread.names.empty() ||
+                 (thread.names.size() < kMaxDepth && rnd.Next(2) == 0);
+    if (begin) {
+      thread.names.push_back(rnd.Next(kNumNames));
+      add_event('B', thread, thread.names.back());
+    } else {
+      add_event('E', thread, thread.names.back());
+      thread.names.pop_back();
+    }
+  }
+  for (Stack& thread : threads) {
+    for (; !thread.names.empty(); thread.names.pop_back()) {
+      ts++;
+      add_event('E', thread, thread.names.back());
+    }
+  }
+
+  // Replace the trailing ",\n".
+  json.resize(json.size() - 2);
+  json += "]}\n";
+  return json;
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_SYNTHETIC_TRACE_H_
+#define SRC_TRACE_PROCESSOR_SYNTHETIC_TRACE_H_
+
+#include <stdint.h>
+
+#include <string>
+
+namespace perfetto {
+namespace trace_processor {
+
+// Parameters of the traces built by GenerateSynthetic*Trace(). The same
+// config always yields the same trace, byte by byte.
+struct SyntheticTraceConfig {
+  uint32_t seed = 1;
+
+  // Number of ftrace events (proto traces) or of begin/end events (JSON).
+  uint32_t num_events = 100000;
+  uint32_t num_cpus = 8;
+
+  // Processes and threads alive at the start of the trace.
+  uint32_t num_processes = 50;
+  uint32_t threads_per_process = 4;
+
+  // Relative frequency of each type of ftrace event.
+  uint32_t sched_switch_weight = 90;
+  uint32_t cpu_freq_weight = 10;
+
+  // Fraction of ftrace bundles which are written after the bundles that
+  // follow them, as if the buffers of some CPUs were read late. Bundles
+  // of different CPUs always overlap in time, even when this is 0.
+  double out_of_order_ratio = 0.1;
+
+  // Probability that a thread exits when it's switched out. It's replaced
+  // by a new thread in the same process or, if it was the main thread, by
+  // a new process. pids wrap at 32768, so high values recycle tids.
+  double process_churn = 0.001;
+
+  // Maximum number of ftrace events per bundle (proto traces).
+  uint32_t events_per_bundle = 64;
+};
+
+// Returns a proto trace made of ProcessTree packets and ftrace bundles of
+// sched_switch, cpu_frequency and sched_process_free events.
+std::string GenerateSyntheticProtoTrace(const SyntheticTraceConfig&);
+
+// Returns a JSON trace of nested begin/end slices on the threads of
+// |num_processes| processes, plus the thread name metadata. Only the
+// parameters which apply to JSON traces are used.
+std::string GenerateSyntheticJsonTrace(const SyntheticTraceConfig&);
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_SYNTHETIC_TRACE_H_
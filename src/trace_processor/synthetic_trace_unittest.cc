@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/synthetic_trace.h"
+
+#include <string.h>
+
+#include "gtest/gtest.h"
+#include "src/trace_processor/trace_processor.h"
+
+#include "perfetto/trace_processor/raw_query.pb.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+int64_t QueryCount(TraceProcessor* tp, const std::string& sql) {
+  protos::RawQueryArgs args;
+  args.set_sql_query(sql);
+  int64_t count = -1;
+  tp->ExecuteQuery(args, [&count](const protos::RawQueryResult& res) {
+    ASSERT_FALSE(res.has_error()) << res.error();
+    count = res.columns(0).long_values(0);
+  });
+  return count;
+}
+
+void Load(TraceProcessor* tp, const std::string& trace) {
+  std::unique_ptr<uint8_t[]> buf(new uint8_t[trace.size()]);
+  memcpy(buf.get(), trace.data(), trace.size());
+  ASSERT_TRUE(tp->Parse(std::move(buf), trace.size()));
+  tp->NotifyEndOfFile();
+}
+
+TEST(SyntheticTraceTest, Deterministic) {
+  SyntheticTraceConfig config;
+  config.num_events = 1000;
+  std::string trace = GenerateSyntheticProtoTrace(config);
+  ASSERT_EQ(trace, GenerateSyntheticProtoTrace(config));
+  config.seed++;
+  ASSERT_NE(trace, GenerateSyntheticProtoTrace(config));
+
+  ASSERT_EQ(GenerateSyntheticJsonTrace(config),
+            GenerateSyntheticJsonTrace(config));
+}
+
+TEST(SyntheticTraceTest, ProtoTrace) {
+  SyntheticTraceConfig config;
+  config.num_events = 10000;
+  config.num_cpus = 4;
+  config.out_of_order_ratio = 0.5;
+  config.process_churn = 0.1;
+  TraceProcessor tp{TraceProcessor::Config()};
+  Load(&tp, GenerateSyntheticProtoTrace(config));
+
+  ASSERT_GT(QueryCount(&tp, "SELECT COUNT(*) FROM sched"), 5000);
+  ASSERT_GT(QueryCount(&tp, "SELECT COUNT(*) FROM counters"), 500);
+  ASSERT_EQ(QueryCount(&tp, "SELECT MAX(ref) FROM counters WHERE ts > 0"), 3);
+
+  // Exited threads are replaced by new ones.
+  ASSERT_GT(QueryCount(&tp, "SELECT COUNT(*) FROM thread"),
+            config.num_processes * config.threads_per_process);
+}
+
+TEST(SyntheticTraceTest, JsonTrace) {
+  SyntheticTraceConfig config;
+  config.num_events = 10000;
+  TraceProcessor tp{TraceProcessor::Config()};
+  Load(&tp, GenerateSyntheticJsonTrace(config));
+
+  // Each slice has a begin and an end event.
+  ASSERT_GE(QueryCount(&tp, "SELECT COUNT(*) FROM slices"),
+            config.num_events / 2);
+  ASSERT_EQ(QueryCount(&tp, "SELECT COUNT(*) FROM thread"),
+            config.num_processes * config.threads_per_process);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -20,6 +20,8 @@
 #include <string.h>
 
 #include "perfetto/base/logging.h"
+#include "perfetto/base/time.h"
+#include "src/trace_processor/sqlite_utils.h"
 
 namespace perfetto {
 namespace trace_processor {
@@ -42,6 +44,53 @@ Table::Cursor* ToCursor(sqlite3_vtab_cursor* cursor) {
   return static_cast<Table::Cursor*>(cursor);
 }
 
+// Returns the names of the columns declared by a CREATE TABLE statement, in
+// order. Trailing table constraints (e.g. PRIMARY KEY) are returned as well,
+// but are never referenced by column index.
+std::vector<std::string> ParseColumnNames(const std::string& create) {
+  std::vector<std::string> names;
+  size_t pos = create.find('(');
+  if (pos == std::string::npos)
+    return names;
+  int depth = 0;
+  std::string def;
+  for (pos++; pos < create.size(); pos++) {
+    char c = create[pos];
+    if ((c == ',' || c == ')') && depth == 0) {
+      size_t start = def.find_first_not_of(" \n");
+      if (start != std::string::npos) {
+        size_t end = def.find_first_of(" \n", start);
+        names.emplace_back(def.substr(start, end - start));
+      }
+      def.clear();
+      if (c == ')')
+        break;
+      continue;
+    }
+    if (c == '(')
+      depth++;
+    if (c == ')')
+      depth--;
+    def += c;
+  }
+  return names;
+}
+
+// Invokes |fn|, timing the call if it's the next sample.
+template <typename Fn>
+int ProfileCall(QueryProfiler::CallStats* stats,
+                uint64_t sampling_period,
+                Fn fn) {
+  if (stats->calls++ % sampling_period != 0)
+    return fn();
+  base::TimeNanos start = base::GetWallTimeNs();
+  int ret = fn();
+  stats->sampled_ns +=
+      static_cast<uint64_t>((base::GetWallTimeNs() - start).count());
+  stats->sampled_calls++;
+  return ret;
+}
+
 }  // namespace
 
 // static
@@ -63,23 +112,56 @@ void Table::RegisterInternal(sqlite3* db,
   PERFETTO_CHECK(table_name.size() > 0 && isalnum(table_name.front()) &&
                  isalnum(table_name.back()));
 
+  CreateModule(db, table_name, storage, create_statement, factory);
+}
+
+void Table::RegisterWithArgsInternal(sqlite3* db,
+                                     const TraceStorage* storage,
+                                     const std::string& module_name,
+                                     Factory factory) {
+  CreateModule(db, module_name, storage, "", factory);
+}
+
+// An empty |create_statement| denotes a module whose tables are created with
+// arguments, which declare their schema in Init().
+void Table::CreateModule(sqlite3* db,
+                         const std::string& module_name,
+                         const TraceStorage* storage,
+                         const std::string& create_statement,
+                         Factory factory) {
   std::unique_ptr<TableDescriptor> desc(new TableDescriptor());
-  desc->name = table_name;
+  desc->name = module_name;
   desc->create_statement = create_statement;
   desc->storage = storage;
   desc->factory = factory;
   sqlite3_module* module = &desc->module;
   memset(module, 0, sizeof(*module));
 
-  module->xConnect = [](sqlite3* xdb, void* arg, int, const char* const*,
-                        sqlite3_vtab** tab, char**) {
+  // argv[0] is the module name, argv[1] the database name, argv[2] the table
+  // name and the rest are the arguments of the module, if any.
+  module->xConnect = [](sqlite3* xdb, void* arg, int argc,
+                        const char* const* argv, sqlite3_vtab** tab,
+                        char** pzErr) {
     const TableDescriptor* xdesc = static_cast<const TableDescriptor*>(arg);
-    int res = sqlite3_declare_vtab(xdb, xdesc->create_statement.c_str());
+    std::unique_ptr<Table> table =
+        xdesc->factory(xdb, xdesc->storage, argv[2]);
+    std::string create = xdesc->create_statement;
+    if (create.empty()) {
+      std::vector<std::string> args(argv + 3, argv + argc);
+      std::string error;
+      create = table->Init(args, &error);
+      if (create.empty()) {
+        *pzErr = sqlite3_mprintf("%s", error.c_str());
+        return SQLITE_ERROR;
+      }
+    }
+    int res = sqlite3_declare_vtab(xdb, create.c_str());
     if (res != SQLITE_OK)
       return res;
+    table->column_names_ = ParseColumnNames(create);
 
     // Freed in xDisconnect().
-    *tab = xdesc->factory(xdesc->storage, xdesc->name).release();
+    *tab = table.release();
 
     return SQLITE_OK;
   };
@@ -106,10 +188,14 @@ void Table::RegisterInternal(sqlite3* db,
                        sqlite3_value** v) {
     return ToCursor(c)->FilterInternal(i, s, a, v);
   };
-  module->xNext = [](sqlite3_vtab_cursor* c) { return ToCursor(c)->Next(); };
-  module->xEof = [](sqlite3_vtab_cursor* c) { return ToCursor(c)->Eof(); };
+  module->xNext = [](sqlite3_vtab_cursor* c) {
+    return ToCursor(c)->NextInternal();
+  };
+  module->xEof = [](sqlite3_vtab_cursor* c) {
+    return ToCursor(c)->EofInternal();
+  };
   module->xColumn = [](sqlite3_vtab_cursor* c, sqlite3_context* a, int b) {
-    return ToCursor(c)->Column(a, b);
+    return ToCursor(c)->ColumnInternal(a, b);
   };
 
   module->xRowid = [](sqlite3_vtab_cursor*, sqlite_int64*) {
@@ -121,8 +207,15 @@ void Table::RegisterInternal(sqlite3* db,
          void (**fn)(sqlite3_context*, int, sqlite3_value**),
          void** args) { return ToTable(t)->FindFunction(name, fn, args); };
 
+  // Tables created with arguments need xCreate/xDestroy: without them SQLite
+  // treats the module as eponymous-only.
+  if (create_statement.empty()) {
+    module->xCreate = module->xConnect;
+    module->xDestroy = module->xDisconnect;
+  }
+
   int res = sqlite3_create_module_v2(
-      db, table_name.c_str(), module, desc.release(),
+      db, module_name.c_str(), module, desc.release(),
       [](void* arg) { delete static_cast<TableDescriptor*>(arg); });
   PERFETTO_CHECK(res == SQLITE_OK);
 }
@@ -181,7 +274,13 @@ int Table::BestIndexInternal(sqlite3_index_info* idx) {
   if (!info.order_by_consumed)
     query_constraints.ClearOrderBy();
 
-  idx->idxStr = query_constraints.ToNewSqlite3String().release();
+  // The constraints are followed by a flag for each of them, set if SQLite
+  // checks it too, which is used to profile the query.
+  std::string idx_str = query_constraints.ToNewSqlite3String().get();
+  idx_str += '|';
+  for (bool omit : info.omit)
+    idx_str += omit ? '0' : '1';
+  idx->idxStr = sqlite3_mprintf("%s", idx_str.c_str());
   idx->needToFreeIdxStr = true;
   idx->idxNum = ++best_index_num_;
 
@@ -192,6 +291,50 @@ int Table::FindFunction(const char*, FindFunctionFn, void**) {
   return 0;
 };
 
+std::string Table::Init(const std::vector<std::string>&, std::string* error) {
+  *error = "Table does not take arguments";
+  return "";
+}
+
+void Table::DescribeConstraints(const char* sqlite_checked) {
+  constraints_desc_.clear();
+  order_by_desc_.clear();
+  sqlite_constraints_desc_.clear();
+  sqlite_constraint_columns_ = 0;
+  const auto& constraints = qc_cache_.constraints();
+  for (size_t i = 0; i < constraints.size(); i++) {
+    const auto& cs = constraints[i];
+    // LIMIT and OFFSET are not about a column, and are never checked on rows.
+    bool is_row_constraint =
+        !sqlite_utils::IsOpLimit(cs.op) && !sqlite_utils::IsOpOffset(cs.op);
+    std::string desc = sqlite_utils::OpToString(cs.op) + " ?";
+    if (is_row_constraint)
+      desc = ColumnName(cs.iColumn) + " " + desc;
+    constraints_desc_ += (i ? ", " : "") + desc;
+    if (sqlite_checked[i] != '1')
+      continue;
+    if (!sqlite_constraints_desc_.empty())
+      sqlite_constraints_desc_ += ", ";
+    sqlite_constraints_desc_ += desc;
+    if (is_row_constraint && cs.iColumn >= 0 && cs.iColumn < 64)
+      sqlite_constraint_columns_ |= 1ull << cs.iColumn;
+  }
+  const auto& order_by = qc_cache_.order_by();
+  for (size_t i = 0; i < order_by.size(); i++) {
+    order_by_desc_ += (i ? ", " : "") + ColumnName(order_by[i].iColumn);
+    if (order_by[i].desc)
+      order_by_desc_ += " DESC";
+  }
+}
+
+std::string Table::ColumnName(int column) const {
+  if (column < 0)
+    return "rowid";
+  if (static_cast<size_t>(column) < column_names_.size())
+    return column_names_[static_cast<size_t>(column)];
+  return "column" + std::to_string(column);
+}
+
 Table::Cursor::~Cursor() = default;
 
 int Table::Cursor::FilterInternal(int idxNum,
@@ -201,8 +344,13 @@ int Table::Cursor::FilterInternal(int idxNum,
   auto* table = ToTable(this->pVtab);
   bool cache_hit = true;
   if (idxNum != table->qc_hash_) {
-    table->qc_cache_ = QueryConstraints::FromString(idxStr);
+    const char* sqlite_checked = strchr(idxStr, '|');
+    PERFETTO_CHECK(sqlite_checked);
+    std::string qc_str(idxStr, static_cast<size_t>(sqlite_checked - idxStr));
+    table->qc_cache_ = QueryConstraints::FromString(qc_str.c_str());
     table->qc_hash_ = idxNum;
+    table->DescribeConstraints(sqlite_checked + 1);
+    table->profile_query_id_ = 0;
     cache_hit = false;
   }
   if (Table::debug) {
@@ -211,7 +359,54 @@ int Table::Cursor::FilterInternal(int idxNum,
   }
   PERFETTO_DCHECK(table->qc_cache_.constraints().size() ==
                   static_cast<size_t>(argc));
-  return Filter(table->qc_cache_, argv);
+
+  // Looking up the stats is much slower than the calls that follow, and
+  // nested loop joins call Filter() once for each row of the outer table.
+  QueryProfiler* profiler = QueryProfiler::current();
+  stats_ = nullptr;
+  if (profiler) {
+    if (table->profile_query_id_ != profiler->running_query_id()) {
+      table->profile_stats_ = profiler->GetTableStats(
+          table->name_, table->constraints_desc_, table->order_by_desc_,
+          table->sqlite_constraints_desc_);
+      table->profile_query_id_ = profiler->running_query_id();
+    }
+    stats_ = table->profile_stats_;
+  }
+  sqlite_constraint_columns_ = table->sqlite_constraint_columns_;
+  other_column_read_ = false;
+
+  if (!stats_)
+    return Filter(table->qc_cache_, argv);
+  return ProfileCall(&stats_->filter, 1, [this, table, argv] {
+    return Filter(table->qc_cache_, argv);
+  });
+}
+
+int Table::Cursor::NextInternal() {
+  if (!stats_)
+    return Next();
+  if (sqlite_constraint_columns_ && !other_column_read_)
+    stats_->rows_rejected++;
+  other_column_read_ = false;
+  return ProfileCall(&stats_->next, QueryProfiler::kSamplingPeriod,
+                     [this] { return Next(); });
+}
+
+int Table::Cursor::EofInternal() {
+  int eof = Eof();
+  if (stats_ && !eof)
+    stats_->rows++;
+  return eof;
+}
+
+int Table::Cursor::ColumnInternal(sqlite3_context* context, int N) {
+  if (!stats_)
+    return Column(context, N);
+  if (N < 0 || N >= 64 || !(sqlite_constraint_columns_ & (1ull << N)))
+    other_column_read_ = true;
+  return ProfileCall(&stats_->column, QueryProfiler::kSamplingPeriod,
+                     [this, context, N] { return Column(context, N); });
 }
 
 }  // namespace trace_processor
@@ -25,6 +25,7 @@
 #include <vector>
 
 #include "src/trace_processor/query_constraints.h"
+#include "src/trace_processor/query_profiler.h"
 
 namespace perfetto {
 namespace trace_processor {
@@ -36,9 +37,10 @@ class TraceStorage;
 // implement a friendlier API than that required by SQLite.
 class Table : public sqlite3_vtab {
  public:
-  using Factory =
-      std::function<std::unique_ptr<Table>(const TraceStorage*,
-                                           const std::string& name)>;
+  using Factory = std::function<std::unique_ptr<Table>(
+      sqlite3*,
+      const TraceStorage*,
+      const std::string& name)>;
 
   // When set it logs all BestIndex and Filter actions on the console.
   static bool debug;
@@ -63,6 +65,18 @@ class Table : public sqlite3_vtab {
 
     // Overriden functions from sqlite3_vtab_cursor.
     int FilterInternal(int num, const char* idxStr, int argc, sqlite3_value**);
+    int NextInternal();
+    int EofInternal();
+    int ColumnInternal(sqlite3_context* context, int N);
+
+    // Where the calls are accounted when the query is profiled (see
+    // QueryProfiler), for the constraints of the last Filter() call.
+    QueryProfiler::TableStats* stats_ = nullptr;
+
+    // Bitmap of the columns with constraints checked by SQLite, and whether
+    // SQLite read any other column of the current row.
+    uint64_t sqlite_constraint_columns_ = 0;
+    bool other_column_read_ = false;
   };
 
  protected:
@@ -84,6 +98,18 @@ class Table : public sqlite3_vtab {
     RegisterInternal(db, storage, create_statement, GetFactory<T>());
   }
 
+  // Like Register(), but for tables which do not exist implicitly and are
+  // instead instantiated with:
+  //   CREATE VIRTUAL TABLE name USING module_name(arg1, arg2, ...)
+  // The table is constructed with the database it belongs to and declares
+  // its schema in Init(), based on the arguments.
+  template <typename T>
+  static void RegisterWithArgs(sqlite3* db,
+                               const TraceStorage* storage,
+                               const std::string& module_name) {
+    RegisterWithArgsInternal(db, storage, module_name, GetFactoryWithDb<T>());
+  }
+
   // Methods to be implemented by derived table classes.
   virtual std::unique_ptr<Cursor> CreateCursor() = 0;
   virtual int BestIndex(const QueryConstraints& qc, BestIndexInfo* info) = 0;
@@ -92,32 +118,74 @@ class Table : public sqlite3_vtab {
   using FindFunctionFn = void (**)(sqlite3_context*, int, sqlite3_value**);
   virtual int FindFunction(const char* name, FindFunctionFn fn, void** args);
 
+  // Must be implemented by tables registered with RegisterWithArgs(). Parses
+  // the arguments of the CREATE VIRTUAL TABLE statement and returns the
+  // CREATE TABLE statement declaring the schema of the table. On failure,
+  // returns an empty string and sets |error|.
+  virtual std::string Init(const std::vector<std::string>& args,
+                           std::string* error);
+
  private:
   template <typename TableType>
   static Factory GetFactory() {
-    return [](const TraceStorage* storage, const std::string& name) {
+    return [](sqlite3*, const TraceStorage* storage, const std::string& name) {
       auto table = std::unique_ptr<Table>(new TableType(storage));
       table->name_ = name;
       return table;
     };
   }
 
+  template <typename TableType>
+  static Factory GetFactoryWithDb() {
+    return [](sqlite3* db, const TraceStorage* storage,
+              const std::string& name) {
+      auto table = std::unique_ptr<Table>(new TableType(db, storage));
+      table->name_ = name;
+      return table;
+    };
+  }
+
   static void RegisterInternal(sqlite3* db,
                                const TraceStorage*,
                                const std::string& create,
                                Factory);
+  static void RegisterWithArgsInternal(sqlite3* db,
+                                       const TraceStorage*,
+                                       const std::string& module_name,
+                                       Factory);
+  static void CreateModule(sqlite3* db,
+                           const std::string& module_name,
+                           const TraceStorage*,
+                           const std::string& create_statement,
+                           Factory);
 
   // Overriden functions from sqlite3_vtab.
   int OpenInternal(sqlite3_vtab_cursor**);
   int BestIndexInternal(sqlite3_index_info*);
 
+  // Describes |qc_cache_| for the profiler. |sqlite_checked| has a '1' for
+  // each constraint which SQLite checks itself.
+  void DescribeConstraints(const char* sqlite_checked);
+  std::string ColumnName(int column) const;
+
   Table(const Table&) = delete;
   Table& operator=(const Table&) = delete;
 
   std::string name_;
+  std::vector<std::string> column_names_;
   QueryConstraints qc_cache_;
   int qc_hash_ = 0;
   int best_index_num_ = 0;
+
+  // Description of |qc_cache_| (see QueryProfiler::TableStats).
+  std::string constraints_desc_;
+  std::string order_by_desc_;
+  std::string sqlite_constraints_desc_;
+  uint64_t sqlite_constraint_columns_ = 0;
+
+  // Stats of |qc_cache_| in the query |profile_query_id_|.
+  QueryProfiler::TableStats* profile_stats_ = nullptr;
+  uint64_t profile_query_id_ = 0;
 };
 
 }  // namespace trace_processor
@@ -0,0 +1,316 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/thread_state_table.h"
+
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <utility>
+
+#include "perfetto/base/logging.h"
+#include "src/trace_processor/sqlite_utils.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+namespace {
+
+using namespace sqlite_utils;
+
+// The letters of the task states, one per bit of prev_state, as printed by
+// the sched_switch tracepoint. Bits above these (TASK_STATE_MAX) flag a task
+// which was preempted.
+constexpr char kStateLetters[] = "SDTtXZxKWPN";
+constexpr size_t kStateBits = sizeof(kStateLetters) - 1;
+
+bool IsUtidTimestampOrder(const std::vector<QueryConstraints::OrderBy>& ob,
+                          bool has_utid_eq) {
+  size_t i = 0;
+  if (i < ob.size() && ob[i].iColumn == ThreadStateTable::Column::kUtid &&
+      !ob[i].desc) {
+    i++;
+  } else if (!has_utid_eq && !ob.empty()) {
+    return false;
+  }
+  if (i < ob.size() && ob[i].iColumn == ThreadStateTable::Column::kTimestamp &&
+      !ob[i].desc) {
+    i++;
+  }
+  return i == ob.size();
+}
+
+}  // namespace
+
+// static
+constexpr uint32_t ThreadStateTable::kNoCpu;
+constexpr size_t ThreadStateTable::kMaxStateLength;
+
+ThreadStateTable::ThreadStateTable(const TraceStorage* storage)
+    : storage_(storage) {}
+
+void ThreadStateTable::RegisterTable(sqlite3* db,
+                                     const TraceStorage* storage) {
+  Table::Register<ThreadStateTable>(db, storage,
+                                    "CREATE TABLE thread_state("
+                                    "utid UNSIGNED INT, "
+                                    "ts UNSIGNED BIG INT, "
+                                    "dur UNSIGNED BIG INT, "
+                                    "cpu UNSIGNED INT, "
+                                    "state STRING, "
+                                    "PRIMARY KEY(utid, ts)"
+                                    ") WITHOUT ROWID;");
+}
+
+// static
+std::unique_ptr<ThreadStateTable::Timelines> ThreadStateTable::BuildTimelines(
+    const TraceStorage* storage,
+    const std::array<uint32_t, base::kMaxCpus>& slice_counts) {
+  std::unique_ptr<Timelines> timelines(new Timelines());
+  timelines->slice_counts = slice_counts;
+  auto* intervals_by_utid = &timelines->intervals_by_utid;
+
+  // The state each thread was switched out with at the end of its last slice.
+  std::vector<uint32_t> end_states;
+
+  // Merges the slices of all the CPUs by timestamp, so that the slices of
+  // each thread are visited in order even if it migrates between CPUs.
+  using Head = std::pair<uint64_t /* start_ns */, uint32_t /* cpu */>;
+  std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+  std::array<uint32_t, base::kMaxCpus> next_row{};
+  for (uint32_t cpu = 0; cpu < base::kMaxCpus; cpu++) {
+    if (slice_counts[cpu] > 0)
+      heads.emplace(storage->SlicesForCpu(cpu).start_ns()[0], cpu);
+  }
+
+  uint64_t trace_end_ns = 0;
+  while (!heads.empty()) {
+    uint32_t cpu = heads.top().second;
+    heads.pop();
+    const auto& slices = storage->SlicesForCpu(cpu);
+    uint32_t row = next_row[cpu]++;
+    if (next_row[cpu] < slice_counts[cpu])
+      heads.emplace(slices.start_ns()[next_row[cpu]], cpu);
+
+    UniqueTid utid = slices.utids()[row];
+    uint64_t start_ns = slices.start_ns()[row];
+    uint64_t end_ns = start_ns + slices.durations()[row];
+    trace_end_ns = std::max(trace_end_ns, end_ns);
+
+    // Utid 0 stands for the idle threads (swapper/N) too, which run on
+    // several CPUs at once: their slices would overlap in a single timeline.
+    if (utid == 0)
+      continue;
+    if (utid >= intervals_by_utid->size()) {
+      intervals_by_utid->resize(utid + 1);
+      end_states.resize(utid + 1);
+    }
+
+    auto* intervals = &(*intervals_by_utid)[utid];
+    if (!intervals->empty()) {
+      uint64_t prev_end_ns = intervals->back().ts + intervals->back().dur;
+      if (start_ns > prev_end_ns) {
+        intervals->emplace_back(Interval{prev_end_ns, start_ns - prev_end_ns,
+                                         kNoCpu, end_states[utid]});
+      }
+    }
+    intervals->emplace_back(Interval{start_ns, end_ns - start_ns, cpu, 0});
+    end_states[utid] = slices.end_states()[row];
+  }
+
+  for (UniqueTid utid = 0; utid < intervals_by_utid->size(); utid++) {
+    auto* intervals = &(*intervals_by_utid)[utid];
+    if (intervals->empty())
+      continue;
+    uint64_t prev_end_ns = intervals->back().ts + intervals->back().dur;
+    if (trace_end_ns > prev_end_ns) {
+      intervals->emplace_back(Interval{prev_end_ns, trace_end_ns - prev_end_ns,
+                                       kNoCpu, end_states[utid]});
+    }
+    intervals->shrink_to_fit();
+  }
+  return timelines;
+}
+
+// static
+size_t ThreadStateTable::FormatState(uint32_t state, char* buf) {
+  size_t len = 0;
+  for (size_t bit = 0; bit < kStateBits; bit++) {
+    if (!(state & (1u << bit)))
+      continue;
+    if (len > 0)
+      buf[len++] = '|';
+    buf[len++] = kStateLetters[bit];
+  }
+  if (len == 0)
+    buf[len++] = 'R';
+  if (state >> kStateBits)
+    buf[len++] = '+';
+  PERFETTO_DCHECK(len < kMaxStateLength);
+  buf[len] = '\0';
+  return len;
+}
+
+std::shared_ptr<const ThreadStateTable::Timelines>
+ThreadStateTable::GetTimelines() {
+  auto slice_counts = storage_->GetVisibleRowCounts().sched_slices;
+  if (!timelines_ || timelines_->slice_counts != slice_counts)
+    timelines_ = BuildTimelines(storage_, slice_counts);
+  return timelines_;
+}
+
+std::unique_ptr<Table::Cursor> ThreadStateTable::CreateCursor() {
+  return std::unique_ptr<Table::Cursor>(new Cursor(this));
+}
+
+int ThreadStateTable::BestIndex(const QueryConstraints& qc,
+                                BestIndexInfo* info) {
+  bool is_time_constrained = false;
+  bool is_utid_constrained = false;
+  for (const auto& cs : qc.constraints()) {
+    if (cs.iColumn == Column::kTimestamp)
+      is_time_constrained = true;
+    if (cs.iColumn == Column::kUtid && IsOpEq(cs.op))
+      is_utid_constrained = true;
+  }
+
+  if (is_utid_constrained) {
+    info->estimated_cost = is_time_constrained ? 1 : 5;
+  } else {
+    info->estimated_cost = is_time_constrained ? 1000 : 10000;
+  }
+  info->order_by_consumed =
+      IsUtidTimestampOrder(qc.order_by(), is_utid_constrained);
+  return SQLITE_OK;
+}
+
+ThreadStateTable::Cursor::Cursor(ThreadStateTable* table) : table_(table) {}
+
+int ThreadStateTable::Cursor::Filter(const QueryConstraints& qc,
+                                     sqlite3_value** argv) {
+  bool has_utid = false;
+  UniqueTid utid = 0;
+  uint64_t min_ts = 0;
+  uint64_t max_ts = std::numeric_limits<uint64_t>::max();
+  for (size_t i = 0; i < qc.constraints().size(); i++) {
+    const auto& cs = qc.constraints()[i];
+    if (IsOpLimit(cs.op) || IsOpOffset(cs.op))
+      continue;
+
+    // These only narrow down the intervals to scan: SQLite checks the
+    // constraints again on each row.
+    switch (cs.iColumn) {
+      case Column::kUtid:
+        if (IsOpEq(cs.op) && !has_utid) {
+          has_utid = true;
+          utid = static_cast<UniqueTid>(sqlite3_value_int64(argv[i]));
+        }
+        break;
+      case Column::kTimestamp: {
+        auto ts = static_cast<uint64_t>(sqlite3_value_int64(argv[i]));
+        if (IsOpGe(cs.op) || IsOpGt(cs.op)) {
+          min_ts = std::max(min_ts, ts);
+        } else if (IsOpLe(cs.op) || IsOpLt(cs.op)) {
+          max_ts = std::min(max_ts, ts);
+        } else if (IsOpEq(cs.op)) {
+          min_ts = std::max(min_ts, ts);
+          max_ts = std::min(max_ts, ts);
+        }
+        break;
+      }
+    }
+  }
+
+  timelines_ = table_->GetTimelines();
+  ranges_.clear();
+  UniqueTid first_utid = has_utid ? utid : 0;
+  UniqueTid end_utid =
+      has_utid ? utid + 1
+               : static_cast<UniqueTid>(timelines_->intervals_by_utid.size());
+  auto ts_less = [](const Interval& interval, uint64_t ts) {
+    return interval.ts < ts;
+  };
+  auto ts_greater = [](uint64_t ts, const Interval& interval) {
+    return ts < interval.ts;
+  };
+  for (UniqueTid u = first_utid; u < end_utid && min_ts <= max_ts; u++) {
+    const auto& intervals = timelines_->IntervalsForUtid(u);
+    if (intervals.empty())
+      continue;
+    auto begin = std::lower_bound(intervals.begin(), intervals.end(), min_ts,
+                                  ts_less);
+    auto end = std::upper_bound(begin, intervals.end(), max_ts, ts_greater);
+    if (begin < end) {
+      ranges_.emplace_back(
+          UtidRange{u, static_cast<size_t>(begin - intervals.begin()),
+                    static_cast<size_t>(end - intervals.begin())});
+    }
+  }
+
+  range_idx_ = 0;
+  index_ = ranges_.empty() ? 0 : ranges_[0].begin;
+  return SQLITE_OK;
+}
+
+int ThreadStateTable::Cursor::Next() {
+  if (++index_ >= ranges_[range_idx_].end && ++range_idx_ < ranges_.size())
+    index_ = ranges_[range_idx_].begin;
+  return SQLITE_OK;
+}
+
+int ThreadStateTable::Cursor::Eof() {
+  return range_idx_ >= ranges_.size();
+}
+
+int ThreadStateTable::Cursor::Column(sqlite3_context* context, int N) {
+  const Interval& current = interval();
+  switch (N) {
+    case Column::kUtid:
+      sqlite3_result_int64(context, ranges_[range_idx_].utid);
+      break;
+    case Column::kTimestamp:
+      sqlite3_result_int64(context, static_cast<sqlite3_int64>(current.ts));
+      break;
+    case Column::kDuration:
+      sqlite3_result_int64(context, static_cast<sqlite3_int64>(current.dur));
+      break;
+    case Column::kCpu:
+      if (current.is_running()) {
+        sqlite3_result_int64(context, current.cpu);
+      } else {
+        sqlite3_result_null(context);
+      }
+      break;
+    case Column::kState: {
+      if (current.is_running()) {
+        sqlite3_result_text(context, "Running", -1, SQLITE_STATIC);
+        break;
+      }
+      char buf[kMaxStateLength];
+      size_t len = FormatState(current.state, buf);
+      sqlite3_result_text(context, buf, static_cast<int>(len),
+                          SQLITE_TRANSIENT);
+      break;
+    }
+    default:
+      PERFETTO_FATAL("Unknown column %d", N);
+      break;
+  }
+  return SQLITE_OK;
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_THREAD_STATE_TABLE_H_
+#define SRC_TRACE_PROCESSOR_THREAD_STATE_TABLE_H_
+
+#include <sqlite3.h>
+
+#include <array>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include "perfetto/base/utils.h"
+#include "src/trace_processor/table.h"
+#include "src/trace_processor/trace_storage.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// The timeline of the state of each thread, derived from the sched slices:
+// a thread is "Running" on a CPU during each of its slices and, between the
+// end of a slice and the start of its next one, in the state it was switched
+// out with (the |prev_state| of the sched_switch, e.g. "R" for preempted, "S"
+// for sleeping, "D" for uninterruptible sleep). The state after the last
+// slice of a thread lasts until the end of the last slice of the trace. Utid
+// 0 (the idle threads) has no timeline.
+//
+// The timelines are built on first use, in one pass over the sched slices,
+// and cached until more slices are visible to queries. Rows are sorted by
+// (utid, ts), and constraints on utid and ts are answered by a lookup in the
+// cached timeline of the thread, e.g.:
+//   SELECT state, SUM(dur) FROM thread_state WHERE utid = 5 GROUP BY state
+class ThreadStateTable : public Table {
+ public:
+  enum Column {
+    kUtid = 0,
+    kTimestamp = 1,
+    kDuration = 2,
+    kCpu = 3,
+    kState = 4,
+  };
+
+  // A period of time during which a thread was in a single state.
+  struct Interval {
+    bool is_running() const { return cpu != kNoCpu; }
+
+    uint64_t ts;
+    uint64_t dur;
+
+    // The CPU the thread ran on, or kNoCpu if it was not running.
+    uint32_t cpu;
+
+    // The prev_state of the sched_switch which ended the preceding slice.
+    // Meaningless if the thread was running.
+    uint32_t state;
+  };
+
+  static constexpr uint32_t kNoCpu = std::numeric_limits<uint32_t>::max();
+
+  // The timelines of all the threads, for the sched slices visible when they
+  // were built.
+  struct Timelines {
+    // Returns the intervals of |utid|, sorted by timestamp.
+    const std::vector<Interval>& IntervalsForUtid(UniqueTid utid) const {
+      return utid < intervals_by_utid.size() ? intervals_by_utid[utid]
+                                             : empty;
+    }
+
+    std::array<uint32_t, base::kMaxCpus> slice_counts{};
+    std::vector<std::vector<Interval>> intervals_by_utid;
+    const std::vector<Interval> empty;
+  };
+
+  static void RegisterTable(sqlite3* db, const TraceStorage* storage);
+
+  ThreadStateTable(const TraceStorage*);
+
+  // Builds the timelines of the first |slice_counts[cpu]| slices of each CPU.
+  static std::unique_ptr<Timelines> BuildTimelines(
+      const TraceStorage*,
+      const std::array<uint32_t, base::kMaxCpus>& slice_counts);
+
+  // Formats |state| as the sched_switch tracepoint does, e.g. "R", "S",
+  // "D|K" or "R+". |buf| must have room for at least kMaxStateLength chars.
+  static constexpr size_t kMaxStateLength = 32;
+  static size_t FormatState(uint32_t state, char* buf);
+
+  // Table implementation.
+  std::unique_ptr<Table::Cursor> CreateCursor() override;
+  int BestIndex(const QueryConstraints&, BestIndexInfo*) override;
+
+ private:
+  class Cursor : public Table::Cursor {
+   public:
+    Cursor(ThreadStateTable*);
+
+    // Implementation of Table::Cursor.
+    int Filter(const QueryConstraints&, sqlite3_value**) override;
+    int Next() override;
+    int Eof() override;
+    int Column(sqlite3_context*, int N) override;
+
+   private:
+    // The range of intervals returned for a thread.
+    struct UtidRange {
+      UniqueTid utid;
+      size_t begin;
+      size_t end;
+    };
+
+    const Interval& interval() const {
+      return timelines_->IntervalsForUtid(ranges_[range_idx_].utid)[index_];
+    }
+
+    ThreadStateTable* const table_;
+    std::shared_ptr<const Timelines> timelines_;
+    std::vector<UtidRange> ranges_;
+    size_t range_idx_ = 0;
+    size_t index_ = 0;
+  };
+
+  // Returns the timelines for the slices visible to the current query,
+  // rebuilding them if more slices have been published since they were last
+  // built. The returned timelines stay valid after they are replaced.
+  std::shared_ptr<const Timelines> GetTimelines();
+
+  const TraceStorage* const storage_;
+  std::shared_ptr<const Timelines> timelines_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_THREAD_STATE_TABLE_H_
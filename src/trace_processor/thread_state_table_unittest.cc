@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/thread_state_table.h"
+#include "src/trace_processor/process_tracker.h"
+#include "src/trace_processor/sched_tracker.h"
+#include "src/trace_processor/scoped_db.h"
+#include "src/trace_processor/trace_processor_context.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+
+class ThreadStateTableTest : public ::testing::Test {
+ public:
+  ThreadStateTableTest() {
+    sqlite3* db = nullptr;
+    PERFETTO_CHECK(sqlite3_open(":memory:", &db) == SQLITE_OK);
+    db_.reset(db);
+
+    context_.storage.reset(new TraceStorage());
+    context_.process_tracker.reset(new ProcessTracker(&context_));
+    context_.sched_tracker.reset(new SchedTracker(&context_));
+
+    ThreadStateTable::RegisterTable(db_.get(), context_.storage.get());
+  }
+
+  // Returns the rows of |sql| as comma separated values.
+  std::vector<std::string> Query(const std::string& sql) {
+    sqlite3_stmt* raw_stmt = nullptr;
+    EXPECT_EQ(sqlite3_prepare_v2(*db_, sql.c_str(),
+                                 static_cast<int>(sql.size()), &raw_stmt,
+                                 nullptr),
+              SQLITE_OK);
+    ScopedStmt stmt(raw_stmt);
+    std::vector<std::string> rows;
+    while (sqlite3_step(*stmt) == SQLITE_ROW) {
+      std::string row;
+      for (int i = 0; i < sqlite3_column_count(*stmt); i++) {
+        const char* value =
+            reinterpret_cast<const char*>(sqlite3_column_text(*stmt, i));
+        row += (i > 0 ? "," : "") + std::string(value ? value : "NULL");
+      }
+      rows.emplace_back(std::move(row));
+    }
+    return rows;
+  }
+
+  // cpu 0: pid 10 runs in [100, 110) and sleeps (S), then pid 20 runs in
+  //        [110, 130) and blocks (D).
+  // cpu 1: pid 30 runs in [105, 150) and is preempted (R) by pid 10, which
+  //        runs in [150, 160) and blocks (D|K).
+  void PushSwitches() {
+    auto* tracker = context_.sched_tracker.get();
+    tracker->PushSchedSwitch(0, 100, 0, 0, "swapper", 10);
+    tracker->PushSchedSwitch(1, 105, 0, 0, "swapper", 30);
+    tracker->PushSchedSwitch(0, 110, 10, 1, "t10", 20);
+    tracker->PushSchedSwitch(0, 130, 20, 2, "t20", 0);
+    tracker->PushSchedSwitch(1, 150, 30, 0, "t30", 10);
+    tracker->PushSchedSwitch(1, 160, 10, 0x82, "t10", 0);
+  }
+
+  UniqueTid UtidOfSlice(uint32_t cpu, size_t row) {
+    return context_.storage->SlicesForCpu(cpu).utids()[row];
+  }
+
+  ~ThreadStateTableTest() override { context_.storage->ResetStorage(); }
+
+ protected:
+  TraceProcessorContext context_;
+  ScopedDb db_;
+};
+
+TEST_F(ThreadStateTableTest, TimelineOfEachThread) {
+  PushSwitches();
+  UniqueTid t10 = UtidOfSlice(0, 0);
+  UniqueTid t20 = UtidOfSlice(0, 1);
+  UniqueTid t30 = UtidOfSlice(1, 0);
+
+  auto query = [this](UniqueTid utid) {
+    return Query("SELECT ts, dur, cpu, state FROM thread_state WHERE utid = " +
+                 std::to_string(utid));
+  };
+  ASSERT_THAT(query(t10), ElementsAre("100,10,0,Running", "110,40,NULL,S",
+                                      "150,10,1,Running"));
+  // The last state of a thread lasts until the end of the trace.
+  ASSERT_THAT(query(t20), ElementsAre("110,20,0,Running", "130,30,NULL,D"));
+  ASSERT_THAT(query(t30), ElementsAre("105,45,1,Running", "150,10,NULL,R"));
+  ASSERT_THAT(query(0), IsEmpty());
+  ASSERT_THAT(query(1000), IsEmpty());
+}
+
+TEST_F(ThreadStateTableTest, SortedByUtidAndTimestamp) {
+  PushSwitches();
+  UniqueTid t10 = UtidOfSlice(0, 0);
+  UniqueTid t20 = UtidOfSlice(0, 1);
+  ASSERT_LT(t10, t20);
+
+  auto rows = Query("SELECT utid, ts FROM thread_state WHERE ts >= 110");
+  ASSERT_THAT(rows, ElementsAre(std::to_string(t10) + ",110",
+                                std::to_string(t10) + ",150",
+                                std::to_string(t20) + ",110",
+                                std::to_string(t20) + ",130",
+                                std::to_string(UtidOfSlice(1, 0)) + ",150"));
+}
+
+TEST_F(ThreadStateTableTest, TimestampConstraints) {
+  PushSwitches();
+  std::string utid = std::to_string(UtidOfSlice(0, 0));
+  ASSERT_THAT(Query("SELECT ts FROM thread_state WHERE utid = " + utid +
+                    " AND ts > 100 AND ts <= 150"),
+              ElementsAre("110", "150"));
+  ASSERT_THAT(Query("SELECT ts FROM thread_state WHERE utid = " + utid +
+                    " AND ts = 110"),
+              ElementsAre("110"));
+  ASSERT_THAT(Query("SELECT ts FROM thread_state WHERE utid = " + utid +
+                    " AND ts > 150"),
+              IsEmpty());
+  ASSERT_THAT(Query("SELECT ts FROM thread_state WHERE utid = " + utid +
+                    " ORDER BY ts DESC"),
+              ElementsAre("150", "110", "100"));
+}
+
+TEST_F(ThreadStateTableTest, RebuiltWhenSlicesAreAdded) {
+  PushSwitches();
+  std::string t10 = std::to_string(UtidOfSlice(0, 0));
+  std::string t20 = std::to_string(UtidOfSlice(0, 1));
+  ASSERT_THAT(Query("SELECT COUNT(*) FROM thread_state WHERE utid = " + t10),
+              ElementsAre("3"));
+
+  context_.sched_tracker->PushSchedSwitch(0, 200, 0, 0, "swapper", 10);
+  context_.sched_tracker->PushSchedSwitch(0, 210, 10, 1, "t10", 0);
+  ASSERT_THAT(
+      Query("SELECT ts, dur, state FROM thread_state WHERE utid = " + t10 +
+            " AND ts >= 150"),
+      ElementsAre("150,10,Running", "160,40,D|K", "200,10,Running"));
+  ASSERT_THAT(Query("SELECT state, dur FROM thread_state WHERE utid = " + t20 +
+                    " AND ts = 130"),
+              ElementsAre("D,80"));
+}
+
+TEST_F(ThreadStateTableTest, IdleThreadsHaveNoTimeline) {
+  // Utid 0 runs on both CPUs at once, around a slice of another thread.
+  auto* storage = context_.storage.get();
+  UniqueTid utid = storage->AddEmptyThread(10);
+  storage->AddSliceToCpu(0, 100, 50, 0, 0, 0);
+  storage->AddSliceToCpu(1, 110, 20, 0, 0, 0);
+  storage->AddSliceToCpu(1, 130, 10, utid, 0, 1);
+  storage->PublishRowCounts();
+
+  ASSERT_THAT(Query("SELECT utid, ts, dur, state FROM thread_state"),
+              ElementsAre(std::to_string(utid) + ",130,10,Running",
+                          std::to_string(utid) + ",140,10,S"));
+  ASSERT_THAT(Query("SELECT ts FROM thread_state WHERE utid = 0"), IsEmpty());
+}
+
+TEST_F(ThreadStateTableTest, FormatState) {
+  char buf[ThreadStateTable::kMaxStateLength];
+  auto format = [&buf](uint32_t state) {
+    ThreadStateTable::FormatState(state, buf);
+    return std::string(buf);
+  };
+  ASSERT_EQ(format(0), "R");
+  ASSERT_EQ(format(1), "S");
+  ASSERT_EQ(format(2), "D");
+  ASSERT_EQ(format(0x82), "D|K");
+  ASSERT_EQ(format(0x800), "R+");
+  ASSERT_EQ(format(0x7ff), "S|D|T|t|X|Z|x|K|W|P|N");
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -16,6 +16,8 @@
 
 #include "src/trace_processor/thread_table.h"
 
+#include <algorithm>
+
 #include "perfetto/base/logging.h"
 #include "src/trace_processor/query_constraints.h"
 #include "src/trace_processor/sqlite_utils.h"
@@ -47,7 +49,7 @@ std::unique_ptr<Table::Cursor> ThreadTable::CreateCursor() {
 }
 
 int ThreadTable::BestIndex(const QueryConstraints& qc, BestIndexInfo* info) {
-  info->estimated_cost = static_cast<uint32_t>(storage_->thread_count());
+  info->estimated_cost = storage_->GetVisibleRowCounts().threads - 1;
 
   // If the query has a constraint on the |utid| field, return a reduced cost
   // because we can do that filter efficiently.
@@ -74,8 +76,8 @@ int ThreadTable::Cursor::Column(sqlite3_context* context, int N) {
     }
     case Column::kName: {
       const auto& name = storage_->GetString(thread.name_id);
-      sqlite3_result_text(context, name.c_str(),
-                          static_cast<int>(name.length()), nullptr);
+      sqlite3_result_text(context, name.data(), static_cast<int>(name.size()),
+                          nullptr);
       break;
     }
     case Column::kTid: {
@@ -93,7 +95,9 @@ int ThreadTable::Cursor::Column(sqlite3_context* context, int N) {
 int ThreadTable::Cursor::Filter(const QueryConstraints& qc,
                                 sqlite3_value** argv) {
   utid_filter_.min = 1;
-  utid_filter_.max = static_cast<uint32_t>(storage_->thread_count());
+  // The 0th row is the invalid-thread sentinel.
+  const uint32_t max_utid = storage_->GetVisibleRowCounts().threads - 1;
+  utid_filter_.max = max_utid;
   utid_filter_.desc = false;
   utid_filter_.current = utid_filter_.min;
   for (size_t j = 0; j < qc.constraints().size(); j++) {
@@ -116,6 +120,8 @@ int ThreadTable::Cursor::Filter(const QueryConstraints& qc,
       }
     }
   }
+  // Never return rows which were not visible when the query started.
+  utid_filter_.max = std::min(utid_filter_.max, max_utid);
   for (const auto& ob : qc.order_by()) {
     if (ob.iColumn == Column::kUtid) {
       utid_filter_.desc = ob.desc;
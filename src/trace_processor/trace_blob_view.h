@@ -20,7 +20,7 @@
 #include <stddef.h>
 #include <stdint.h>
 
-#include <limits>
+#include <functional>
 #include <memory>
 
 #include "perfetto/base/logging.h"
@@ -33,15 +33,24 @@ namespace trace_processor {
 // of the raw trace.
 // The underlying buffer will be freed once all the TraceBlobViews that refer
 // to the same buffer have passed through the pipeline and been parsed.
+// The buffer is either a heap allocation owned by the TraceBlobView or memory
+// owned by the caller (e.g. a mmapped region of the trace file), in which case
+// a callback is invoked to release it.
 class TraceBlobView {
  public:
+  using ReleaseCallback = std::function<void()>;
+
   TraceBlobView(std::unique_ptr<uint8_t[]> buffer, size_t offset, size_t length)
       : shbuf_(SharedBuf(std::move(buffer))),
-        offset_(static_cast<uint32_t>(offset)),
-        length_(static_cast<uint32_t>(length)) {
-    PERFETTO_DCHECK(offset <= std::numeric_limits<uint32_t>::max());
-    PERFETTO_DCHECK(length <= std::numeric_limits<uint32_t>::max());
-  }
+        offset_(offset),
+        length_(length) {}
+
+  // Wraps [buffer, buffer + length) without copying it. |release| is invoked
+  // once the last TraceBlobView referring to the buffer is destroyed.
+  TraceBlobView(const uint8_t* buffer, size_t length, ReleaseCallback release)
+      : shbuf_(SharedBuf(buffer, std::move(release))),
+        offset_(0),
+        length_(length) {}
 
   // Allow std::move().
   TraceBlobView(TraceBlobView&&) noexcept = default;
@@ -82,6 +91,10 @@ class TraceBlobView {
       rcbuf_ = new RefCountedBuf(std::move(mem));
     }
 
+    SharedBuf(const uint8_t* mem, ReleaseCallback release) {
+      rcbuf_ = new RefCountedBuf(mem, std::move(release));
+    }
+
     SharedBuf(const SharedBuf& copy) : rcbuf_(copy.rcbuf_) {
       PERFETTO_DCHECK(rcbuf_->refcount > 0);
       rcbuf_->refcount++;
@@ -116,14 +129,25 @@ class TraceBlobView {
 
     bool operator==(const SharedBuf& x) const { return x.rcbuf_ == rcbuf_; }
     bool operator!=(const SharedBuf& x) const { return !(x == *this); }
-    const uint8_t* data() const { return rcbuf_->mem.get(); }
+    const uint8_t* data() const { return rcbuf_->mem; }
 
    private:
     struct RefCountedBuf {
       explicit RefCountedBuf(std::unique_ptr<uint8_t[]> buf)
-          : refcount(1), mem(std::move(buf)) {}
+          : refcount(1), mem(buf.get()), owned_mem(std::move(buf)) {}
+
+      RefCountedBuf(const uint8_t* buf, ReleaseCallback release_cb)
+          : refcount(1), mem(buf), release(std::move(release_cb)) {}
+
+      ~RefCountedBuf() {
+        if (release)
+          release();
+      }
+
       int refcount;
-      std::unique_ptr<uint8_t[]> mem;
+      const uint8_t* mem;
+      std::unique_ptr<uint8_t[]> owned_mem;  // Null for external buffers.
+      ReleaseCallback release;               // Null for heap buffers.
     };
 
     RefCountedBuf* rcbuf_ = nullptr;
@@ -132,13 +156,11 @@ class TraceBlobView {
   inline const uint8_t* start() const { return shbuf_.data(); }
 
   TraceBlobView(SharedBuf b, size_t o, size_t l)
-      : shbuf_(b),
-        offset_(static_cast<uint32_t>(o)),
-        length_(static_cast<uint32_t>(l)) {}
+      : shbuf_(b), offset_(o), length_(l) {}
 
   SharedBuf shbuf_;
-  uint32_t offset_;
-  uint32_t length_;  // Measured from |offset_|, not from |data()|.
+  size_t offset_;
+  size_t length_;  // Measured from |offset_|, not from |data()|.
 };
 
 }  // namespace trace_processor
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/trace_blob_view.h"
+
+#include <string.h>
+#include <sys/mman.h>
+
+#include "gtest/gtest.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+TEST(TraceBlobViewTest, Slices) {
+  std::unique_ptr<uint8_t[]> buffer(new uint8_t[100]);
+  memset(buffer.get(), 'x', 100);
+  const uint8_t* start = buffer.get();
+  TraceBlobView blob(std::move(buffer), 10, 90);
+  ASSERT_EQ(blob.data(), start + 10);
+  ASSERT_EQ(blob.length(), 90u);
+
+  // Slice offsets are relative to the start of the buffer.
+  TraceBlobView slice = blob.slice(20, 30);
+  ASSERT_EQ(slice.data(), start + 20);
+  ASSERT_EQ(slice.length(), 30u);
+  ASSERT_EQ(slice.offset_of(slice.data()), 20u);
+  ASSERT_EQ(slice, blob.slice(20, 30));
+  ASSERT_NE(slice, blob.slice(20, 31));
+}
+
+// Traces mapped whole can be larger than 4 GB.
+TEST(TraceBlobViewTest, SlicesPast4GB) {
+  if (sizeof(size_t) < 8)
+    return;
+  const size_t kSize = 8ull * 1024 * 1024 * 1024;
+  const size_t kOffset = 5ull * 1024 * 1024 * 1024 + 3;
+
+  // The memory is only reserved, never touched.
+  void* addr = mmap(nullptr, kSize, PROT_NONE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  ASSERT_NE(addr, MAP_FAILED);
+  const uint8_t* start = static_cast<const uint8_t*>(addr);
+  bool released = false;
+  {
+    TraceBlobView blob(start, kSize, [addr, kSize, &released] {
+      munmap(addr, kSize);
+      released = true;
+    });
+    ASSERT_EQ(blob.length(), kSize);
+
+    TraceBlobView slice = blob.slice(kOffset, 16);
+    ASSERT_EQ(slice.data(), start + kOffset);
+    ASSERT_EQ(slice.length(), 16u);
+    ASSERT_EQ(slice.offset_of(slice.data()), kOffset);
+
+    TraceBlobView tail = blob.slice(kOffset, kSize - kOffset);
+    ASSERT_EQ(tail.length(), kSize - kOffset);
+    TraceBlobView nested =
+        tail.slice(tail.offset_of(tail.data()) + 100, 8);
+    ASSERT_EQ(nested.data(), start + kOffset + 100);
+  }
+  ASSERT_TRUE(released);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
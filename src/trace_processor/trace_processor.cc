@@ -16,29 +16,67 @@
 
 #include "src/trace_processor/trace_processor.h"
 
+#include <ctype.h>
 #include <sqlite3.h>
+#include <algorithm>
 #include <functional>
+#include <string>
+#include <thread>
 
+#include "perfetto/base/build_config.h"
 #include "src/trace_processor/counters_table.h"
+#include "src/trace_processor/cpu_summary_table.h"
 #include "src/trace_processor/json_trace_parser.h"
 #include "src/trace_processor/process_table.h"
 #include "src/trace_processor/process_tracker.h"
 #include "src/trace_processor/proto_trace_parser.h"
 #include "src/trace_processor/proto_trace_tokenizer.h"
+#include "src/trace_processor/query_profile_table.h"
 #include "src/trace_processor/sched_slice_table.h"
 #include "src/trace_processor/sched_tracker.h"
 #include "src/trace_processor/slice_table.h"
+#include "src/trace_processor/span_join_table.h"
+#include "src/trace_processor/storage_snapshot.h"
 #include "src/trace_processor/string_table.h"
 #include "src/trace_processor/table.h"
+#include "src/trace_processor/thread_state_table.h"
 #include "src/trace_processor/thread_table.h"
 #include "src/trace_processor/trace_sorter.h"
+#include "src/trace_processor/trace_storage.h"
+#include "src/trace_processor/worker_pool.h"
+#include "src/trace_processor/xz_trace_reader.h"
 
 #include "perfetto/trace_processor/raw_query.pb.h"
 
 namespace perfetto {
 namespace trace_processor {
 
-TraceProcessor::TraceProcessor(const Config& cfg) {
+namespace {
+
+// The type of a column of a query which returned no rows, guessed from the
+// type it is declared with as SQLite does for column affinities. Columns
+// which aren't from a table (e.g. expressions) have no declared type.
+protos::RawQueryResult_ColumnDesc_Type DeclaredColumnType(const char* decl) {
+  std::string type(decl ? decl : "");
+  std::transform(type.begin(), type.end(), type.begin(), ::toupper);
+  auto contains = [&type](const char* str) {
+    return type.find(str) != std::string::npos;
+  };
+  if (contains("INT"))
+    return protos::RawQueryResult_ColumnDesc_Type_LONG;
+  if (contains("CHAR") || contains("CLOB") || contains("TEXT") ||
+      contains("STRING")) {
+    return protos::RawQueryResult_ColumnDesc_Type_STRING;
+  }
+  if (contains("REAL") || contains("FLOA") || contains("DOUB"))
+    return protos::RawQueryResult_ColumnDesc_Type_DOUBLE;
+  return protos::RawQueryResult_ColumnDesc_Type_LONG;
+}
+
+}  // namespace
+
+TraceProcessor::TraceProcessor(const Config& cfg)
+    : load_window_(cfg.load_window) {
   sqlite3* db = nullptr;
   PERFETTO_CHECK(sqlite3_open(":memory:", &db) == SQLITE_OK);
   db_.reset(std::move(db));
@@ -49,18 +87,33 @@ TraceProcessor::TraceProcessor(const Config& cfg) {
   context_.sorter.reset(
       new TraceSorter(&context_, cfg.optimization_mode, cfg.window_size_ns));
   context_.storage.reset(new TraceStorage());
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WASM)
+  if (cfg.ingestion_threads > 0)
+    context_.worker_pool.reset(new WorkerPool(cfg.ingestion_threads));
+#endif
 
   ProcessTable::RegisterTable(*db_, context_.storage.get());
   SchedSliceTable::RegisterTable(*db_, context_.storage.get());
   SliceTable::RegisterTable(*db_, context_.storage.get());
   StringTable::RegisterTable(*db_, context_.storage.get());
   ThreadTable::RegisterTable(*db_, context_.storage.get());
+  ThreadStateTable::RegisterTable(*db_, context_.storage.get());
   CountersTable::RegisterTable(*db_, context_.storage.get());
+  SpanJoinTable::RegisterTable(*db_, context_.storage.get());
+  CpuSummaryTable::RegisterTable(*db_, context_.storage.get());
+  QueryProfileTable::RegisterTable(*db_, context_.storage.get());
 }
 
 TraceProcessor::~TraceProcessor() = default;
 
 bool TraceProcessor::Parse(std::unique_ptr<uint8_t[]> data, size_t size) {
+  if (size == 0)
+    return true;
+  return Parse(TraceBlobView(std::move(data), 0, size));
+}
+
+bool TraceProcessor::Parse(TraceBlobView blob) {
+  const size_t size = blob.length();
   if (size == 0)
     return true;
   if (unrecoverable_parse_error_)
@@ -68,31 +121,201 @@ bool TraceProcessor::Parse(std::unique_ptr<uint8_t[]> data, size_t size) {
 
   // If this is the first Parse() call, guess the trace type and create the
   // appropriate parser.
-  if (!context_.chunk_reader) {
-    char buf[32];
-    memcpy(buf, &data[0], std::min(size, sizeof(buf)));
-    buf[sizeof(buf) - 1] = '\0';
-    const size_t kPreambleLen = strlen(JsonTraceParser::kPreamble);
-    if (strncmp(buf, JsonTraceParser::kPreamble, kPreambleLen) == 0) {
-      PERFETTO_DLOG("Legacy JSON trace detected");
-      context_.chunk_reader.reset(new JsonTraceParser(&context_));
+  if (!context_.chunk_reader)
+    context_.chunk_reader = CreateChunkReader(blob);
+
+  bool res = context_.chunk_reader->Parse(std::move(blob));
+  unrecoverable_parse_error_ |= !res;
+  context_.storage->PublishRowCounts();
+  return res;
+}
+
+std::unique_ptr<ChunkedTraceReader> TraceProcessor::CreateChunkReader(
+    const TraceBlobView& first_chunk) {
+  const size_t size = first_chunk.length();
+  char buf[32];
+  memcpy(buf, first_chunk.data(), std::min(size, sizeof(buf)));
+  buf[sizeof(buf) - 1] = '\0';
+  const size_t kPreambleLen = strlen(JsonTraceParser::kPreamble);
+  if (strncmp(buf, JsonTraceParser::kPreamble, kPreambleLen) == 0) {
+    PERFETTO_DLOG("Legacy JSON trace detected");
+    return std::unique_ptr<ChunkedTraceReader>(new JsonTraceParser(&context_));
+  }
+  if (size >= sizeof(StorageSnapshot::kMagic) &&
+      memcmp(buf, StorageSnapshot::kMagic, sizeof(StorageSnapshot::kMagic)) ==
+          0) {
+    PERFETTO_DLOG("Trace processor snapshot detected");
+    return std::unique_ptr<ChunkedTraceReader>(
+        new StorageSnapshotReader(&context_));
+  }
+  if (size >= sizeof(XzTraceReader::kMagic) &&
+      memcmp(buf, XzTraceReader::kMagic, sizeof(XzTraceReader::kMagic)) == 0) {
+    PERFETTO_DLOG("Compressed .xz trace detected");
+    return std::unique_ptr<ChunkedTraceReader>(
+        new XzTraceReader([this](const TraceBlobView& chunk) {
+          return CreateChunkReader(chunk);
+        }));
+  }
+  return std::unique_ptr<ChunkedTraceReader>(
+      new ProtoTraceTokenizer(&context_, load_window_));
+}
+
+uint8_t* TraceProcessor::GetWritableChunk(size_t size) {
+  return chunk_pool_.Acquire(size);
+}
+
+bool TraceProcessor::CommitChunk(uint8_t* chunk, size_t size) {
+  return Parse(chunk_pool_.Commit(chunk, size));
+}
+
+bool TraceProcessor::ParseTracesInParallel(std::vector<TraceBlobView> traces) {
+  using TokenizedPiece = ProtoTraceTokenizer::TokenizedPiece;
+  PERFETTO_CHECK(!context_.chunk_reader);
+  for (const TraceBlobView& trace : traces) {
+    const char* preamble = JsonTraceParser::kPreamble;
+    const size_t len = trace.length();
+    if ((len >= strlen(preamble) &&
+         memcmp(trace.data(), preamble, strlen(preamble)) == 0) ||
+        (len >= sizeof(StorageSnapshot::kMagic) &&
+         memcmp(trace.data(), StorageSnapshot::kMagic,
+                sizeof(StorageSnapshot::kMagic)) == 0) ||
+        (len >= sizeof(XzTraceReader::kMagic) &&
+         memcmp(trace.data(), XzTraceReader::kMagic,
+                sizeof(XzTraceReader::kMagic)) == 0)) {
+      PERFETTO_ELOG("Only protobuf traces can be loaded in parallel");
+      return false;
+    }
+  }
+
+  // The workers only read the raw bytes of the traces: the TraceBlobViews
+  // themselves are not thread safe and are only touched by this thread.
+  std::vector<std::vector<TokenizedPiece>> pieces(traces.size());
+  std::vector<uint8_t> complete(traces.size());
+  std::vector<uint32_t> invalid_bundles(traces.size());
+  auto tokenize = [this, &pieces, &complete, &invalid_bundles](
+                      const uint8_t* data, size_t size, size_t i) {
+    complete[i] = ProtoTraceTokenizer::TokenizeAndSortTrace(
+        data, size, load_window_, &pieces[i], &invalid_bundles[i]);
+  };
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_WASM)
+  for (size_t i = 0; i < traces.size(); i++)
+    tokenize(traces[i].data(), traces[i].length(), i);
+#else
+  {
+    const uint32_t num_threads = std::max(
+        1u, std::min(std::thread::hardware_concurrency(),
+                     static_cast<uint32_t>(traces.size())));
+    WorkerPool pool(num_threads);
+    for (size_t i = 0; i < traces.size(); i++) {
+      const uint8_t* data = traces[i].data();
+      const size_t size = traces[i].length();
+      pool.PostTask([&tokenize, data, size, i] { tokenize(data, size, i); });
+    }
+    // The destructor of the pool waits for all the tasks.
+  }
+#endif
+
+  for (uint32_t count : invalid_bundles)
+    context_.storage->AddFtraceBundlesInvalidCpu(count);
+
+  // k-way merge of the sorted pieces of each trace, as in the TraceSorter.
+  // Pieces with the same timestamp and source are taken from the traces in
+  // the order they were passed in.
+  std::vector<size_t> next(traces.size());
+  auto heap_cmp = [&pieces, &next](size_t a, size_t b) {
+    const TokenizedPiece& piece_a = pieces[a][next[a]];
+    const TokenizedPiece& piece_b = pieces[b][next[b]];
+    if (piece_a.SortsBefore(piece_b))
+      return false;
+    return piece_b.SortsBefore(piece_a) || a > b;
+  };
+  std::vector<size_t> heap;
+  for (size_t i = 0; i < traces.size(); i++) {
+    if (!pieces[i].empty())
+      heap.emplace_back(i);
+  }
+  std::make_heap(heap.begin(), heap.end(), heap_cmp);
+
+  // Rows are published periodically, so that queries running meanwhile see
+  // the progress.
+  constexpr uint32_t kPiecesPerPublish = 64 * 1024;
+  uint32_t pieces_since_publish = 0;
+  auto* parser = context_.proto_parser.get();
+  while (!heap.empty()) {
+    std::pop_heap(heap.begin(), heap.end(), heap_cmp);
+    const size_t i = heap.back();
+    const TokenizedPiece& piece = pieces[i][next[i]];
+    TraceBlobView& trace = traces[i];
+    TraceBlobView view =
+        trace.slice(trace.offset_of(trace.data()) + piece.offset, piece.length);
+    if (piece.cpu == TokenizedPiece::kNoCpu) {
+      parser->ParseTracePacket(std::move(view));
     } else {
-      context_.chunk_reader.reset(new ProtoTraceTokenizer(&context_));
+      parser->ParseFtracePacket(piece.cpu, piece.timestamp, std::move(view),
+                                piece.event);
+    }
+
+    if (++next[i] < pieces[i].size()) {
+      std::push_heap(heap.begin(), heap.end(), heap_cmp);
+    } else {
+      heap.pop_back();
+      std::vector<TokenizedPiece>().swap(pieces[i]);
+    }
+    if (++pieces_since_publish == kPiecesPerPublish) {
+      context_.storage->PublishRowCounts();
+      pieces_since_publish = 0;
     }
   }
+  context_.storage->PublishRowCounts();
 
-  bool res = context_.chunk_reader->Parse(std::move(data), size);
-  unrecoverable_parse_error_ |= !res;
-  return res;
+  bool all_complete = std::all_of(complete.begin(), complete.end(),
+                                  [](uint8_t c) { return c != 0; });
+  if (!all_complete)
+    PERFETTO_ELOG("Truncated TracePacket at the end of a trace");
+  return all_complete;
 }
 
 void TraceProcessor::NotifyEndOfFile() {
+  if (context_.chunk_reader)
+    context_.chunk_reader->NotifyEndOfFile();
   context_.sorter->FlushEventsForced();
+  context_.storage->PublishRowCounts();
 }
 
+constexpr uint32_t TraceProcessor::kDefaultQueryBatchSize;
+
 void TraceProcessor::ExecuteQuery(
     const protos::RawQueryArgs& args,
     std::function<void(const protos::RawQueryResult&)> callback) {
+  ExecuteQueryInBatches(args, 0 /* batch_size */,
+                        [&callback](const protos::RawQueryResult& res) {
+                          callback(res);
+                          return true;
+                        });
+}
+
+void TraceProcessor::ExecuteStreamingQuery(const protos::RawQueryArgs& args,
+                                           QueryBatchCallback callback) {
+  uint32_t batch_size =
+      args.batch_size() ? args.batch_size() : kDefaultQueryBatchSize;
+  ExecuteQueryInBatches(args, batch_size, callback);
+}
+
+void TraceProcessor::ExecuteQueryInBatches(const protos::RawQueryArgs& args,
+                                           uint32_t batch_size,
+                                           const QueryBatchCallback& callback) {
+  // SQLite is built without thread safety, so queries coming from different
+  // threads are serialized. Ingestion is not blocked: the query only sees the
+  // rows published when it started.
+  std::lock_guard<std::mutex> lock(query_mutex_);
+  TraceStorage::ReadScope read_scope(context_.storage.get());
+
+  // Outlives the statement, so that the profile is complete when stored.
+  QueryProfiler::Scope profiler_scope(&query_profiler_, args.sql_query());
+
+  // The same proto is reused for all the batches: once a batch has been
+  // delivered only the column values are cleared, so the descriptors are
+  // repeated in each batch and the allocated capacity is recycled.
   protos::RawQueryResult proto;
   query_interrupted_.store(false, std::memory_order_relaxed);
 
@@ -102,7 +325,8 @@ void TraceProcessor::ExecuteQuery(
                                &raw_stmt, nullptr);
   ScopedStmt stmt(raw_stmt);
   int col_count = sqlite3_column_count(*stmt);
-  int row_count = 0;
+  uint64_t row_count = 0;
+  uint32_t batch_row_count = 0;
   while (!err) {
     int r = sqlite3_step(*stmt);
     if (r != SQLITE_ROW) {
@@ -111,13 +335,23 @@ void TraceProcessor::ExecuteQuery(
       break;
     }
 
+    if (batch_size > 0 && batch_row_count == batch_size) {
+      proto.set_num_records(batch_row_count);
+      if (!callback(proto))
+        return;
+      for (int i = 0; i < col_count; i++)
+        proto.mutable_columns(i)->Clear();
+      batch_row_count = 0;
+    }
+
     for (int i = 0; i < col_count; i++) {
+      const int value_type = sqlite3_column_type(*stmt, i);
       if (row_count == 0) {
         // Setup the descriptors.
         auto* descriptor = proto.add_column_descriptors();
         descriptor->set_name(sqlite3_column_name(*stmt, i));
 
-        switch (sqlite3_column_type(*stmt, i)) {
+        switch (value_type) {
           case SQLITE_INTEGER:
             descriptor->set_type(protos::RawQueryResult_ColumnDesc_Type_LONG);
             break;
@@ -128,16 +362,28 @@ void TraceProcessor::ExecuteQuery(
             descriptor->set_type(protos::RawQueryResult_ColumnDesc_Type_DOUBLE);
             break;
           case SQLITE_NULL:
-            proto.set_error("Query yields to NULL column, can't handle that");
-            callback(std::move(proto));
-            return;
+            // The type of the values is unknown: use the declared one.
+            descriptor->set_type(
+                DeclaredColumnType(sqlite3_column_decltype(*stmt, i)));
+            break;
         }
 
         // Add an empty column.
         proto.add_columns();
       }
 
+      // NULLs are flagged only in the columns which have some in the batch,
+      // from the first one on.
       auto* column = proto.mutable_columns(i);
+      if (value_type == SQLITE_NULL) {
+        if (column->is_nulls_size() == 0) {
+          column->mutable_is_nulls()->Resize(static_cast<int>(batch_row_count),
+                                             false);
+        }
+        column->add_is_nulls(true);
+      } else if (column->is_nulls_size() > 0) {
+        column->add_is_nulls(false);
+      }
       switch (proto.column_descriptors(i).type()) {
         case protos::RawQueryResult_ColumnDesc_Type_LONG:
           column->add_long_values(sqlite3_column_int64(*stmt, i));
@@ -154,15 +400,28 @@ void TraceProcessor::ExecuteQuery(
       }
     }
     row_count++;
+    batch_row_count++;
   }
 
+  proto.set_is_last_batch(true);
   if (err) {
     proto.set_error(sqlite3_errmsg(*db_));
-    callback(std::move(proto));
+    callback(proto);
     return;
   }
 
-  proto.set_num_records(static_cast<uint64_t>(row_count));
+  // Without rows, the types of the values are unknown, but consumers still
+  // need the columns (e.g. for the header of a CSV output).
+  if (row_count == 0) {
+    for (int i = 0; i < col_count; i++) {
+      auto* descriptor = proto.add_column_descriptors();
+      descriptor->set_name(sqlite3_column_name(*stmt, i));
+      descriptor->set_type(
+          DeclaredColumnType(sqlite3_column_decltype(*stmt, i)));
+      proto.add_columns();
+    }
+  }
+  proto.set_num_records(batch_row_count);
 
   if (query_interrupted_.load()) {
     PERFETTO_ELOG("SQLite query interrupted");
@@ -179,6 +438,21 @@ void TraceProcessor::InterruptQuery() {
   sqlite3_interrupt(db_.get());
 }
 
+bool TraceProcessor::SaveSnapshot(int fd) {
+  return StorageSnapshot::Write(*context_.storage, fd);
+}
+
+void TraceProcessor::PrintMemoryUsage() {
+  TraceStorage::MemoryUsage usage = context_.storage->GetMemoryUsage();
+  PERFETTO_ILOG("Memory usage: %.2f MB", usage.total() / 1E6);
+  PERFETTO_ILOG("  sched slices:    %.2f MB", usage.sched_slices / 1E6);
+  PERFETTO_ILOG("  nestable slices: %.2f MB", usage.nestable_slices / 1E6);
+  PERFETTO_ILOG("  counters:        %.2f MB", usage.counters / 1E6);
+  PERFETTO_ILOG("  strings:         %.2f MB", usage.strings / 1E6);
+  PERFETTO_ILOG("  processes:       %.2f MB", usage.processes / 1E6);
+  PERFETTO_ILOG("  threads:         %.2f MB", usage.threads / 1E6);
+}
+
 // static
 void EnableSQLiteVtableDebugging() {
   // This level of indirection is required to avoid clients to depend on table.h
@@ -20,9 +20,14 @@
 #include <atomic>
 #include <functional>
 #include <memory>
+#include <mutex>
+#include <vector>
 
 #include "src/trace_processor/basic_types.h"
+#include "src/trace_processor/chunk_pool.h"
+#include "src/trace_processor/query_profiler.h"
 #include "src/trace_processor/scoped_db.h"
+#include "src/trace_processor/trace_blob_view.h"
 #include "src/trace_processor/trace_processor_context.h"
 
 namespace perfetto {
@@ -34,25 +39,82 @@ class RawQueryResult;
 
 namespace trace_processor {
 
+class ChunkedTraceReader;
+
 // Coordinates the loading of traces from an arbitrary source and allows
 // execution of SQL queries on the events in these traces.
+//
+// The trace can be queried while it is still being loaded: the methods which
+// push data (Parse(), CommitChunk(), NotifyEndOfFile() and the others which
+// are not about queries) must all be called on the same thread, while
+// queries can be run concurrently from any other thread. Each query sees the
+// trace as it was at the end of the last Parse() call completed before the
+// query started, and is not affected by data added while it runs.
 class TraceProcessor {
  public:
   struct Config {
     OptimizationMode optimization_mode = OptimizationMode::kMaxBandwidth;
     uint64_t window_size_ns = 60 * 1000 * 1000 * 1000ULL;  // 60 seconds.
+
+    // Number of worker threads used to tokenize protobuf traces. When > 0,
+    // the chunks passed to Parse() are tokenized on a pool of threads while
+    // the calling thread applies the results in order; data becomes visible
+    // to queries only after it has been applied (at the latest, in
+    // NotifyEndOfFile()). 0 does all the work on the calling thread.
+    // Ignored in WASM builds.
+    uint32_t ingestion_threads = 0;
+
+    // Loads only the part of a protobuf trace in [start_ts, end_ts]: ftrace
+    // events outside of it are dropped as the trace is tokenized, before
+    // they are sorted or decoded, so loading a window of a long trace costs
+    // about as much as loading a trace of the length of the window. The
+    // sched_switch and cpu_frequency events up to |margin_ns| before or
+    // after the window are kept, as the slices and frequencies at its edges
+    // depend on them, and so are all the sched_process_free and task_rename
+    // events, which track the lifetime of the threads. Packets other than
+    // ftrace (e.g. process trees) and JSON traces are always loaded whole.
+    LoadWindow load_window;
   };
+
   explicit TraceProcessor(const Config&);
   ~TraceProcessor();
 
   // The entry point to push trace data into the processor. The trace format
-  // will be automatically discovered on the first push call. It is possible
-  // to make queries between two pushes.
+  // will be automatically discovered on the first push call. Traces
+  // compressed in the .xz format are decompressed on the fly, on a helper
+  // thread. It is possible to make queries between two pushes.
   // Returns true if parsing has been succeeding so far, false if some
   // unrecoverable error happened. If this happens, the TraceProcessor will
   // ignore the following Parse() requests and drop data on the floor.
   bool Parse(std::unique_ptr<uint8_t[]>, size_t);
 
+  // Same as above, but takes a view on a buffer that can be owned by the
+  // caller (e.g. a mmapped trace file). The buffer is retained, without
+  // copies, until all the events in it have been parsed.
+  bool Parse(TraceBlobView);
+
+  // Zero-copy alternative to Parse() for callers which would otherwise have
+  // to copy the trace into a buffer allocated for the occasion (e.g. the WASM
+  // bridge, which receives the trace from JS). GetWritableChunk() returns a
+  // buffer of at least |size| bytes, recycled from the chunks parsed so far,
+  // into which the caller writes the next part of the trace. CommitChunk()
+  // then parses its first |size| bytes, as Parse() would; committing 0 bytes
+  // just returns the chunk. Several chunks can be written at once (e.g. to
+  // overlap I/O and parsing), and are parsed in the order they are committed.
+  uint8_t* GetWritableChunk(size_t size);
+  bool CommitChunk(uint8_t* chunk, size_t size);
+
+  // Loads several whole protobuf traces (e.g. the periodic dumps of a long
+  // capture, or the traces of different devices) and merges them into one,
+  // as if they were a single trace sorted by timestamp. Each trace is
+  // tokenized and sorted on its own thread, with up to one thread per core;
+  // the merged events are then parsed on the calling thread. The traces are
+  // fully parsed, and visible to queries, once this returns. Must be called
+  // instead of, not after, Parse(). Returns false if any of the traces is
+  // not a protobuf trace or is truncated, in which case the whole packets
+  // of all the traces are still loaded.
+  bool ParseTracesInParallel(std::vector<TraceBlobView> traces);
+
   // When parsing a bounded file (as opposite to streaming from a device) this
   // function should be called when the last chunk of the file has been passed
   // into Parse(). This allows to flush the events queued in the ordering stage,
@@ -60,17 +122,68 @@ class TraceProcessor {
   void NotifyEndOfFile();
 
   // Executes a SQLite query on the loaded portion of the trace. |result| will
-  // be invoked once after the result of the query is available.
+  // be invoked once after the result of the query is available. Queries
+  // issued from different threads are run one at a time, so |result| must not
+  // start another query.
   void ExecuteQuery(const protos::RawQueryArgs&,
                     std::function<void(const protos::RawQueryResult&)>);
 
-  // Interrupts the current query. Typically used by Ctrl-C handler.
+  // Invoked with each batch of a streaming query. Returning false stops the
+  // query: no more rows are computed and the callback is not invoked again.
+  using QueryBatchCallback = std::function<bool(const protos::RawQueryResult&)>;
+
+  // Like ExecuteQuery(), but delivers the result in batches of at most
+  // |args.batch_size| rows as SQLite produces them, so that the memory used
+  // does not depend on the size of the result. Each batch is a self-contained
+  // RawQueryResult (see raw_query.proto); the last one has |is_last_batch|
+  // set and has no rows only if the query returned none, in which case the
+  // types of its column descriptors come from the declared types of the
+  // columns (LONG if they have none). Batches are delivered synchronously:
+  // the next one is computed only once |callback| has returned.
+  // InterruptQuery() stops the query, in which case the last batch carries an
+  // error.
+  void ExecuteStreamingQuery(const protos::RawQueryArgs&, QueryBatchCallback);
+
+  // Interrupts the current query. Typically used by Ctrl-C handler. Can be
+  // called from any thread.
   void InterruptQuery();
 
+  // Writes a snapshot of the parsed trace to |fd|. Passing the snapshot to
+  // Parse() in a later session restores the trace without re-parsing it.
+  // Should be called only after NotifyEndOfFile(). Returns false on I/O
+  // errors.
+  bool SaveSnapshot(int fd);
+
+  // Logs a breakdown of the memory used by the parsed trace.
+  void PrintMemoryUsage();
+
  private:
+  static constexpr uint32_t kDefaultQueryBatchSize = 1024;
+
+  // Creates the reader for a trace which starts with |first_chunk|, guessing
+  // its format from the first bytes.
+  std::unique_ptr<ChunkedTraceReader> CreateChunkReader(
+      const TraceBlobView& first_chunk);
+
+  // |batch_size| == 0 returns the whole result in a single batch.
+  void ExecuteQueryInBatches(const protos::RawQueryArgs&,
+                             uint32_t batch_size,
+                             const QueryBatchCallback&);
+
   ScopedDb db_;  // Keep first.
+
+  // Must outlive |context_|, which holds views on its chunks.
+  ChunkPool chunk_pool_;
+
   TraceProcessorContext context_;
   bool unrecoverable_parse_error_ = false;
+  const LoadWindow load_window_;
+
+  // Held while a query runs, as |db_| can't be used by two threads at once.
+  std::mutex query_mutex_;
+
+  // Profiles of the last queries, exposed by the query_profile table.
+  QueryProfiler query_profiler_;
 
   // This is atomic because it is set by the CTRL-C signal handler and we need
   // to prevent single-flow compiler optimizations in ExecuteQuery().
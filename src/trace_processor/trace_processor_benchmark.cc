@@ -0,0 +1,307 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "src/trace_processor/process_tracker.h"
+#include "src/trace_processor/proto_trace_parser.h"
+#include "src/trace_processor/proto_trace_tokenizer.h"
+#include "src/trace_processor/sched_tracker.h"
+#include "src/trace_processor/synthetic_trace.h"
+#include "src/trace_processor/trace_processor.h"
+#include "src/trace_processor/trace_processor_context.h"
+#include "src/trace_processor/trace_sorter.h"
+#include "src/trace_processor/trace_storage.h"
+
+#include "perfetto/trace_processor/raw_query.pb.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+// Size of the chunks passed to Parse(), as in trace_processor_shell.
+constexpr size_t kChunkSize = 1024 * 1024;
+
+constexpr uint64_t kWindowSizeNs = 60 * 1000 * 1000 * 1000ULL;
+
+bool IsBenchmarkFunctionalOnly() {
+  return getenv("BENCHMARK_FUNCTIONAL_TEST_ONLY") != nullptr;
+}
+
+uint32_t NumEvents() {
+  return IsBenchmarkFunctionalOnly() ? 10000 : 500000;
+}
+
+// Proto trace benchmarks take {cpus, out of order %, churn per 10k switches}.
+SyntheticTraceConfig ProtoConfig(const benchmark::State& state) {
+  SyntheticTraceConfig config;
+  config.num_events = NumEvents();
+  config.num_cpus = static_cast<uint32_t>(state.range(0));
+  config.out_of_order_ratio = static_cast<double>(state.range(1)) / 100;
+  config.process_churn = static_cast<double>(state.range(2)) / 10000;
+  return config;
+}
+
+void ProtoTraceArgs(benchmark::internal::Benchmark* b) {
+  b->Args({1, 0, 0});
+  b->Args({8, 0, 0});
+  b->Args({8, 10, 0});
+  b->Args({8, 50, 0});
+  b->Args({8, 10, 100});
+  b->Args({32, 10, 10});
+}
+
+// Generating a trace takes longer than processing it, so the last one is
+// kept for the following runs, which usually have the same arguments.
+const std::string& GetProtoTrace(const benchmark::State& state) {
+  static std::vector<int64_t>* cached_args = new std::vector<int64_t>();
+  static std::string* cached_trace = new std::string();
+  std::vector<int64_t> args{state.range(0), state.range(1), state.range(2)};
+  if (args != *cached_args) {
+    *cached_trace = GenerateSyntheticProtoTrace(ProtoConfig(state));
+    *cached_args = args;
+  }
+  return *cached_trace;
+}
+
+// Wraps |trace| without copying it.
+TraceBlobView WrapTrace(const std::string& trace) {
+  return TraceBlobView(reinterpret_cast<const uint8_t*>(trace.data()),
+                       trace.size(), [] {});
+}
+
+void ParseInChunks(TraceProcessor* tp, const std::string& trace) {
+  TraceBlobView blob = WrapTrace(trace);
+  for (size_t off = 0; off < trace.size(); off += kChunkSize)
+    tp->Parse(blob.slice(off, std::min(kChunkSize, trace.size() - off)));
+  tp->NotifyEndOfFile();
+}
+
+// Drops the sorted packets: measures the stages before the parser.
+class NullParser : public ProtoTraceParser {
+ public:
+  explicit NullParser(TraceProcessorContext* context)
+      : ProtoTraceParser(context) {}
+
+  void ParseTracePacket(TraceBlobView) override {}
+  void ParseFtracePacket(uint32_t,
+                         uint64_t,
+                         TraceBlobView,
+                         const DecodedFtraceEvent&) override {}
+};
+
+// A packet as passed to the parser by the sorter.
+struct SortedPacket {
+  bool is_ftrace;
+  uint32_t cpu;
+  uint64_t timestamp;
+  size_t offset;
+  size_t size;
+  DecodedFtraceEvent event;  // Its strings point into the trace.
+};
+
+// Records the sorted packets, which must all point into |trace|.
+class RecordingParser : public ProtoTraceParser {
+ public:
+  RecordingParser(TraceProcessorContext* context,
+                  const std::string* trace,
+                  std::vector<SortedPacket>* packets)
+      : ProtoTraceParser(context), trace_(trace), packets_(packets) {}
+
+  void ParseTracePacket(TraceBlobView packet) override {
+    packets_->emplace_back(SortedPacket{false, 0, 0, OffsetOf(packet),
+                                        packet.length(), DecodedFtraceEvent()});
+  }
+
+  void ParseFtracePacket(uint32_t cpu,
+                         uint64_t timestamp,
+                         TraceBlobView packet,
+                         const DecodedFtraceEvent& event) override {
+    packets_->emplace_back(SortedPacket{true, cpu, timestamp, OffsetOf(packet),
+                                        packet.length(), event});
+  }
+
+ private:
+  size_t OffsetOf(const TraceBlobView& packet) {
+    auto start = reinterpret_cast<const uint8_t*>(trace_->data());
+    PERFETTO_CHECK(packet.data() >= start &&
+                   packet.data() + packet.length() <= start + trace_->size());
+    return static_cast<size_t>(packet.data() - start);
+  }
+
+  const std::string* const trace_;
+  std::vector<SortedPacket>* const packets_;
+};
+
+// Tokenizer and sorter, from the raw trace to sorted packets.
+void BM_ProtoTokenizeAndSort(benchmark::State& state) {
+  const std::string& trace = GetProtoTrace(state);
+  for (auto _ : state) {
+    TraceProcessorContext context;
+    context.storage.reset(new TraceStorage());
+    context.proto_parser.reset(new NullParser(&context));
+    context.sorter.reset(new TraceSorter(
+        &context, OptimizationMode::kMaxBandwidth, kWindowSizeNs));
+    ProtoTraceTokenizer tokenizer(&context);
+    TraceBlobView blob = WrapTrace(trace);
+    for (size_t off = 0; off < trace.size(); off += kChunkSize) {
+      size_t size = std::min(kChunkSize, trace.size() - off);
+      tokenizer.Parse(blob.slice(off, size));
+    }
+    context.sorter->FlushEventsForced();
+  }
+  state.SetBytesProcessed(state.iterations() *
+                          static_cast<int64_t>(trace.size()));
+}
+BENCHMARK(BM_ProtoTokenizeAndSort)->Apply(ProtoTraceArgs);
+
+// Parser, trackers and storage, from sorted packets, whose ftrace events have
+// been decoded by the tokenizer, to the tables. Bytes are those of the whole
+// trace, for comparison with the other stages.
+void BM_ProtoParse(benchmark::State& state) {
+  const std::string& trace = GetProtoTrace(state);
+  std::vector<SortedPacket> packets;
+  {
+    TraceProcessorContext context;
+    context.storage.reset(new TraceStorage());
+    context.proto_parser.reset(new RecordingParser(&context, &trace, &packets));
+    context.sorter.reset(new TraceSorter(
+        &context, OptimizationMode::kMaxBandwidth, kWindowSizeNs));
+    ProtoTraceTokenizer tokenizer(&context);
+    tokenizer.Parse(WrapTrace(trace));
+    context.sorter->FlushEventsForced();
+  }
+
+  for (auto _ : state) {
+    TraceProcessorContext context;
+    context.storage.reset(new TraceStorage());
+    context.process_tracker.reset(new ProcessTracker(&context));
+    context.sched_tracker.reset(new SchedTracker(&context));
+    context.proto_parser.reset(new ProtoTraceParser(&context));
+    TraceBlobView blob = WrapTrace(trace);
+    for (const SortedPacket& packet : packets) {
+      if (packet.is_ftrace) {
+        context.proto_parser->ParseFtracePacket(
+            packet.cpu, packet.timestamp,
+            blob.slice(packet.offset, packet.size), packet.event);
+      } else {
+        context.proto_parser->ParseTracePacket(
+            blob.slice(packet.offset, packet.size));
+      }
+    }
+  }
+  state.SetBytesProcessed(state.iterations() *
+                          static_cast<int64_t>(trace.size()));
+}
+BENCHMARK(BM_ProtoParse)->Apply(ProtoTraceArgs);
+
+// The whole pipeline, through the public API. The 4th argument is the number
+// of ingestion threads.
+void BM_ProtoLoad(benchmark::State& state) {
+  const std::string& trace = GetProtoTrace(state);
+  TraceProcessor::Config config;
+  config.ingestion_threads = static_cast<uint32_t>(state.range(3));
+  for (auto _ : state) {
+    TraceProcessor tp(config);
+    ParseInChunks(&tp, trace);
+  }
+  state.SetBytesProcessed(state.iterations() *
+                          static_cast<int64_t>(trace.size()));
+}
+BENCHMARK(BM_ProtoLoad)
+    ->Args({8, 10, 10, 0})
+    ->Args({8, 10, 10, 4})
+    ->Args({32, 10, 10, 0})
+    ->Args({32, 10, 10, 4});
+
+void BM_JsonLoad(benchmark::State& state) {
+  SyntheticTraceConfig trace_config;
+  trace_config.num_events = NumEvents();
+  const std::string trace = GenerateSyntheticJsonTrace(trace_config);
+  for (auto _ : state) {
+    TraceProcessor tp{TraceProcessor::Config()};
+    ParseInChunks(&tp, trace);
+  }
+  state.SetBytesProcessed(state.iterations() *
+                          static_cast<int64_t>(trace.size()));
+}
+BENCHMARK(BM_JsonLoad);
+
+struct Query {
+  const char* name;
+  const char* sql;
+};
+
+const Query kQueries[] = {
+    {"sched_scan", "SELECT ts, dur, cpu, utid FROM sched"},
+    {"sched_cpu", "SELECT ts, dur, utid FROM sched WHERE cpu = 1"},
+    {"sched_ts_range",
+     "SELECT ts, dur, cpu FROM sched WHERE ts >= 1000000000 AND "
+     "ts < 1050000000"},
+    {"sched_sorted_by_dur",
+     "SELECT ts, dur, cpu FROM sched ORDER BY dur DESC LIMIT 1000"},
+    {"sched_by_thread",
+     "SELECT utid, SUM(dur), COUNT(*) FROM sched GROUP BY utid"},
+    {"sched_thread_timeline",
+     "SELECT ts, dur, cpu FROM sched WHERE utid = 10 ORDER BY ts"},
+    {"sched_join_thread",
+     "SELECT sched.ts, thread.name FROM sched JOIN thread USING (utid) "
+     "WHERE cpu = 0"},
+    {"thread_join_process",
+     "SELECT thread.name, process.name FROM thread JOIN process "
+     "USING (upid)"},
+    {"counters_cpu", "SELECT ts, value, dur FROM counters WHERE ref = 0"},
+};
+
+// Rows/s returned by typical queries on a loaded trace. The row count of
+// queries which aggregate is that of the result.
+void BM_Query(benchmark::State& state) {
+  static TraceProcessor* tp = [] {
+    SyntheticTraceConfig config;
+    config.num_events = NumEvents();
+    config.process_churn = 0.01;
+    std::string trace = GenerateSyntheticProtoTrace(config);
+    auto* processor = new TraceProcessor(TraceProcessor::Config());
+    ParseInChunks(processor, trace);
+    return processor;
+  }();
+
+  const Query& query = kQueries[state.range(0)];
+  protos::RawQueryArgs args;
+  args.set_sql_query(query.sql);
+  uint64_t rows = 0;
+  for (auto _ : state) {
+    tp->ExecuteQuery(args, [&rows, &state](const protos::RawQueryResult& res) {
+      if (res.has_error())
+        state.SkipWithError(res.error().c_str());
+      rows += res.num_records();
+    });
+  }
+  state.SetLabel(query.name);
+  state.SetItemsProcessed(static_cast<int64_t>(rows));
+}
+BENCHMARK(BM_Query)->DenseRange(
+    0,
+    static_cast<int>(sizeof(kQueries) / sizeof(kQueries[0])) - 1);
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
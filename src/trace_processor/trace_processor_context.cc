@@ -21,6 +21,7 @@
 #include "src/trace_processor/proto_trace_parser.h"
 #include "src/trace_processor/sched_tracker.h"
 #include "src/trace_processor/trace_sorter.h"
+#include "src/trace_processor/worker_pool.h"
 
 namespace perfetto {
 namespace trace_processor {
@@ -29,6 +29,7 @@ class TraceParser;
 class TraceSorter;
 class ProtoTraceParser;
 class ChunkedTraceReader;
+class WorkerPool;
 
 class TraceProcessorContext {
  public:
@@ -40,6 +41,11 @@ class TraceProcessorContext {
   std::unique_ptr<TraceStorage> storage;
   std::unique_ptr<ProtoTraceParser> proto_parser;
   std::unique_ptr<TraceSorter> sorter;
+
+  // Only set when ingestion is pipelined across multiple threads (see
+  // TraceProcessor::Config::ingestion_threads).
+  std::unique_ptr<WorkerPool> worker_pool;
+
   std::unique_ptr<ChunkedTraceReader> chunk_reader;
 };
 
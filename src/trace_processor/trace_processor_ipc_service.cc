@@ -0,0 +1,269 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/trace_processor_ipc_service.h"
+
+#include "perfetto/base/logging.h"
+#include "perfetto/base/task_runner.h"
+#include "perfetto/ipc/async_result.h"
+#include "src/trace_processor/trace_processor.h"
+#include "src/trace_processor/worker_pool.h"
+
+#include "perfetto/trace_processor/raw_query.pb.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+namespace {
+
+// The largest serialized RawQueryResult sent in a reply. The 64 bytes are an
+// over-estimation of the overhead of the InvokeMethodReply and of the frame.
+constexpr int kMaxReplySize = static_cast<int>(ipc::kIPCBufferSize) - 64;
+
+// Returns the rows [begin, end) of |batch|, with its column descriptors.
+protos::RawQueryResult CopyRows(const protos::RawQueryResult& batch,
+                                int begin,
+                                int end) {
+  protos::RawQueryResult rows;
+  *rows.mutable_column_descriptors() = batch.column_descriptors();
+  rows.set_num_records(static_cast<uint64_t>(end - begin));
+  for (int c = 0; c < batch.columns_size(); c++) {
+    const auto& column = batch.columns(c);
+    auto* rows_column = rows.add_columns();
+    for (int r = begin; r < end; r++) {
+      switch (batch.column_descriptors(c).type()) {
+        case protos::RawQueryResult_ColumnDesc_Type_LONG:
+          rows_column->add_long_values(column.long_values(r));
+          break;
+        case protos::RawQueryResult_ColumnDesc_Type_DOUBLE:
+          rows_column->add_double_values(column.double_values(r));
+          break;
+        case protos::RawQueryResult_ColumnDesc_Type_STRING:
+          rows_column->add_string_values(column.string_values(r));
+          break;
+      }
+      if (column.is_nulls_size() > 0)
+        rows_column->add_is_nulls(column.is_nulls(r));
+    }
+  }
+  return rows;
+}
+
+// Appends the rows [begin, end) of |batch| to |replies|, halving the range
+// until each part fits in a reply. A single row which doesn't fit is
+// replaced by an error.
+void SplitRows(const protos::RawQueryResult& batch,
+               int begin,
+               int end,
+               std::vector<protos::RawQueryResult>* replies) {
+  protos::RawQueryResult rows = CopyRows(batch, begin, end);
+  if (rows.ByteSize() <= kMaxReplySize) {
+    replies->emplace_back(std::move(rows));
+    return;
+  }
+  if (end - begin == 1) {
+    replies->emplace_back();
+    replies->back().set_error("Row too large for an IPC reply");
+    return;
+  }
+  const int mid = begin + (end - begin) / 2;
+  SplitRows(batch, begin, mid, replies);
+  SplitRows(batch, mid, end, replies);
+}
+
+}  // namespace
+
+constexpr size_t TraceProcessorIPCService::kMaxBufferedBytes;
+
+TraceProcessorIPCService::TraceProcessorIPCService(
+    trace_processor::TraceProcessor* trace_processor,
+    base::TaskRunner* task_runner)
+    : trace_processor_(trace_processor),
+      task_runner_(task_runner),
+      worker_(new WorkerPool(1)),
+      weak_ptr_factory_(this) {}
+
+TraceProcessorIPCService::~TraceProcessorIPCService() {
+  // Stops the running query and lets the worker skip the ones still queued.
+  while (!queries_.empty())
+    CancelQuery(queries_.begin());
+  worker_.reset();
+}
+
+// Called by the IPC layer.
+void TraceProcessorIPCService::RawQuery(const protos::RawQueryArgs& args,
+                                        DeferredRawQueryResult reply) {
+  EnqueueQuery(args, std::move(reply), /*streaming=*/false);
+}
+
+// Called by the IPC layer.
+void TraceProcessorIPCService::StreamingRawQuery(
+    const protos::RawQueryArgs& args,
+    DeferredRawQueryResult reply) {
+  EnqueueQuery(args, std::move(reply), /*streaming=*/true);
+}
+
+// Called by the IPC layer.
+void TraceProcessorIPCService::OnClientDisconnected() {
+  ipc::ClientID client_id = ipc::Service::client_info().client_id();
+  for (auto it = queries_.begin(); it != queries_.end();) {
+    auto cur = it++;
+    if (cur->second.client_id == client_id)
+      CancelQuery(cur);
+  }
+  client_buffers_.erase(client_id);
+}
+
+void TraceProcessorIPCService::EnqueueQuery(const protos::RawQueryArgs& args,
+                                            DeferredRawQueryResult reply,
+                                            bool streaming) {
+  const uint64_t query_id = ++last_query_id_;
+  PendingQuery& query = queries_[query_id];
+  query.client_id = ipc::Service::client_info().client_id();
+  query.reply = std::move(reply);
+  std::shared_ptr<ClientBuffer>& buffer = client_buffers_[query.client_id];
+  if (!buffer)
+    buffer.reset(new ClientBuffer());
+  query.state.reset(new QueryState(buffer));
+
+  auto weak_this = weak_ptr_factory_.GetWeakPtr();
+  std::shared_ptr<QueryState> state = query.state;
+  worker_->PostTask([this, weak_this, query_id, state, args, streaming] {
+    RunQuery(weak_this, query_id, state, args, streaming);
+  });
+}
+
+void TraceProcessorIPCService::RunQuery(
+    base::WeakPtr<TraceProcessorIPCService> weak_this,
+    uint64_t query_id,
+    const std::shared_ptr<QueryState>& state,
+    const protos::RawQueryArgs& args,
+    bool streaming) {
+  {
+    std::lock_guard<std::mutex> lock(state->mutex);
+    if (state->cancelled)
+      return;
+    state->running = true;
+  }
+  if (streaming) {
+    trace_processor_->ExecuteStreamingQuery(
+        args, [this, &weak_this, query_id,
+               &state](const protos::RawQueryResult& batch) {
+          return PostReplies(weak_this, query_id, state, batch);
+        });
+  } else {
+    // The whole result has to fit in the single reply.
+    trace_processor_->ExecuteQuery(
+        args, [this, &weak_this, query_id,
+               &state](const protos::RawQueryResult& res) {
+          if (res.ByteSize() <= kMaxReplySize) {
+            PostReplies(weak_this, query_id, state, res);
+            return;
+          }
+          protos::RawQueryResult error;
+          error.set_error("Result too large, use StreamingRawQuery");
+          error.set_is_last_batch(true);
+          PostReplies(weak_this, query_id, state, error);
+        });
+  }
+
+  // Cancelling the query interrupts it only while it's running, so that the
+  // next query isn't interrupted instead.
+  std::lock_guard<std::mutex> lock(state->mutex);
+  state->running = false;
+}
+
+bool TraceProcessorIPCService::PostReplies(
+    base::WeakPtr<TraceProcessorIPCService> weak_this,
+    uint64_t query_id,
+    const std::shared_ptr<QueryState>& state,
+    const protos::RawQueryResult& batch) {
+  std::vector<protos::RawQueryResult> replies;
+  if (batch.ByteSize() <= kMaxReplySize) {
+    replies.emplace_back(batch);
+  } else {
+    SplitRows(batch, 0, static_cast<int>(batch.num_records()), &replies);
+  }
+
+  ClientBuffer* buffer = state->buffer.get();
+  for (size_t i = 0; i < replies.size(); i++) {
+    // An error ends the query, even if it's not the last batch.
+    bool is_last = (i + 1 == replies.size() && batch.is_last_batch()) ||
+                   replies[i].has_error();
+    replies[i].set_is_last_batch(is_last);
+    {
+      std::lock_guard<std::mutex> lock(state->mutex);
+      if (state->cancelled)
+        return false;
+    }
+
+    // The worker holds the query lock of the TraceProcessor, so it must not
+    // wait for the client to catch up: the query is stopped instead. The
+    // error is small enough not to be accounted.
+    size_t size = static_cast<size_t>(replies[i].ByteSize());
+    if (buffer->bytes.fetch_add(size) + size > kMaxBufferedBytes) {
+      buffer->bytes.fetch_sub(size);
+      replies[i].Clear();
+      replies[i].set_error("Client too slow reading the result, query stopped");
+      replies[i].set_is_last_batch(true);
+      is_last = true;
+      size = 0;
+    }
+
+    // Tasks have to be copyable, hence the shared_ptr.
+    std::shared_ptr<protos::RawQueryResult> reply(new protos::RawQueryResult());
+    reply->Swap(&replies[i]);
+    std::shared_ptr<ClientBuffer> shared_buffer = state->buffer;
+    task_runner_->PostTask([weak_this, query_id, reply, shared_buffer, size] {
+      if (weak_this)
+        weak_this->SendReply(query_id, reply.get());
+      shared_buffer->bytes.fetch_sub(size);
+    });
+    if (is_last)
+      return false;
+  }
+  return true;
+}
+
+void TraceProcessorIPCService::SendReply(uint64_t query_id,
+                                         protos::RawQueryResult* reply) {
+  auto it = queries_.find(query_id);
+  if (it == queries_.end())
+    return;  // The client has disconnected.
+
+  auto result = ipc::AsyncResult<protos::RawQueryResult>::Create();
+  result->Swap(reply);
+  const bool has_more = !result->is_last_batch();
+  result.set_has_more(has_more);
+  it->second.reply.Resolve(std::move(result));
+  if (!has_more)
+    queries_.erase(it);
+}
+
+void TraceProcessorIPCService::CancelQuery(
+    std::map<uint64_t, PendingQuery>::iterator it) {
+  {
+    QueryState* state = it->second.state.get();
+    std::lock_guard<std::mutex> lock(state->mutex);
+    state->cancelled = true;
+    if (state->running)
+      trace_processor_->InterruptQuery();
+  }
+  queries_.erase(it);
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
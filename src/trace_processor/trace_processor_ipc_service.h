@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_TRACE_PROCESSOR_IPC_SERVICE_H_
+#define SRC_TRACE_PROCESSOR_TRACE_PROCESSOR_IPC_SERVICE_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "perfetto/base/weak_ptr.h"
+#include "perfetto/ipc/basic_types.h"
+
+#include "perfetto/trace_processor/trace_processor.ipc.h"
+
+namespace perfetto {
+
+namespace base {
+class TaskRunner;
+}  // namespace base
+
+namespace trace_processor {
+
+class TraceProcessor;
+class WorkerPool;
+
+// Implements the TraceProcessor port of the IPC service, so that a trace is
+// loaded once and then queried by many remote clients. Like the ipc::Host,
+// this class lives on the thread of |task_runner|. The queries are run on a
+// worker thread, one at a time in the order they are received (as the
+// TraceProcessor can't run two queries at once anyway), so that the host
+// keeps accepting clients and requests meanwhile. The worker never waits for
+// a client to read its replies, which would hold up the queries of all the
+// others: a client which lets more than kMaxBufferedBytes of replies pile up
+// gets its query stopped with an error. The queries of a client are stopped,
+// and the running one interrupted, when it disconnects.
+class TraceProcessorIPCService : public protos::TraceProcessor {
+ public:
+  TraceProcessorIPCService(trace_processor::TraceProcessor*, base::TaskRunner*);
+  ~TraceProcessorIPCService() override;
+
+  // protos::TraceProcessor implementation (from .proto IPC definition).
+  void RawQuery(const protos::RawQueryArgs&, DeferredRawQueryResult) override;
+  void StreamingRawQuery(const protos::RawQueryArgs&,
+                         DeferredRawQueryResult) override;
+  void OnClientDisconnected() override;
+
+ private:
+  // Size of the replies posted by the worker thread and not yet sent to a
+  // client, shared by all the queries of the client.
+  struct ClientBuffer {
+    std::atomic<size_t> bytes{0};
+  };
+
+  // The state of a query shared with the worker thread running it.
+  struct QueryState {
+    explicit QueryState(std::shared_ptr<ClientBuffer> b)
+        : buffer(std::move(b)) {}
+
+    const std::shared_ptr<ClientBuffer> buffer;
+    std::mutex mutex;
+    bool cancelled = false;  // Guarded by |mutex|.
+    bool running = false;    // Guarded by |mutex|.
+  };
+
+  struct PendingQuery {
+    ipc::ClientID client_id;
+    DeferredRawQueryResult reply;
+    std::shared_ptr<QueryState> state;
+  };
+
+  // Bounds the memory used by the replies to a client which reads them
+  // slower than its queries produce them.
+  static constexpr size_t kMaxBufferedBytes = 32 * 1024 * 1024;
+
+  TraceProcessorIPCService(const TraceProcessorIPCService&) = delete;
+  TraceProcessorIPCService& operator=(const TraceProcessorIPCService&) =
+      delete;
+
+  void EnqueueQuery(const protos::RawQueryArgs&,
+                    DeferredRawQueryResult,
+                    bool streaming);
+
+  // Run on the worker thread. The WeakPtr is only dereferenced by the tasks
+  // posted to |task_runner_|.
+  void RunQuery(base::WeakPtr<TraceProcessorIPCService>,
+                uint64_t query_id,
+                const std::shared_ptr<QueryState>&,
+                const protos::RawQueryArgs&,
+                bool streaming);
+
+  // Splits |batch| into replies that fit in IPC messages and posts them to
+  // |task_runner_|. Returns false if the query has to stop, i.e. it's
+  // cancelled, done or its client's buffer is full.
+  bool PostReplies(base::WeakPtr<TraceProcessorIPCService>,
+                   uint64_t query_id,
+                   const std::shared_ptr<QueryState>&,
+                   const protos::RawQueryResult& batch);
+
+  void SendReply(uint64_t query_id, protos::RawQueryResult*);
+  void CancelQuery(std::map<uint64_t, PendingQuery>::iterator);
+
+  trace_processor::TraceProcessor* const trace_processor_;
+  base::TaskRunner* const task_runner_;
+
+  // Queries received and not fully replied to yet, by id.
+  std::map<uint64_t, PendingQuery> queries_;
+
+  // The buffers of the connected clients which have sent queries.
+  std::map<ipc::ClientID, std::shared_ptr<ClientBuffer>> client_buffers_;
+  uint64_t last_query_id_ = 0;
+
+  std::unique_ptr<WorkerPool> worker_;
+
+  // Keep last.
+  base::WeakPtrFactory<TraceProcessorIPCService> weak_ptr_factory_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_TRACE_PROCESSOR_IPC_SERVICE_H_
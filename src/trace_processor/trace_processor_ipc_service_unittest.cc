@@ -0,0 +1,232 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/trace_processor_ipc_service.h"
+
+#include <chrono>
+#include <functional>
+#include <future>
+#include <string>
+#include <thread>
+
+#include "gtest/gtest.h"
+#include "perfetto/base/unix_task_runner.h"
+#include "perfetto/ipc/client.h"
+#include "perfetto/ipc/host.h"
+#include "src/base/test/test_task_runner.h"
+#include "src/ipc/test/test_socket.h"
+#include "src/trace_processor/trace_processor.h"
+
+#include "perfetto/trace_processor/raw_query.pb.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+constexpr char kSockName[] = TEST_SOCK_NAME("trace_processor_ipc_service");
+
+class ConnectListener : public ipc::ServiceProxy::EventListener {
+ public:
+  explicit ConnectListener(std::function<void()> on_connect)
+      : on_connect_(std::move(on_connect)) {}
+
+  void OnConnect() override { on_connect_(); }
+
+ private:
+  std::function<void()> on_connect_;
+};
+
+class TraceProcessorIPCServiceTest : public ::testing::Test {
+ protected:
+  // The host runs on its own thread, as if it was in another process: the
+  // host blocks on sending replies until the client has read them.
+  void SetUp() override {
+    DESTROY_TEST_SOCK(kSockName);
+    std::promise<bool> started;
+    host_thread_ = std::thread([this, &started] {
+      base::UnixTaskRunner task_runner;
+      std::unique_ptr<ipc::Host> host =
+          ipc::Host::CreateInstance(kSockName, &task_runner);
+      bool ok = host && host->ExposeService(std::unique_ptr<ipc::Service>(
+                            new TraceProcessorIPCService(&tp_, &task_runner)));
+      host_task_runner_ = &task_runner;
+      started.set_value(ok);
+      if (ok)
+        task_runner.Run();
+    });
+    host_started_ = started.get_future().get();
+    ASSERT_TRUE(host_started_);
+  }
+
+  void TearDown() override {
+    if (host_started_) {
+      base::UnixTaskRunner* task_runner = host_task_runner_;
+      task_runner->PostTask([task_runner] { task_runner->Quit(); });
+    }
+    host_thread_.join();
+    DESTROY_TEST_SOCK(kSockName);
+  }
+
+  // Connects a new client and waits for the service to be bound.
+  std::unique_ptr<protos::TraceProcessorProxy> Connect() {
+    std::string checkpoint = "connect_" + std::to_string(clients_.size());
+    listeners_.emplace_back(
+        new ConnectListener(task_runner_.CreateCheckpoint(checkpoint)));
+    clients_.emplace_back(
+        ipc::Client::CreateInstance(kSockName, &task_runner_));
+    std::unique_ptr<protos::TraceProcessorProxy> proxy(
+        new protos::TraceProcessorProxy(listeners_.back().get()));
+    clients_.back()->BindService(proxy->GetWeakPtr());
+    task_runner_.RunUntilCheckpoint(checkpoint);
+    return proxy;
+  }
+
+  // Returns a query yielding the integers [0, |n|) in column "x" and |n|
+  // copies of a |row_size| bytes long string in column "s".
+  static protos::RawQueryArgs CountQuery(int n, int row_size) {
+    protos::RawQueryArgs args;
+    args.set_sql_query(
+        "WITH RECURSIVE cnt(x) AS (SELECT 0 UNION ALL SELECT x + 1 FROM cnt "
+        "WHERE x + 1 < " +
+        std::to_string(n) + ") SELECT x, substr(hex(zeroblob(" +
+        std::to_string(row_size) + ")), 1, " + std::to_string(row_size) +
+        ") AS s FROM cnt");
+    return args;
+  }
+
+  TraceProcessor tp_{TraceProcessor::Config()};
+  std::thread host_thread_;
+  base::UnixTaskRunner* host_task_runner_ = nullptr;
+  bool host_started_ = false;
+
+  base::TestTaskRunner task_runner_;
+  std::vector<std::unique_ptr<ConnectListener>> listeners_;
+  std::vector<std::unique_ptr<ipc::Client>> clients_;
+};
+
+TEST_F(TraceProcessorIPCServiceTest, ConcurrentClients) {
+  auto proxy_a = Connect();
+  auto proxy_b = Connect();
+
+  // The batches of 1024 rows are split to fit in IPC messages, but the rows
+  // are all returned in order. Meanwhile a second client gets its result.
+  constexpr int kRows = 5000;
+  int64_t next_row = 0;
+  int replies = 0;
+  auto on_done = task_runner_.CreateCheckpoint("streaming_done");
+  ipc::Deferred<protos::RawQueryResult> streaming_reply(
+      [&](ipc::AsyncResult<protos::RawQueryResult> reply) {
+        ASSERT_TRUE(reply.success());
+        ASSERT_FALSE(reply->has_error()) << reply->error();
+        replies++;
+        for (int64_t value : reply->columns(0).long_values())
+          ASSERT_EQ(value, next_row++);
+        ASSERT_EQ(reply->is_last_batch(), !reply.has_more());
+        if (!reply.has_more())
+          on_done();
+      });
+  proxy_a->StreamingRawQuery(CountQuery(kRows, 200),
+                             std::move(streaming_reply));
+
+  auto on_count = task_runner_.CreateCheckpoint("count_done");
+  ipc::Deferred<protos::RawQueryResult> count_reply(
+      [&on_count](ipc::AsyncResult<protos::RawQueryResult> reply) {
+        ASSERT_TRUE(reply.success());
+        ASSERT_FALSE(reply.has_more());
+        ASSERT_EQ(reply->num_records(), 10u);
+        on_count();
+      });
+  proxy_b->RawQuery(CountQuery(10, 1), std::move(count_reply));
+
+  task_runner_.RunUntilCheckpoint("count_done");
+  task_runner_.RunUntilCheckpoint("streaming_done");
+  ASSERT_EQ(next_row, kRows);
+  ASSERT_GT(replies, kRows / 1024 + 1);
+}
+
+TEST_F(TraceProcessorIPCServiceTest, ResultTooLargeForRawQuery) {
+  auto proxy = Connect();
+  auto on_reply = task_runner_.CreateCheckpoint("reply");
+  ipc::Deferred<protos::RawQueryResult> reply(
+      [&on_reply](ipc::AsyncResult<protos::RawQueryResult> res) {
+        ASSERT_TRUE(res.success());
+        ASSERT_TRUE(res->has_error());
+        on_reply();
+      });
+  proxy->RawQuery(CountQuery(5000, 100), std::move(reply));
+  task_runner_.RunUntilCheckpoint("reply");
+}
+
+TEST_F(TraceProcessorIPCServiceTest, SlowClientQueryIsStopped) {
+  auto proxy = Connect();
+
+  // The client doesn't read the replies while the query produces more than
+  // kMaxBufferedBytes of them: the query is stopped with an error rather
+  // than waiting for the client.
+  constexpr int kRows = 20000;
+  constexpr int kRowSize = 2000;
+  static_assert(static_cast<size_t>(kRows) * kRowSize > 32 * 1024 * 1024,
+                "The result must exceed the buffer of the client");
+  int64_t rows = 0;
+  bool slept = false;
+  auto on_done = task_runner_.CreateCheckpoint("done");
+  ipc::Deferred<protos::RawQueryResult> reply(
+      [&](ipc::AsyncResult<protos::RawQueryResult> res) {
+        ASSERT_TRUE(res.success());
+        if (!slept) {
+          std::this_thread::sleep_for(std::chrono::seconds(1));
+          slept = true;
+        }
+        rows += static_cast<int64_t>(res->num_records());
+        if (res.has_more())
+          return;
+        ASSERT_TRUE(res->has_error());
+        on_done();
+      });
+  proxy->StreamingRawQuery(CountQuery(kRows, kRowSize), std::move(reply));
+  task_runner_.RunUntilCheckpoint("done");
+  ASSERT_LT(rows, kRows);
+}
+
+TEST_F(TraceProcessorIPCServiceTest, DisconnectInterruptsQuery) {
+  auto proxy_a = Connect();
+  auto proxy_b = Connect();
+
+  // A query which would run for minutes and return a single row.
+  protos::RawQueryArgs args;
+  args.set_sql_query(
+      "WITH RECURSIVE cnt(x) AS (SELECT 0 UNION ALL SELECT x + 1 FROM cnt "
+      "WHERE x + 1 < 10000000000) SELECT count(*) FROM cnt");
+  proxy_a->RawQuery(args, ipc::Deferred<protos::RawQueryResult>());
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  clients_[0].reset();
+  proxy_a.reset();
+
+  // The query of the other client runs as soon as the first is interrupted.
+  auto on_count = task_runner_.CreateCheckpoint("count_done");
+  ipc::Deferred<protos::RawQueryResult> count_reply(
+      [&on_count](ipc::AsyncResult<protos::RawQueryResult> reply) {
+        ASSERT_TRUE(reply.success());
+        ASSERT_EQ(reply->num_records(), 10u);
+        on_count();
+      });
+  proxy_b->RawQuery(CountQuery(10, 1), std::move(count_reply));
+  task_runner_.RunUntilCheckpoint("count_done");
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -16,15 +16,30 @@
 
 #include <aio.h>
 #include <fcntl.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <functional>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "perfetto/base/build_config.h"
+#include "perfetto/base/file_utils.h"
 #include "perfetto/base/logging.h"
 #include "perfetto/base/time.h"
+#include "perfetto/base/unix_task_runner.h"
+#include "perfetto/ipc/host.h"
+#include "src/trace_processor/batch_queries.h"
+#include "src/trace_processor/storage_snapshot.h"
+#include "src/trace_processor/trace_blob_view.h"
 #include "src/trace_processor/trace_processor.h"
+#include "src/trace_processor/trace_processor_ipc_service.h"
 
 #include "perfetto/trace_processor/raw_query.pb.h"
 
@@ -51,36 +66,40 @@ void PrintPrompt() {
   fflush(stdout);
 }
 
-void OnQueryResult(base::TimeNanos t_start, const protos::RawQueryResult& res) {
-  if (res.has_error()) {
-    PERFETTO_ELOG("SQLite error: %s", res.error().c_str());
-    return;
-  }
+// Rows printed between two "more records" prompts. Interactive queries are
+// streamed in batches of this size, so that the first page is printed as soon
+// as it is available and nothing beyond the last page viewed is computed.
+constexpr uint32_t kRowsPerPage = 32;
+
+// Prints one page of query results. Returns false if the user asked to stop.
+bool PrintQueryPage(const protos::RawQueryResult& res, bool first_page) {
   PERFETTO_CHECK(res.columns_size() == res.column_descriptors_size());
+  if (res.num_records() == 0)
+    return true;
 
-  base::TimeNanos t_end = base::GetWallTimeNs();
+  if (!first_page) {
+    fprintf(stderr, "...\nType 'q' to stop, Enter for more records: ");
+    fflush(stderr);
+    char input[32];
+    if (!fgets(input, sizeof(input) - 1, stdin))
+      exit(0);
+    if (input[0] == 'q')
+      return false;
+  }
+  for (const auto& col : res.column_descriptors())
+    printf("%20s ", col.name().c_str());
+  printf("\n");
 
-  for (int r = 0; r < static_cast<int>(res.num_records()); r++) {
-    if (r % 32 == 0) {
-      if (r > 0) {
-        fprintf(stderr, "...\nType 'q' to stop, Enter for more records: ");
-        fflush(stderr);
-        char input[32];
-        if (!fgets(input, sizeof(input) - 1, stdin))
-          exit(0);
-        if (input[0] == 'q')
-          break;
-      }
-      for (const auto& col : res.column_descriptors())
-        printf("%20s ", col.name().c_str());
-      printf("\n");
-
-      for (int i = 0; i < res.columns_size(); i++)
-        printf("%20s ", "--------------------");
-      printf("\n");
-    }
+  for (int i = 0; i < res.columns_size(); i++)
+    printf("%20s ", "--------------------");
+  printf("\n");
 
+  for (int r = 0; r < static_cast<int>(res.num_records()); r++) {
     for (int c = 0; c < res.columns_size(); c++) {
+      if (res.columns(c).is_nulls_size() > 0 && res.columns(c).is_nulls(r)) {
+        printf("%20s ", "[NULL]");
+        continue;
+      }
       switch (res.column_descriptors(c).type()) {
         case protos::RawQueryResult_ColumnDesc_Type_STRING:
           printf("%-20.20s ", res.columns(c).string_values(r).c_str());
@@ -98,33 +117,133 @@ void OnQueryResult(base::TimeNanos t_start, const protos::RawQueryResult& res) {
     }
     printf("\n");
   }
-  printf("\nQuery executed in %.3f ms\n\n", (t_end - t_start).count() / 1E6);
+  return true;
 }
 
-}  // namespace
+void RunQuery(const std::string& sql) {
+  protos::RawQueryArgs query;
+  query.set_sql_query(sql);
+  query.set_batch_size(kRowsPerPage);
 
-int main(int argc, char** argv) {
-  if (argc < 2) {
-    PERFETTO_ELOG("Usage: %s [-d] trace_file.proto", argv[0]);
-    return 1;
+  // The time spent printing and waiting for user input is not accounted as
+  // query execution time.
+  base::TimeNanos t_start = base::GetWallTimeNs();
+  base::TimeNanos t_printing(0);
+  bool first_page = true;
+  bool failed = false;
+  g_tp->ExecuteStreamingQuery(query, [&](const protos::RawQueryResult& res) {
+    if (res.has_error()) {
+      PERFETTO_ELOG("SQLite error: %s", res.error().c_str());
+      failed = true;
+      return false;
+    }
+    base::TimeNanos t_print_start = base::GetWallTimeNs();
+    bool more = PrintQueryPage(res, first_page);
+    first_page = false;
+    t_printing += base::GetWallTimeNs() - t_print_start;
+    return more;
+  });
+  if (failed)
+    return;
+  base::TimeNanos t_query = base::GetWallTimeNs() - t_start - t_printing;
+  printf("\nQuery executed in %.3f ms\n\n", t_query.count() / 1E6);
+}
+
+// Runs all the queries in |query_file| and writes their results to stdout.
+// Stops at the first query that fails. Returns false on errors.
+bool RunQueriesInBatch(const char* query_file, OutputFormat format) {
+  std::string sql;
+  if (!base::ReadFile(query_file, &sql)) {
+    PERFETTO_ELOG("Failed to read %s", query_file);
+    return false;
   }
-  const char* trace_file_path = nullptr;
-  for (int i = 1; i < argc; i++) {
-    if (strcmp(argv[i], "-d") == 0) {
-      EnableSQLiteVtableDebugging();
-      continue;
+  std::vector<std::string> statements = SplitStatements(sql);
+
+  // Larger batches than the interactive mode, to amortize the per-batch
+  // overhead: the results are never waited on by a user.
+  constexpr uint32_t kBatchSize = 4096;
+  BatchOutput output(format, STDOUT_FILENO);
+  for (size_t i = 0; i < statements.size(); i++) {
+    protos::RawQueryArgs query;
+    query.set_sql_query(statements[i]);
+    query.set_batch_size(kBatchSize);
+
+    base::TimeNanos t_start = base::GetWallTimeNs();
+    uint64_t rows = 0;
+    std::string error;
+    output.BeginQuery(i == 0);
+    g_tp->ExecuteStreamingQuery(query, [&](const protos::RawQueryResult& res) {
+      if (res.has_error()) {
+        error = res.error();
+        return false;
+      }
+      rows += res.num_records();
+      output.WriteBatch(res);
+      return true;
+    });
+    if (!output.EndQuery(error)) {
+      PERFETTO_PLOG("Failed to write the results");
+      return false;
     }
-    trace_file_path = argv[i];
+    if (!error.empty()) {
+      PERFETTO_ELOG("Query %zu failed: %s", i + 1, error.c_str());
+      return false;
+    }
+    base::TimeNanos t_query = base::GetWallTimeNs() - t_start;
+    PERFETTO_ILOG("Query %zu: %" PRIu64 " rows in %.3f ms", i + 1, rows,
+                  t_query.count() / 1E6);
   }
+  return true;
+}
 
-  // Load the trace file into the trace processor.
-  TraceProcessor::Config config;
-  config.optimization_mode = OptimizationMode::kMaxBandwidth;
-  TraceProcessor tp(config);
-  base::ScopedFile fd;
-  fd.reset(open(trace_file_path, O_RDONLY));
-  PERFETTO_CHECK(fd);
+// Maps the trace file in windows of kWindowSize and passes them to the trace
+// processor without copying. Pages are faulted in on demand while parsing and
+// each window is unmapped as soon as all the events in it have been parsed.
+// Returns false, without passing any data to |tp|, if the file can't be
+// mmapped (e.g. it is a pipe).
+bool LoadTraceMmap(TraceProcessor* tp, int fd, uint64_t* file_size) {
+  struct stat stat_buf {};
+  if (fstat(fd, &stat_buf) != 0 || !S_ISREG(stat_buf.st_mode))
+    return false;
+  const size_t size = static_cast<size_t>(stat_buf.st_size);
+
+  // Must be a multiple of the page size, as it's used as mmap() offset.
+  constexpr size_t kWindowSize = 64 * 1024 * 1024;
+
+  // Each window is still passed to the trace processor in smaller slices, to
+  // keep the tokenizer working set (and the batches posted to the ingestion
+  // worker threads, if any) small.
+  constexpr size_t kSliceSize = 1024 * 1024;
+  for (size_t off = 0; off < size; off += kWindowSize) {
+    fprintf(stderr, "\rLoading trace: %.2f MB\r", off / 1E6);
+    size_t len = std::min(kWindowSize, size - off);
+    void* addr = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd,
+                      static_cast<off_t>(off));
+    if (addr == MAP_FAILED && off == 0)
+      return false;
+    PERFETTO_CHECK(addr != MAP_FAILED);
+    madvise(addr, len, MADV_SEQUENTIAL);
 
+    uint8_t* data = static_cast<uint8_t*>(addr);
+    TraceBlobView window(data, len, [addr, len] { munmap(addr, len); });
+    for (size_t slice_off = 0; slice_off < len; slice_off += kSliceSize) {
+      // Start reading the next slice while this one is parsed. Only the
+      // slice ahead of the parse cursor is requested, so that the pages are
+      // still faulted in on demand.
+      const size_t next_off = slice_off + kSliceSize;
+      if (next_off < len) {
+        madvise(data + next_off, std::min(kSliceSize, len - next_off),
+                MADV_WILLNEED);
+      }
+      tp->Parse(window.slice(slice_off, std::min(kSliceSize, len - slice_off)));
+    }
+    *file_size += len;
+  }
+  return true;
+}
+
+// Fallback for files that can't be mmapped.
+void LoadTraceAio(TraceProcessor* tp, int fd, uint64_t* file_size) {
   // Load the trace in chunks using async IO. We create a simple pipeline where,
   // at each iteration, we parse the current chunk and asynchronously start
   // reading the next chunk.
@@ -133,60 +252,273 @@ int main(int argc, char** argv) {
   constexpr size_t kChunkSize = 1024 * 1024;
   struct aiocb cb {};
   cb.aio_nbytes = kChunkSize;
-  cb.aio_fildes = *fd;
+  cb.aio_fildes = fd;
 
-  // The control block has ownership of the buffer while the read is in-flight.
-  cb.aio_buf = new uint8_t[kChunkSize];
+  // The chunks are written directly by the kernel into buffers recycled by
+  // the trace processor, which are then parsed without copies.
+  cb.aio_buf = tp->GetWritableChunk(kChunkSize);
 
   PERFETTO_CHECK(aio_read(&cb) == 0);
   struct aiocb* aio_list[1] = {&cb};
 
-  uint64_t file_size = 0;
-  auto t_load_start = base::GetWallTimeMs();
   for (int i = 0;; i++) {
     if (i % 128 == 0)
-      fprintf(stderr, "\rLoading trace: %.2f MB\r", file_size / 1E6);
+      fprintf(stderr, "\rLoading trace: %.2f MB\r", *file_size / 1E6);
 
     // Block waiting for the pending read to complete.
     PERFETTO_CHECK(aio_suspend(aio_list, 1, nullptr) == 0);
     auto rsize = aio_return(&cb);
-    if (rsize <= 0)
+    uint8_t* chunk = reinterpret_cast<uint8_t*>(const_cast<void*>(cb.aio_buf));
+    if (rsize <= 0) {
+      tp->CommitChunk(chunk, 0);  // Just gives the chunk back.
       break;
-    file_size += static_cast<uint64_t>(rsize);
+    }
+    *file_size += static_cast<uint64_t>(rsize);
 
-    // Take ownership of the completed buffer and enqueue a new async read
-    // with a fresh buffer.
-    std::unique_ptr<uint8_t[]> buf(
-        reinterpret_cast<uint8_t*>(const_cast<void*>(cb.aio_buf)));
-    cb.aio_buf = new uint8_t[kChunkSize];
+    // Enqueue a new async read into a fresh chunk.
+    cb.aio_buf = tp->GetWritableChunk(kChunkSize);
     cb.aio_offset += rsize;
     PERFETTO_CHECK(aio_read(&cb) == 0);
 
-    // Parse the completed buffer while the async read is in-flight.
-    tp.Parse(std::move(buf), static_cast<size_t>(rsize));
+    // Parse the completed chunk while the async read is in-flight.
+    tp->CommitChunk(chunk, static_cast<size_t>(rsize));
+  }
+}
+
+// Maps (or, if that's not possible, reads) the whole file in memory.
+TraceBlobView MapWholeFile(int fd) {
+  struct stat stat_buf {};
+  PERFETTO_CHECK(fstat(fd, &stat_buf) == 0);
+  if (S_ISREG(stat_buf.st_mode) && stat_buf.st_size > 0) {
+    const size_t size = static_cast<size_t>(stat_buf.st_size);
+    void* addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr != MAP_FAILED) {
+      madvise(addr, size, MADV_SEQUENTIAL);
+      return TraceBlobView(static_cast<const uint8_t*>(addr), size,
+                           [addr, size] { munmap(addr, size); });
+    }
+  }
+
+  // Read straight into a buffer which is handed over to the TraceBlobView.
+  // For regular files it has room for the whole file (and one more byte, to
+  // hit the end of file without growing it), otherwise it's grown with
+  // realloc(), which can usually remap large buffers rather than copy them.
+  size_t capacity = 1024 * 1024;
+  if (S_ISREG(stat_buf.st_mode))
+    capacity = std::max(capacity, static_cast<size_t>(stat_buf.st_size) + 1);
+  size_t size = 0;
+  auto* data = static_cast<uint8_t*>(malloc(capacity));
+  PERFETTO_CHECK(data);
+  for (;;) {
+    if (size == capacity) {
+      capacity *= 2;
+      data = static_cast<uint8_t*>(realloc(data, capacity));
+      PERFETTO_CHECK(data);
+    }
+    ssize_t rsize = read(fd, data + size, capacity - size);
+    if (rsize <= 0)
+      break;
+    size += static_cast<size_t>(rsize);
+  }
+  return TraceBlobView(data, size, [data] { free(data); });
+}
+
+// Returns true if the file starts with the magic of a trace processor
+// snapshot. Doesn't move the file offset.
+bool IsSnapshot(int fd) {
+  char magic[sizeof(StorageSnapshot::kMagic)];
+  return pread(fd, magic, sizeof(magic), 0) ==
+             static_cast<ssize_t>(sizeof(magic)) &&
+         memcmp(magic, StorageSnapshot::kMagic, sizeof(magic)) == 0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    PERFETTO_ELOG(
+        "Usage: %s [-d] [-b] [-j threads] [-s snapshot_out] "
+        "[-w start_ns end_ns] [-r socket_name] "
+        "[-q query_file [-f csv|binary]] "
+        "trace_file.proto [more_trace_files.proto...]",
+        argv[0]);
+    return 1;
+  }
+  std::vector<const char*> trace_file_paths;
+  uint32_t ingestion_threads = 0;
+  const char* snapshot_path = nullptr;
+  bool load_in_background = false;
+  LoadWindow load_window;
+  const char* rpc_socket_name = nullptr;
+  const char* query_file = nullptr;
+  OutputFormat output_format = OutputFormat::kCsv;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-d") == 0) {
+      EnableSQLiteVtableDebugging();
+      continue;
+    }
+    if (strcmp(argv[i], "-b") == 0) {
+      load_in_background = true;
+      continue;
+    }
+    if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      ingestion_threads = static_cast<uint32_t>(atoi(argv[++i]));
+      continue;
+    }
+    if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      snapshot_path = argv[++i];
+      continue;
+    }
+    if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+      rpc_socket_name = argv[++i];
+      continue;
+    }
+    if (strcmp(argv[i], "-q") == 0 && i + 1 < argc) {
+      query_file = argv[++i];
+      continue;
+    }
+    if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+      const char* format = argv[++i];
+      if (strcmp(format, "csv") == 0) {
+        output_format = OutputFormat::kCsv;
+      } else if (strcmp(format, "binary") == 0) {
+        output_format = OutputFormat::kBinary;
+      } else {
+        PERFETTO_ELOG("Unknown output format %s", format);
+        return 1;
+      }
+      continue;
+    }
+    if (strcmp(argv[i], "-w") == 0 && i + 2 < argc) {
+      load_window.start_ts = strtoull(argv[++i], nullptr, 10);
+      load_window.end_ts = strtoull(argv[++i], nullptr, 10);
+      continue;
+    }
+    trace_file_paths.push_back(argv[i]);
+  }
+  if (trace_file_paths.empty()) {
+    PERFETTO_ELOG("No trace file given");
+    return 1;
+  }
+  if (query_file && rpc_socket_name) {
+    PERFETTO_ELOG("-q and -r can't be used together");
+    return 1;
+  }
+
+  // Load the trace file into the trace processor.
+  TraceProcessor::Config config;
+  config.optimization_mode = OptimizationMode::kMaxBandwidth;
+  config.ingestion_threads = ingestion_threads;
+  config.load_window = load_window;
+  TraceProcessor tp(config);
+  std::vector<base::ScopedFile> fds;
+  for (const char* path : trace_file_paths) {
+    fds.emplace_back(open(path, O_RDONLY));
+    PERFETTO_CHECK(fds.back());
+  }
+
+  // Several files are loaded at once and merged into a single trace.
+  auto load_trace = [&tp, &fds, snapshot_path]() -> bool {
+    uint64_t file_size = 0;
+    auto t_load_start = base::GetWallTimeMs();
+    bool parsed = true;
+    if (fds.size() == 1 && IsSnapshot(*fds[0])) {
+      // Passed in one piece, so that the reader decodes all the sections in
+      // place instead of gathering those spanning several slices.
+      TraceBlobView snapshot = MapWholeFile(*fds[0]);
+      file_size = snapshot.length();
+      parsed = tp.Parse(std::move(snapshot));
+    } else if (fds.size() == 1) {
+      if (!LoadTraceMmap(&tp, *fds[0], &file_size))
+        LoadTraceAio(&tp, *fds[0], &file_size);
+    } else {
+      std::vector<TraceBlobView> traces;
+      for (const auto& fd : fds) {
+        traces.emplace_back(MapWholeFile(*fd));
+        file_size += traces.back().length();
+      }
+      parsed = tp.ParseTracesInParallel(std::move(traces));
+    }
+    tp.NotifyEndOfFile();
+    if (!parsed) {
+      PERFETTO_ELOG("Failed to parse the trace");
+      return false;
+    }
+    double t_load = (base::GetWallTimeMs() - t_load_start).count() / 1E3;
+    double size_mb = file_size / 1E6;
+    PERFETTO_ILOG("Trace loaded: %.2f MB (%.1f MB/s)", size_mb,
+                  size_mb / t_load);
+    tp.PrintMemoryUsage();
+
+    if (snapshot_path) {
+      base::ScopedFile snapshot_fd(
+          open(snapshot_path, O_WRONLY | O_CREAT | O_TRUNC, 0644));
+      if (!snapshot_fd || !tp.SaveSnapshot(*snapshot_fd)) {
+        PERFETTO_ELOG("Failed to write snapshot to %s", snapshot_path);
+        return false;
+      }
+      PERFETTO_ILOG("Snapshot written to %s", snapshot_path);
+    }
+    return true;
+  };
+
+  // With -b the prompt is shown straight away and queries run on the part of
+  // the trace loaded so far. Batch queries (-q) always run on the whole trace.
+  // The loader sets |loaded| before exiting: read it only after joining it.
+  std::thread loader;
+  bool loaded = true;
+  if (load_in_background && !query_file) {
+    loader = std::thread([&load_trace, &loaded] { loaded = load_trace(); });
+  } else if (!load_trace()) {
+    return 1;
   }
-  tp.NotifyEndOfFile();
-  double t_load = (base::GetWallTimeMs() - t_load_start).count() / 1E3;
-  double size_mb = file_size / 1E6;
-  PERFETTO_ILOG("Trace loaded: %.2f MB (%.1f MB/s)", size_mb, size_mb / t_load);
   g_tp = &tp;
 
+  // The loader can't be interrupted: every return below waits for it, as
+  // destroying a joinable std::thread terminates the process.
+  auto join_loader = [&loader] {
+    if (loader.joinable())
+      loader.join();
+  };
+
+  // With -r the queries come from the clients of the IPC socket rather than
+  // from the console. Combined with -b, they can be issued while loading.
+  if (rpc_socket_name) {
+    base::UnixTaskRunner task_runner;
+    std::unique_ptr<ipc::Host> host =
+        ipc::Host::CreateInstance(rpc_socket_name, &task_runner);
+    if (!host) {
+      PERFETTO_ELOG("Failed to listen on %s", rpc_socket_name);
+      join_loader();
+      return 1;
+    }
+    host->ExposeService(std::unique_ptr<ipc::Service>(
+        new TraceProcessorIPCService(&tp, &task_runner)));
+    PERFETTO_ILOG("Serving queries on %s", rpc_socket_name);
+    task_runner.Run();
+    join_loader();
+    return loaded ? 0 : 1;
+  }
+
 #if PERFETTO_HAS_SIGNAL_H()
   signal(SIGINT, [](int) { g_tp->InterruptQuery(); });
 #endif
 
+  // With -q the queries of the file are run and the shell exits, writing
+  // nothing but their results to stdout.
+  if (query_file)
+    return RunQueriesInBatch(query_file, output_format) ? 0 : 1;
+
   for (;;) {
     PrintPrompt();
     char line[1024];
     if (!fgets(line, sizeof(line) - 1, stdin) || strcmp(line, "q\n") == 0)
-      return 0;
+      break;
     if (strcmp(line, "\n") == 0)
       continue;
-    protos::RawQueryArgs query;
-    query.set_sql_query(line);
-    base::TimeNanos t_start = base::GetWallTimeNs();
-    g_tp->ExecuteQuery(query, [t_start](const protos::RawQueryResult& res) {
-      OnQueryResult(t_start, res);
-    });
+    RunQuery(line);
   }
+
+  join_loader();
+  return loaded ? 0 : 1;
 }
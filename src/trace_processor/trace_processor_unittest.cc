@@ -0,0 +1,368 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/trace_processor.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <thread>
+
+#include "gtest/gtest.h"
+#include "src/trace_processor/synthetic_trace.h"
+
+#include "perfetto/trace_processor/raw_query.pb.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+// Returns a query yielding the integers [0, |n|) in column "x".
+protos::RawQueryArgs CountQuery(int n, uint32_t batch_size) {
+  protos::RawQueryArgs args;
+  args.set_sql_query(
+      "WITH RECURSIVE cnt(x) AS (SELECT 0 UNION ALL SELECT x + 1 FROM cnt "
+      "WHERE x + 1 < " +
+      std::to_string(n) + ") SELECT x FROM cnt");
+  args.set_batch_size(batch_size);
+  return args;
+}
+
+// Returns the rows of a query on integer columns.
+std::vector<std::vector<int64_t>> QueryRows(TraceProcessor* tp,
+                                            const std::string& sql) {
+  protos::RawQueryArgs args;
+  args.set_sql_query(sql);
+  std::vector<std::vector<int64_t>> rows;
+  tp->ExecuteQuery(args, [&rows](const protos::RawQueryResult& res) {
+    EXPECT_FALSE(res.has_error()) << res.error();
+    rows.resize(res.num_records());
+    for (const auto& column : res.columns()) {
+      for (size_t r = 0; r < rows.size(); r++)
+        rows[r].push_back(column.long_values(static_cast<int>(r)));
+    }
+  });
+  return rows;
+}
+
+void LoadTrace(TraceProcessor* tp, const std::string& trace) {
+  std::unique_ptr<uint8_t[]> buf(new uint8_t[trace.size()]);
+  memcpy(buf.get(), trace.data(), trace.size());
+  ASSERT_TRUE(tp->Parse(std::move(buf), trace.size()));
+  tp->NotifyEndOfFile();
+}
+
+TEST(TraceProcessorTest, StreamingQueryBatches) {
+  TraceProcessor tp{TraceProcessor::Config()};
+  std::vector<uint64_t> batch_sizes;
+  int64_t expected = 0;
+  tp.ExecuteStreamingQuery(
+      CountQuery(2500, 1000), [&](const protos::RawQueryResult& res) {
+        EXPECT_FALSE(res.has_error());
+        EXPECT_EQ(res.column_descriptors_size(), 1);
+        EXPECT_EQ(res.column_descriptors(0).name(), "x");
+        EXPECT_EQ(res.columns(0).long_values_size(),
+                  static_cast<int>(res.num_records()));
+        for (int64_t value : res.columns(0).long_values())
+          EXPECT_EQ(value, expected++);
+        batch_sizes.push_back(res.num_records());
+        EXPECT_EQ(res.is_last_batch(), batch_sizes.size() == 3);
+        return true;
+      });
+  ASSERT_EQ(batch_sizes, std::vector<uint64_t>({1000, 1000, 500}));
+  ASSERT_EQ(expected, 2500);
+}
+
+TEST(TraceProcessorTest, StreamingQueryStop) {
+  TraceProcessor tp{TraceProcessor::Config()};
+  int batches = 0;
+  tp.ExecuteStreamingQuery(CountQuery(1000, 10),
+                           [&batches](const protos::RawQueryResult& res) {
+                             EXPECT_FALSE(res.is_last_batch());
+                             return ++batches < 2;
+                           });
+  ASSERT_EQ(batches, 2);
+}
+
+TEST(TraceProcessorTest, StreamingQueryError) {
+  TraceProcessor tp{TraceProcessor::Config()};
+  protos::RawQueryArgs args;
+  args.set_sql_query("SELECT * FROM no_such_table");
+  int batches = 0;
+  tp.ExecuteStreamingQuery(args, [&batches](const protos::RawQueryResult& res) {
+    EXPECT_TRUE(res.has_error());
+    EXPECT_TRUE(res.is_last_batch());
+    batches++;
+    return true;
+  });
+  ASSERT_EQ(batches, 1);
+}
+
+TEST(TraceProcessorTest, NonStreamingQueryIsSingleBatch) {
+  TraceProcessor tp{TraceProcessor::Config()};
+  int calls = 0;
+  tp.ExecuteQuery(CountQuery(5000, 10),
+                  [&calls](const protos::RawQueryResult& res) {
+                    EXPECT_EQ(res.num_records(), 5000u);
+                    calls++;
+                  });
+  ASSERT_EQ(calls, 1);
+}
+
+TEST(TraceProcessorTest, EmptyResultHasColumns) {
+  TraceProcessor tp{TraceProcessor::Config()};
+  protos::RawQueryArgs args;
+  args.set_sql_query("SELECT ts, name, 1.5 AS x FROM slices");
+  int batches = 0;
+  tp.ExecuteStreamingQuery(args, [&batches](const protos::RawQueryResult& res) {
+    EXPECT_FALSE(res.has_error());
+    EXPECT_TRUE(res.is_last_batch());
+    EXPECT_EQ(res.num_records(), 0u);
+    EXPECT_EQ(res.columns_size(), 3);
+    EXPECT_EQ(res.column_descriptors_size(), 3);
+    if (res.column_descriptors_size() == 3) {
+      EXPECT_EQ(res.column_descriptors(0).name(), "ts");
+      EXPECT_EQ(res.column_descriptors(0).type(),
+                protos::RawQueryResult_ColumnDesc_Type_LONG);
+      EXPECT_EQ(res.column_descriptors(1).name(), "name");
+      EXPECT_EQ(res.column_descriptors(1).type(),
+                protos::RawQueryResult_ColumnDesc_Type_STRING);
+      // Expressions have no declared type.
+      EXPECT_EQ(res.column_descriptors(2).name(), "x");
+      EXPECT_EQ(res.column_descriptors(2).type(),
+                protos::RawQueryResult_ColumnDesc_Type_LONG);
+    }
+    batches++;
+    return true;
+  });
+  ASSERT_EQ(batches, 1);
+}
+
+TEST(TraceProcessorTest, NullValues) {
+  SyntheticTraceConfig trace_config;
+  trace_config.num_events = 2000;
+  trace_config.num_cpus = 2;
+  TraceProcessor tp{TraceProcessor::Config()};
+  LoadTrace(&tp, GenerateSyntheticProtoTrace(trace_config));
+  auto counts = QueryRows(
+      &tp, "SELECT COUNT(*), COUNT(cpu), SUM(cpu) FROM thread_state");
+  ASSERT_EQ(counts.size(), 1u);
+  ASSERT_GT(counts[0][1], 0);
+  ASSERT_LT(counts[0][1], counts[0][0]);
+
+  // The first rows are not running, and so have no cpu: the type of the
+  // column is its declared one, and the NULLs are flagged in each batch.
+  protos::RawQueryArgs args;
+  args.set_sql_query(
+      "SELECT cpu FROM thread_state ORDER BY cpu IS NOT NULL, utid, ts");
+  args.set_batch_size(100);
+  int64_t rows = 0;
+  int64_t nulls = 0;
+  int64_t cpu_sum = 0;
+  tp.ExecuteStreamingQuery(args, [&](const protos::RawQueryResult& res) {
+    EXPECT_FALSE(res.has_error()) << res.error();
+    EXPECT_EQ(res.column_descriptors(0).type(),
+              protos::RawQueryResult_ColumnDesc_Type_LONG);
+    const auto& column = res.columns(0);
+    EXPECT_EQ(column.long_values_size(), static_cast<int>(res.num_records()));
+    if (column.is_nulls_size() > 0) {
+      EXPECT_EQ(column.is_nulls_size(), static_cast<int>(res.num_records()));
+    }
+    for (int r = 0; r < static_cast<int>(res.num_records()); r++) {
+      bool is_null = column.is_nulls_size() > 0 && column.is_nulls(r);
+      if (rows == 0) {
+        EXPECT_TRUE(is_null);
+      }
+      nulls += is_null;
+      cpu_sum += is_null ? 0 : column.long_values(r);
+      rows++;
+    }
+    return true;
+  });
+  ASSERT_EQ(rows, counts[0][0]);
+  ASSERT_EQ(rows - nulls, counts[0][1]);
+  ASSERT_EQ(cpu_sum, counts[0][2]);
+}
+
+TEST(TraceProcessorTest, WritableChunks) {
+  TraceProcessor tp{TraceProcessor::Config()};
+  std::string trace = "{\"traceEvents\":[";
+  for (int i = 0; i < 100; i++) {
+    trace += (i ? "," : "");
+    trace += "{\"ph\":\"X\",\"cat\":\"c\",\"name\":\"s\",\"pid\":1,";
+    trace += "\"tid\":1,\"ts\":" + std::to_string(i * 10) + ",\"dur\":1}";
+  }
+  trace += "]}";
+
+  // Each chunk is recycled for the next one once parsed.
+  const size_t kChunkSize = 100;
+  uint8_t* first_chunk = nullptr;
+  for (size_t off = 0; off < trace.size(); off += kChunkSize) {
+    size_t size = std::min(kChunkSize, trace.size() - off);
+    uint8_t* chunk = tp.GetWritableChunk(kChunkSize);
+    if (!first_chunk)
+      first_chunk = chunk;
+    ASSERT_EQ(chunk, first_chunk);
+    memcpy(chunk, trace.data() + off, size);
+    ASSERT_TRUE(tp.CommitChunk(chunk, size));
+  }
+  tp.NotifyEndOfFile();
+
+  protos::RawQueryArgs args;
+  args.set_sql_query("SELECT COUNT(*) FROM slices");
+  tp.ExecuteQuery(args, [](const protos::RawQueryResult& res) {
+    ASSERT_EQ(res.columns(0).long_values(0), 100);
+  });
+}
+
+TEST(TraceProcessorTest, QueryWhileParsing) {
+  TraceProcessor tp{TraceProcessor::Config()};
+  const int kSlices = 20000;
+  std::thread parser([&tp] {
+    std::string trace = "{\"traceEvents\":[";
+    for (int i = 0; i < kSlices; i++) {
+      trace += (i ? "," : "");
+      trace += "{\"ph\":\"X\",\"cat\":\"c\",\"name\":\"s\",\"pid\":1,";
+      trace += "\"tid\":1,\"ts\":" + std::to_string(i * 10) + ",\"dur\":1}";
+    }
+    trace += "]}";
+    const size_t kChunkSize = 1024;
+    for (size_t off = 0; off < trace.size(); off += kChunkSize) {
+      size_t size = std::min(kChunkSize, trace.size() - off);
+      std::unique_ptr<uint8_t[]> chunk(new uint8_t[size]);
+      memcpy(chunk.get(), trace.data() + off, size);
+      tp.Parse(std::move(chunk), size);
+    }
+    tp.NotifyEndOfFile();
+  });
+
+  // Each query sees a consistent snapshot, which only grows over time.
+  protos::RawQueryArgs args;
+  args.set_sql_query(
+      "SELECT (SELECT COUNT(*) FROM slices), (SELECT COUNT(*) FROM slices)");
+  int64_t last_count = 0;
+  while (last_count < kSlices) {
+    tp.ExecuteQuery(args, [&last_count](const protos::RawQueryResult& res) {
+      ASSERT_FALSE(res.has_error());
+      int64_t count = res.columns(0).long_values(0);
+      ASSERT_EQ(res.columns(1).long_values(0), count);
+      ASSERT_GE(count, last_count);
+      last_count = count;
+    });
+    if (HasFatalFailure())
+      break;
+  }
+  parser.join();
+  ASSERT_EQ(last_count, kSlices);
+}
+
+TEST(TraceProcessorTest, LoadWindow) {
+  SyntheticTraceConfig trace_config;
+  trace_config.num_events = 20000;
+  trace_config.num_cpus = 4;
+  std::string trace = GenerateSyntheticProtoTrace(trace_config);
+
+  TraceProcessor full_tp{TraceProcessor::Config()};
+  LoadTrace(&full_tp, trace);
+  auto bounds = QueryRows(&full_tp, "SELECT MIN(ts), MAX(ts) FROM sched");
+  ASSERT_EQ(bounds.size(), 1u);
+  const int64_t kStart = bounds[0][0];
+  const int64_t kLength = bounds[0][1] - kStart;
+
+  TraceProcessor::Config config;
+  config.load_window.start_ts = static_cast<uint64_t>(kStart + kLength / 3);
+  config.load_window.end_ts = static_cast<uint64_t>(kStart + kLength * 2 / 3);
+  config.load_window.margin_ns = static_cast<uint64_t>(kLength / 10);
+  TraceProcessor window_tp(config);
+  LoadTrace(&window_tp, trace);
+
+  // The slices and frequencies in the window are the same as in the whole
+  // trace, including their durations.
+  const std::string kWhere =
+      " WHERE ts >= " + std::to_string(config.load_window.start_ts) +
+      " AND ts <= " + std::to_string(config.load_window.end_ts);
+  for (const char* query :
+       {"SELECT ts, cpu, dur FROM sched", "SELECT ts, ref, value, dur "
+                                          "FROM counters"}) {
+    auto expected = QueryRows(&full_tp, query + kWhere + " ORDER BY 1, 2");
+    ASSERT_GT(expected.size(), 100u);
+    ASSERT_EQ(QueryRows(&window_tp, query + kWhere + " ORDER BY 1, 2"),
+              expected);
+  }
+
+  // Nothing beyond the margin is loaded.
+  auto loaded = QueryRows(&window_tp, "SELECT MIN(ts), MAX(ts) FROM sched");
+  ASSERT_GE(static_cast<uint64_t>(loaded[0][0]),
+            config.load_window.start_ts - config.load_window.margin_ns);
+  ASSERT_LE(static_cast<uint64_t>(loaded[0][1]),
+            config.load_window.end_ts + config.load_window.margin_ns);
+}
+
+TEST(TraceProcessorTest, ParseTracesInParallel) {
+  std::vector<std::string> traces;
+  std::string concatenated;
+  for (uint32_t i = 0; i < 3; i++) {
+    SyntheticTraceConfig trace_config;
+    trace_config.seed = i + 1;
+    trace_config.num_events = 5000;
+    trace_config.num_cpus = 2 + i;
+    traces.push_back(GenerateSyntheticProtoTrace(trace_config));
+    concatenated += traces.back();
+  }
+
+  // A concatenation of proto traces is a valid trace, sorted as a whole.
+  TraceProcessor sequential_tp{TraceProcessor::Config()};
+  LoadTrace(&sequential_tp, concatenated);
+
+  TraceProcessor parallel_tp{TraceProcessor::Config()};
+  std::vector<TraceBlobView> blobs;
+  for (const std::string& trace : traces) {
+    std::unique_ptr<uint8_t[]> buf(new uint8_t[trace.size()]);
+    memcpy(buf.get(), trace.data(), trace.size());
+    blobs.emplace_back(std::move(buf), 0, trace.size());
+  }
+  ASSERT_TRUE(parallel_tp.ParseTracesInParallel(std::move(blobs)));
+  parallel_tp.NotifyEndOfFile();
+
+  // Only the timestamps of the non-ftrace packets differ, hence the threads
+  // the slices belong to are not compared.
+  for (const char* query : {"SELECT ts, cpu, dur FROM sched ORDER BY 1, 2",
+                            "SELECT ts, ref, value, dur FROM counters "
+                            "ORDER BY 1, 2, 3"}) {
+    auto expected = QueryRows(&sequential_tp, query);
+    ASSERT_GT(expected.size(), 1000u);
+    ASSERT_EQ(QueryRows(&parallel_tp, query), expected);
+  }
+}
+
+TEST(TraceProcessorTest, ParseTracesInParallelTruncated) {
+  SyntheticTraceConfig trace_config;
+  trace_config.num_events = 1000;
+  std::string trace = GenerateSyntheticProtoTrace(trace_config);
+  const size_t size = trace.size() - 10;
+  std::unique_ptr<uint8_t[]> buf(new uint8_t[size]);
+  memcpy(buf.get(), trace.data(), size);
+  std::vector<TraceBlobView> blobs;
+  blobs.emplace_back(std::move(buf), 0, size);
+
+  TraceProcessor tp{TraceProcessor::Config()};
+  ASSERT_FALSE(tp.ParseTracesInParallel(std::move(blobs)));
+  ASSERT_GT(QueryRows(&tp, "SELECT COUNT(*) FROM sched")[0][0], 100);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -25,6 +25,9 @@ namespace trace_processor {
 
 // static
 constexpr uint32_t TraceSorter::TimestampedTracePiece::kNoCpu;
+constexpr size_t TraceSorter::kPacketQueueIdx;
+constexpr size_t TraceSorter::kFirstCpuQueueIdx;
+constexpr uint32_t TraceSorter::kMaxBandwidthFlushBatch;
 
 TraceSorter::TraceSorter(TraceProcessorContext* context,
                          OptimizationMode optimization,
@@ -33,57 +36,89 @@ TraceSorter::TraceSorter(TraceProcessorContext* context,
       optimization_(optimization),
       window_size_ns_(window_size_ns) {}
 
-void TraceSorter::SortAndFlushEventsBeyondWindow(uint64_t window_size_ns) {
-  // First check if any sorting is needed.
-  if (sort_start_idx_ > 0) {
-    PERFETTO_DCHECK(sort_start_idx_ < events_.size());
-    PERFETTO_DCHECK(sort_min_ts_ > 0 && sort_min_ts_ < latest_timestamp_);
-
-    // We know that all events between [0, sort_start_idx_] are sorted. Witin
-    // this range, perform a bound search and find the iterator for the min
-    // timestamp that broke the monotonicity. Re-sort from there to the end.
-    auto sorted_end = events_.begin() + static_cast<ssize_t>(sort_start_idx_);
-    PERFETTO_DCHECK(std::is_sorted(events_.begin(), sorted_end));
-    auto sort_from = std::lower_bound(events_.begin(), sorted_end, sort_min_ts_,
-                                      &TimestampedTracePiece::Compare);
-    std::sort(sort_from, events_.end());
-    sort_start_idx_ = 0;
-    sort_min_ts_ = 0;
-  }
+void TraceSorter::Queue::Sort() {
+  if (!needs_sorting_)
+    return;
 
-  // At this point |events_| musr be fully sorted.
+  PERFETTO_DCHECK(sort_start_idx_ < events_.size());
+  PERFETTO_DCHECK(sort_min_ts_ < max_ts_);
+
+  // We know that all events between [0, sort_start_idx_) are sorted. Witin
+  // this range, perform a bound search and find the iterator for the min
+  // timestamp that broke the monotonicity. Re-sort from there to the end.
+  auto sorted_end = events_.begin() + static_cast<ssize_t>(sort_start_idx_);
+  PERFETTO_DCHECK(std::is_sorted(events_.begin(), sorted_end));
+  auto sort_from = std::lower_bound(events_.begin(), sorted_end, sort_min_ts_,
+                                    &TimestampedTracePiece::Compare);
+  std::stable_sort(sort_from, events_.end());
+  needs_sorting_ = false;
+  sort_start_idx_ = 0;
+  sort_min_ts_ = 0;
+
+  // At this point |events_| must be fully sorted.
   PERFETTO_DCHECK(std::is_sorted(events_.begin(), events_.end()));
+}
+
+void TraceSorter::SortAndFlushEventsBeyondWindow(uint64_t window_size_ns) {
+  events_since_flush_ = 0;
+
+  // First sort the queues that received out-of-order events, if any.
+  for (auto& queue : queues_)
+    queue.Sort();
 
   if (PERFETTO_UNLIKELY(latest_timestamp_ < window_size_ns))
     return;
 
-  // Now that all events are sorted, flush all events beyond the window, that is
-  // all events in [begin .. latest_timestamp - window_size_ns].
-  auto flush_end = std::lower_bound(events_.begin(), events_.end(),
-                                    1 + latest_timestamp_ - window_size_ns,
-                                    &TimestampedTracePiece::Compare);
+  // Flush all events beyond the window, that is all events in
+  // [begin .. latest_timestamp - window_size_ns], merging the queues.
+  const uint64_t flush_end_ts = latest_timestamp_ - window_size_ns;
+
+  // The heap is ordered by the timestamp of the first event of each queue,
+  // breaking ties using the queue index. As the std:: heap functions build
+  // max-heaps, the comparator is reversed.
+  auto heap_cmp = [this](size_t a, size_t b) {
+    uint64_t ts_a = queues_[a].front().timestamp;
+    uint64_t ts_b = queues_[b].front().timestamp;
+    return ts_a > ts_b || (ts_a == ts_b && a > b);
+  };
+
+  merge_heap_.clear();
+  for (size_t i = 0; i < queues_.size(); i++) {
+    if (!queues_[i].empty() && queues_[i].front().timestamp <= flush_end_ts)
+      merge_heap_.emplace_back(i);
+  }
+  std::make_heap(merge_heap_.begin(), merge_heap_.end(), heap_cmp);
 
   auto* next_stage = context_->proto_parser.get();
-  for (auto it = events_.begin(); it != flush_end; it++) {
-    PERFETTO_DCHECK(latest_timestamp_ - it->timestamp >= window_size_ns);
-    if (it->is_ftrace()) {
-      next_stage->ParseFtracePacket(it->cpu, it->timestamp,
-                                    std::move(it->blob_view));
+  while (!merge_heap_.empty()) {
+    std::pop_heap(merge_heap_.begin(), merge_heap_.end(), heap_cmp);
+    Queue& queue = queues_[merge_heap_.back()];
+    TimestampedTracePiece& ttp = queue.front();
+    PERFETTO_DCHECK(latest_timestamp_ - ttp.timestamp >= window_size_ns);
+    if (ttp.is_ftrace()) {
+      next_stage->ParseFtracePacket(ttp.cpu, ttp.timestamp,
+                                    std::move(ttp.blob_view),
+                                    ttp.ftrace_event);
     } else {
-      next_stage->ParseTracePacket(std::move(it->blob_view));
+      next_stage->ParseTracePacket(std::move(ttp.blob_view));
     }
-  }
+    queue.PopFront();
 
-  // Now erase-front all the expired events that have been pushed by the
-  // previous loop.
-  events_.erase(events_.begin(), flush_end);
+    if (!queue.empty() && queue.front().timestamp <= flush_end_ts) {
+      std::push_heap(merge_heap_.begin(), merge_heap_.end(), heap_cmp);
+    } else {
+      merge_heap_.pop_back();
+    }
+  }
 
-  if (events_.size() > 0) {
-    earliest_timestamp_ = events_.front().timestamp;
-    latest_timestamp_ = events_.back().timestamp;
-  } else {
-    earliest_timestamp_ = std::numeric_limits<uint64_t>::max();
-    latest_timestamp_ = 0;
+  earliest_timestamp_ = std::numeric_limits<uint64_t>::max();
+  latest_timestamp_ = 0;
+  for (const auto& queue : queues_) {
+    if (queue.empty())
+      continue;
+    const uint64_t front_ts = queue.front().timestamp;
+    earliest_timestamp_ = std::min(earliest_timestamp_, front_ts);
+    latest_timestamp_ = std::max(latest_timestamp_, queue.max_ts());
   }
 }
 
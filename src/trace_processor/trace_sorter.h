@@ -17,9 +17,12 @@
 #ifndef SRC_TRACE_PROCESSOR_TRACE_SORTER_H_
 #define SRC_TRACE_PROCESSOR_TRACE_SORTER_H_
 
+#include <deque>
+#include <limits>
 #include <vector>
 
 #include "src/trace_processor/basic_types.h"
+#include "src/trace_processor/decoded_ftrace_event.h"
 #include "src/trace_processor/trace_blob_view.h"
 #include "src/trace_processor/trace_processor_context.h"
 #include "src/trace_processor/trace_storage.h"
@@ -30,41 +33,38 @@ namespace trace_processor {
 // This class takes care of sorting events parsed from the trace stream in
 // arbitrary order and pushing them to the next pipeline stages (parsing) in
 // order. In order to support streaming use-cases, sorting happens within a
-// max window. Events are held in the TraceSorter staging area (events_) until
+// max window. Events are held in the TraceSorter staging area (queues_) until
 // either (1) the (max - min) timestamp > window_size; (2) trace EOF.
 //
 // Performance considerations:
-// This class is designed assuming that events are mostly ordered and lack of
-// ordering tends to happen towards the end of |events_|. In practice, in fact,
-// lack of ordering comes from the fact that the ftrace buffers from differnt
-// CPUs are independent and are flushed into the trace in blocks. So, when
-// taking a trace file, events that are near (w.r.t. file offset) are likely to
-// be out-of-order, but events that are ~10MB+ apart from each other are often
-// in-order.
+// Lack of ordering in a trace comes mostly from the fact that the ftrace
+// buffers from different CPUs are independent and are flushed into the trace
+// in blocks. Within a single CPU, instead, ftrace events are already ordered.
+// For this reason the staging area is split into one queue per source: one
+// for each CPU and one for all the non-ftrace packets. Each queue is, in the
+// common case, already sorted and events are just appended to it.
 //
 // Operation:
-// When a bunch of events is pushed they are just appeneded to the end of the
-// |events_| staging area. While appending, we keep track of the fact that the
-// staging area is ordered or not. When an out-of-order event is detected we
-// keep track of: (1) the offset within the staging area where the chaos begun,
-// (2) the timestamp that broke the ordering.
-// When we decide to flush events from the staging area into the next stages of
-// the trace processor, we re-sort the events in the staging area. Rather than
-// re-sorting everything all the times, we use the above knowledge to restrict
-// sorting to the (hopefully smaller) tail of the |events_| staging area.
-// At any time, the first partition of |events_| [0 .. sort_start_idx_) is
-// ordered, and the second partition [sort_start_idx_.. end] is not.
-// We use a logarithmic bound search operation to figure out what is the index
-// within the first partition where sorting should start, and sort all events
-// from there to the end.
+// When an event is pushed it is appended to the queue of its source. While
+// appending, each queue keeps track of whether it is still ordered. When an
+// out-of-order event is detected the queue keeps track of: (1) the offset
+// where the chaos begun, (2) the timestamp that broke the ordering. When
+// flushing, only those queues are re-sorted and, within them, only the tail
+// starting at the first event newer than (2) (found with a bound search).
+// Once all queues are sorted, the events beyond the window are moved to the
+// next stages of the trace processor via a k-way merge of the queues, using a
+// min-heap keyed by the timestamp of the head of each queue.
 
 class TraceSorter {
  public:
   struct TimestampedTracePiece {
     static constexpr uint32_t kNoCpu = std::numeric_limits<uint32_t>::max();
 
-    TimestampedTracePiece(uint64_t a, TraceBlobView b, uint32_t c)
-        : timestamp(a), blob_view(std::move(b)), cpu(c) {}
+    TimestampedTracePiece(uint64_t a,
+                          TraceBlobView b,
+                          uint32_t c,
+                          const DecodedFtraceEvent& e = DecodedFtraceEvent())
+        : timestamp(a), blob_view(std::move(b)), cpu(c), ftrace_event(e) {}
 
     TimestampedTracePiece(TimestampedTracePiece&&) noexcept = default;
     TimestampedTracePiece& operator=(TimestampedTracePiece&&) = default;
@@ -84,6 +84,7 @@ class TraceSorter {
     uint64_t timestamp;
     TraceBlobView blob_view;
     uint32_t cpu;
+    DecodedFtraceEvent ftrace_event;  // Only for ftrace events.
   };
 
   TraceSorter(TraceProcessorContext*,
@@ -91,15 +92,23 @@ class TraceSorter {
               uint64_t window_size_ns);
 
   inline void PushTracePacket(uint64_t timestamp, TraceBlobView packet) {
-    AppendAndMaybeFlushEvents(TimestampedTracePiece(
-        timestamp, std::move(packet), TimestampedTracePiece::kNoCpu));
+    AppendAndMaybeFlushEvents(
+        kPacketQueueIdx,
+        TimestampedTracePiece(timestamp, std::move(packet),
+                              TimestampedTracePiece::kNoCpu));
   }
 
-  inline void PushFtracePacket(uint32_t cpu,
-                               uint64_t timestamp,
-                               TraceBlobView packet) {
+  // |event| is the payload of the FtraceEvent in |packet|, as decoded by the
+  // tokenizer.
+  inline void PushFtracePacket(
+      uint32_t cpu,
+      uint64_t timestamp,
+      TraceBlobView packet,
+      const DecodedFtraceEvent& event = DecodedFtraceEvent()) {
+    PERFETTO_DCHECK(cpu < base::kMaxCpus);
     AppendAndMaybeFlushEvents(
-        TimestampedTracePiece(timestamp, std::move(packet), cpu));
+        kFirstCpuQueueIdx + cpu,
+        TimestampedTracePiece(timestamp, std::move(packet), cpu, event));
   }
 
   // This method passes any events older than window_size_ns to the
@@ -116,55 +125,113 @@ class TraceSorter {
   }
 
  private:
-  inline void AppendAndMaybeFlushEvents(TimestampedTracePiece ttp) {
-    const uint64_t timestamp = ttp.timestamp;
-    events_.emplace_back(std::move(ttp));
-    earliest_timestamp_ = std::min(earliest_timestamp_, timestamp);
-
-    // Events are often seen in order.
-    if (PERFETTO_LIKELY(timestamp >= latest_timestamp_)) {
-      latest_timestamp_ = timestamp;
-    } else {
-      // The event is breaking ordering. The first time it happens, keep
-      // track of which index we are at. We know that everything before that
-      // is sorted (because events were pushed monotonically). Everything after
-      // that index, instead, will need a sorting pass before moving events to
-      // the next pipeline stage.
-      if (PERFETTO_UNLIKELY(sort_start_idx_ == 0)) {
-        PERFETTO_DCHECK(events_.size() >= 2);
-        sort_start_idx_ = events_.size() - 1;
-        sort_min_ts_ = timestamp;
+  // Non-ftrace packets go in the first queue, ftrace events for cpu N in the
+  // queue N + 1. When two events have the same timestamp, the one in the queue
+  // with the lowest index is passed to the next stage first.
+  static constexpr size_t kPacketQueueIdx = 0;
+  static constexpr size_t kFirstCpuQueueIdx = 1;
+
+  // When optimizing for bandwidth, the k-way merge is started only once this
+  // many events have been pushed since the last flush, to amortize the cost
+  // of sorting queues and setting up the heap.
+  static constexpr uint32_t kMaxBandwidthFlushBatch = 4096;
+
+  // Staging area for the events of a single source (a CPU or the non-ftrace
+  // packets). Events are mostly appended in order; see the comment at the top
+  // for how out-of-order events are handled.
+  class Queue {
+   public:
+    Queue() = default;
+    Queue(Queue&&) noexcept = default;  // For std::vector::resize().
+    Queue& operator=(Queue&&) = default;
+
+    inline void Append(TimestampedTracePiece ttp) {
+      const uint64_t timestamp = ttp.timestamp;
+      events_.emplace_back(std::move(ttp));
+
+      // Events are often seen in order.
+      if (PERFETTO_LIKELY(timestamp >= max_ts_)) {
+        max_ts_ = timestamp;
       } else {
-        sort_min_ts_ = std::min(sort_min_ts_, timestamp);
+        // The event is breaking ordering. The first time it happens, keep
+        // track of which index we are at. We know that everything before that
+        // is sorted (because events were pushed monotonically). Everything
+        // after that index, instead, will need a sorting pass before moving
+        // events to the next pipeline stage.
+        if (PERFETTO_UNLIKELY(!needs_sorting_)) {
+          PERFETTO_DCHECK(events_.size() >= 2);
+          needs_sorting_ = true;
+          sort_start_idx_ = events_.size() - 1;
+          sort_min_ts_ = timestamp;
+        } else {
+          sort_min_ts_ = std::min(sort_min_ts_, timestamp);
+        }
       }
     }
 
+    // Re-establishes the ordering of |events_| if any out-of-order event was
+    // appended since the last call.
+    void Sort();
+
+    inline void PopFront() {
+      events_.pop_front();
+      if (events_.empty())
+        max_ts_ = 0;
+    }
+
+    bool empty() const { return events_.empty(); }
+    TimestampedTracePiece& front() { return events_.front(); }
+    const TimestampedTracePiece& front() const { return events_.front(); }
+
+    // max(e.timestamp for e in events_), 0 if empty.
+    uint64_t max_ts() const { return max_ts_; }
+
+   private:
+    // Events are consumed one at a time from the front during the merge,
+    // hence a deque rather than a vector.
+    std::deque<TimestampedTracePiece> events_;
+    uint64_t max_ts_ = 0;
+
+    // True if |events_| contains out-of-order events past |sort_start_idx_|.
+    bool needs_sorting_ = false;
+
+    // Contains the index (< events_.size()) of the first out-of-order event.
+    // In essence, events_[0..sort_start_idx_) are guaranteed to be in-order,
+    // while events_[sort_start_idx_..end] are in random order.
+    size_t sort_start_idx_ = 0;
+
+    // The smallest timestamp that breaks the ordering in the range
+    // events_[0..sort_start_idx_). In order to re-establish a total order
+    // within |events_| we need to sort entries from (the index corresponding
+    // to) that timestamp.
+    uint64_t sort_min_ts_ = 0;
+  };
+
+  inline void AppendAndMaybeFlushEvents(size_t queue_idx,
+                                        TimestampedTracePiece ttp) {
+    if (PERFETTO_UNLIKELY(queue_idx >= queues_.size()))
+      queues_.resize(queue_idx + 1);
+
+    const uint64_t timestamp = ttp.timestamp;
+    queues_[queue_idx].Append(std::move(ttp));
+    earliest_timestamp_ = std::min(earliest_timestamp_, timestamp);
+    latest_timestamp_ = std::max(latest_timestamp_, timestamp);
+    events_since_flush_++;
+
     PERFETTO_DCHECK(earliest_timestamp_ <= latest_timestamp_);
 
     if (latest_timestamp_ - earliest_timestamp_ < window_size_ns_)
       return;
 
-    // If we are optimizing for high-bandwidth, wait before we accumulate a
-    // bunch of events before processing them. There are two cpu-intensive
-    // things happening here: (1) Sorting the tail of |events_|; (2) Erasing the
-    // head of |events_| and shifting them left. Both operations become way
-    // faster if done in large batches (~1M events), where we end up erasing
-    // 90% or more of |events_| and the erase-front becomes mainly a memmove of
-    // the remaining tail elements. Capping at 1M objectis to avoid holding
-    // too many events in the staging area.
     if (optimization_ == OptimizationMode::kMaxBandwidth &&
-        latest_timestamp_ - earliest_timestamp_ < window_size_ns_ * 10 &&
-        events_.size() < 5 * 1e6) {
+        events_since_flush_ < kMaxBandwidthFlushBatch) {
       return;
     }
 
     SortAndFlushEventsBeyondWindow(window_size_ns_);
   }
 
-  // std::deque makes erase-front potentially faster but std::sort slower.
-  // Overall seems slower than a vector (350 MB/s vs 400 MB/s) without counting
-  // next pipeline stages.
-  std::vector<TimestampedTracePiece> events_;
+  std::vector<Queue> queues_;
   TraceProcessorContext* const context_;
   OptimizationMode optimization_;
 
@@ -172,22 +239,19 @@ class TraceSorter {
   // is larger than this value.
   uint64_t window_size_ns_;
 
-  // max(e.timestamp for e in events_).
+  // max(e.timestamp for e in queues_).
   uint64_t latest_timestamp_ = 0;
 
-  // min(e.timestamp for e in events_).
+  // min(e.timestamp for e in queues_).
   uint64_t earliest_timestamp_ = std::numeric_limits<uint64_t>::max();
 
-  // Contains the index (< events_.size()) of the last sorted event. In essence,
-  // events_[0..sort_start_idx_] are guaranteed to be in-order, while
-  // events_[(sort_start_idx_ + 1)..end] are in random order.
-  size_t sort_start_idx_ = 0;
+  // Number of events pushed since the last call to
+  // SortAndFlushEventsBeyondWindow().
+  uint32_t events_since_flush_ = 0;
 
-  // The smallest timestamp that breaks the ordering in the range
-  // events_[0..sort_start_idx_]. In order to re-establish a total order within
-  // |events_| we need to sort entries from (the index corresponding to) that
-  // timestamp.
-  uint64_t sort_min_ts_ = 0;
+  // Scratch space for the k-way merge, kept around to avoid reallocations.
+  // Contains the indexes of the queues that have events to flush.
+  std::vector<size_t> merge_heap_;
 };
 
 }  // namespace trace_processor
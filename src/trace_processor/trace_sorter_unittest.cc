@@ -41,7 +41,8 @@ class MockTraceParser : public ProtoTraceParser {
 
   void ParseFtracePacket(uint32_t cpu,
                          uint64_t timestamp,
-                         TraceBlobView tbv) override {
+                         TraceBlobView tbv,
+                         const DecodedFtraceEvent&) override {
     MOCK_ParseFtracePacket(cpu, timestamp, tbv.data(), tbv.length());
   }
 
@@ -112,6 +113,73 @@ TEST_P(TraceSorterTest, Ordering) {
   context_.sorter->FlushEventsForced();
 }
 
+TEST_P(TraceSorterTest, InterleavedCpus) {
+  TraceBlobView view_1 = test_buffer_.slice(0, 1);
+  TraceBlobView view_2 = test_buffer_.slice(0, 2);
+  TraceBlobView view_3 = test_buffer_.slice(0, 3);
+  TraceBlobView view_4 = test_buffer_.slice(0, 4);
+  TraceBlobView view_5 = test_buffer_.slice(0, 5);
+
+  InSequence s;
+
+  EXPECT_CALL(*parser_, MOCK_ParseFtracePacket(1, 1000, view_1.data(), 1));
+  EXPECT_CALL(*parser_, MOCK_ParseFtracePacket(0, 1001, view_2.data(), 2));
+  EXPECT_CALL(*parser_, MOCK_ParseFtracePacket(1, 1002, view_3.data(), 3));
+  EXPECT_CALL(*parser_, MOCK_ParseFtracePacket(3, 1003, view_4.data(), 4));
+  EXPECT_CALL(*parser_, MOCK_ParseFtracePacket(0, 1004, view_5.data(), 5));
+
+  // Each CPU is in order, but the CPUs are pushed in blocks.
+  context_.sorter->set_window_ns_for_testing(1000);
+  context_.sorter->PushFtracePacket(0, 1001, std::move(view_2));
+  context_.sorter->PushFtracePacket(0, 1004, std::move(view_5));
+  context_.sorter->PushFtracePacket(3, 1003, std::move(view_4));
+  context_.sorter->PushFtracePacket(1, 1000, std::move(view_1));
+  context_.sorter->PushFtracePacket(1, 1002, std::move(view_3));
+
+  context_.sorter->FlushEventsForced();
+}
+
+TEST_P(TraceSorterTest, OutOfOrderWithinCpu) {
+  TraceBlobView view_1 = test_buffer_.slice(0, 1);
+  TraceBlobView view_2 = test_buffer_.slice(0, 2);
+  TraceBlobView view_3 = test_buffer_.slice(0, 3);
+  TraceBlobView view_4 = test_buffer_.slice(0, 4);
+
+  InSequence s;
+
+  EXPECT_CALL(*parser_, MOCK_ParseFtracePacket(0, 1000, view_1.data(), 1));
+  EXPECT_CALL(*parser_, MOCK_ParseTracePacket(view_2.data(), 2));
+  EXPECT_CALL(*parser_, MOCK_ParseFtracePacket(0, 1002, view_3.data(), 3));
+  EXPECT_CALL(*parser_, MOCK_ParseFtracePacket(0, 1003, view_4.data(), 4));
+
+  context_.sorter->set_window_ns_for_testing(1000);
+  context_.sorter->PushFtracePacket(0, 1003, std::move(view_4));
+  context_.sorter->PushFtracePacket(0, 1000, std::move(view_1));
+  context_.sorter->PushTracePacket(1001, std::move(view_2));
+  context_.sorter->PushFtracePacket(0, 1002, std::move(view_3));
+
+  context_.sorter->FlushEventsForced();
+}
+
+TEST_P(TraceSorterTest, FlushBeyondWindowOnly) {
+  TraceBlobView view_1 = test_buffer_.slice(0, 1);
+  TraceBlobView view_2 = test_buffer_.slice(0, 2);
+  TraceBlobView view_3 = test_buffer_.slice(0, 3);
+
+  // Only the events older than (1200 - 100) can be flushed.
+  EXPECT_CALL(*parser_, MOCK_ParseFtracePacket(0, 1000, _, 1));
+  EXPECT_CALL(*parser_, MOCK_ParseFtracePacket(1, 1050, _, 2));
+  context_.sorter->set_window_ns_for_testing(100);
+  context_.sorter->PushFtracePacket(1, 1050, std::move(view_2));
+  context_.sorter->PushFtracePacket(0, 1000, std::move(view_1));
+  context_.sorter->PushFtracePacket(1, 1200, std::move(view_3));
+  context_.sorter->SortAndFlushEventsBeyondWindow(100);
+  ::testing::Mock::VerifyAndClearExpectations(parser_);
+
+  EXPECT_CALL(*parser_, MOCK_ParseFtracePacket(1, 1200, _, 3));
+  context_.sorter->FlushEventsForced();
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -18,20 +18,27 @@
 
 #include <string.h>
 
+#include <limits>
+
 namespace perfetto {
 namespace trace_processor {
 
+namespace {
+
+// The innermost ReadScope of the calling thread, if any.
+thread_local TraceStorage::ReadScope* g_read_scope = nullptr;
+
+}  // namespace
+
+static_assert(sizeof(TraceStorage::RowCounts) % sizeof(uint32_t) == 0,
+              "RowCounts must be made only of uint32_t");
+
 TraceStorage::TraceStorage() {
   // Upid/utid 0 is reserved for invalid processes/threads.
-  unique_processes_.emplace_back(0);
-  unique_threads_.emplace_back(0);
-
-  // Reserve string ID 0 for the empty string.
-  InternString("");
+  unique_processes_.emplace_back(Process(0));
+  unique_threads_.emplace_back(Thread(0));
 
-  // Initialize all CPUs @ freq 0Hz.
-  for (size_t cpu = 0; cpu < base::kMaxCpus; cpu++)
-    cpu_freq_[cpu].emplace_back(0, 0);
+  PublishRowCounts();
 }
 
 TraceStorage::~TraceStorage() {}
@@ -40,25 +47,202 @@ void TraceStorage::AddSliceToCpu(uint32_t cpu,
                                  uint64_t start_ns,
                                  uint64_t duration_ns,
                                  UniqueTid utid,
-                                 uint64_t cycles) {
-  cpu_events_[cpu].AddSlice(start_ns, duration_ns, utid, cycles);
+                                 uint64_t cycles,
+                                 uint32_t end_state) {
+  cpu_events_[cpu].AddSlice(start_ns, duration_ns, utid, cycles, end_state);
 };
 
-StringId TraceStorage::InternString(base::StringView str) {
-  auto hash = str.Hash();
-  auto id_it = string_index_.find(hash);
-  if (id_it != string_index_.end()) {
-    PERFETTO_DCHECK(base::StringView(string_pool_[id_it->second]) == str);
-    return id_it->second;
+bool TraceStorage::Counters::FindCounter(const Key& key,
+                                         CounterId* id) const {
+  auto it = ids_.find(key);
+  if (it == ids_.end())
+    return false;
+  *id = it->second;
+  return true;
+}
+
+CounterId TraceStorage::Counters::AddCounter(const Key& key) {
+  CounterId id = static_cast<CounterId>(counters_.size());
+  ids_.emplace(key, id);
+  series_.emplace_back(new CounterSeries());
+  counters_.emplace_back(Counter{std::get<0>(key), std::get<1>(key),
+                                 std::get<2>(key), series_.back().get()});
+  return id;
+}
+
+void TraceStorage::Counters::FindCounters(StringId name_id,
+                                          bool has_ref,
+                                          int64_t ref,
+                                          std::vector<CounterId>* ids) const {
+  const int64_t min_ref = has_ref ? ref : std::numeric_limits<int64_t>::min();
+  for (auto it = ids_.lower_bound(Key(name_id, min_ref, RefType::kNone));
+       it != ids_.end() && std::get<0>(it->first) == name_id; ++it) {
+    if (has_ref && std::get<1>(it->first) != ref)
+      break;
+    ids->emplace_back(it->second);
+  }
+}
+
+bool TraceStorage::Counters::AddSample(CounterId id,
+                                       uint64_t ts,
+                                       int64_t value) {
+  CounterSeries* series = series_[id].get();
+  if (series->size() > 0 && ts < series->last_ts())
+    return false;
+  if (series->published())
+    unpublished_.emplace_back(id);
+  series->Append(ts, value, sample_count_++);
+  return true;
+}
+
+void TraceStorage::Counters::MarkPublished() {
+  for (CounterId id : unpublished_)
+    series_[id]->MarkPublished();
+  unpublished_.clear();
+}
+
+size_t TraceStorage::Counters::memory_usage_bytes() const {
+  size_t usage = counters_.memory_usage_bytes();
+  for (const auto& series : series_)
+    usage += series->memory_usage_bytes();
+  return usage;
+}
+
+CounterId TraceStorage::GetOrAddCounter(StringId name_id,
+                                        int64_t ref,
+                                        RefType ref_type) {
+  const Counters::Key key(name_id, ref, ref_type);
+  CounterId id;
+  if (counters_.FindCounter(key, &id))
+    return id;
+  std::lock_guard<std::mutex> lock(index_mutex_);
+  return counters_.AddCounter(key);
+}
+
+std::vector<CounterId> TraceStorage::FindCounters(StringId name_id,
+                                                  bool has_ref,
+                                                  int64_t ref) const {
+  std::vector<CounterId> ids;
+  std::lock_guard<std::mutex> lock(index_mutex_);
+  counters_.FindCounters(name_id, has_ref, ref, &ids);
+  return ids;
+}
+
+void TraceStorage::PushCounter(StringId name_id,
+                               int64_t ref,
+                               RefType ref_type,
+                               uint64_t timestamp,
+                               int64_t value) {
+  CounterId id = GetOrAddCounter(name_id, ref, ref_type);
+  if (!counters_.AddSample(id, timestamp, value)) {
+    PERFETTO_ELOG("Counter %s out of order by %.4f ms, skipping",
+                  GetString(name_id).data(),
+                  (counters_.counter(id).series->last_ts() - timestamp) / 1e6);
+  }
+}
+
+void TraceStorage::PushCpuFreq(uint64_t timestamp,
+                               uint32_t cpu,
+                               uint32_t new_freq) {
+  if (cpu_freq_name_id_ == 0)
+    cpu_freq_name_id_ = InternString("cpufreq");
+  PushCounter(cpu_freq_name_id_, cpu, RefType::kCpu, timestamp, new_freq);
+  if (!cpu_freq_series_[cpu]) {
+    CounterId id = GetOrAddCounter(cpu_freq_name_id_, cpu, RefType::kCpu);
+    cpu_freq_series_[cpu] = counters_.counter(id).series;
   }
-  string_pool_.emplace_back(str.ToStdString());
-  StringId string_id = string_pool_.size() - 1;
-  string_index_.emplace(hash, string_id);
-  return string_id;
+}
+
+TraceStorage::MemoryUsage TraceStorage::GetMemoryUsage() const {
+  MemoryUsage usage;
+  for (const auto& slices : cpu_events_)
+    usage.sched_slices += slices.memory_usage_bytes();
+  usage.nestable_slices = nestable_slices_.memory_usage_bytes();
+  usage.counters = counters_.memory_usage_bytes();
+  usage.strings = string_pool_.memory_usage_bytes();
+  usage.processes = unique_processes_.memory_usage_bytes();
+  usage.threads = unique_threads_.memory_usage_bytes();
+  return usage;
 }
 
 void TraceStorage::ResetStorage() {
-  *this = TraceStorage();
+  // Not thread safe: there must be no concurrent readers.
+  TraceStorage empty;
+  stats_ = empty.stats_;
+  cpu_events_ = std::move(empty.cpu_events_);
+  counters_ = std::move(empty.counters_);
+  cpu_freq_name_id_ = empty.cpu_freq_name_id_;
+  cpu_freq_series_ = empty.cpu_freq_series_;
+  string_pool_ = std::move(empty.string_pool_);
+  unique_processes_ = std::move(empty.unique_processes_);
+  unique_threads_ = std::move(empty.unique_threads_);
+  nestable_slices_ = std::move(empty.nestable_slices_);
+  PublishRowCounts();
+}
+
+TraceStorage::RowCounts TraceStorage::CountRows() const {
+  RowCounts counts;
+  for (size_t cpu = 0; cpu < base::kMaxCpus; cpu++) {
+    counts.sched_slices[cpu] =
+        static_cast<uint32_t>(cpu_events_[cpu].slice_count());
+  }
+  counts.nestable_slices =
+      static_cast<uint32_t>(nestable_slices_.slice_count());
+  counts.counters = static_cast<uint32_t>(counters_.counter_count());
+  counts.counter_samples = counters_.sample_count();
+  counts.strings = static_cast<uint32_t>(string_pool_.size());
+  counts.processes = static_cast<uint32_t>(unique_processes_.size());
+  counts.threads = static_cast<uint32_t>(unique_threads_.size());
+  return counts;
+}
+
+void TraceStorage::PublishRowCounts() {
+  counters_.MarkPublished();
+  RowCounts counts = CountRows();
+  uint32_t words[kRowCountsWords];
+  memcpy(words, &counts, sizeof(words));
+
+  // There is a single writer, so the sequence number is never contended.
+  uint32_t seq = publish_seq_.load(std::memory_order_relaxed);
+  publish_seq_.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  for (size_t i = 0; i < kRowCountsWords; i++)
+    published_row_counts_[i].store(words[i], std::memory_order_relaxed);
+  publish_seq_.store(seq + 2, std::memory_order_release);
+}
+
+TraceStorage::ReadScope::ReadScope(const TraceStorage* storage)
+    : storage_(storage), prev_(g_read_scope) {
+  // Retry if the counts are being published. This never waits on the writer
+  // for longer than it takes to store a RowCounts.
+  uint32_t words[kRowCountsWords];
+  for (;;) {
+    uint32_t seq = storage->publish_seq_.load(std::memory_order_acquire);
+    if (seq & 1)
+      continue;
+    for (size_t i = 0; i < kRowCountsWords; i++) {
+      words[i] =
+          storage->published_row_counts_[i].load(std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (storage->publish_seq_.load(std::memory_order_relaxed) == seq)
+      break;
+  }
+  memcpy(&row_counts_, words, sizeof(words));
+  g_read_scope = this;
+}
+
+TraceStorage::ReadScope::~ReadScope() {
+  PERFETTO_DCHECK(g_read_scope == this);
+  g_read_scope = prev_;
+}
+
+TraceStorage::RowCounts TraceStorage::GetVisibleRowCounts() const {
+  for (const ReadScope* scope = g_read_scope; scope; scope = scope->prev_) {
+    if (scope->storage_ == this)
+      return scope->row_counts_;
+  }
+  return CountRows();
 }
 
 }  // namespace trace_processor
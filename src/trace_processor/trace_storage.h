@@ -18,15 +18,20 @@
 #define SRC_TRACE_PROCESSOR_TRACE_STORAGE_H_
 
 #include <array>
-#include <deque>
+#include <atomic>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <string>
-#include <unordered_map>
+#include <tuple>
 #include <vector>
 
 #include "perfetto/base/logging.h"
 #include "perfetto/base/string_view.h"
 #include "perfetto/base/utils.h"
+#include "src/trace_processor/chunked_column.h"
+#include "src/trace_processor/counter_series.h"
+#include "src/trace_processor/string_pool.h"
 
 namespace perfetto {
 namespace trace_processor {
@@ -40,16 +45,27 @@ using UniquePid = uint32_t;
 // be reused.
 using UniqueTid = uint32_t;
 
-// StringId is an offset into |string_pool_|.
-using StringId = size_t;
+// CounterId is an offset into the counters of TraceStorage::Counters.
+using CounterId = uint32_t;
 
-// A map containing timestamps and the cpu frequency set at that time.
-using CpuFreq =
-    std::deque<std::pair<uint64_t /*timestamp*/, uint32_t /*freq*/>>;
+// What the |ref| of a counter identifies.
+enum class RefType : uint32_t {
+  kNone = 0,
+  kCpu = 1,
+  kUtid = 2,
+  kUpid = 3,
+};
 
 // Stores a data inside a trace file in a columnar form. This makes it efficient
 // to read or search across a single field of the trace (e.g. all the thread
 // names for a given CPU).
+//
+// The storage is written by a single (ingestion) thread and can be read
+// concurrently by any number of other threads, without locks. Readers see
+// only the rows published by the last PublishRowCounts() call. As all the
+// tables are append-only, those rows don't change afterwards, with the
+// exception of the few thread and process fields which are updated in place
+// (see LockMetadata()).
 class TraceStorage {
  public:
   TraceStorage();
@@ -59,10 +75,84 @@ class TraceStorage {
 
   struct Stats {
     uint64_t mismatched_sched_switch_tids_ = 0;
+
+    // FtraceEventBundles dropped because their cpu is missing or not below
+    // base::kMaxCpus.
+    uint64_t ftrace_bundles_invalid_cpu_ = 0;
+  };
+
+  // Approximate number of bytes used by each part of the storage.
+  struct MemoryUsage {
+    size_t sched_slices = 0;
+    size_t nestable_slices = 0;
+    size_t counters = 0;
+    size_t strings = 0;
+    size_t processes = 0;
+    size_t threads = 0;
+
+    size_t total() const {
+      return sched_slices + nestable_slices + counters + strings + processes +
+             threads;
+    }
+  };
+
+  // Number of rows of each table visible to readers.
+  struct RowCounts {
+    std::array<uint32_t, base::kMaxCpus> sched_slices{};
+    uint32_t nestable_slices = 0;
+    uint32_t counters = 0;
+
+    // The number of counter samples, which readers pass to
+    // CounterSeries::CountSamples().
+    uint32_t counter_samples = 0;
+
+    uint32_t strings = 0;
+
+    // Including the invalid entries with ID 0.
+    uint32_t processes = 0;
+    uint32_t threads = 0;
+  };
+
+  // Makes the current state of the storage visible to readers (see
+  // GetVisibleRowCounts()). Called by the ingestion thread at points where
+  // the storage is consistent, e.g. after each Parse() call.
+  void PublishRowCounts();
+
+  // Marks the calling thread as a reader (e.g. a query) of |storage| for its
+  // lifetime, during which GetVisibleRowCounts() consistently returns the row
+  // counts published when the scope was created. Scopes can be nested.
+  class ReadScope {
+   public:
+    explicit ReadScope(const TraceStorage* storage);
+    ~ReadScope();
+
+   private:
+    ReadScope(const ReadScope&) = delete;
+    ReadScope& operator=(const ReadScope&) = delete;
+
+    friend class TraceStorage;
+
+    const TraceStorage* const storage_;
+    ReadScope* const prev_;
+    RowCounts row_counts_;
   };
 
+  // Returns the number of rows of each table that can be read. Inside a
+  // ReadScope, these are the rows published when the scope was created,
+  // otherwise all the rows (which is valid only on the ingestion thread).
+  RowCounts GetVisibleRowCounts() const;
+
+  // Guards the thread and process fields which the ingestion thread updates
+  // after adding the row (e.g. names), against concurrent reads by
+  // GetThread() and GetProcess(). Taken by the ingestion thread only when
+  // modifying rows, so that it never waits for readers for long.
+  std::unique_lock<std::mutex> LockMetadata() const {
+    return std::unique_lock<std::mutex>(metadata_mutex_);
+  }
+
   // Information about a unique process seen in a trace.
   struct Process {
+    Process() = default;
     explicit Process(uint32_t p) : pid(p) {}
     uint64_t start_ns = 0;
     uint64_t end_ns = 0;
@@ -72,6 +162,7 @@ class TraceStorage {
 
   // Information about a unique thread seen in a trace.
   struct Thread {
+    Thread() = default;
     explicit Thread(uint32_t t) : tid(t) {}
     uint64_t start_ns = 0;
     uint64_t end_ns = 0;
@@ -85,30 +176,58 @@ class TraceStorage {
     inline void AddSlice(uint64_t start_ns,
                          uint64_t duration_ns,
                          UniqueTid utid,
-                         uint64_t cycles) {
+                         uint64_t cycles,
+                         uint32_t end_state) {
       start_ns_.emplace_back(start_ns);
       durations_.emplace_back(duration_ns);
       utids_.emplace_back(utid);
       cycles_.emplace_back(cycles);
+      end_states_.emplace_back(end_state);
+    }
+
+    // Appends |count| slices, whose columns are given as unaligned arrays of
+    // the types of the columns (e.g. the columns of a snapshot).
+    void AppendSlices(size_t count,
+                      const void* start_ns,
+                      const void* durations,
+                      const void* utids,
+                      const void* cycles,
+                      const void* end_states) {
+      start_ns_.AppendUnaligned(start_ns, count);
+      durations_.AppendUnaligned(durations, count);
+      utids_.AppendUnaligned(utids, count);
+      cycles_.AppendUnaligned(cycles, count);
+      end_states_.AppendUnaligned(end_states, count);
     }
 
     size_t slice_count() const { return start_ns_.size(); }
 
-    const std::deque<uint64_t>& start_ns() const { return start_ns_; }
+    const ChunkedColumn<uint64_t>& start_ns() const { return start_ns_; }
+
+    const ChunkedColumn<uint64_t>& durations() const { return durations_; }
 
-    const std::deque<uint64_t>& durations() const { return durations_; }
+    const ChunkedColumn<UniqueTid>& utids() const { return utids_; }
 
-    const std::deque<UniqueTid>& utids() const { return utids_; }
+    const ChunkedColumn<uint64_t>& cycles() const { return cycles_; }
 
-    const std::deque<uint64_t>& cycles() const { return cycles_; }
+    // The state of the thread when it was switched out at the end of the
+    // slice, i.e. the |prev_state| of the sched_switch which ended it.
+    const ChunkedColumn<uint32_t>& end_states() const { return end_states_; }
+
+    size_t memory_usage_bytes() const {
+      return start_ns_.memory_usage_bytes() + durations_.memory_usage_bytes() +
+             utids_.memory_usage_bytes() + cycles_.memory_usage_bytes() +
+             end_states_.memory_usage_bytes();
+    }
 
    private:
-    // Each vector below has the same number of entries (the number of slices
+    // Each column below has the same number of entries (the number of slices
     // in the trace for the CPU).
-    std::deque<uint64_t> start_ns_;
-    std::deque<uint64_t> durations_;
-    std::deque<UniqueTid> utids_;
-    std::deque<uint64_t> cycles_;
+    ChunkedColumn<uint64_t> start_ns_;
+    ChunkedColumn<uint64_t> durations_;
+    ChunkedColumn<UniqueTid> utids_;
+    ChunkedColumn<uint64_t> cycles_;
+    ChunkedColumn<uint32_t> end_states_;
   };
 
   class NestableSlices {
@@ -131,27 +250,108 @@ class TraceStorage {
       parent_stack_ids_.emplace_back(parent_stack_id);
     }
 
+    // Same as SlicesPerCpu::AppendSlices(). The string IDs in |cats| and
+    // |names| are uint64_t.
+    void AppendSlices(size_t count,
+                      const void* start_ns,
+                      const void* durations,
+                      const void* utids,
+                      const void* cats,
+                      const void* names,
+                      const void* depths,
+                      const void* stack_ids,
+                      const void* parent_stack_ids) {
+      start_ns_.AppendUnaligned(start_ns, count);
+      durations_.AppendUnaligned(durations, count);
+      utids_.AppendUnaligned(utids, count);
+      cats_.AppendUnaligned<uint64_t>(cats, count);
+      names_.AppendUnaligned<uint64_t>(names, count);
+      depths_.AppendUnaligned(depths, count);
+      stack_ids_.AppendUnaligned(stack_ids, count);
+      parent_stack_ids_.AppendUnaligned(parent_stack_ids, count);
+    }
+
     size_t slice_count() const { return start_ns_.size(); }
-    const std::deque<uint64_t>& start_ns() const { return start_ns_; }
-    const std::deque<uint64_t>& durations() const { return durations_; }
-    const std::deque<UniqueTid>& utids() const { return utids_; }
-    const std::deque<StringId>& cats() const { return cats_; }
-    const std::deque<StringId>& names() const { return names_; }
-    const std::deque<uint8_t>& depths() const { return depths_; }
-    const std::deque<uint64_t>& stack_ids() const { return stack_ids_; }
-    const std::deque<uint64_t>& parent_stack_ids() const {
+    const ChunkedColumn<uint64_t>& start_ns() const { return start_ns_; }
+    const ChunkedColumn<uint64_t>& durations() const { return durations_; }
+    const ChunkedColumn<UniqueTid>& utids() const { return utids_; }
+    const ChunkedColumn<StringId>& cats() const { return cats_; }
+    const ChunkedColumn<StringId>& names() const { return names_; }
+    const ChunkedColumn<uint8_t>& depths() const { return depths_; }
+    const ChunkedColumn<uint64_t>& stack_ids() const { return stack_ids_; }
+    const ChunkedColumn<uint64_t>& parent_stack_ids() const {
       return parent_stack_ids_;
     }
 
+    size_t memory_usage_bytes() const {
+      return start_ns_.memory_usage_bytes() + durations_.memory_usage_bytes() +
+             utids_.memory_usage_bytes() + cats_.memory_usage_bytes() +
+             names_.memory_usage_bytes() + depths_.memory_usage_bytes() +
+             stack_ids_.memory_usage_bytes() +
+             parent_stack_ids_.memory_usage_bytes();
+    }
+
+   private:
+    ChunkedColumn<uint64_t> start_ns_;
+    ChunkedColumn<uint64_t> durations_;
+    ChunkedColumn<UniqueTid> utids_;
+    ChunkedColumn<StringId> cats_;
+    ChunkedColumn<StringId> names_;
+    ChunkedColumn<uint8_t> depths_;
+    ChunkedColumn<uint64_t> stack_ids_;
+    ChunkedColumn<uint64_t> parent_stack_ids_;
+  };
+
+  // The samples of all the counters of the trace (e.g. cpu frequencies), in
+  // one delta encoded CounterSeries per counter. A counter is identified by
+  // its name and by what it refers to (e.g. the cpufreq counter of cpu 2).
+  class Counters {
+   public:
+    struct Counter {
+      StringId name_id;
+      int64_t ref;
+      RefType ref_type;
+      const CounterSeries* series;
+    };
+
+    // Appends a sample to the counter |id|. The samples of a counter must be
+    // added in timestamp order: returns false, and drops the sample, if
+    // |ts| is before the last one.
+    bool AddSample(CounterId id, uint64_t ts, int64_t value);
+
+    // Marks the series which got samples since the last call as published,
+    // so that readers can tell which samples are visible to them (see
+    // CounterSeries). Called when the row counts are published.
+    void MarkPublished();
+
+    size_t counter_count() const { return counters_.size(); }
+    const Counter& counter(CounterId id) const { return counters_[id]; }
+
+    // The number of samples added so far, to all the counters.
+    uint32_t sample_count() const { return sample_count_; }
+
+    size_t memory_usage_bytes() const;
+
    private:
-    std::deque<uint64_t> start_ns_;
-    std::deque<uint64_t> durations_;
-    std::deque<UniqueTid> utids_;
-    std::deque<StringId> cats_;
-    std::deque<StringId> names_;
-    std::deque<uint8_t> depths_;
-    std::deque<uint64_t> stack_ids_;
-    std::deque<uint64_t> parent_stack_ids_;
+    friend class TraceStorage;
+    using Key = std::tuple<StringId, int64_t, RefType>;
+
+    // The index is accessed through TraceStorage, which guards it against
+    // concurrent lookups by readers.
+    bool FindCounter(const Key& key, CounterId* id) const;
+    CounterId AddCounter(const Key& key);
+    void FindCounters(StringId name_id,
+                      bool has_ref,
+                      int64_t ref,
+                      std::vector<CounterId>* ids) const;
+
+    ChunkedColumn<Counter, 8> counters_;
+
+    // Only accessed by the writer.
+    std::vector<std::unique_ptr<CounterSeries>> series_;
+    std::map<Key, CounterId> ids_;  // Guarded by TraceStorage::index_mutex_.
+    std::vector<CounterId> unpublished_;
+    uint32_t sample_count_ = 0;
   };
 
   void ResetStorage();
@@ -160,32 +360,53 @@ class TraceStorage {
                      uint64_t start_ns,
                      uint64_t duration_ns,
                      UniqueTid utid,
-                     uint64_t cycles);
+                     uint64_t cycles,
+                     uint32_t end_state);
 
   UniqueTid AddEmptyThread(uint32_t tid) {
-    unique_threads_.emplace_back(tid);
+    unique_threads_.emplace_back(Thread(tid));
     return static_cast<UniqueTid>(unique_threads_.size() - 1);
   }
 
   UniquePid AddEmptyProcess(uint32_t pid) {
-    unique_processes_.emplace_back(pid);
+    unique_processes_.emplace_back(Process(pid));
     return static_cast<UniquePid>(unique_processes_.size() - 1);
   }
 
   void AddMismatchedSchedSwitch() { ++stats_.mismatched_sched_switch_tids_; }
+  void AddFtraceBundlesInvalidCpu(uint32_t count) {
+    stats_.ftrace_bundles_invalid_cpu_ += count;
+  }
+
+  const Stats& stats() const { return stats_; }
+  Stats* mutable_stats() { return &stats_; }
 
   // Return an unqiue identifier for the contents of each string.
   // The string is copied internally and can be destroyed after this called.
-  StringId InternString(base::StringView);
+  StringId InternString(base::StringView str) {
+    StringId id;
+    if (string_pool_.Find(str, &id))
+      return id;
+    std::lock_guard<std::mutex> lock(index_mutex_);
+    return string_pool_.InternString(str);
+  }
 
+  // Sets |id| to the id of |str| and returns true if it was interned. Can be
+  // called by readers.
+  bool FindString(base::StringView str, StringId* id) const {
+    std::lock_guard<std::mutex> lock(index_mutex_);
+    return string_pool_.Find(str, id);
+  }
+
+  // Changes to published rows must be made under LockMetadata().
   Process* GetMutableProcess(UniquePid upid) {
     PERFETTO_DCHECK(upid > 0 && upid < unique_processes_.size());
-    return &unique_processes_[upid];
+    return unique_processes_.mutable_at(upid);
   }
 
   Thread* GetMutableThread(UniqueTid utid) {
     PERFETTO_DCHECK(utid > 0 && utid < unique_threads_.size());
-    return &unique_threads_[utid];
+    return unique_threads_.mutable_at(utid);
   }
 
   // Reading methods.
@@ -194,41 +415,65 @@ class TraceStorage {
     return cpu_events_[cpu];
   }
 
-  const std::string& GetString(StringId id) const {
-    PERFETTO_DCHECK(id < string_pool_.size());
-    return string_pool_[id];
+  SlicesPerCpu* mutable_slices_for_cpu(uint32_t cpu) {
+    PERFETTO_DCHECK(cpu < cpu_events_.size());
+    return &cpu_events_[cpu];
   }
 
-  const Process& GetProcess(UniquePid upid) const {
+  // The returned view is NUL terminated and stays valid for the lifetime of
+  // the storage.
+  base::StringView GetString(StringId id) const {
+    return string_pool_.Get(id);
+  }
+
+  // Processes and threads are returned by copy, as they can be updated by
+  // the ingestion thread.
+  Process GetProcess(UniquePid upid) const {
     PERFETTO_DCHECK(upid > 0 && upid < unique_processes_.size());
+    std::lock_guard<std::mutex> lock(metadata_mutex_);
     return unique_processes_[upid];
   }
 
-  const Thread& GetThread(UniqueTid utid) const {
+  Thread GetThread(UniqueTid utid) const {
     PERFETTO_DCHECK(utid > 0 && utid < unique_threads_.size());
+    std::lock_guard<std::mutex> lock(metadata_mutex_);
     return unique_threads_[utid];
   }
 
   const NestableSlices& nestable_slices() const { return nestable_slices_; }
   NestableSlices* mutable_nestable_slices() { return &nestable_slices_; }
 
-  // Virtual for testing.
+  const Counters& counters() const { return counters_; }
+  Counters* mutable_counters() { return &counters_; }
+
+  // Returns the id of the counter with the given key, adding it if needed.
+  CounterId GetOrAddCounter(StringId name_id, int64_t ref, RefType ref_type);
+
+  // Returns the ids of the counters named |name_id|, only the ones referring
+  // to |ref| if |has_ref|, in (ref, ref_type) order. Can be called by readers,
+  // which must skip the ids of the counters not visible to them yet.
+  std::vector<CounterId> FindCounters(StringId name_id,
+                                      bool has_ref,
+                                      int64_t ref) const;
+
+  // Adds a sample to the counter with the given key. Samples out of
+  // timestamp order are dropped.
+  void PushCounter(StringId name_id,
+                   int64_t ref,
+                   RefType ref_type,
+                   uint64_t timestamp,
+                   int64_t value);
+
+  // Adds a sample to the "cpufreq" counter of |cpu|: from |timestamp| on, the
+  // cpu runs at |new_freq| kHz. Virtual for testing.
   virtual void PushCpuFreq(uint64_t timestamp,
                            uint32_t cpu,
-                           uint32_t new_freq) {
-    auto& freqs = cpu_freq_[cpu];
-    if (!freqs.empty() && timestamp < freqs.back().first) {
-      PERFETTO_ELOG("cpufreq out of order by %.4f ms, skipping",
-                    (freqs.back().first - timestamp) / 1e6);
-      return;
-    }
-    freqs.emplace_back(timestamp, new_freq);
-  }
+                           uint32_t new_freq);
 
-  const CpuFreq& GetFreqForCpu(uint32_t cpu) const { return cpu_freq_[cpu]; }
-
-  uint32_t GetMaxCpu() const {
-    return static_cast<uint32_t>(cpu_freq_.size() - 1);
+  // Only for the ingestion thread: the samples added by PushCpuFreq() for
+  // |cpu|, or nullptr if there is none.
+  const CounterSeries* GetCpuFreqSeries(uint32_t cpu) const {
+    return cpu_freq_series_[cpu];
   }
 
   // |unique_processes_| always contains at least 1 element becuase the 0th ID
@@ -242,10 +487,15 @@ class TraceStorage {
   // Number of interned strings in the pool. Includes the empty string w/ ID=0.
   size_t string_count() const { return string_pool_.size(); }
 
+  // Returns a breakdown of the memory currently allocated by the storage.
+  MemoryUsage GetMemoryUsage() const;
+
  private:
-  TraceStorage& operator=(const TraceStorage&) = default;
+  static constexpr size_t kRowCountsWords =
+      sizeof(RowCounts) / sizeof(uint32_t);
 
-  using StringHash = uint64_t;
+  // Returns the current number of rows of each table.
+  RowCounts CountRows() const;
 
   // Metadata counters for events being added.
   Stats stats_;
@@ -253,24 +503,37 @@ class TraceStorage {
   // One entry for each CPU in the trace.
   std::array<SlicesPerCpu, base::kMaxCpus> cpu_events_;
 
-  // One map containing frequencies for every CPU in the trace. The map contains
-  // timestamps and the cpu frequency value at that time.
-  std::array<CpuFreq, base::kMaxCpus> cpu_freq_;
+  // The counters of the trace, e.g. the frequency of each CPU.
+  Counters counters_;
 
-  // One entry for each unique string in the trace.
-  std::deque<std::string> string_pool_;
+  // The name of the cpufreq counters, interned when the first one is added,
+  // and their series. Only accessed by the writer.
+  StringId cpu_freq_name_id_ = 0;
+  std::array<const CounterSeries*, base::kMaxCpus> cpu_freq_series_{};
 
   // One entry for each unique string in the trace.
-  std::unordered_map<StringHash, StringId> string_index_;
+  StringPool string_pool_;
 
   // One entry for each UniquePid, with UniquePid as the index.
-  std::deque<Process> unique_processes_;
+  ChunkedColumn<Process, 10> unique_processes_;
 
   // One entry for each UniqueTid, with UniqueTid as the index.
-  std::deque<Thread> unique_threads_;
+  ChunkedColumn<Thread, 10> unique_threads_;
 
   // Slices coming from userspace events (e.g. Chromium TRACE_EVENT macros).
   NestableSlices nestable_slices_;
+
+  mutable std::mutex metadata_mutex_;
+
+  // Guards the indexes of |string_pool_| and |counters_| against lookups by
+  // readers. The writer takes it only to add to them, so interning an
+  // existing string doesn't lock.
+  mutable std::mutex index_mutex_;
+
+  // The RowCounts published for readers, as a sequence lock: |publish_seq_|
+  // is odd while they are being written.
+  std::atomic<uint32_t> publish_seq_{0};
+  std::array<std::atomic<uint32_t>, kRowCountsWords> published_row_counts_{};
 };
 
 }  // namespace trace_processor
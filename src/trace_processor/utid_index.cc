@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/utid_index.h"
+
+#include <algorithm>
+
+namespace perfetto {
+namespace trace_processor {
+
+UtidIndex::UtidIndex() = default;
+UtidIndex::~UtidIndex() = default;
+
+void UtidIndex::Update(const ChunkedColumn<UniqueTid>& utids,
+                       const ChunkedColumn<uint64_t>& start_ns,
+                       uint32_t row_count) {
+  if (row_count < indexed_rows_) {
+    rows_by_utid_.clear();
+    indexed_rows_ = 0;
+  }
+  if (row_count == indexed_rows_)
+    return;
+
+  // Rows are appended in timestamp order in most tables (e.g. the sched
+  // slices of a CPU), in which case the lists stay sorted. Otherwise, the new
+  // rows of each list are sorted and merged with the ones already there.
+  auto by_ts = [&start_ns](uint32_t f, uint32_t s) {
+    return start_ns[f] < start_ns[s] || (start_ns[f] == start_ns[s] && f < s);
+  };
+  const uint32_t first_new_row = indexed_rows_;
+  std::vector<UniqueTid> updated_utids;
+  for (uint32_t row = first_new_row; row < row_count; row++) {
+    UniqueTid utid = utids[row];
+    if (utid >= rows_by_utid_.size())
+      rows_by_utid_.resize(utid + 1);
+    auto* rows = &rows_by_utid_[utid];
+    if (rows->empty() || rows->back() < first_new_row)
+      updated_utids.emplace_back(utid);
+    rows->emplace_back(row);
+  }
+  for (UniqueTid utid : updated_utids) {
+    auto* rows = &rows_by_utid_[utid];
+
+    // The new rows are all at the end of the list.
+    auto first_new = rows->end();
+    while (first_new != rows->begin() && *(first_new - 1) >= first_new_row)
+      first_new--;
+    auto sorted_begin = first_new == rows->begin() ? first_new : first_new - 1;
+    if (std::is_sorted(sorted_begin, rows->end(), by_ts))
+      continue;
+    std::sort(first_new, rows->end(), by_ts);
+    std::inplace_merge(rows->begin(), first_new, rows->end(), by_ts);
+  }
+  indexed_rows_ = row_count;
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_UTID_INDEX_H_
+#define SRC_TRACE_PROCESSOR_UTID_INDEX_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "src/trace_processor/chunked_column.h"
+#include "src/trace_processor/trace_storage.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// Lists, for each utid, the rows of a table which belong to the thread, in
+// timestamp order, so that the queries on the timeline of a thread read only
+// its rows. The index is built lazily by the tables which use it: Update()
+// indexes the rows appended to the table since the last call.
+//
+// Not thread safe. Tables update it from their cursors, which are only used
+// by one query at a time.
+class UtidIndex {
+ public:
+  UtidIndex();
+  ~UtidIndex();
+
+  // Indexes the rows [indexed_rows(), row_count) of the table with the given
+  // utid and timestamp columns. If the table has fewer rows than already
+  // indexed (i.e. the storage has been reset), the index is rebuilt.
+  void Update(const ChunkedColumn<UniqueTid>& utids,
+              const ChunkedColumn<uint64_t>& start_ns,
+              uint32_t row_count);
+
+  // Returns the rows of |utid| indexed so far, sorted by timestamp, and by
+  // row for rows with the same timestamp.
+  const std::vector<uint32_t>& RowsForUtid(UniqueTid utid) const {
+    return utid < rows_by_utid_.size() ? rows_by_utid_[utid] : empty_;
+  }
+
+  uint32_t indexed_rows() const { return indexed_rows_; }
+
+ private:
+  UtidIndex(const UtidIndex&) = delete;
+  UtidIndex& operator=(const UtidIndex&) = delete;
+
+  std::vector<std::vector<uint32_t>> rows_by_utid_;
+  uint32_t indexed_rows_ = 0;
+  const std::vector<uint32_t> empty_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_UTID_INDEX_H_
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/utid_index.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+
+class UtidIndexTest : public ::testing::Test {
+ public:
+  void AddRow(uint64_t ts, UniqueTid utid) {
+    start_ns_.emplace_back(ts);
+    utids_.emplace_back(utid);
+  }
+
+  void Update() {
+    index_.Update(utids_, start_ns_, static_cast<uint32_t>(utids_.size()));
+  }
+
+ protected:
+  ChunkedColumn<uint64_t> start_ns_;
+  ChunkedColumn<UniqueTid> utids_;
+  UtidIndex index_;
+};
+
+TEST_F(UtidIndexTest, RowsInTimestampOrder) {
+  AddRow(10, 1);
+  AddRow(12, 2);
+  AddRow(15, 1);
+  Update();
+  ASSERT_EQ(index_.indexed_rows(), 3u);
+  ASSERT_THAT(index_.RowsForUtid(1), ElementsAre(0u, 2u));
+  ASSERT_THAT(index_.RowsForUtid(2), ElementsAre(1u));
+  ASSERT_THAT(index_.RowsForUtid(3), IsEmpty());
+
+  // Rows out of timestamp order, within the new rows and with respect to the
+  // ones already indexed, are merged in place.
+  AddRow(20, 1);
+  AddRow(11, 1);
+  AddRow(5, 1);
+  AddRow(15, 1);
+  AddRow(13, 2);
+  Update();
+  ASSERT_EQ(index_.indexed_rows(), 8u);
+  ASSERT_THAT(index_.RowsForUtid(1), ElementsAre(5u, 0u, 4u, 2u, 6u, 3u));
+  ASSERT_THAT(index_.RowsForUtid(2), ElementsAre(1u, 7u));
+}
+
+TEST_F(UtidIndexTest, PartialUpdates) {
+  AddRow(10, 1);
+  AddRow(11, 1);
+  AddRow(12, 1);
+  index_.Update(utids_, start_ns_, 2);
+  ASSERT_THAT(index_.RowsForUtid(1), ElementsAre(0u, 1u));
+
+  Update();
+  ASSERT_THAT(index_.RowsForUtid(1), ElementsAre(0u, 1u, 2u));
+
+  // Fewer rows than indexed: the table has been reset.
+  index_.Update(utids_, start_ns_, 1);
+  ASSERT_EQ(index_.indexed_rows(), 1u);
+  ASSERT_THAT(index_.RowsForUtid(1), ElementsAre(0u));
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -37,10 +37,15 @@ using RequestID = uint32_t;
 // Args:
 //  RequestID: the ID passed by the embedder when invoking the RPC method (e.g.,
 //             the first argument passed to sched_getSchedEvents()).
-using ReplyFunction = void (*)(RequestID,
+//  is_last: false if more replies to the same request follow, which happens
+//           only for streaming queries.
+// Returns false if the embedder is not interested in further replies to the
+// same request, which cancels streaming queries. Ignored for other methods.
+using ReplyFunction = bool (*)(RequestID,
                                bool success,
                                const char* /*proto_reply_data*/,
-                               uint32_t /*len*/);
+                               uint32_t /*len*/,
+                               bool is_last);
 
 namespace {
 TraceProcessor* g_trace_processor;
@@ -64,14 +69,36 @@ void EMSCRIPTEN_KEEPALIVE trace_processor_parse(RequestID,
                                                 const uint8_t*,
                                                 uint32_t);
 void trace_processor_parse(RequestID id, const uint8_t* data, size_t size) {
-  // TODO(primiano): This copy is extremely unfortunate. Ideally there should be
-  // a way to take the Blob coming from JS (either from FileReader or from th
-  // fetch() stream) and move into WASM.
+  // This copy is unfortunate, trace_processor_getWritableChunk() and
+  // trace_processor_commitChunk() avoid it. Ideally there should be a way to
+  // take the Blob coming from JS (either from FileReader or from the fetch()
+  // stream) and move into WASM.
   // See https://github.com/WebAssembly/design/issues/1162.
-  std::unique_ptr<uint8_t[]> buf(new uint8_t[size]);
-  memcpy(buf.get(), data, size);
-  g_trace_processor->Parse(std::move(buf), size);
-  g_reply(id, true, "", 0);
+  uint8_t* chunk = g_trace_processor->GetWritableChunk(size);
+  memcpy(chunk, data, size);
+  g_trace_processor->CommitChunk(chunk, size);
+  g_reply(id, true, "", 0, true);
+}
+
+// Returns a buffer of at least |size| bytes in the WASM heap, into which the
+// JS side can copy the next part of the trace (e.g. with HEAPU8.set()) and
+// then pass it to trace_processor_commitChunk(). This saves the copy made by
+// trace_processor_parse(). Unlike the other methods, this returns its result
+// synchronously.
+uint8_t* EMSCRIPTEN_KEEPALIVE trace_processor_getWritableChunk(uint32_t);
+uint8_t* trace_processor_getWritableChunk(uint32_t size) {
+  return g_trace_processor->GetWritableChunk(size);
+}
+
+// Parses the first |size| bytes of a chunk returned by
+// trace_processor_getWritableChunk(). The chunk must not be accessed by the JS
+// side after this call.
+void EMSCRIPTEN_KEEPALIVE trace_processor_commitChunk(RequestID,
+                                                      uint8_t*,
+                                                      uint32_t);
+void trace_processor_commitChunk(RequestID id, uint8_t* chunk, uint32_t size) {
+  g_trace_processor->CommitChunk(chunk, size);
+  g_reply(id, true, "", 0, true);
 }
 
 // We keep the same signature as other methods even though we don't take input
@@ -82,7 +109,7 @@ void EMSCRIPTEN_KEEPALIVE trace_processor_notifyEof(RequestID,
 void trace_processor_notifyEof(RequestID id, const uint8_t*, uint32_t size) {
   PERFETTO_DCHECK(!size);
   g_trace_processor->NotifyEndOfFile();
-  g_reply(id, true, "", 0);
+  g_reply(id, true, "", 0, true);
 }
 
 void EMSCRIPTEN_KEEPALIVE trace_processor_rawQuery(RequestID,
@@ -95,7 +122,7 @@ void trace_processor_rawQuery(RequestID id,
   bool parsed = query.ParseFromArray(query_data, len);
   if (!parsed) {
     std::string err = "Failed to parse input request";
-    g_reply(id, false, err.data(), err.size());
+    g_reply(id, false, err.data(), err.size(), true);
     return;
   }
 
@@ -104,12 +131,44 @@ void trace_processor_rawQuery(RequestID id,
   auto callback = [id](const protos::RawQueryResult& res) {
     std::string encoded;
     res.SerializeToString(&encoded);
-    g_reply(id, true, encoded.data(), static_cast<uint32_t>(encoded.size()));
+    g_reply(id, true, encoded.data(), static_cast<uint32_t>(encoded.size()),
+            true);
   };
 
   g_trace_processor->ExecuteQuery(query, callback);
 }
 
+// Like trace_processor_rawQuery, but replies once for each batch of rows (see
+// TraceProcessor::ExecuteStreamingQuery()) rather than once for the whole
+// result. All replies carry the same RequestID; the last one has |is_last|
+// set, as well as |is_last_batch| in the RawQueryResult. The query stops
+// early, without a last batch, as soon as the reply function returns false.
+void EMSCRIPTEN_KEEPALIVE trace_processor_rawStreamingQuery(RequestID,
+                                                            const uint8_t*,
+                                                            int);
+void trace_processor_rawStreamingQuery(RequestID id,
+                                       const uint8_t* query_data,
+                                       int len) {
+  protos::RawQueryArgs query;
+  bool parsed = query.ParseFromArray(query_data, len);
+  if (!parsed) {
+    std::string err = "Failed to parse input request";
+    g_reply(id, false, err.data(), err.size(), true);
+    return;
+  }
+
+  // The encoding buffer is reused across batches.
+  std::string encoded;
+  auto callback = [id, &encoded](const protos::RawQueryResult& res) {
+    encoded.clear();
+    res.SerializeToString(&encoded);
+    return g_reply(id, true, encoded.data(),
+                   static_cast<uint32_t>(encoded.size()), res.is_last_batch());
+  };
+
+  g_trace_processor->ExecuteStreamingQuery(query, callback);
+}
+
 }  // extern "C"
 
 }  // namespace trace_processor
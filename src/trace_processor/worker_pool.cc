@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/worker_pool.h"
+
+#include "perfetto/base/logging.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+WorkerPool::WorkerPool(uint32_t num_threads) {
+  PERFETTO_CHECK(num_threads > 0);
+  for (uint32_t i = 0; i < num_threads; i++)
+    threads_.emplace_back(&WorkerPool::RunWorker, this);
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    quit_ = true;
+  }
+  task_posted_.notify_all();
+  for (auto& thread : threads_)
+    thread.join();
+}
+
+void WorkerPool::PostTask(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    tasks_.emplace_back(std::move(task));
+  }
+  task_posted_.notify_one();
+}
+
+void WorkerPool::RunWorker() {
+  for (;;) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      task_posted_.wait(lock, [this] { return quit_ || !tasks_.empty(); });
+      if (tasks_.empty())
+        return;  // |quit_| is set and there is nothing left to run.
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+    task();
+  }
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_WORKER_POOL_H_
+#define SRC_TRACE_PROCESSOR_WORKER_POOL_H_
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace perfetto {
+namespace trace_processor {
+
+// A fixed-size pool of threads running tasks in FIFO order. Used to offload
+// CPU intensive, self-contained work (e.g. tokenizing a chunk of the trace)
+// from the thread that feeds the trace processor. Tasks must not touch
+// TraceStorage or any other state owned by the TraceProcessorContext: the
+// results have to be handed back to the calling thread, which is responsible
+// for applying them in order.
+// Not available in WASM builds, which are single-threaded.
+class WorkerPool {
+ public:
+  explicit WorkerPool(uint32_t num_threads);
+
+  // Runs all the tasks that are still queued and joins the threads.
+  ~WorkerPool();
+
+  void PostTask(std::function<void()>);
+
+  uint32_t num_threads() const {
+    return static_cast<uint32_t>(threads_.size());
+  }
+
+ private:
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  void RunWorker();
+
+  std::mutex mutex_;
+  std::condition_variable task_posted_;
+  std::deque<std::function<void()>> tasks_;  // Guarded by |mutex_|.
+  bool quit_ = false;                         // Guarded by |mutex_|.
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_WORKER_POOL_H_
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/worker_pool.h"
+
+#include <atomic>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+TEST(WorkerPoolTest, RunsAllTasks) {
+  std::atomic<uint32_t> counter{0};
+  {
+    WorkerPool pool(4);
+    ASSERT_EQ(pool.num_threads(), 4u);
+    for (uint32_t i = 0; i < 1000; i++)
+      pool.PostTask([&counter] { counter++; });
+  }
+  // The destructor runs the queued tasks before joining the threads.
+  ASSERT_EQ(counter.load(), 1000u);
+}
+
+TEST(WorkerPoolTest, SingleThreadIsFifo) {
+  std::vector<uint32_t> order;
+  {
+    WorkerPool pool(1);
+    for (uint32_t i = 0; i < 100; i++)
+      pool.PostTask([&order, i] { order.push_back(i); });
+  }
+  ASSERT_EQ(order.size(), 100u);
+  for (uint32_t i = 0; i < 100; i++)
+    ASSERT_EQ(order[i], i);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,289 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/xz_trace_reader.h"
+
+#include <7zCrc.h>
+#include <Alloc.h>
+#include <Xz.h>
+#include <XzCrc64.h>
+
+#include "perfetto/base/build_config.h"
+#include "perfetto/base/logging.h"
+#include "perfetto/base/utils.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+namespace {
+
+// Compressed chunks queued for the helper thread after which Parse() blocks
+// until they are decompressed.
+constexpr size_t kMaxQueuedChunks = 4;
+
+// Decompressed blocks which can be waiting to be parsed before the helper
+// thread stops decompressing.
+constexpr size_t kMaxDecodedBlocks = 4;
+
+}  // namespace
+
+// Thin wrapper around the streaming decoder of the LZMA SDK. Concatenated
+// .xz streams (e.g. `cat a.xz b.xz`) are decoded as a single one.
+class XzTraceReader::Decoder {
+ public:
+  Decoder() {
+    static bool tables_initialized = [] {
+      CrcGenerateTable();
+      Crc64GenerateTable();
+      return true;
+    }();
+    base::ignore_result(tables_initialized);
+    XzUnpacker_Construct(&state_, &g_Alloc);
+  }
+
+  ~Decoder() { XzUnpacker_Free(&state_); }
+
+  // Decompresses up to |*src_len| bytes of |src| into |dst|, which has room
+  // for |*dst_len| bytes. On return, the two lengths are updated to the
+  // bytes actually consumed and produced.
+  bool Code(uint8_t* dst,
+            size_t* dst_len,
+            const uint8_t* src,
+            size_t* src_len,
+            bool last) {
+    ECoderStatus status;
+    SRes res = XzUnpacker_Code(&state_, dst, dst_len, src, src_len, last,
+                               CODER_FINISH_ANY, &status);
+    return res == SZ_OK;
+  }
+
+  bool finished() const { return XzUnpacker_IsStreamWasFinished(&state_); }
+
+ private:
+  CXzUnpacker state_;
+};
+
+constexpr uint8_t XzTraceReader::kMagic[];
+constexpr size_t XzTraceReader::kBlockSize;
+
+XzTraceReader::XzTraceReader(ReaderFactory reader_factory, size_t block_size)
+    : reader_factory_(std::move(reader_factory)),
+      block_size_(block_size),
+      decoder_(new Decoder()) {}
+
+XzTraceReader::~XzTraceReader() {
+  if (!thread_.joinable())
+    return;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    quit_ = true;
+  }
+  cv_.notify_all();
+  thread_.join();
+}
+
+bool XzTraceReader::Parse(TraceBlobView blob) {
+  if (failed_)
+    return false;
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_WASM)
+  failed_ = !Decode(
+      blob.data(), blob.length(), false /* last */,
+      [this](Block block) { return ParseBlock(std::move(block)); });
+  return !failed_;
+#else
+  if (!thread_.joinable())
+    thread_ = std::thread(&XzTraceReader::RunDecoderThread, this);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queued_chunks_.emplace_back(blob.data(), blob.length());
+  }
+  cv_.notify_all();
+  chunks_.emplace_back(std::move(blob));
+
+  // Lets the helper thread lag behind by a few chunks, so that it keeps
+  // decompressing while the calling thread reads the next chunk, without
+  // buffering the whole compressed trace.
+  failed_ = !ParseDecodedBlocks(kMaxQueuedChunks);
+  return !failed_;
+#endif
+}
+
+void XzTraceReader::NotifyEndOfFile() {
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_WASM)
+  if (!failed_) {
+    failed_ = !Decode(nullptr, 0, true /* last */, [this](Block block) {
+      return ParseBlock(std::move(block));
+    });
+  }
+#else
+  if (thread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      end_of_file_ = true;
+    }
+    cv_.notify_all();
+    if (!failed_)
+      failed_ = !ParseDecodedBlocks(0);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      quit_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+  }
+#endif
+  if (reader_)
+    reader_->NotifyEndOfFile();
+}
+
+bool XzTraceReader::Decode(const uint8_t* data,
+                           size_t size,
+                           bool last,
+                           const std::function<bool(Block)>& emit_block) {
+  for (;;) {
+    if (!partial_block_.data) {
+      partial_block_.data.reset(new uint8_t[block_size_]);
+      partial_block_.size = 0;
+    }
+    size_t dst_len = block_size_ - partial_block_.size;
+    size_t src_len = size;
+    if (!decoder_->Code(partial_block_.data.get() + partial_block_.size,
+                        &dst_len, data, &src_len, last)) {
+      PERFETTO_ELOG("Corrupted .xz trace");
+      return false;
+    }
+    data += src_len;
+    size -= src_len;
+    partial_block_.size += dst_len;
+
+    if (partial_block_.size == block_size_) {
+      if (!emit_block(std::move(partial_block_)))
+        return false;
+      partial_block_ = Block{nullptr, 0};
+      continue;
+    }
+    if (size == 0)
+      break;
+    if (src_len == 0 && dst_len == 0) {
+      PERFETTO_ELOG("Unexpected data after the end of the .xz trace");
+      return false;
+    }
+  }
+
+  if (!last)
+    return true;
+  if (!decoder_->finished()) {
+    PERFETTO_ELOG("Truncated .xz trace");
+    return false;
+  }
+  if (partial_block_.size > 0 && !emit_block(std::move(partial_block_)))
+    return false;
+  partial_block_ = Block{nullptr, 0};
+  return true;
+}
+
+bool XzTraceReader::ParseBlock(Block block) {
+  TraceBlobView blob(std::move(block.data), 0, block.size);
+  if (!reader_) {
+    reader_ = reader_factory_(blob);
+    if (!reader_)
+      return false;
+  }
+  return reader_->Parse(std::move(blob));
+}
+
+bool XzTraceReader::ParseDecodedBlocks(size_t max_queued_chunks) {
+  for (;;) {
+    std::deque<Block> blocks;
+    bool caught_up;
+    bool decoder_failed;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      auto is_caught_up = [this, max_queued_chunks] {
+        return decoder_done_ ||
+               (!end_of_file_ && queued_chunks_.size() <= max_queued_chunks);
+      };
+      cv_.wait(lock, [this, &is_caught_up] {
+        return !decoded_blocks_.empty() || is_caught_up();
+      });
+      blocks.swap(decoded_blocks_);
+      caught_up = is_caught_up();
+      decoder_failed = decoder_failed_;
+      for (; consumed_chunks_ > 0; consumed_chunks_--)
+        chunks_.pop_front();
+    }
+    cv_.notify_all();
+
+    for (Block& block : blocks) {
+      if (!ParseBlock(std::move(block)))
+        return false;
+    }
+    if (decoder_failed)
+      return false;
+    if (blocks.empty() && caught_up)
+      return true;
+  }
+}
+
+void XzTraceReader::RunDecoderThread() {
+  auto emit_block = [this](Block block) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this] {
+      return quit_ || decoded_blocks_.size() < kMaxDecodedBlocks;
+    });
+    if (quit_)
+      return false;
+    decoded_blocks_.emplace_back(std::move(block));
+    cv_.notify_all();
+    return true;
+  };
+
+  for (;;) {
+    std::pair<const uint8_t*, size_t> chunk{nullptr, 0};
+    bool last = false;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this] {
+        return quit_ || end_of_file_ || !queued_chunks_.empty();
+      });
+      if (quit_)
+        return;
+      if (queued_chunks_.empty()) {
+        last = true;
+      } else {
+        chunk = queued_chunks_.front();
+      }
+    }
+
+    bool success = Decode(chunk.first, chunk.second, last, emit_block);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!last) {
+      queued_chunks_.pop_front();
+      consumed_chunks_++;
+    }
+    if (!success || last) {
+      decoder_failed_ = !success;
+      decoder_done_ = true;
+      cv_.notify_all();
+      return;
+    }
+    cv_.notify_all();
+  }
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
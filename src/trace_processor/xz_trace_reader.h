@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_XZ_TRACE_READER_H_
+#define SRC_TRACE_PROCESSOR_XZ_TRACE_READER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "src/trace_processor/chunked_trace_reader.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// Reads traces compressed in the .xz format (e.g. `xz -T0 trace`), without
+// decompressing them to disk first. The compressed chunks passed to Parse()
+// are decompressed in a streaming way on a helper thread, while the calling
+// thread feeds the decompressed data, in blocks of |block_size| bytes, to the
+// reader of the trace inside (proto, JSON or snapshot), which is created by
+// |reader_factory| from the first block. Decompression thus overlaps with
+// tokenization and parsing, and at most a few blocks are buffered at any
+// time. In WASM builds, which are single-threaded, the chunks are
+// decompressed in Parse() itself.
+class XzTraceReader : public ChunkedTraceReader {
+ public:
+  using ReaderFactory = std::function<std::unique_ptr<ChunkedTraceReader>(
+      const TraceBlobView& first_chunk)>;
+
+  // Header of an .xz stream.
+  static constexpr uint8_t kMagic[] = {0xFD, '7', 'z', 'X', 'Z', 0x00};
+
+  // Default size of the decompressed chunks passed to the inner reader. Large
+  // enough that few packets straddle two chunks.
+  static constexpr size_t kBlockSize = 4 * 1024 * 1024;
+
+  explicit XzTraceReader(ReaderFactory reader_factory,
+                         size_t block_size = kBlockSize);
+  ~XzTraceReader() override;
+
+  // ChunkedTraceReader implementation.
+  bool Parse(TraceBlobView) override;
+  void NotifyEndOfFile() override;
+
+ private:
+  class Decoder;
+
+  struct Block {
+    std::unique_ptr<uint8_t[]> data;
+    size_t size;
+  };
+
+  XzTraceReader(const XzTraceReader&) = delete;
+  XzTraceReader& operator=(const XzTraceReader&) = delete;
+
+  // Decompresses |size| bytes and passes the blocks filled meanwhile to
+  // |emit_block|; the last, partially filled, block is flushed only if
+  // |last| is true. Returns false if the data is not a valid .xz stream.
+  bool Decode(const uint8_t* data,
+              size_t size,
+              bool last,
+              const std::function<bool(Block)>& emit_block);
+
+  // Passes a decompressed block to the inner reader, creating it first if
+  // needed. Returns false if the inner reader fails.
+  bool ParseBlock(Block);
+
+  // Parses the blocks decompressed by the helper thread and releases the
+  // chunks it has consumed. Blocks until at most |max_queued_chunks| chunks
+  // are left to decompress or, after NotifyEndOfFile(), until the helper
+  // thread has finished. Returns false if decompression or parsing fails.
+  bool ParseDecodedBlocks(size_t max_queued_chunks);
+
+  void RunDecoderThread();
+
+  const ReaderFactory reader_factory_;
+  const size_t block_size_;
+  std::unique_ptr<Decoder> decoder_;  // Only used by the decoding thread.
+  std::unique_ptr<ChunkedTraceReader> reader_;
+  Block partial_block_{nullptr, 0};  // Only used by the decoding thread.
+  bool failed_ = false;
+
+  // The compressed chunks which have not been fully decompressed yet. They
+  // are only touched by the calling thread, as TraceBlobView is not thread
+  // safe: the helper thread reads their bytes through |queued_chunks_|.
+  std::deque<TraceBlobView> chunks_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  // All the fields below are guarded by |mutex_|.
+  std::deque<std::pair<const uint8_t*, size_t>> queued_chunks_;
+  size_t consumed_chunks_ = 0;
+  std::deque<Block> decoded_blocks_;
+  bool end_of_file_ = false;
+  bool decoder_done_ = false;
+  bool decoder_failed_ = false;
+  bool quit_ = false;
+
+  std::thread thread_;  // Keep last.
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_XZ_TRACE_READER_H_
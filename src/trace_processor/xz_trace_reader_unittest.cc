@@ -0,0 +1,218 @@
+/*
+ * Copyright (C) 2018 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/xz_trace_reader.h"
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+// 10000 bytes, the i-th being (i * 7) % 251, compressed with `xz -9`.
+const uint8_t kCompressed[] = {
+    0xfd, 0x37, 0x7a, 0x58, 0x5a, 0x00, 0x00, 0x04, 0xe6, 0xd6, 0xb4, 0x46,
+    0x02, 0x00, 0x21, 0x01, 0x1c, 0x00, 0x00, 0x00, 0x10, 0xcf, 0x58, 0xcc,
+    0xe0, 0x27, 0x0f, 0x01, 0x18, 0x5d, 0x00, 0x00, 0x02, 0x0f, 0x57, 0x02,
+    0x68, 0xc6, 0x78, 0xce, 0xd8, 0x0f, 0x90, 0xe6, 0xeb, 0xb6, 0xdd, 0x1f,
+    0x70, 0x62, 0xb0, 0x21, 0x27, 0x14, 0xf9, 0xb1, 0x95, 0x8a, 0x58, 0x60,
+    0x21, 0x7a, 0x2c, 0xac, 0xe7, 0x77, 0x98, 0xdf, 0x45, 0x86, 0xb1, 0x88,
+    0xdf, 0xf8, 0xf7, 0x05, 0x2d, 0xd5, 0x35, 0xf1, 0x7a, 0xfa, 0x80, 0xad,
+    0xbb, 0xe5, 0xd1, 0xb2, 0xba, 0xc3, 0x8a, 0xaa, 0xe4, 0x11, 0x31, 0x7b,
+    0xe1, 0x6b, 0xce, 0x4e, 0xff, 0xa1, 0x38, 0x2b, 0xb9, 0x9b, 0x2a, 0xc6,
+    0x70, 0x70, 0xa5, 0x63, 0x2c, 0x9f, 0xf0, 0x10, 0x0e, 0xbe, 0x8d, 0x03,
+    0xd6, 0x0c, 0xbe, 0x64, 0xbb, 0xaf, 0xc8, 0x45, 0x04, 0x53, 0x97, 0x31,
+    0xb9, 0xb5, 0xac, 0xed, 0xec, 0x16, 0x3b, 0x79, 0x30, 0xbc, 0x22, 0xc6,
+    0x54, 0xcf, 0xe9, 0x5e, 0x30, 0x49, 0x05, 0x9d, 0xcb, 0x5d, 0xbf, 0x0b,
+    0x24, 0x72, 0x49, 0x9b, 0x7a, 0x81, 0x88, 0x93, 0x4d, 0x9f, 0x69, 0x43,
+    0x3f, 0x0f, 0xe5, 0xd5, 0x35, 0xfa, 0x96, 0x31, 0xb3, 0x62, 0xd6, 0x2d,
+    0x48, 0x7a, 0xe3, 0x28, 0x20, 0xb9, 0x16, 0xac, 0x46, 0x87, 0xd0, 0x7e,
+    0xa5, 0xe6, 0x40, 0x5c, 0x4b, 0xc8, 0xea, 0xe4, 0xe6, 0xe9, 0x2e, 0x13,
+    0xa3, 0x15, 0x2a, 0x6c, 0x47, 0x1c, 0x36, 0x58, 0x57, 0xf6, 0x03, 0x97,
+    0xc8, 0x04, 0x65, 0x3c, 0xed, 0x87, 0xbb, 0xa3, 0x5e, 0xe5, 0xcb, 0x29,
+    0x00, 0x63, 0x1f, 0xa5, 0x71, 0x81, 0xf7, 0xb3, 0xe3, 0xae, 0x27, 0x2c,
+    0x29, 0x8d, 0xe2, 0xcd, 0xcc, 0x2b, 0x42, 0xeb, 0x7b, 0xc7, 0xff, 0x3a,
+    0x1a, 0xd0, 0xa8, 0x93, 0xe5, 0xd7, 0xc2, 0xf4, 0xe7, 0x2e, 0xd0, 0x4c,
+    0xc9, 0x8a, 0x91, 0x04, 0x62, 0x68, 0x55, 0x0a, 0xb5, 0x28, 0xf9, 0x53,
+    0xf7, 0x37, 0xfa, 0xdf, 0x6c, 0x95, 0x03, 0x00, 0xd3, 0x14, 0xa1, 0x7d,
+    0x0c, 0xd1, 0x77, 0x90, 0xd1, 0x47, 0xd5, 0x4a, 0x84, 0x25, 0xf4, 0x86,
+    0xed, 0xa3, 0x30, 0x5f, 0x6a, 0x82, 0x0a, 0xb9, 0x9a, 0x00, 0x00, 0x00,
+    0x8a, 0x9f, 0x1c, 0x48, 0x6d, 0xbd, 0x8d, 0x35, 0x00, 0x01, 0xb4, 0x02,
+    0x90, 0x4e, 0x00, 0x00, 0xb0, 0x97, 0x8a, 0xff, 0xb1, 0xc4, 0x67, 0xfb,
+    0x02, 0x00, 0x00, 0x00, 0x00, 0x04, 0x59, 0x5a,
+};
+constexpr size_t kDecompressedSize = 10000;
+
+class RecordingReader : public ChunkedTraceReader {
+ public:
+  bool Parse(TraceBlobView blob) override {
+    block_sizes.push_back(blob.length());
+    data.append(reinterpret_cast<const char*>(blob.data()), blob.length());
+    return true;
+  }
+  void NotifyEndOfFile() override { end_of_file = true; }
+
+  std::vector<size_t> block_sizes;
+  std::string data;
+  bool end_of_file = false;
+};
+
+// Fails on the |fail_at|-th block.
+class FailingReader : public ChunkedTraceReader {
+ public:
+  explicit FailingReader(size_t fail_at) : fail_at_(fail_at) {}
+
+  bool Parse(TraceBlobView) override { return ++blocks < fail_at_; }
+  void NotifyEndOfFile() override { end_of_file = true; }
+
+  size_t blocks = 0;
+  bool end_of_file = false;
+
+ private:
+  const size_t fail_at_;
+};
+
+TraceBlobView CopyToBlob(const uint8_t* data, size_t size) {
+  std::unique_ptr<uint8_t[]> buf(new uint8_t[size]);
+  memcpy(buf.get(), data, size);
+  return TraceBlobView(std::move(buf), 0, size);
+}
+
+class XzTraceReaderTest : public ::testing::Test {
+ protected:
+  XzTraceReaderTest()
+      : xz_reader_(
+            [this](const TraceBlobView&) {
+              reader_ = new RecordingReader();
+              return std::unique_ptr<ChunkedTraceReader>(reader_);
+            },
+            4096 /* block_size */) {}
+
+  RecordingReader* reader_ = nullptr;  // Owned by |xz_reader_|.
+  XzTraceReader xz_reader_;
+};
+
+TEST_F(XzTraceReaderTest, DecompressesInBlocks) {
+  ASSERT_EQ(memcmp(kCompressed, XzTraceReader::kMagic,
+                   sizeof(XzTraceReader::kMagic)),
+            0);
+  // Chunk boundaries don't need to match anything in the compressed stream.
+  for (size_t off = 0; off < sizeof(kCompressed); off += 7) {
+    size_t size = std::min(sizeof(kCompressed) - off, size_t(7));
+    ASSERT_TRUE(xz_reader_.Parse(CopyToBlob(kCompressed + off, size)));
+  }
+  xz_reader_.NotifyEndOfFile();
+
+  ASSERT_NE(reader_, nullptr);
+  ASSERT_TRUE(reader_->end_of_file);
+  ASSERT_EQ(reader_->block_sizes,
+            std::vector<size_t>({4096, 4096, kDecompressedSize - 8192}));
+  ASSERT_EQ(reader_->data.size(), kDecompressedSize);
+  for (size_t i = 0; i < kDecompressedSize; i++)
+    ASSERT_EQ(static_cast<uint8_t>(reader_->data[i]), (i * 7) % 251) << i;
+}
+
+TEST_F(XzTraceReaderTest, CorruptedStream) {
+  std::vector<uint8_t> corrupted(kCompressed,
+                                 kCompressed + sizeof(kCompressed));
+  corrupted[sizeof(XzTraceReader::kMagic) + 10] ^= 0xff;
+
+  // The error is reported by one of the Parse() calls following the one
+  // which passed the corrupted byte, as the decompression is asynchronous.
+  bool failed = false;
+  for (size_t i = 0; i < corrupted.size() && !failed; i++)
+    failed = !xz_reader_.Parse(CopyToBlob(&corrupted[i], 1));
+  ASSERT_TRUE(failed);
+  ASSERT_FALSE(xz_reader_.Parse(CopyToBlob(kCompressed, 1)));
+  xz_reader_.NotifyEndOfFile();
+  ASSERT_EQ(reader_, nullptr);
+}
+
+TEST_F(XzTraceReaderTest, TruncatedStream) {
+  // Without the stream footer, all the data decompresses but the end of the
+  // stream is never reached.
+  const size_t kTruncatedSize = sizeof(kCompressed) - 12;
+  ASSERT_TRUE(xz_reader_.Parse(CopyToBlob(kCompressed, kTruncatedSize)));
+  xz_reader_.NotifyEndOfFile();
+
+  // The partially filled last block is dropped.
+  ASSERT_NE(reader_, nullptr);
+  ASSERT_TRUE(reader_->end_of_file);
+  ASSERT_EQ(reader_->data.size(), 8192u);
+  ASSERT_FALSE(xz_reader_.Parse(CopyToBlob(kCompressed, 1)));
+}
+
+TEST_F(XzTraceReaderTest, TrailingGarbage) {
+  const char kGarbage[] = "garbage!";
+  ASSERT_TRUE(xz_reader_.Parse(CopyToBlob(kCompressed, sizeof(kCompressed))));
+  xz_reader_.Parse(
+      CopyToBlob(reinterpret_cast<const uint8_t*>(kGarbage), 8));
+  xz_reader_.NotifyEndOfFile();
+
+  ASSERT_NE(reader_, nullptr);
+  ASSERT_LT(reader_->data.size(), kDecompressedSize);
+  ASSERT_FALSE(xz_reader_.Parse(CopyToBlob(kCompressed, 1)));
+}
+
+// Small blocks, so that the helper thread fills its queue of decompressed
+// blocks and waits for the inner reader to consume them.
+TEST(XzTraceReaderFailureTest, InnerReaderFailsBeforeEndOfFile) {
+  FailingReader* reader = nullptr;
+  XzTraceReader xz_reader(
+      [&reader](const TraceBlobView&) {
+        reader = new FailingReader(2);
+        return std::unique_ptr<ChunkedTraceReader>(reader);
+      },
+      64 /* block_size */);
+  // Depending on the progress of the helper thread, either Parse() or
+  // NotifyEndOfFile() fails on the second block, while the helper thread may
+  // be waiting to queue more.
+  xz_reader.Parse(CopyToBlob(kCompressed, sizeof(kCompressed)));
+  xz_reader.NotifyEndOfFile();
+  ASSERT_NE(reader, nullptr);
+  ASSERT_EQ(reader->blocks, 2u);
+  ASSERT_TRUE(reader->end_of_file);
+  ASSERT_FALSE(xz_reader.Parse(CopyToBlob(kCompressed, 1)));
+}
+
+TEST(XzTraceReaderFailureTest, DestroyedAfterInnerReaderFails) {
+  FailingReader* reader = nullptr;
+  std::unique_ptr<XzTraceReader> xz_reader(new XzTraceReader(
+      [&reader](const TraceBlobView&) {
+        reader = new FailingReader(2);
+        return std::unique_ptr<ChunkedTraceReader>(reader);
+      },
+      64 /* block_size */));
+
+  bool failed = false;
+  for (size_t off = 0; off < sizeof(kCompressed) && !failed; off++)
+    failed = !xz_reader->Parse(CopyToBlob(kCompressed + off, 1));
+  ASSERT_TRUE(failed);
+  ASSERT_EQ(reader->blocks, 2u);
+
+  // Without NotifyEndOfFile(), the destructor stops the helper thread, which
+  // can be waiting to queue a block that nobody will parse.
+  xz_reader.reset();
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
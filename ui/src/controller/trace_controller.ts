@@ -25,7 +25,7 @@ import {
   setVisibleTraceTime,
   updateStatus
 } from '../common/actions';
-import {TimeSpan} from '../common/time';
+import {fromNs, TimeSpan} from '../common/time';
 import {QuantizedLoad, ThreadDesc} from '../frontend/globals';
 import {SLICE_TRACK_KIND} from '../tracks/chrome_slices/common';
 import {CPU_SLICE_TRACK_KIND} from '../tracks/cpu_slices/common';
@@ -231,6 +231,34 @@ export class TraceController extends Controller<States> {
     const engine = assertExists<Engine>(this.engine);
     const numSteps = 100;
     const stepSec = traceTime.duration / numSteps;
+
+    // Sched overview. cpu_summary computes the busy time of every step of
+    // every CPU in one pass, rather than one scan of the sched slices per
+    // step. Its steps are aligned to multiples of the quantum.
+    const stepNs = Math.max(1, Math.ceil(stepSec * 1e9));
+    const schedRows = await engine.rawQuery({
+      sqlQuery: 'select ts, cpu, busy_dur from cpu_summary ' +
+          `where quantum = ${stepNs} order by ts, cpu`
+    });
+    let schedData: {[key: string]: QuantizedLoad} = {};
+    let schedStepNs = -1;
+    for (let i = 0; i < schedRows.numRecords; i++) {
+      const ts = +schedRows.columns[0].longValues![i];
+      if (ts !== schedStepNs && Object.keys(schedData).length > 0) {
+        globals.publish('OverviewData', schedData);
+        schedData = {};
+      }
+      schedStepNs = ts;
+      const cpu = schedRows.columns[1].longValues![i] as number;
+      const busyNs = +schedRows.columns[2].longValues![i];
+      const startSec = fromNs(ts);
+      const endSec = fromNs(ts + stepNs);
+      schedData[cpu] = {startSec, endSec, load: busyNs / stepNs};
+    }  // for (record ...)
+    if (Object.keys(schedData).length > 0) {
+      globals.publish('OverviewData', schedData);
+    }
+
     for (let step = 0; step < numSteps; step++) {
       globals.dispatch(updateStatus(
           'Loading overview ' +
@@ -240,20 +268,6 @@ export class TraceController extends Controller<States> {
       const endSec = startSec + stepSec;
       const endNs = Math.ceil(endSec * 1e9);
 
-      // Sched overview.
-      const schedRows = await engine.rawQuery({
-        sqlQuery: `select sum(dur)/${stepSec}/1e9, cpu from sched ` +
-            `where ts >= ${startNs} and ts < ${endNs} ` +
-            'group by cpu order by cpu'
-      });
-      const schedData: {[key: string]: QuantizedLoad} = {};
-      for (let i = 0; i < schedRows.numRecords; i++) {
-        const load = schedRows.columns[0].doubleValues![i];
-        const cpu = schedRows.columns[1].longValues![i] as number;
-        schedData[cpu] = {startSec, endSec, load};
-      }  // for (record ...)
-      globals.publish('OverviewData', schedData);
-
       // Slices overview.
       const slicesRows = await engine.rawQuery({
         sqlQuery:
@@ -131,7 +131,10 @@ export class WasmEngineProxy extends Engine {
     if (callback === undefined) {
       throw new Error(`No such request: ${response.id}`);
     }
-    this.pendingCallbacks.delete(response.id);
+    // Streaming queries get a response for each batch of rows.
+    if (response.isLast) {
+      this.pendingCallbacks.delete(response.id);
+    }
     callback(null, response.data);
   }
 
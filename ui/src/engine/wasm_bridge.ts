@@ -30,12 +30,15 @@ export interface WasmBridgeResponse {
   id: number;
   success: boolean;
   data?: Uint8Array;
+  // False if more responses to the same request follow (streaming queries).
+  isLast: boolean;
 }
 
 export class WasmBridge {
   private deferredRuntimeInitialized: Deferred<void>;
   private deferredReady: Deferred<void>;
-  private callback: (_: WasmBridgeResponse) => void;
+  // Can return false to cancel a streaming request.
+  private callback: (_: WasmBridgeResponse) => boolean | void;
   private aborted: boolean;
   private outstandingRequests: Set<number>;
 
@@ -43,7 +46,7 @@ export class WasmBridge {
 
   constructor(
       init: init_trace_processor.InitWasm,
-      callback: (_: WasmBridgeResponse) => void) {
+      callback: (_: WasmBridgeResponse) => boolean | void) {
     this.deferredRuntimeInitialized = defer<void>();
     this.deferredReady = defer<void>();
     this.callback = callback;
@@ -67,17 +70,31 @@ export class WasmBridge {
     this.outstandingRequests.clear();
   }
 
-  onReply(reqId: number, success: boolean, heapPtr: number, size: number) {
+  // Streaming requests get several replies: the request stays outstanding
+  // until the one with |isLast| set, or until the callback cancels it.
+  // Returns false if no further replies to |reqId| are wanted.
+  onReply(
+      reqId: number, success: boolean, heapPtr: number, size: number,
+      isLast: boolean): boolean {
     if (!this.outstandingRequests.has(reqId)) {
       throw new Error(`Unknown request id: "${reqId}"`);
     }
-    this.outstandingRequests.delete(reqId);
+    // The flag comes from WASM as a number.
+    isLast = Boolean(isLast);
+    if (isLast) {
+      this.outstandingRequests.delete(reqId);
+    }
     const data = this.connection.HEAPU8.slice(heapPtr, heapPtr + size);
-    this.callback({
+    const wantsMore = this.callback({
       id: reqId,
       success,
       data,
-    });
+      isLast,
+    }) !== false;
+    if (!wantsMore) {
+      this.outstandingRequests.delete(reqId);
+    }
+    return wantsMore;
   }
 
   abortRequest(requestId: number) {
@@ -85,6 +102,7 @@ export class WasmBridge {
       id: requestId,
       success: false,
       data: undefined,
+      isLast: true,
     });
   }
 
@@ -107,7 +125,7 @@ export class WasmBridge {
   async initialize(): Promise<void> {
     await this.deferredRuntimeInitialized;
     const replyFn =
-        this.connection.addFunction(this.onReply.bind(this), 'viiii');
+        this.connection.addFunction(this.onReply.bind(this), 'iiiiii');
     this.connection.ccall('Initialize', 'void', ['number'], [replyFn]);
     this.deferredReady.resolve();
   }
@@ -74,7 +74,7 @@ test('wasm bridge early calls are delayed', async () => {
   m.onRuntimeInitialized();
 
   await readyPromise;
-  bridge.onReply(100, true, 0, 1);
+  bridge.onReply(100, true, 0, 1, true);
   await requestPromise;
   expect(m.ccall.mock.calls[0][0]).toBe('Initialize');
   expect(m.ccall.mock.calls[1][0]).toBe('service_method');
@@ -119,15 +119,71 @@ test('wasm bridge aborts all calls on failure', async () => {
     id: 100,
     success: false,
     data: undefined,
+    isLast: true,
   });
   expect(callback.mock.calls[1][0]).toEqual({
     id: 200,
     success: false,
     data: undefined,
+    isLast: true,
   });
   expect(callback.mock.calls[2][0]).toEqual({
     id: 300,
     success: false,
     data: undefined,
+    isLast: true,
   });
 });
+
+test('wasm bridge keeps streaming requests until the last reply', async () => {
+  const m = new MockModule();
+  const callback = jest.fn();
+  const bridge = new WasmBridge(m.init.bind(m), callback);
+
+  const readyPromise = bridge.initialize();
+  m.onRuntimeInitialized();
+  await readyPromise;
+
+  await bridge.callWasm({
+    id: 100,
+    serviceName: 'trace_processor',
+    methodName: 'rawStreamingQuery',
+    data: new Uint8Array(42),
+  });
+
+  expect(bridge.onReply(100, true, 0, 1, false)).toBe(true);
+  expect(bridge.onReply(100, true, 1, 2, false)).toBe(true);
+  expect(bridge.onReply(100, true, 3, 1, true)).toBe(true);
+  expect(callback.mock.calls.length).toBe(3);
+  expect(callback.mock.calls.map((c) => c[0].isLast)).toEqual([
+    false,
+    false,
+    true,
+  ]);
+  expect(callback.mock.calls[1][0].data).toEqual(new Uint8Array([1, 2]));
+
+  // No more replies are expected after the last one.
+  expect(() => bridge.onReply(100, true, 0, 1, true)).toThrow();
+});
+
+test('wasm bridge stops streaming requests cancelled by the callback',
+     async () => {
+       const m = new MockModule();
+       const callback = jest.fn().mockReturnValue(false);
+       const bridge = new WasmBridge(m.init.bind(m), callback);
+
+       const readyPromise = bridge.initialize();
+       m.onRuntimeInitialized();
+       await readyPromise;
+
+       await bridge.callWasm({
+         id: 100,
+         serviceName: 'trace_processor',
+         methodName: 'rawStreamingQuery',
+         data: new Uint8Array(42),
+       });
+
+       expect(bridge.onReply(100, true, 0, 1, false)).toBe(false);
+       expect(callback.mock.calls.length).toBe(1);
+       expect(() => bridge.onReply(100, true, 0, 1, false)).toThrow();
+     });